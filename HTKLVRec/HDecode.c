@@ -41,6 +41,7 @@ char *hdecode_sccs_id = "$Id: HDecode.c,v 1.1.1.1 2006/10/11 09:54:55 jal58 Exp
 #include "HWave.h"
 #include "HLabel.h"
 #include "HAudio.h"
+#include "HVQ.h"
 #include "HParm.h"
 #include "HDict.h"
 #include "HModel.h"
@@ -49,6 +50,7 @@ char *hdecode_sccs_id = "$Id: HDecode.c,v 1.1.1.1 2006/10/11 09:54:55 jal58 Exp
 #include "HAdapt.h"
 #include "HNet.h"       /* for Lattice */
 #include "HLat.h"       /* for Lattice */
+#include "HThreads.h"
 
 #include "config.h"
 
@@ -56,8 +58,6 @@ char *hdecode_sccs_id = "$Id: HDecode.c,v 1.1.1.1 2006/10/11 09:54:55 jal58 Exp
 #include "HLVRec.h"
 #include "HLVLM.h"
 
-#include <time.h>
-
 /* -------------------------- Trace Flags & Vars ------------------------ */
 
 #define T_TOP 00001		/* Basic progress reporting */
@@ -129,7 +129,58 @@ static LogFloat fastlmlaBeam = - LZERO;  /* do fast LM la outside this beam */
 static int nTok = 32;           /* number of different LMStates per HMM state */
 static Boolean useHModel = FALSE; /* use standard HModel OutP functions */
 static int outpBlocksize = 1;   /* number of frames for which outP is calculated in one go */
-static Observation *obs;        /* array of Observations */
+
+#ifdef COLLECT_STATS
+/* search space counters of one frame (or totals of an utterance)
+   for the STATSFILE */
+typedef struct _FrameStats FrameStats;
+struct _FrameStats {
+   FrameStats *next;
+   int frame;
+   int nInst;                   /* active LexNodeInsts at end of frame */
+   int nTok;                    /* active tokens at end of frame */
+   int nLayerInst[NLAYERS];     /* active LexNodeInsts per layer */
+   int nWordend;                /* word end hyps created */
+   int lmlaHit, lmlaMiss;       /* LM lookahead cache */
+   int outPHit, outPMiss;       /* output prob cache */
+   float beam;                  /* main beam used for next frame */
+   double stageTime[NSTAGES];   /* wall clock seconds per stage */
+};
+
+static char *stageName[NSTAGES] = {"gc", "obs", "outp", "internal", "external", "prune"};
+#endif
+
+/* utterances are decoded by numThreads threads, each with its own
+   decoder instance; the HMMSet, LexNet and LM are shared read-only */
+typedef struct {
+   DecoderInst *dec;            /* decoder instance of this thread */
+   Observation *obs;            /* array of outpBlocksize Observations */
+   MemHeap inputBufHeap;        /* input buffer */
+   MemHeap transHeap;           /* transcriptions and lattices */
+   int idx;                     /* position of current file in script */
+   char fn[MAXFNAMELEN];        /* name of current file */
+#ifdef COLLECT_STATS
+   MemHeap statsHeap;           /* frame records of current file */
+   FrameStats *frameStats;      /* first and last frame record */
+   FrameStats *lastFrameStats;
+   FrameStats uttStats;         /* totals of current file */
+#endif
+} DecodeThread;
+
+static int numThreads = 1;      /* number of decoding threads */
+static DecodeThread *dthr;      /* [numThreads] per thread decoding state */
+static HLock ioLock;            /* serialises input, output and heap creation */
+static HSignal outSignal;       /* broadcast when nextOut is incremented */
+static int partialFreq = 0;     /* frames between partial results, 0 = none */
+static char *netImage = NULL;   /* compiled LexNet image file */
+static char *lmImage = NULL;    /* compiled n-gram LM image file */
+static Boolean imagesOnly = FALSE; /* only bring the images up to date */
+static char *statsFN = NULL;    /* search space statistics file */
+static Boolean statsCSV = FALSE; /* write STATSFILE as CSV, else JSON lines */
+static Boolean statsFrames = TRUE; /* write a record for each frame */
+static FILE *statsF = NULL;
+static int nextIn = 0;          /* script position of next file to read */
+static int nextOut = 0;         /* script position of next file to output */
 
 /* transforms/adaptatin */
 /* information about transforms */
@@ -144,15 +195,23 @@ static char *bestAlignMLF;      /* MLF with 1-best alignment */
 static MemHeap modelHeap;
 static MemHeap netHeap;
 static MemHeap lmHeap;
-static MemHeap inputBufHeap;
-static MemHeap transHeap;
 static MemHeap regHeap;
 
 /* -------------------------- Prototypes -------------------------------- */
 void SetConfParms (void);
 void ReportUsage (void);
-DecoderInst *Initialise (void);
-void DoRecognition (DecoderInst *dec, char *fn);
+void Initialise (void);
+void DoRecognition (DecodeThread *dt, char *datafn);
+void PrintResult (char *tag, int frame, Transcription *trans, int nStable);
+void PrintPartial (DecodeThread *dt);
+#ifdef COLLECT_STATS
+void OpenStatsFile (void);
+void RecordFrameStats (DecodeThread *dt);
+void PutStatsStr (char *s);
+void PutFrameStats (DecodeThread *dt, FrameStats *fs, Boolean isUtt);
+void WriteStats (DecodeThread *dt, double decSec, double tbSec, double cpuSec);
+#endif
+Ptr DecodeFiles (Ptr arg);
 Boolean UpdateSpkrModels (char *fn);
 
 /* ---------------- Configuration Parameters ---------------------------- */
@@ -199,13 +258,33 @@ SetConfParms (void)
       if (GetConfStr(cParm,nParm,"LATFILEMASK",buf)) {
          latFileMask = CopyString(&gstack, buf);
       }
+      if (GetConfInt (cParm, nParm, "NUMTHREADS", &i))
+         numThreads = i;
+      if (GetConfInt (cParm, nParm, "PARTIALFREQ", &i))
+         partialFreq = i;
+      if (GetConfStr (cParm, nParm, "NETIMAGE", buf))
+         netImage = CopyString (&gstack, buf);
+      if (GetConfStr (cParm, nParm, "LMIMAGE", buf))
+         lmImage = CopyString (&gstack, buf);
+      if (GetConfStr (cParm, nParm, "STATSFILE", buf))
+         statsFN = CopyString (&gstack, buf);
+      if (GetConfStr (cParm, nParm, "STATSFORMAT", buf)) {
+         if (strcmp (buf, "CSV") == 0)
+            statsCSV = TRUE;
+         else if (strcmp (buf, "JSON") == 0)
+            statsCSV = FALSE;
+         else
+            HError (9999, "HDecode: unknown STATSFORMAT %s", buf);
+      }
+      if (GetConfBool (cParm, nParm, "STATSFRAMES", &b))
+         statsFrames = b;
    }
 }
 
 void
 ReportUsage (void)
 {
-   printf ("\nUSAGE: HDecode [options] VocabFile HMMList DataFiles...\n\n");
+   printf ("\nUSAGE: HDecode [options] VocabFile HMMList [DataFiles...]\n\n");
    printf (" Option                                   Default\n\n");
    printf (" -m      enable XForm and use inXForm        off\n");
 
@@ -217,6 +296,7 @@ ReportUsage (void)
    printf (" -h s    speaker name pattern                none\n");
    printf (" -p f    word insertion penalty              0.0\n");
    printf (" -a f    acoustic scale factor               1.0\n");
+   printf (" -c      only write network and LM images    off\n");
    printf (" -r f    pronunciation scale factor          1.0\n");
    printf (" -s f    LM scale factor                     1.0\n");
    printf (" -t f    pruning beam width                  none\n");
@@ -246,8 +326,9 @@ ReportUsage (void)
 int
 main (int argc, char *argv[])
 {
-   char *s, *datafn;
-   DecoderInst *dec;
+   char *s;
+   HThread *thr;
+   int t;
 
    if (InitShell (argc, argv, hdecode_version, hdecode_sccs_id) < SUCCESS)
       HError (4000, "HDecode: InitShell failed");
@@ -258,6 +339,7 @@ main (int argc, char *argv[])
    InitWave ();
    InitLabel ();
    InitAudio ();
+   InitVQ ();
    InitModel ();
    if (InitParm () < SUCCESS)
       HError (4000, "HDecode: InitParm failed");
@@ -265,9 +347,11 @@ main (int argc, char *argv[])
    InitDict ();
    InitLVNet ();
    InitLVLM ();
+   InitLVModel ();
    InitLVRec ();
    InitAdapt (&xfInfo);
    InitLat ();
+   InitThreads ();
 
    if (!InfoPrinted () && NumArgs () == 0)
       ReportUsage ();
@@ -364,6 +448,9 @@ main (int argc, char *argv[])
 	    HError (4019, "HDecode: acoustic scale factor expected");
 	 acScale = GetFltArg ();
 	 break;
+      case 'c':
+         imagesOnly = TRUE;
+         break;
       case 'r':
 	 if (NextArg () != FLOATARG)
 	    HError (4019, "HDecode: pronunciation scale factor expected");
@@ -501,7 +588,7 @@ main (int argc, char *argv[])
       HError (4019, "HDecode model list file name expected");
    hmmListfn = GetStrArg ();
 
-   if (beamWidth > -LSMALL)
+   if (beamWidth > -LSMALL && !imagesOnly)
       HError (4019, "main beam is too wide!");
 
    if (xfInfo.useInXForm) {
@@ -516,25 +603,49 @@ main (int argc, char *argv[])
    }   
 
 
-   /* load models and initialise decoder */
-   dec = Initialise ();
+   if (imagesOnly && ((!netImage && !lmImage) || latRescore))
+      HError (4019, "HDecode: -c needs NETIMAGE or LMIMAGE and a language model");
+
+   if (numThreads < 1)
+      HError (9999, "HDecode: NUMTHREADS must be at least 1");
+   if (numThreads > 1) {
+      if (latRescore || bestAlignMLF)
+         HError (9999, "HDecode: lattice rescoring and BESTALIGNMLF need NUMTHREADS=1");
+      if (xfInfo.useInXForm || xfInfo.usePaXForm || xfInfo.useOutXForm)
+         HError (9999, "HDecode: adaptation transforms need NUMTHREADS=1");
+      if (partialFreq > 0 || (NumArgs () == 0 && !imagesOnly))
+         HError (9999, "HDecode: partial results and direct audio input need NUMTHREADS=1");
+   }
+   if (NumArgs () == 0 && (latRescore || bestAlignMLF))
+      HError (9999, "HDecode: lattice rescoring and BESTALIGNMLF need data files");
+
+   /* load models and initialise decoders */
+   Initialise ();
+   if (imagesOnly)
+      Exit (0);
 
    /* load 1-best alignment */
    if (bestAlignMLF)
       LoadMasterFile (bestAlignMLF);
 
-
-   while (NumArgs () > 0) {
-      if (NextArg () != STRINGARG)
-	 HError (4019, "HDecode: Data file name expected");
-      datafn = GetStrArg ();
-
-      if (trace & T_TOP) {
-	 printf ("File: %s\n", datafn);
-	 fflush (stdout);
+   /* perform recognition */
+   if (NumArgs () == 0) {       /* recognise direct audio input */
+      for (t = 1; ; ++t) {
+         printf ("\nREADY[%d]>\n", t);
+         fflush (stdout);
+         AcquireHLock (ioLock);
+         dthr[0].idx = nextIn++;
+         DoRecognition (&dthr[0], NULL);
       }
-      DoRecognition (dec, datafn);
-      /* perform recognition */
+   }
+   else if (numThreads == 1)
+      DecodeFiles (&dthr[0]);
+   else {
+      thr = (HThread *) New (&gcheap, numThreads * sizeof (HThread));
+      for (t = 0; t < numThreads; ++t)
+         thr[t] = CreateHThread (&gcheap, DecodeFiles, &dthr[t]);
+      for (t = 0; t < numThreads; ++t)
+         JoinHThread (thr[t]);
    }
 
    if (trace & T_MEM) {
@@ -545,21 +656,23 @@ main (int argc, char *argv[])
    /* maybe output transforms for last speaker */
    UpdateSpkrStats(&hset,&xfInfo, NULL); 
 
+   if (statsF)
+      fclose (statsF);
+
    Exit(0);             /* maybe print config and exit */
    return (0);
 }
 
-DecoderInst *Initialise (void)
+void Initialise (void)
 {
-   int i;
-   DecoderInst *dec;
+   int i, t;
+   DecodeThread *dt;
    Boolean eSep;
    Boolean modAlign;
 
    /* init Heaps */
    CreateHeap (&netHeap, "Net heap", MSTAK, 1, 0,100000, 800000);
    CreateHeap (&lmHeap, "LM heap", MSTAK, 1, 0,1000000, 10000000);
-   CreateHeap(&transHeap,"Transcription heap",MSTAK,1,0,8000,80000);
 
    /* Read dictionary */
    if (trace & T_TOP) {
@@ -645,7 +758,10 @@ DecoderInst *Initialise (void)
       MarkAllWords (&vocab);
 
       /* create network */
-      net = CreateLexNet (&netHeap, &vocab, &hset, startWord, endWord, silDict);
+      if (netImage)
+         net = LoadLexNet (&netHeap, netImage, &vocab, &hset, startWord, endWord, silDict);
+      else
+         net = CreateLexNet (&netHeap, &vocab, &hset, startWord, endWord, silDict);
       
       /* Read language model */
       if (trace & T_TOP) {
@@ -653,7 +769,12 @@ DecoderInst *Initialise (void)
          fflush (stdout);
       }
       
-      lm = CreateLM (&lmHeap, langfn, startWord, endWord, &vocab);
+      if (lmImage)
+         lm = LoadLM (&lmHeap, langfn, lmImage, startWord, endWord, &vocab);
+      else
+         lm = CreateLM (&lmHeap, langfn, startWord, endWord, &vocab);
+      if (imagesOnly)           /* -c: the images are up to date now */
+         return;
    }
    else {
       net = NULL;
@@ -668,20 +789,52 @@ DecoderInst *Initialise (void)
          HError (9999, "DoRecognition: likelihoods for model alignment not supported");
    }
 
-   /* create Decoder instance */
-   dec = CreateDecoderInst (&hset, lm, nTok, TRUE, useHModel, outpBlocksize,
-                            bestAlignMLF ? TRUE : FALSE,
-                            modAlign);
-   
-   /* create buffers for observations */
+   if (weBeamWidth > beamWidth)
+      weBeamWidth = beamWidth;
+   if (zsBeamWidth > beamWidth)
+      zsBeamWidth = beamWidth;
+   if (net)
+      net->vocabFN = dictfn;
+
+   /* create Decoder instances and buffers for observations */
    SetStreamWidths (hset.pkind, hset.vecSize, hset.swidth, &eSep);
 
-   obs = (Observation *) New (&gcheap, outpBlocksize * sizeof (Observation));
-   for (i = 0; i < outpBlocksize; ++i)
-      obs[i] = MakeObservation (&gcheap, hset.swidth, hset.pkind, 
-                                (hset.hsKind == DISCRETEHS), eSep);
+   dthr = (DecodeThread *) New (&gcheap, numThreads * sizeof (DecodeThread));
+   for (t = 0; t < numThreads; ++t) {
+      dt = &dthr[t];
+      if (t == 0)
+         dt->dec = CreateDecoderInst (&hset, lm, nTok, TRUE, useHModel, outpBlocksize,
+                                      bestAlignMLF ? TRUE : FALSE,
+                                      modAlign);
+      else
+         dt->dec = CloneDecoderInst (dthr[0].dec);
+
+      dt->obs = (Observation *) New (&gcheap, outpBlocksize * sizeof (Observation));
+      for (i = 0; i < outpBlocksize; ++i)
+         dt->obs[i] = MakeObservation (&gcheap, hset.swidth, hset.pkind, 
+                                       (hset.hsKind == DISCRETEHS), eSep);
+
+      CreateHeap (&dt->inputBufHeap, "Input Buffer Heap", MSTAK, 1, 1.0, 80000, 800000);
+      CreateHeap (&dt->transHeap, "Transcription heap", MSTAK, 1, 0, 8000, 80000);
+      dt->idx = 0;
+      dt->fn[0] = '\0';
+#ifdef COLLECT_STATS
+      CreateHeap (&dt->statsHeap, "Frame stats heap", MSTAK, 1, 1.0, 8000, 800000);
+      dt->frameStats = dt->lastFrameStats = NULL;
+      dt->dec->stats.timing = (statsFN != NULL);
+#endif
+   }
+   ioLock = CreateHLock (&gcheap);
 
-   CreateHeap (&inputBufHeap, "Input Buffer Heap", MSTAK, 1, 1.0, 80000, 800000);
+   /* search space statistics */
+   if (statsFN) {
+#ifdef COLLECT_STATS
+      OpenStatsFile ();
+#else
+      HError (9999, "Initialise: STATSFILE needs HLVRec compiled with COLLECT_STATS");
+#endif
+   }
+   outSignal = CreateHSignal (&gcheap);
 
    /* Initialise adaptation */
 
@@ -715,8 +868,6 @@ DecoderInst *Initialise (void)
       InitialiseTransform(&hset, &regHeap, rt, FALSE);
    }
 #endif
-
-   return dec;
 }
 
 
@@ -802,7 +953,7 @@ BestInfo *CreateBestInfo (MemHeap *heap, char *fn, HTime frameDur)
    BestInfo *bestAlignInfo;
 
    MakeFN (fn, "", "rec", alignFN);
-   bestTrans = LOpen (&transHeap, alignFN, HTK);
+   bestTrans = LOpen (heap, alignFN, HTK);
       
    /* delete 'sp' or 'sil' before final 'sil' if it is there
       these are always inserted by HVite but not possible in HDecode's net structure*/
@@ -830,7 +981,7 @@ BestInfo *CreateBestInfo (MemHeap *heap, char *fn, HTime frameDur)
            ln, lnLabId->name);
 #endif
    assert (ll->labid == lnLabId);
-   bestAlignInfo = New (&transHeap, sizeof (BestInfo));
+   bestAlignInfo = New (heap, sizeof (BestInfo));
    bestAlignInfo->start = ll->start / (frameDur*1.0e7);
    bestAlignInfo->end = ll->end / (frameDur*1.0e7);
    bestAlignInfo->ll = ll;
@@ -838,7 +989,7 @@ BestInfo *CreateBestInfo (MemHeap *heap, char *fn, HTime frameDur)
    
    
    /* info for all the following nodes */
-   bestAlignInfo->next = FindLexNetLab (&transHeap, ln, ll->succ, frameDur);
+   bestAlignInfo->next = FindLexNetLab (heap, ln, ll->succ, frameDur);
    
    {
       BestInfo *b;
@@ -857,7 +1008,7 @@ void PrintAlignBestInfo (DecoderInst *dec, BestInfo *b)
    LabId monoPhone;
    LogDouble phonePost;
 
-   inst = b->ln->inst;
+   inst = LNINST(dec,b->ln);
    score = inst ? inst->best : LZERO;
 
    if (b->ln->type == LN_MODEL) {
@@ -903,22 +1054,240 @@ void AnalyseSearchSpace (DecoderInst *dec, BestInfo *bestInfo)
 
 /*****************  main recognition function  ************************/
 
-void DoRecognition (DecoderInst *dec, char *fn)
+/* DecodeFiles: thread body, recognise data files until none are left */
+Ptr DecodeFiles (Ptr arg)
+{
+   DecodeThread *dt = (DecodeThread *) arg;
+   char *datafn;
+
+   for (;;) {
+      AcquireHLock (ioLock);
+      if (NumArgs () == 0) {
+         ReleaseHLock (ioLock);
+         return NULL;
+      }
+      if (NextArg () != STRINGARG)
+	 HError (4019, "HDecode: Data file name expected");
+      datafn = GetStrArg ();
+      dt->idx = nextIn++;
+
+      if ((trace & T_TOP) && numThreads == 1) {
+	 printf ("File: %s\n", datafn);
+	 fflush (stdout);
+      }
+      DoRecognition (dt, datafn);
+   }
+}
+
+/* PrintResult: print the words of trans on one line, a '|' follows
+   the first nStable words unless nStable < 0 */
+void PrintResult (char *tag, int frame, Transcription *trans, int nStable)
+{
+   LabList *ll = trans->head;
+   LLink lab;
+   int i;
+
+   printf ("%s [%d frames]", tag, frame);
+   for (lab = ll->head->succ, i = 0; lab != ll->tail; lab = lab->succ, ++i) {
+      if (i == nStable)
+         printf (" |");
+      printf (" %s", lab->labid->name);
+   }
+   if (i == nStable)
+      printf (" |");
+   printf ("\n");
+   fflush (stdout);
+}
+
+/* PrintPartial: print the current best hypothesis of the decoder of dt */
+void PrintPartial (DecodeThread *dt)
+{
+   Transcription *trans;
+   int nStable;
+
+   trans = PartialTraceBack (&dt->transHeap, dt->dec, &nStable);
+   PrintResult ("PARTIAL", dt->dec->frame, trans, nStable);
+   Dispose (&dt->transHeap, trans);
+}
+
+#ifdef COLLECT_STATS
+/* OpenStatsFile: create STATSFILE and write the CSV header */
+void OpenStatsFile (void)
+{
+   int i;
+
+   if ((statsF = fopen (statsFN, "w")) == NULL)
+      HError (9999, "OpenStatsFile: cannot create stats file %s", statsFN);
+   if (statsCSV) {
+      fprintf (statsF, "type,file,frame,insts,tokens,wordends,lmla_hit,lmla_miss,"
+               "outp_hit,outp_miss,beam");
+      for (i = 0; i < NSTAGES; ++i)
+         fprintf (statsF, ",%s_ms", stageName[i]);
+      fprintf (statsF, ",traceback_ms,decode_ms,cpu_ms,peak_insts,peak_tokens,"
+               "gc_minor,gc_full,gc_max_ms");
+      for (i = 0; i < NLAYERS; ++i)
+         fprintf (statsF, ",layer%d", i);
+      fprintf (statsF, "\n");
+   }
+}
+
+/* RecordFrameStats: add the counters of the frame just processed by
+   dt to the totals of the current file and keep them for output */
+void RecordFrameStats (DecodeThread *dt)
+{
+   DecoderInst *dec = dt->dec;
+   FrameStats *fs, *u = &dt->uttStats;
+   int i;
+
+   if (statsFrames) {
+      fs = (FrameStats *) New (&dt->statsHeap, sizeof (FrameStats));
+      fs->next = NULL;
+      fs->frame = dec->frame;
+      fs->nInst = dec->nActInst; fs->nTok = dec->nActTok;
+      fs->nWordend = dec->stats.nWordend;
+      fs->lmlaHit = dec->lmCache->laHit; fs->lmlaMiss = dec->lmCache->laMiss;
+      fs->outPHit = dec->outPCache->cacheHit; fs->outPMiss = dec->outPCache->cacheMiss;
+      fs->beam = dec->curBeamWidth;
+      for (i = 0; i < NLAYERS; ++i)
+         fs->nLayerInst[i] = (i < dec->nLayers) ? dec->stats.nLayerInst[i] : 0;
+      for (i = 0; i < NSTAGES; ++i)
+         fs->stageTime[i] = dec->stats.stageTime[i];
+      if (dt->lastFrameStats)
+         dt->lastFrameStats->next = fs;
+      else
+         dt->frameStats = fs;
+      dt->lastFrameStats = fs;
+   }
+
+   u->frame = dec->frame;
+   u->nInst += dec->nActInst; u->nTok += dec->nActTok;
+   u->nWordend += dec->stats.nWordend;
+   u->lmlaHit += dec->lmCache->laHit; u->lmlaMiss += dec->lmCache->laMiss;
+   u->outPHit += dec->outPCache->cacheHit; u->outPMiss += dec->outPCache->cacheMiss;
+   for (i = 0; i < dec->nLayers && i < NLAYERS; ++i)
+      u->nLayerInst[i] += dec->stats.nLayerInst[i];
+   for (i = 0; i < NSTAGES; ++i)
+      u->stageTime[i] += dec->stats.stageTime[i];
+}
+
+/* PutStatsStr: write s as a quoted CSV field or JSON string */
+void PutStatsStr (char *s)
+{
+   fputc ('"', statsF);
+   for (; *s; ++s) {
+      if (*s == '"')
+         fputs (statsCSV ? "\"\"" : "\\\"", statsF);
+      else if (*s == '\\' && !statsCSV)
+         fputs ("\\\\", statsF);
+      else if ((unsigned char) *s < ' ' && !statsCSV)
+         fprintf (statsF, "\\u%04x", (unsigned char) *s);
+      else
+         fputc (*s, statsF);
+   }
+   fputc ('"', statsF);
+}
+
+/* PutFrameStats: write the common fields of frame record fs,
+   which holds the totals of the file if isUtt */
+void PutFrameStats (DecodeThread *dt, FrameStats *fs, Boolean isUtt)
+{
+   char *type = isUtt ? "utterance" : "frame";
+   int i;
+
+   if (statsCSV) {
+      fprintf (statsF, "%s,", type);
+      PutStatsStr (dt->fn);
+      fprintf (statsF, ",%d,%d,%d,%d,%d,%d,%d,%d,%.2f", fs->frame, fs->nInst, fs->nTok,
+               fs->nWordend, fs->lmlaHit, fs->lmlaMiss, fs->outPHit, fs->outPMiss, fs->beam);
+      for (i = 0; i < NSTAGES; ++i)
+         fprintf (statsF, ",%.4f", fs->stageTime[i] * 1000.0);
+   }
+   else {
+      fprintf (statsF, "{\"type\":\"%s\",\"file\":", type);
+      PutStatsStr (dt->fn);
+      fprintf (statsF, ",\"%s\":%d,\"insts\":%d,\"tokens\":%d,\"wordends\":%d,"
+               "\"lmlaHit\":%d,\"lmlaMiss\":%d,\"outPHit\":%d,\"outPMiss\":%d,"
+               "\"%s\":%.2f,\"layers\":[", 
+               isUtt ? "frames" : "frame", fs->frame, fs->nInst, fs->nTok,
+               fs->nWordend, fs->lmlaHit, fs->lmlaMiss, fs->outPHit, fs->outPMiss,
+               isUtt ? "minBeam" : "beam", fs->beam);
+      for (i = 0; i < dt->dec->nLayers && i < NLAYERS; ++i)
+         fprintf (statsF, "%s%d", i ? "," : "", fs->nLayerInst[i]);
+      fprintf (statsF, "],\"ms\":{");
+      for (i = 0; i < NSTAGES; ++i)
+         fprintf (statsF, "%s\"%s\":%.4f", i ? "," : "", stageName[i], fs->stageTime[i] * 1000.0);
+   }
+}
+
+/* WriteStats: write the frame records and the totals of the file
+   decoded by dt. decSec is the wall clock time of decoding, tbSec
+   that of the traceback and cpuSec the CPU time */
+void WriteStats (DecodeThread *dt, double decSec, double tbSec, double cpuSec)
+{
+   DecoderInst *dec = dt->dec;
+   FrameStats *fs, *u = &dt->uttStats;
+   int i;
+
+   for (fs = dt->frameStats; fs; fs = fs->next) {
+      PutFrameStats (dt, fs, FALSE);
+      if (statsCSV) {
+         fprintf (statsF, ",,,,,,,,");
+         for (i = 0; i < NLAYERS; ++i)
+            fprintf (statsF, ",%d", fs->nLayerInst[i]);
+         fprintf (statsF, "\n");
+      }
+      else
+         fprintf (statsF, "}}\n");
+   }
+
+   u->beam = dec->minBeamWidth;
+   PutFrameStats (dt, u, TRUE);
+   if (statsCSV) {
+      fprintf (statsF, ",%.4f,%.4f,%.4f,%d,%d,%d,%d,%.4f", tbSec * 1000.0,
+               decSec * 1000.0, cpuSec * 1000.0, dec->peakActInst, dec->peakActTok,
+               dec->gcStats.nMinor, dec->gcStats.nFull, dec->gcStats.maxPause * 1000.0);
+      for (i = 0; i < NLAYERS; ++i)
+         fprintf (statsF, ",%d", u->nLayerInst[i]);
+      fprintf (statsF, "\n");
+   }
+   else
+      fprintf (statsF, ",\"traceback\":%.4f,\"decode\":%.4f,\"cpu\":%.4f},"
+               "\"peakInsts\":%d,\"peakTokens\":%d,\"gc\":{\"minor\":%d,\"full\":%d,"
+               "\"reclaimedMB\":%.3f,\"maxMs\":%.4f}}\n",
+               tbSec * 1000.0, decSec * 1000.0, cpuSec * 1000.0,
+               dec->peakActInst, dec->peakActTok, dec->gcStats.nMinor, dec->gcStats.nFull,
+               dec->gcStats.reclaimed / 1048576.0, dec->gcStats.maxPause * 1000.0);
+   fflush (statsF);
+}
+#endif
+
+/* DoRecognition: recognise datafn with the decoder of dt, direct audio
+   input if datafn is NULL. Must be called with ioLock held, which is
+   released while decoding and tracing back. Results are output in
+   script order. */
+void DoRecognition (DecodeThread *dt, char *datafn)
 {
    char buf1[MAXSTRLEN], buf2[MAXSTRLEN];
+   DecoderInst *dec = dt->dec;
+   Observation *obs = dt->obs;
+   char *fn = dt->fn;
    ParmBuf parmBuf;
    BufferInfo pbInfo;
    int frameN, frameProc, i, bs;
    Transcription *trans;
    Lattice *lat;
-   clock_t startClock, endClock;
-   double cpuSec;
+   double startCPU, cpuSec, startWall, decSec, tbSec;
    Observation *obsBlock[MAXBLOCKOBS];
    BestInfo *bestAlignInfo = NULL;
 
+   if (datafn)
+      strcpy (fn, datafn);
+   else
+      fn[0] = '\0';
+
    /* This handles the initial input transform, parent transform setting
       and output transform creation */
-   { 
+   if (datafn) { 
       Boolean changed;
 
       changed = UpdateSpkrStats(&hset, &xfInfo, fn);
@@ -929,15 +1298,22 @@ void DoRecognition (DecoderInst *dec, char *fn)
 #endif
    }
 
-   startClock = clock();
+   startCPU = ThreadCPUTime ();
+   startWall = WallClockTime ();
+#ifdef COLLECT_STATS
+   memset (&dt->uttStats, 0, sizeof (FrameStats));
+   dt->frameStats = dt->lastFrameStats = NULL;
+#endif
 
    /* get transcrition of 1-best alignment */
    if (bestAlignMLF)
-      bestAlignInfo = CreateBestInfo (&transHeap, fn, pbInfo.tgtSampRate/1.0e7);
+      bestAlignInfo = CreateBestInfo (&dt->transHeap, fn, pbInfo.tgtSampRate/1.0e7);
    
-   parmBuf = OpenBuffer (&inputBufHeap, fn, 50, dataForm, TRI_UNDEF, TRI_UNDEF);
+   parmBuf = OpenBuffer (&dt->inputBufHeap, datafn, 50, dataForm, TRI_UNDEF, TRI_UNDEF);
    if (!parmBuf)
       HError (9999, "HDecode: Opening input failed");
+   if (!datafn)
+      StartBuffer (parmBuf);
    
    GetBufferInfo (parmBuf, &pbInfo);
    if (pbInfo.tgtPK != hset.pkind)
@@ -986,6 +1362,7 @@ void DoRecognition (DecoderInst *dec, char *fn)
       if (trace & T_TOP)
          printf ("Creating network\n");
       net = CreateLexNet (&netHeap, &vocab, &hset, startWord, endWord, silDict);
+      net->vocabFN = dictfn;
 
       /* create LM based on pronIds defined by CreateLexNet */
       if (trace & T_TOP)
@@ -994,21 +1371,21 @@ void DoRecognition (DecoderInst *dec, char *fn)
       dec->lm = lm;
    }
 
-   if (weBeamWidth > beamWidth)
-      weBeamWidth = beamWidth;
-   if (zsBeamWidth > beamWidth)
-      zsBeamWidth = beamWidth;
-
    InitDecoderInst (dec, net, pbInfo.tgtSampRate, beamWidth, relBeamWidth,
                     weBeamWidth, zsBeamWidth, maxModel,
                     insPen, acScale, pronScale, lmScale, fastlmlaBeam);
 
-   net->vocabFN = dictfn;
    dec->utterFN = fn;
+   ReleaseHLock (ioLock);
 
    frameN = frameProc = 0;
-   while (BufferStatus (parmBuf) != PB_CLEARED) {
-      ReadAsBuffer (parmBuf, &obs[frameN % outpBlocksize]);
+   for (;;) {
+      /* HParm is not reentrant */
+      AcquireHLock (ioLock);
+      if (BufferStatus (parmBuf) == PB_CLEARED ||
+          !ReadAsBuffer (parmBuf, &obs[frameN % outpBlocksize]))
+         break;
+      ReleaseHLock (ioLock);
       
 #ifdef LEGACY_CUHTK2_MLLR
       if (fvTransMat) {
@@ -1019,6 +1396,7 @@ void DoRecognition (DecoderInst *dec, char *fn)
                            obs[frameN % outpBlocksize].fv[1]);
       }
 #endif
+      GSelObservation (&hset, &obs[frameN % outpBlocksize]);
 
       if (frameN+1 >= outpBlocksize) {  /* enough frames available */
          if (trace & T_OBS)
@@ -1032,13 +1410,20 @@ void DoRecognition (DecoderInst *dec, char *fn)
 #endif
          
          ProcessFrame (dec, obsBlock, outpBlocksize, xfInfo.inXForm);
+#ifdef COLLECT_STATS
+         if (statsF)
+            RecordFrameStats (dt);
+#endif
          if (bestAlignInfo)
             AnalyseSearchSpace (dec, bestAlignInfo);
          ++frameProc;
+         if (partialFreq > 0 && frameProc % partialFreq == 0)
+            PrintPartial (dt);
       }
       ++frameN;
    }
    CloseBuffer (parmBuf);
+   ReleaseHLock (ioLock);
 
    /* process remaining frames (no full blocks available anymore) */
    for (bs = outpBlocksize-1; bs >=1; --bs) {
@@ -1048,25 +1433,69 @@ void DoRecognition (DecoderInst *dec, char *fn)
          obsBlock[i] = &obs[(frameProc + i) % outpBlocksize];
       
       ProcessFrame (dec, obsBlock, bs, xfInfo.inXForm);
+#ifdef COLLECT_STATS
+      if (statsF)
+         RecordFrameStats (dt);
+#endif
       if (bestAlignInfo)
          AnalyseSearchSpace (dec, bestAlignInfo);
       ++frameProc;
+      if (partialFreq > 0 && frameProc % partialFreq == 0)
+         PrintPartial (dt);
    }
    assert (frameProc == frameN);
 
    
-   endClock = clock();
-   cpuSec = (endClock - startClock) / (double) CLOCKS_PER_SEC;
+   cpuSec = ThreadCPUTime () - startCPU;
+   decSec = WallClockTime () - startWall;
+
+   /* traceback and lattice generation only use this thread's decoder
+      and heap, so run them before waiting for the output turn; both
+      stay on transHeap until it is reset below and what they found is
+      printed by PrintTraceBackInfo in turn */
+   startWall = WallClockTime ();
+   trans = TraceBack (&dt->transHeap, dec);
+   lat = (latGen && datafn) ? LatTraceBack (&dt->transHeap, dec) : NULL;
+   tbSec = WallClockTime () - startWall;
+
+   /* wait for the preceding files to be output */
+   AcquireHLock (ioLock);
+   while (nextOut != dt->idx)
+      WaitHSignal (outSignal, ioLock);
+
+   if ((trace & T_TOP) && numThreads > 1) {
+      printf ("File: %s\n", fn);
+      fflush (stdout);
+   }
    printf ("CPU time %f  utterance length %f  RT factor %f\n",
            cpuSec, frameN*dec->frameDur, cpuSec / (frameN*dec->frameDur));
-
-   trans = TraceBack (&transHeap, dec);
+   PrintTraceBackInfo (dec, FALSE);
+   if ((trace & T_TOP) && dec->frame > 0)
+      printf ("Active insts %.1f (peak %d)  tokens %.1f (peak %d)  min beam %.1f\n",
+              dec->sumActInst / dec->frame, dec->peakActInst,
+              dec->sumActTok / dec->frame, dec->peakActTok, dec->minBeamWidth);
+   if (trace & T_TOP) {
+      long hit, miss;
+      int nUsed;
+      size_t mem;
+
+      if (GetSharedLMCacheStats (dec, &hit, &miss, &nUsed, &mem) && hit + miss > 0)
+         printf ("LM cache %d entries (%.1f MB)  hit rate %.1f%%\n",
+                 nUsed, mem / 1048576.0, 100.0 * hit / (hit + miss));
+      if (dec->gcStats.nMinor + dec->gcStats.nFull > 0)
+         printf ("Path GC %d new %d full  %.1f MB reclaimed  pause %.2f ms (max %.2f ms)\n",
+                 dec->gcStats.nMinor, dec->gcStats.nFull, dec->gcStats.reclaimed / 1048576.0,
+                 dec->gcStats.pause * 1000.0, dec->gcStats.maxPause * 1000.0);
+   }
 
    /* save 1-best transcription */
    /* the following is from HVite.c */
    if (trans) {
       char labfn[MAXSTRLEN];
 
+      if (partialFreq > 0 || !datafn)
+         PrintResult ("FINAL", frameN, trans, -1);
+
       if (labForm != NULL)
          ReFormatTranscription (trans, pbInfo.tgtSampRate, FALSE, FALSE,
                                 strchr(labForm,'X')!=NULL,
@@ -1074,23 +1503,24 @@ void DoRecognition (DecoderInst *dec, char *fn)
                                 strchr(labForm,'C')!=NULL,strchr(labForm,'T')!=NULL,
                                 strchr(labForm,'W')!=NULL,strchr(labForm,'M')!=NULL);
       
-      MakeFN (fn, labDir, labExt, labfn);
-
-      if (LSave (labfn, trans, ofmt) < SUCCESS)
-         HError(9999, "DoRecognition: Cannot save file %s", labfn);
+      if (datafn) {
+         MakeFN (fn, labDir, labExt, labfn);
+         if (LSave (labfn, trans, ofmt) < SUCCESS)
+            HError(9999, "DoRecognition: Cannot save file %s", labfn);
+      }
       if (trace & T_TOP)
          PrintTranscription (trans, "1-best hypothesis");
-
-      Dispose (&transHeap, trans);
    }
 
-   if (latGen) {
-      lat = LatTraceBack (&transHeap, dec);
-
-      /* prune lattice */
-      if (lat && latPruneBeam < - LSMALL) {
-         lat = LatPrune (&transHeap, lat, latPruneBeam, latPruneAPS);
+   if (latGen && datafn)
+      PrintTraceBackInfo (dec, TRUE);
+   if (lat) {
+      /* prune lattice, LatPrune takes scratch space from gcheap */
+      startWall = WallClockTime ();
+      if (latPruneBeam < - LSMALL) {
+         lat = LatPrune (&dt->transHeap, lat, latPruneBeam, latPruneAPS);
       }
+      tbSec += WallClockTime () - startWall;
 
       /* the following is from HVite.c */
       if (lat) {
@@ -1128,12 +1558,15 @@ void DoRecognition (DecoderInst *dec, char *fn)
             HError(9999, "DoRecognition: WriteLattice failed");
          
          FClose (file,isPipe);
-         Dispose (&transHeap, lat);
       }
    }
 
 
 #ifdef COLLECT_STATS
+   if (statsF) {
+      WriteStats (dt, decSec, tbSec, cpuSec);
+      ResetHeap (&dt->statsHeap);
+   }
    printf ("Stats: nTokSet %lu\n", dec->stats.nTokSet);
    printf ("Stats: TokPerSet %f\n", dec->stats.sumTokPerTS / (double) dec->stats.nTokSet);
    printf ("Stats: activePerFrame %f\n", dec->stats.nActive / (double) dec->stats.nFrames);
@@ -1158,9 +1591,13 @@ void DoRecognition (DecoderInst *dec, char *fn)
       PrintAllHeapStats ();
    }
 
-   ResetHeap (&inputBufHeap);
-   ResetHeap (&transHeap);
+   ResetHeap (&dt->inputBufHeap);
+   ResetHeap (&dt->transHeap);
    CleanDecoderInst (dec);
+
+   ++nextOut;
+   BroadcastHSignal (outSignal);
+   ReleaseHLock (ioLock);
 }
 
 #ifdef LEGACY_CUHTK2_MLLR
@@ -851,7 +851,7 @@ void PrintAlignBestInfo (DecoderInst *dec, BestInfo *b)
    LabId monoPhone;
    LogDouble phonePost;
 
-   inst = b->ln->inst;
+   inst = LNINST(dec,b->ln);
    score = inst ? inst->best : LZERO;
 
    if (b->ln->type == LN_MODEL) {
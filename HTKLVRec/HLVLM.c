@@ -47,6 +47,9 @@ char *hlvlm_vc_id = "$Id: HLVLM.c,v 1.1.1.1 2006/10/11 09:54:55 jal58 Exp $";
 #include "HLVLM.h"
 
 #include <assert.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 /* ----------------------------- Trace Flags ------------------------- */
 
@@ -68,12 +71,17 @@ NEntry *GetNEntry (FSLM_ngram *nglm, LMId ndx[NSIZE], Boolean create);
 void SetNEntryBO (FSLM *lm);
 
 LogFloat LMTransProb_ngram (FSLM *lm, LMState src, PronId pronid, LMState *dest);
+LogFloat LMTransProb_qngram (FSLM *lm, LMState src, PronId pronid, LMState *dest);
+LogFloat LMLookAhead_qngram (FSLM *lm, LMState src, PronId minPron, PronId maxPron);
 LogFloat LMLookAhead_2gram (FSLM *lm, LMState src, PronId minPron, PronId maxPron);
 LogFloat LMLookAhead_3gram (FSLM *lm, LMState src, PronId minPron, PronId maxPron);
 LogFloat LMLookAhead_ngram (FSLM *lm, LMState src, PronId minPron, PronId maxPron);
 LogFloat LMTransProb_latlm (FSLM *lm, LMState src, PronId pronid, LMState *dest);
 LogFloat LMLookAhead_latlm (FSLM *lm, LMState src, PronId minPron, PronId maxPron);
 LMState Fast_LMLA_LMState (FSLM *lm, LMState src);
+static void SetNGramFuncs (FSLM *lm);
+static int HistLength (LMId *word);
+static QNEntry *GetQNEntry (FSLM_ngram *nglm, LMId ndx[NSIZE]);
      
 /* --------------------------- Initialisation ---------------------- */
 
@@ -566,8 +574,24 @@ FSLM *CreateLM (MemHeap *heap, char *fn, char *startWord, char *endWord, Vocab *
 
    SetStartEnd (lm, startWord, endWord, vocab);
 
+   SetNGramFuncs (lm);
+
+   return (lm);
+}
+
+/* SetNGramFuncs
+
+     set initial state and access functions of n-gram lm
+*/
+static void SetNGramFuncs (FSLM *lm)
+{
    lm->initial = (LMState) 0xffffffff;
 
+   if (lm->data.nglm->quant) {  /* LM image */
+      lm->lookahead = LMLookAhead_qngram;
+      lm->transProb = LMTransProb_qngram;
+      return;
+   }
    lm->lookahead = LMLookAhead_ngram;
    lm->transProb = LMTransProb_ngram;
    switch (lm->data.nglm->nsize) {
@@ -580,6 +604,400 @@ FSLM *CreateLM (MemHeap *heap, char *fn, char *startWord, char *endWord, Vocab *
       lm->transProb = LMTransProb_ngram;
       break;
    }
+}
+
+
+/* -------------- compiled LM images --------------- */
+
+/*
+   An LM image (see LVImgWrite in HLVNet) holds an n-gram LM in its
+   object area as
+      LMImgRoot
+      the QNEntry array, sorted by history length and history
+      per history length the PronId and the probability code arrays of
+      the predicted words, in QNEntry order
+      the QNEntry hash table, the unigram and the PronId to LMId arrays
+      the codebooks
+   Probabilities and back-off weights are quantised to NGLM_Code with
+   one codebook per history length (unigrams use that of the empty
+   history).  A codebook holds every distinct value if there are at
+   most NGLM_NCODE of them and the means of runs of neighbouring values
+   otherwise.  SEntries are indexed by PronId, so an image is only
+   valid for the PronIds it was written with; the key covers them as
+   well as the size and date of the ARPA file.
+*/
+
+#define LMIMGMAGIC "HTKLMIM2"
+#if defined(__LP64__) || defined(_WIN64)
+#define LMIMGBASEADDR ((size_t)0x3f8000000000) /* preferred mapping */
+#else
+#define LMIMGBASEADDR ((size_t)0x50000000)
+#endif
+
+typedef struct {
+   int nSize;                   /* NSIZE of writer */
+   int codeSize;                /* sizeof(NGLM_Code) of writer */
+   int pronIdSize;              /* sizeof(PronId) of writer */
+   int lmIdSize;                /* sizeof(LMId) of writer */
+   int entrySize;               /* sizeof(QNEntry) of writer */
+   int nsize;                   /* FSLM_ngram fields */
+   unsigned int hashsize;
+   int counts[NSIZE+1];
+   int vocSize;
+   int nNEntry;                 /* entries in QNEntry array */
+   int levelStart[NSIZE+1];     /* first QNEntry with history of length l */
+   int nProbCode[NSIZE];        /* codebook sizes */
+   int nBowtCode[NSIZE];
+   size_t pronId2LMId;          /* offset of LMId [vocSize+1] */
+   NGLM_Quant quant;            /* pointers to the quantised LM */
+} LMImgRoot;
+
+typedef struct {                /* NEntry and its index in the image */
+   NEntry *ne;
+   int idx;
+} LMImgNE;
+
+/* lmimg_ne_cmp: order NEntry pointers by history length and history */
+static int lmimg_ne_cmp (const void *v1, const void *v2)
+{
+   NEntry *n1 = *(NEntry **) v1, *n2 = *(NEntry **) v2;
+   int i, l1, l2;
+
+   l1 = HistLength (n1->word); l2 = HistLength (n2->word);
+   if (l1 != l2)
+      return l1 - l2;
+   for (i = l1 - 1; i >= 0; --i)        /* oldest word first */
+      if (n1->word[i] != n2->word[i])
+         return (n1->word[i] < n2->word[i]) ? -1 : 1;
+   return 0;
+}
+
+static int lmimg_ptr_cmp (const void *v1, const void *v2)
+{
+   NEntry *n1 = ((LMImgNE *) v1)->ne, *n2 = ((LMImgNE *) v2)->ne;
+
+   return (n1 < n2) ? -1 : (n1 > n2) ? 1 : 0;
+}
+
+static int lmimg_float_cmp (const void *v1, const void *v2)
+{
+   float f1 = *(float *) v1, f2 = *(float *) v2;
+
+   return (f1 < f2) ? -1 : (f1 > f2) ? 1 : 0;
+}
+
+/* LMImgOffset: image offset of ne (0 for NULL) given the map sorted by pointer */
+static size_t LMImgOffset (LMImgNE *map, int n, size_t nentry, NEntry *ne)
+{
+   LMImgNE key, *e;
+
+   if (!ne)
+      return 0;
+   key.ne = ne;
+   e = (LMImgNE *) bsearch (&key, map, n, sizeof (LMImgNE), lmimg_ptr_cmp);
+   if (!e)
+      HError (9999, "LMImgOffset: NEntry not in hash table");
+   return nentry + e->idx * sizeof (QNEntry);
+}
+
+/* LMImgCodebook
+
+     sort the n values v and build their codebook cb, returning its
+     size.  ub[c] is the largest value coded as c.  Runs of
+     neighbouring values share a code only if there are more than
+     NGLM_NCODE distinct values, and LZERO values never share one with
+     others.
+*/
+static int LMImgCodebook (float *v, int n, float *cb, float *ub)
+{
+   int i, j, d, nc, pop, tgt;
+   double sum;
+   float first;
+
+   qsort (v, n, sizeof (float), lmimg_float_cmp);
+   for (i = 0, d = 0; i < n; ++i)
+      if (i == 0 || v[i] != v[i-1])
+         ++d;
+   tgt = (d <= NGLM_NCODE) ? 1 : n / (NGLM_NCODE - 2) + 1;
+
+   nc = 0; pop = 0; sum = 0.0; first = 0.0;
+   for (i = 0; i < n; i = j) {
+      if (pop == 0)
+         first = v[i];
+      for (j = i; j < n && v[j] == v[i]; ++j)
+         sum += v[j];
+      pop += j - i;
+      if (j == n || pop >= tgt || (v[i] < LSMALL) != (v[j] < LSMALL)) {
+         cb[nc] = (first == v[i]) ? v[i] : (float) (sum / pop);
+         ub[nc] = v[i];
+         ++nc; pop = 0; sum = 0.0;
+      }
+   }
+   return nc;
+}
+
+/* LMImgEncode: code of x in the codebook with upper bounds ub[0..nc-1] */
+static NGLM_Code LMImgEncode (float *ub, int nc, float x)
+{
+   int l, h, c;
+
+   l = 0; h = nc - 1;
+   while (l < h) {              /* first c with ub[c] >= x */
+      c = (l + h) / 2;
+      if (ub[c] < x)
+         l = c + 1;
+      else
+         h = c;
+   }
+   return (NGLM_Code) l;
+}
+
+static unsigned long LMImgStrHash (unsigned long h, char *s)
+{
+   while (*s)
+      h = h * 31 + (unsigned char) *s++;
+   return h ^ (h >> 15);
+}
+
+/* LMImageKey
+
+     checksum of the inputs of an n-gram LM: size and date of the ARPA
+     file fn, the start and end words and the PronIds of vocab.  Sums
+     are used so the order of the vocab hash table does not matter.
+*/
+static unsigned long LMImageKey (char *fn, char *startWord, char *endWord, Vocab *vocab)
+{
+   struct stat st;
+   unsigned long key;
+   Word word;
+   Pron pron;
+   int i, k;
+
+   key = LMImgStrHash (LMImgStrHash (0, startWord), endWord);
+   if (stat (fn, &st) == 0)
+      key += (unsigned long) st.st_size * 31 + (unsigned long) st.st_mtime;
+   key += vocab->nprons;
+   for (i = 0; i < VHASHSIZE; ++i)
+      for (word = vocab->wtab[i]; word; word = word->next)
+         for (pron = word->pron, k = 0; pron; pron = pron->next, ++k)
+            if (pron->aux)
+               key += LMImgStrHash (k * 31 + (unsigned long) (size_t) pron->aux,
+                                    word->wordName->name) * 2 + 1;
+   return key;
+}
+
+/* SaveLMImage
+
+     write n-gram lm as image fn with given key
+*/
+static ReturnStatus SaveLMImage (FSLM *lm, char *fn, unsigned long key)
+{
+   FSLM_ngram *nglm = lm->data.nglm;
+   LVImgBuild b;
+   LMImgRoot *r;
+   LMImgNE *map;
+   NEntry **sorted, *ne;
+   QNEntry *qne;
+   float *pv, *bv, *pcb, *pub, *bcb, *bub;
+   NGLM_Code *code;
+   PronId *word;
+   size_t root, quant, nentry, sew, sep, at, t;
+   int i, j, k, l, m, n, nse, npv, npc, nbc;
+
+   /* collect and sort NEntries */
+   for (i = 0, n = 0; i < nglm->hashsize; ++i)
+      for (ne = nglm->hashtab[i]; ne; ne = ne->link)
+         ++n;
+   sorted = (NEntry **) New (&gcheap, (n + 1) * sizeof (NEntry *));
+   map = (LMImgNE *) New (&gcheap, (n + 1) * sizeof (LMImgNE));
+   for (i = 0, n = 0; i < nglm->hashsize; ++i)
+      for (ne = nglm->hashtab[i]; ne; ne = ne->link)
+         sorted[n++] = ne;
+   qsort (sorted, n, sizeof (NEntry *), lmimg_ne_cmp);
+   for (i = 0; i < n; ++i) {
+      map[i].ne = sorted[i]; map[i].idx = i;
+   }
+   qsort (map, n, sizeof (LMImgNE), lmimg_ptr_cmp);
+
+   root = LVImgInit (&b, LMIMGBASEADDR, sizeof (LMImgRoot));
+   quant = root + offsetof (LMImgRoot, quant);
+   nentry = LVImgAlloc (&b, n * sizeof (QNEntry));
+   if (n == 0 || HistLength (sorted[0]->word) != 0)
+      HError (9999, "SaveLMImage: LM has no empty history");
+
+   /* QNEntries, their SEntry arrays and codebooks per history length */
+   for (i = 0; i < n; i = j) {
+      l = HistLength (sorted[i]->word);
+      for (j = i, nse = 0; j < n && HistLength (sorted[j]->word) == l; ++j)
+         nse += sorted[j]->nse;
+
+      /* collect and quantise the values of this history length */
+      npv = nse + ((l == 0) ? nglm->vocSize + 1 : 0);
+      pv = (float *) New (&gcheap, (npv + 1) * sizeof (float));
+      pcb = (float *) New (&gcheap, (npv + 1) * sizeof (float));
+      pub = (float *) New (&gcheap, (npv + 1) * sizeof (float));
+      bv = (float *) New (&gcheap, (j - i) * sizeof (float));
+      bcb = (float *) New (&gcheap, (j - i) * sizeof (float));
+      bub = (float *) New (&gcheap, (j - i) * sizeof (float));
+      for (k = i, npv = 0; k < j; ++k) {
+         bv[k-i] = NGLM_PROB_TO_FLOAT (sorted[k]->bowt);
+         for (m = 0; m < sorted[k]->nse; ++m)
+            pv[npv++] = NGLM_PROB_TO_FLOAT (sorted[k]->se[m].prob);
+      }
+      if (l == 0)
+         for (m = 0; m <= nglm->vocSize; ++m)
+            pv[npv++] = NGLM_PROB_TO_FLOAT (nglm->unigrams[m]);
+      npc = (npv > 0) ? LMImgCodebook (pv, npv, pcb, pub) : 0;
+      nbc = LMImgCodebook (bv, j - i, bcb, bub);
+      if (trace & T_TOP)
+         printf ("HLVLM: history length %d: %d probs in %d codes, %d bowts in %d codes\n",
+                 l, npv, npc, j - i, nbc);
+
+      if (npc > 0) {
+         t = LVImgAlloc (&b, npc * sizeof (float));
+         memcpy (b.buf + t, pcb, npc * sizeof (float));
+         LVImgLink (&b, quant + offsetof (NGLM_Quant, probCB) + l * sizeof (float *), t);
+      }
+      t = LVImgAlloc (&b, nbc * sizeof (float));
+      memcpy (b.buf + t, bcb, nbc * sizeof (float));
+      LVImgLink (&b, quant + offsetof (NGLM_Quant, bowtCB) + l * sizeof (float *), t);
+      ((LMImgRoot *) (b.buf + root))->nProbCode[l] = npc;
+      ((LMImgRoot *) (b.buf + root))->nBowtCode[l] = nbc;
+
+      sew = LVImgAlloc (&b, nse * sizeof (PronId));
+      sep = LVImgAlloc (&b, nse * sizeof (NGLM_Code));
+      LVImgLink (&b, quant + offsetof (NGLM_Quant, seWord) + l * sizeof (PronId *), sew);
+      LVImgLink (&b, quant + offsetof (NGLM_Quant, seProb) + l * sizeof (NGLM_Code *), sep);
+      word = (PronId *) (b.buf + sew);
+      code = (NGLM_Code *) (b.buf + sep);
+      for (k = i, nse = 0; k < j; ++k) {
+         ne = sorted[k];
+         at = nentry + k * sizeof (QNEntry);
+         qne = (QNEntry *) (b.buf + at);
+         memcpy (qne->word, ne->word, sizeof (ne->word));
+         qne->nse = ne->nse;
+         qne->bowt = LMImgEncode (bub, nbc, NGLM_PROB_TO_FLOAT (ne->bowt));
+         qne->se = nse;
+         for (m = 0; m < ne->nse; ++m, ++nse) {
+            word[nse] = ne->se[m].word;
+            code[nse] = LMImgEncode (pub, npc, NGLM_PROB_TO_FLOAT (ne->se[m].prob));
+         }
+         LVImgLink (&b, at + offsetof (QNEntry, nebo), LMImgOffset (map, n, nentry, ne->nebo));
+         LVImgLink (&b, at + offsetof (QNEntry, link), LMImgOffset (map, n, nentry, ne->link));
+      }
+
+      if (l == 0) {             /* unigrams share the codebook of the empty history */
+         t = LVImgAlloc (&b, (nglm->vocSize + 1) * sizeof (NGLM_Code));
+         code = (NGLM_Code *) (b.buf + t);
+         for (m = 0; m <= nglm->vocSize; ++m)
+            code[m] = LMImgEncode (pub, npc, NGLM_PROB_TO_FLOAT (nglm->unigrams[m]));
+         LVImgLink (&b, quant + offsetof (NGLM_Quant, unigrams), t);
+      }
+      Dispose (&gcheap, pv); Dispose (&gcheap, pcb); Dispose (&gcheap, pub);
+      Dispose (&gcheap, bv); Dispose (&gcheap, bcb); Dispose (&gcheap, bub);
+   }
+
+   t = LVImgAlloc (&b, nglm->hashsize * sizeof (QNEntry *));
+   for (i = 0; i < nglm->hashsize; ++i)
+      LVImgLink (&b, t + i * sizeof (QNEntry *), LMImgOffset (map, n, nentry, nglm->hashtab[i]));
+   LVImgLink (&b, quant + offsetof (NGLM_Quant, hashtab), t);
+   t = LVImgAlloc (&b, (nglm->vocSize + 1) * sizeof (LMId));
+   memcpy (b.buf + t, nglm->pronId2LMId, (nglm->vocSize + 1) * sizeof (LMId));
+   ((LMImgRoot *) (b.buf + root))->pronId2LMId = t;
+
+   r = (LMImgRoot *) (b.buf + root);
+   r->nSize = NSIZE; r->codeSize = sizeof (NGLM_Code);
+   r->pronIdSize = sizeof (PronId); r->lmIdSize = sizeof (LMId);
+   r->entrySize = sizeof (QNEntry);
+   r->nsize = nglm->nsize; r->hashsize = nglm->hashsize;
+   for (i = 0; i <= NSIZE; ++i)
+      r->counts[i] = nglm->counts[i];
+   r->vocSize = nglm->vocSize;
+   r->nNEntry = n;
+   for (l = 0, k = 0; l <= NSIZE; ++l) {
+      while (k < n && HistLength (sorted[k]->word) < l)
+         ++k;
+      r->levelStart[l] = k;
+   }
+
+   Dispose (&gcheap, sorted);
+   Dispose (&gcheap, map);
+   return LVImgWrite (&b, fn, LMIMGMAGIC, key);
+}
+
+/* LoadLMImage
+
+     map LM image fn and return its lm, or NULL if the image is missing
+     or was written for other inputs
+*/
+static FSLM *LoadLMImage (MemHeap *heap, char *fn, char *arpaFn, unsigned long key,
+                          Vocab *vocab)
+{
+   FSLM *lm;
+   FSLM_ngram *nglm;
+   LMImgRoot *r;
+   char *base;
+   int i;
+
+   if ((base = LVImgMap (heap, fn, LMIMGMAGIC, key)) == NULL)
+      return NULL;
+   r = (LMImgRoot *) (base + ((LVImgHeader *) base)->root);
+   if (r->nSize != NSIZE || r->codeSize != sizeof (NGLM_Code) ||
+       r->pronIdSize != sizeof (PronId) || r->lmIdSize != sizeof (LMId) ||
+       r->entrySize != sizeof (QNEntry) || r->vocSize != vocab->nprons) {
+      LVImgUnmap (base);
+      HRError (-9999, "LoadLMImage: image %s written with a different LM layout", fn);
+      return NULL;
+   }
+
+   nglm = (FSLM_ngram *) New (heap, sizeof (FSLM_ngram));
+   nglm->heap = heap;
+   nglm->nsize = r->nsize;
+   nglm->hashsize = r->hashsize;
+   nglm->hashtab = NULL;        /* replaced by quant */
+   for (i = 0; i <= NSIZE; ++i)
+      nglm->counts[i] = r->counts[i];
+   nglm->vocab = vocab;
+   nglm->vocSize = r->vocSize;
+   nglm->unigrams = NULL;
+   nglm->lablist = NULL;        /* only needed while reading ARPA files */
+   nglm->wordlist = NULL;
+   nglm->pronId2LMId = (LMId *) (base + r->pronId2LMId);
+   nglm->quant = &r->quant;
+
+   lm = (FSLM *) New (heap, sizeof (FSLM));
+   lm->heap = heap;
+   lm->name = CopyString (heap, arpaFn);
+   lm->type = fslm_ngram;
+   lm->data.nglm = nglm;
+
+   if (trace & T_TOP)
+      printf ("HLVLM: LM image %s has %d histories\n", fn, r->nNEntry);
+   return lm;
+}
+
+/* EXPORT->LoadLM: CreateLM reusing or writing the LM image imageFn */
+FSLM *LoadLM (MemHeap *heap, char *fn, char *imageFn, char *startWord, char *endWord,
+              Vocab *vocab)
+{
+   FSLM *lm;
+   unsigned long key;
+
+   key = LMImageKey (fn, startWord, endWord, vocab);
+   lm = LoadLMImage (heap, imageFn, fn, key, vocab);
+   if (!lm) {
+      lm = ReadARPALM (heap, fn, vocab);
+      if (SaveLMImage (lm, imageFn, key) < SUCCESS)
+         HError (-9999, "LoadLM: continuing without LM image");
+      else {
+         /* decode with the quantised LM from the start, as later runs will */
+         Dispose (heap, lm);
+         if ((lm = LoadLMImage (heap, imageFn, fn, key, vocab)) == NULL)
+            HError (9999, "LoadLM: cannot map LM image %s just written", imageFn);
+      }
+   }
+   SetStartEnd (lm, startWord, endWord, vocab);
+   SetNGramFuncs (lm);
 
    return (lm);
 }
@@ -754,7 +1172,7 @@ LogFloat LMTransProb (FSLM *lm, LMState src, PronId pronid, LMState *dest)
 {
    switch (lm->type) {
    case fslm_ngram:
-      return LMTransProb_ngram (lm, src, pronid, dest);
+      return (lm->transProb) (lm, src, pronid, dest);
       break;
    case fslm_latlm:
       return LMTransProb_latlm (lm, src, pronid, dest);
@@ -766,6 +1184,48 @@ LogFloat LMTransProb (FSLM *lm, LMState src, PronId pronid, LMState *dest)
 }
 
 
+/* NGramDest
+
+     return the state reached from the history srcWord (NULL for the
+     unigram state) by pronid, i.e. the longest history present
+*/
+static LMState NGramDest (FSLM_ngram *nglm, LMId *srcWord, PronId pronid)
+{
+   LMId hist[NSIZE] = {0};      /* initialise whole array to zero! */
+   LMState ne;
+   int i, l;
+
+   if (srcWord) {
+      l = 0;
+      for (i = 1; i < NSIZE-1; ++i) {
+         hist[i] = srcWord[i-1];
+         if (hist[i] != 0)
+            l = i;
+      } /* l is now the index of the last (oldest) non zero element */
+   }
+   else
+      l = 1;
+
+   hist[0] = nglm->pronId2LMId[pronid];
+
+   if (nglm->quant) {
+      ne = (LMState) GetQNEntry (nglm, hist);
+      for ( ; !ne && (l > 0); --l) {
+         hist[l] = 0;              /* back off */
+         ne = (LMState) GetQNEntry (nglm, hist);
+      }
+   }
+   else {
+      ne = (LMState) GetNEntry (nglm, hist, FALSE);
+      for ( ; !ne && (l > 0); --l) {
+         hist[l] = 0;              /* back off */
+         ne = (LMState) GetNEntry (nglm, hist, FALSE);
+      }
+   }
+   /* if we left the loop because l=0, then ne is still NULL, which is what we want */
+   return ne;
+}
+
 /* LMTransProb_ngram
 
      return logprob of transition from src labelled word. Also return dest state.
@@ -860,34 +1320,8 @@ LogFloat LMTransProb_ngram (FSLM *lm, LMState src, PronId pronid, LMState *dest)
 
 
    /* now determine dest state */
-   if (pronid != lm->endPronId) {
-      if (src) {
-         ne = (NEntry *) src;
-      
-         l = 0;
-         hist[NSIZE-1] = 0;
-         for (i = 1; i < NSIZE-1; ++i) {
-            hist[i] = ne->word[i-1];
-            if (hist[i] != 0)
-               l = i;
-         } /* l is now the index of the last (oldest) non zero element */
-      }
-      else {
-         for (i = 1; i < NSIZE-1; ++i)
-            hist[i] = 0;
-         l = 1;
-      }
-      
-      hist[0] = nglm->pronId2LMId[pronid];
-      
-      ne = (LMState) GetNEntry (nglm, hist, FALSE);
-      for ( ; !ne && (l > 0); --l) {
-         hist[l] = 0;              /* back off */
-         ne = (LMState) GetNEntry (nglm, hist, FALSE);
-      }
-      /* if we left the loop because l=0, then ne is still NULL, which is what we want */
-      *dest = ne;
-   }
+   if (pronid != lm->endPronId)
+      *dest = NGramDest (nglm, src ? ((NEntry *) src)->word : NULL, pronid);
    else {       /* SENT_END case */
       *dest = (Ptr) 0xfffffffe;
    }
@@ -1319,6 +1753,200 @@ LogFloat LMLookAhead_ngram (FSLM *lm, LMState src, PronId minPron, PronId maxPro
 }
 
 
+/* FindQSEntry
+
+     return index of pronId in the n predicted words w, or -1
+*/
+static int FindQSEntry (PronId *w, int n, PronId pronId)
+{
+   int l, h, c;
+
+   l = 0; h = n - 1;
+   while (l <= h) {
+      c = (l + h) / 2;
+      if (w[c] == pronId)
+         return c;
+      else if (w[c] < pronId)
+         l = c + 1;
+      else
+         h = c - 1;
+   }
+   return -1;
+}
+
+/* FindMinQSEntry
+
+     return index of the first of the n predicted words w >= minPron,
+     or n if there isn't one
+*/
+static int FindMinQSEntry (PronId *w, int n, PronId minPron)
+{
+   int l, h, c;
+
+   l = 0; h = n;
+   while (l < h) {
+      c = (l + h) / 2;
+      if (w[c] < minPron)
+         l = c + 1;
+      else
+         h = c;
+   }
+   return l;
+}
+
+/* LMTransProb_qngram
+
+     return logprob of transition from src labelled word. Also return dest state.
+     LM image case, back-off as LMTransProb_ngram
+*/
+LogFloat LMTransProb_qngram (FSLM *lm, LMState src, PronId pronid, LMState *dest)
+{
+   FSLM_ngram *nglm;
+   NGLM_Quant *q;
+   LMId hist[NSIZE] = {0};      /* initialise whole array to zero! */
+   LogFloat lmprob;
+   QNEntry *ne;
+   int h, i;
+
+   assert (lm->type == fslm_ngram);
+
+   assert (src != (Ptr) 0xfffffffe);
+
+   if (trace & T_ACCESS)
+      printf ("src %p PronId %u\n", src, (unsigned int) pronid);
+
+   nglm = lm->data.nglm;
+   q = nglm->quant;
+
+   if (pronid == 0 || pronid > nglm->vocSize) {
+      HError (9999, "pron %d not in LM wordlist", pronid);
+      *dest = NULL;
+      return (LZERO);
+   }
+
+   /* from initial state only allow startword transition */
+   if (src == (Ptr) 0xffffffff) {
+      assert (pronid == lm->startPronId);
+
+      hist[0] = nglm->pronId2LMId[pronid];
+      *dest = (LMState) GetQNEntry (nglm, hist);
+      return 0.0;
+   }
+
+   if (!src)            /* unigram case */
+      lmprob = q->probCB[0][q->unigrams[pronid]];
+   else {
+      ne = (QNEntry *) src;
+      h = HistLength (ne->word);
+      if ((i = FindQSEntry (q->seWord[h] + ne->se, ne->nse, pronid)) >= 0)   /* found */
+         lmprob = q->probCB[h][q->seProb[h][ne->se + i]];
+      else {
+         lmprob = 0.0;
+         for ( ; h > 1; --h) {
+            lmprob += q->bowtCB[h][ne->bowt];
+            ne = ne->nebo;     /* back-off: discard oldest word */
+            if ((i = FindQSEntry (q->seWord[h-1] + ne->se, ne->nse, pronid)) >= 0) {
+               lmprob += q->probCB[h-1][q->seProb[h-1][ne->se + i]];
+               break;
+            }
+         }
+         if (h <= 1) {          /* backed-off all the way to unigram */
+            lmprob += q->bowtCB[h][ne->bowt];
+            lmprob += q->probCB[0][q->unigrams[pronid]];
+         }
+      }
+   }
+
+   /* now determine dest state */
+   if (pronid != lm->endPronId)
+      *dest = NGramDest (nglm, src ? ((QNEntry *) src)->word : NULL, pronid);
+   else         /* SENT_END case */
+      *dest = (Ptr) 0xfffffffe;
+
+   if (trace & T_ACCESS)
+      printf ("lmprob = %f  dest %p\n", lmprob, *dest);
+
+   return lmprob;
+}
+
+/* LMLookAhead_qngram
+
+     return \max_{i=minWord}^{maxWord} p(w_i | src)
+     LM image case.  As the codebooks are increasing only the highest
+     code found for each history length is expanded.  The back-off
+     weights are then added in the order used by LMLookAhead_2gram and
+     _3gram, or by LMLookAhead_ngram beyond trigrams, so the result is
+     the same as for the LM the image was made from if no values were
+     merged when quantising.
+*/
+LogFloat LMLookAhead_qngram (FSLM *lm, LMState src, PronId minPron, PronId maxPron)
+{
+   FSLM_ngram *nglm;
+   NGLM_Quant *q;
+   QNEntry *ne[NSIZE];
+   PronId *w[NSIZE];
+   NGLM_Code *c[NSIZE];
+   int se[NSIZE], nse[NSIZE], best[NSIZE], bestUg;
+   int h, l;
+   PronId p;
+   LogFloat bowt, prob, maxScore;
+
+   nglm = lm->data.nglm;
+   q = nglm->quant;
+
+   /* ne[l] is the history of l words src backs off to */
+   h = src ? HistLength (((QNEntry *) src)->word) : 0;
+   for (l = h; l >= 1; --l) {
+      ne[l] = (l == h) ? (QNEntry *) src : ne[l+1]->nebo;
+      w[l] = q->seWord[l] + ne[l]->se;
+      c[l] = q->seProb[l] + ne[l]->se;
+      nse[l] = ne[l]->nse;
+      se[l] = FindMinQSEntry (w[l], nse[l], minPron);
+      best[l] = -1;
+   }
+
+   bestUg = -1;
+   for (p = minPron; p <= maxPron; ++p) {
+      for (l = h; l >= 1; --l)
+         if (se[l] < nse[l] && w[l][se[l]] == p)
+            break;
+      if (l >= 1) {
+         if (c[l][se[l]] > best[l])
+            best[l] = c[l][se[l]];
+         for ( ; l >= 1; --l)   /* step over p here and in shorter histories */
+            if (se[l] < nse[l] && w[l][se[l]] == p)
+               ++se[l];
+      }
+      else if (q->unigrams[p] > bestUg)
+         bestUg = q->unigrams[p];
+   }
+
+   maxScore = LZERO;
+   bowt = 0.0;                  /* back-off weights from src to ne[l] */
+   for (l = h; l >= 1; --l) {
+      if (best[l] >= 0) {
+         prob = q->probCB[l][best[l]] + bowt;
+         if (prob > maxScore)
+            maxScore = prob;
+      }
+      if (l > 1)
+         bowt += q->bowtCB[l][ne[l]->bowt];
+   }
+   if (bestUg >= 0) {
+      prob = q->probCB[0][bestUg];
+      if (h >= 1 && prob > LSMALL) {
+         if (nglm->nsize > 3)
+            prob = (prob + bowt) + q->bowtCB[1][ne[1]->bowt];
+         else
+            prob = prob + (bowt + q->bowtCB[1][ne[1]->bowt]);
+      }
+      if (prob > maxScore)
+         maxScore = prob;
+   }
+   return maxScore;
+}
+
+
 /* Fast_LMLA_LMState
 
      back-off to a more "simple" state, i.e. for 3grams discard oldest word 
@@ -1406,6 +2034,43 @@ void PrintLMHashStats(FSLM *lm)
 static int hvs[]= { 165902236, 220889002, 32510287, 117809592,
                     165902236, 220889002, 32510287, 117809592 };
 
+/* NGramHash: hash table slot of history ndx */
+static unsigned int NGramHash (FSLM_ngram *nglm, LMId ndx[NSIZE])
+{
+   unsigned int hash;
+   int i;
+
+   hash=0;
+   for (i=0;i<NSIZE-1;i++)
+      hash=hash+(ndx[i]*hvs[i]);
+   return (hash>>7)&(nglm->hashsize-1);
+}
+
+/* HistLength: number of words in history word */
+static int HistLength (LMId *word)
+{
+   int i, l;
+
+   for (i = 0, l = 0; i < NSIZE-1; ++i)
+      if (word[i] != 0)
+         l = i + 1;
+   return l;
+}
+
+/* GetQNEntry: find history ndx in an LM image, NULL if not present */
+static QNEntry *GetQNEntry (FSLM_ngram *nglm, LMId ndx[NSIZE])
+{
+   QNEntry *ne;
+   int i;
+
+   for (ne = nglm->quant->hashtab[NGramHash (nglm, ndx)]; ne != NULL; ne = ne->link) {
+      for (i = 0; i < NSIZE-1 && ne->word[i] == ndx[i]; ++i);
+      if (i == NSIZE-1)
+         break;
+   }
+   return ne;
+}
+
 /* EXPORT->GetNEntry: Access specific NGram entry indexed by ndx */
 NEntry *GetNEntry (FSLM_ngram *nglm, LMId ndx[NSIZE], Boolean create)
 {
@@ -1414,10 +2079,7 @@ NEntry *GetNEntry (FSLM_ngram *nglm, LMId ndx[NSIZE], Boolean create)
    int i;
    /* #define LM_HASH_CHECK */
   
-   hash=0;
-   for (i=0;i<NSIZE-1;i++)
-      hash=hash+(ndx[i]*hvs[i]);
-   hash=(hash>>7)&(nglm->hashsize-1);
+   hash=NGramHash(nglm,ndx);
   
    for (ne=nglm->hashtab[hash]; ne!=NULL; ne=ne->link) {
       if (ne->word[0]==ndx[0]
@@ -1464,6 +2126,7 @@ FSLM_ngram *CreateBoNGram (MemHeap *heap, int vocSize, int counts[NSIZE])
    nglm = (FSLM_ngram *) New (heap, sizeof(FSLM_ngram));
 
    nglm->heap = heap;
+   nglm->quant = NULL;
 
    for (i=0;i<=NSIZE;i++) nglm->counts[i]=0;
    for (i=1;i<=NSIZE;i++)
@@ -149,6 +149,32 @@ typedef struct nentry {         /* HLM NGram history */
    struct nentry *link;         /* Next entry in hash table */
 } NEntry;
 
+/* compiled LM images (see LoadLM) hold probabilities and back-off
+   weights as 16-bit codes into one codebook per history length.  The
+   codebooks are increasing, so codes compare like the values they
+   stand for. */
+
+typedef unsigned short NGLM_Code;
+#define NGLM_NCODE 65536        /* max size of a codebook */
+
+typedef struct qnentry {        /* NEntry of an LM image */
+   LMId word[NSIZE-1];          /* Word history representing this entry */
+   LMId nse;                    /* Number of ngrams for this entry */
+   unsigned int se;             /* First of them in seWord/seProb[history length] */
+   NGLM_Code bowt;              /* Back-off weight, in bowtCB[history length] */
+   struct qnentry *nebo;        /* QNEntry for back-off */
+   struct qnentry *link;        /* Next entry in hash table */
+} QNEntry;
+
+typedef struct {                /* quantised n-gram data of an LM image */
+   QNEntry **hashtab;           /* Hash table for finding QNEntries */
+   NGLM_Code *unigrams;         /* Unigram probabilities, in probCB[0] */
+   PronId *seWord[NSIZE];       /* predicted PronIds after l words */
+   NGLM_Code *seProb[NSIZE];    /* and their probs, in probCB[l] */
+   float *probCB[NSIZE];        /* codebooks of probs after l words */
+   float *bowtCB[NSIZE];        /* codebooks of bowts of histories of l words */
+} NGLM_Quant;
+
 struct _FSLM_ngram {
    MemHeap *heap;
    int nsize;                   /* Unigram==1, Bigram==2, Trigram==3 */
@@ -162,6 +188,8 @@ struct _FSLM_ngram {
    Word *wordlist;              /* Lookup table for Words from LMId */
    LMId *pronId2LMId;           /* PronId -> LMId mapping array [1..voc->nprons] 
                                    needed for LM histories */
+   NGLM_Quant *quant;           /* LM image data replacing hashtab and unigrams,
+                                   NULL if read from an ARPA file */
 };
 
 /*------------------------*/
@@ -175,6 +203,12 @@ void InitLVLM (void);
 FSLM *CreateLMfromLat (MemHeap *heap, char *latfn, Lattice *lat, Vocab *vocab);
 FSLM *CreateLM (MemHeap *heap, char *fn, char *startWord, char *endWord, Vocab *vocab);
 
+/* as CreateLM but map the compiled LM image imageFn instead if it was
+   made from the same ARPA file and PronIds, otherwise read fn, write
+   the image and map that.  heap must be an MSTAK. */
+FSLM *LoadLM (MemHeap *heap, char *fn, char *imageFn, char *startWord, char *endWord,
+              Vocab *vocab);
+
 LogFloat LMTransProb (FSLM *lm, LMState src, PronId word, LMState *dest); 
 
 LMState LMInitial (FSLM *lm);
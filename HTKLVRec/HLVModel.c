@@ -49,6 +49,14 @@ char *hlvmodel_vc_id = "$Id: HLVModel.c,v 1.1.1.1 2006/10/11 09:54:55 jal58 Exp
 
 #include <assert.h>
 
+/* SIMD kernels for blocks of frames and for quantised stores, selected
+   at run time together with the HModel Gaussian kernel (see GAUSSKERNEL) */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+    (defined(__clang__) || __GNUC__ >= 7) && !defined(NO_GAUSS_SIMD)
+#define LVMODEL_SIMD
+#include <immintrin.h>
+#endif
+
 
 /* ----------------------------- Trace Flags ------------------------- */
 
@@ -60,6 +68,17 @@ static int nParm = 0;
 
 /* -------------------------- Global Variables etc ---------------------- */
 
+static int quantBits = 0;      /* quantise store to 8 or 16 bits */
+
+#define Q8_LEVEL  127           /* quantised means in [-Q8_LEVEL,Q8_LEVEL] */
+#define Q8_MAXOBS 381           /* 3*Q8_LEVEL */
+#define Q8_MAXDIF 258           /* Q8_MAXDIF*Q8_LEVEL fits a short */
+#define Q16_LEVEL 4095          /* leaves room for outlying observations */
+#define Q16_MAXOBS 32760        /* 8*Q16_LEVEL */
+#define Q16_MAXR  32767
+
+#define LV_ALIGN 64             /* byte alignment of stores and scratch rows */
+
 
 /* --------------------------- Initialisation ---------------------- */
 
@@ -72,7 +91,10 @@ void InitLVModel(void)
    nParm = GetConfig("HLVMODEL", TRUE, cParm, MAXGLOBS);
    if (nParm>0){
       if (GetConfInt(cParm,nParm,"TRACE",&i)) trace = i;
+      if (GetConfInt(cParm,nParm,"QUANTBITS",&i)) quantBits = i;
    }
+   if (quantBits != 0 && quantBits != 8 && quantBits != 16)
+      HError (9999, "InitLVModel: QUANTBITS must be 0, 8 or 16 not %d", quantBits);
 
 }
 
@@ -83,7 +105,29 @@ size_t RoundAlign(size_t addr, size_t align)
    return ((addr % align) == 0) ? addr : (addr/align + 1) * align;
 }
 
+/* AlignedNew: n zeroed bytes from heap starting on a LV_ALIGN boundary */
+static Ptr AlignedNew (MemHeap *heap, size_t n)
+{
+   char *p;
+
+   p = (char *) New (heap, n + LV_ALIGN);
+   p = (char *) RoundAlign ((size_t) p, LV_ALIGN);
+   memset (p, 0, n);
+   return (Ptr) p;
+}
+
+static void QuantiseBlocks (MemHeap *heap, StateInfo_lv *si, int qBits);
+static void InitBlockScoring (MemHeap *heap, StateInfo_lv *si);
+
+/* EXPORT->ConvertHSet: convert hset, quantised if QUANTBITS is set */
 StateInfo_lv *ConvertHSet(MemHeap *heap, HMMSet *hset, Boolean useHModel)
+{
+   return ConvertHSetQuant (heap, hset, useHModel, useHModel ? 0 : quantBits);
+}
+
+/* EXPORT->ConvertHSetQuant: convert hset using a qBits store */
+StateInfo_lv *ConvertHSetQuant(MemHeap *heap, HMMSet *hset, Boolean useHModel,
+                               int qBits)
 {
    HMMScanState hss;
    StateInfo_lv *si;
@@ -91,13 +135,13 @@ StateInfo_lv *ConvertHSet(MemHeap *heap, HMMSet *hset, Boolean useHModel)
    int sIdx = 0;        /* next free sIdx, start at 0 !!! */
 
    assert (hset->swidth[0] == 1);
+   assert (qBits == 0 || ((qBits == 8 || qBits == 16) && !useHModel));
 
    si = (StateInfo_lv *) New (heap, sizeof (StateInfo_lv));
+   si->qBits = 0; si->qbase = NULL; si->xq = NULL; si->xf = NULL;
 
    si->hset = hset;
    si->nDim = hset->vecSize;
-   si->nVec = RoundAlign (si->nDim, HLVMODEL_VEC_PAD) / HLVMODEL_VEC_PAD;
-   si->floatsPerMix = 2 * (si->nVec * HLVMODEL_VEC_PAD) + 4;
    
    /* find block size and assign state indexes */
    NewHMMScan (hset, &hss);
@@ -127,55 +171,24 @@ StateInfo_lv *ConvertHSet(MemHeap *heap, HMMSet *hset, Boolean useHModel)
 
    /* create StateInfo_lv structure */
    si->mixPerBlock = minNMix;
-   si->floatsPerBlock = si->mixPerBlock * si->floatsPerMix;
    si->nBlocks = sIdx;
    hset->numSharedStates = si->nBlocks;
 
-   if (!useHModel) {
-      si->base = (float *) New (heap, si->nBlocks * si->floatsPerBlock * sizeof (float));
-      HLVMODEL_BLOCK_INVVAR_OFFSET(si) = HLVMODEL_BLOCK_MEAN_OFFSET(si) + si->nVec * HLVMODEL_VEC_PAD;
-      
-      NewHMMScan (hset, &hss);
-      while (GoNextState (&hss, FALSE)) {
-         StreamElem *se;
-         MixtureElem *me;
-         MixPDF *mp;
-         LogFloat mixw;
-         int m, i;
-         float *base, *mean, *invVar;
-
-         se = &hss.si->pdf[1];
-
-         base = HLVMODEL_BLOCK_BASE(si, hss.si->sIdx);
-         HLVMODEL_BLOCK_NMIX(si,base) = se->nMix;
-
-         mean = base + HLVMODEL_BLOCK_MEAN_OFFSET(si);
-         invVar = base + HLVMODEL_BLOCK_INVVAR_OFFSET(si);
-
-         for (m = 1; m <= se->nMix; ++m) {
-            me = &se->spdf.cpdf[m];
-            mp = me->mpdf;
-            assert (mp->ckind == INVDIAGC);
-
-            HLVMODEL_BLOCK_GCONST(si, base) = mp->gConst;
-            HLVMODEL_BLOCK_MPDF(si, base) = mp;
-            mixw = MixLogWeight(hset,me->weight);
-            assert (mixw > LSMALL);
-            HLVMODEL_BLOCK_MIXW(si, base) = mixw;
-         
-            for (i = 1; i <= si->nDim;  ++i) {
-               mean[i-1] = mp->mean[i];
-               invVar[i-1] = mp->cov.var[i];
-            }
-            base += si->floatsPerMix;
-            mean += si->floatsPerMix;
-            invVar += si->floatsPerMix;
-         }
-      } 
-      EndHMMScan (&hss);
+   si->view = NULL;
+   if (!useHModel && qBits == 0) {
+      /* float store is the HModel scoring view, indexed by the new sIdx */
+      SyncScoreView (hset);
+      if ((si->view = GetScoreView (hset)) == NULL) {
+         HError (-9999, "ConvertHSet: no scoring view of HMM set, using HModel");
+         useHModel = TRUE;
+      }
+      else {
+         si->view->sumDouble = TRUE;   /* as OutP_lv */
+         InitBlockScoring (heap, si);
+      }
    }
-   else
-      si->base = NULL;
+   else if (qBits > 0)
+      QuantiseBlocks (heap, si, qBits);
 
    si->useHModel = useHModel;
 #if 1   /* USEHMODEL=T */
@@ -190,90 +203,611 @@ StateInfo_lv *ConvertHSet(MemHeap *heap, HMMSet *hset, Boolean useHModel)
    return si;
 }
 
+/* EXPORT->ShareStateInfo_lv: copy of si sharing its store, own scratch */
+StateInfo_lv *ShareStateInfo_lv(MemHeap *heap, StateInfo_lv *si)
+{
+   StateInfo_lv *nsi;
+
+   nsi = (StateInfo_lv *) New (heap, sizeof (StateInfo_lv));
+   *nsi = *si;
+   if (si->qBits > 0)
+      nsi->xq = (short *) AlignedNew (heap, MAXBLOCKOBS * si->nQDim * sizeof (short));
+   if (si->xf)
+      nsi->xf = (float *) AlignedNew (heap, MAXBLOCKOBS * si->view->str[1].stride *
+                                      sizeof (float));
+   return nsi;
+}
+
 
 void PrintState_lv (StateInfo_lv *si,  unsigned short s)
 {
-   int m, i;
-   float *base;
-   float *mean;
-   float *invVar;
-   float gc;
-   int nMix;
-   LogFloat mixw;
-
-   base = HLVMODEL_BLOCK_BASE(si, s);
-   nMix = HLVMODEL_BLOCK_NMIX(si,base);
-   mean = base + HLVMODEL_BLOCK_MEAN_OFFSET(si);
-   invVar = base + HLVMODEL_BLOCK_INVVAR_OFFSET(si);
-
-   for (m = 1; m <= nMix; m++) {
-      mixw = HLVMODEL_BLOCK_MIXW(si,base);
-      gc = HLVMODEL_BLOCK_GCONST(si,base);
-      
-      printf ("mix %d  mixw %.2f gc %.2f  \n",m, mixw, gc);
-
-         
+   ViewStream *vs;
+   int m, i, r;
+
+   vs = &si->view->str[1];
+   for (m = 1, r = vs->first[s]; m <= vs->nMix[s]; m++, r++) {
+      printf ("mix %d  mixw %.2f gc %.2f  \n",m, vs->logWt[r], vs->gConst[r]);
       printf (" mean ");
       for (i = 0; i < si->nDim; ++i) {
-         printf ("%.2f ", mean[i]);
+         printf ("%.2f ", vs->mean[r * vs->stride + i]);
       }
       printf ("\n invVar ");
       for (i = 0; i < si->nDim; ++i) {
-         printf ("%.2f ", invVar[i]);
+         printf ("%.2f ", vs->var[r * vs->stride + i]);
       }
       printf ("\n");
-      base += si->floatsPerMix;
-      mean += si->floatsPerMix;
-      invVar += si->floatsPerMix;
    }
 }
 
 /* EXPORT-> OutP_lv: returns log prob for state s of observation x */
-LogFloat OutP_lv (StateInfo_lv *si,  unsigned short s, float *x)
+LogFloat OutP_lv (StateInfo_lv *si,  unsigned short s, float *x,
+                  unsigned char *cell)
+{
+   return ViewSOutP (si->view, 1, s, x, cell, NULL);
+}
+
+
+/* --------------------------- Block scoring ---------------------- */
+
+/* 
+   A DistBlock kernel sets dist[f] = gConst + sum_i (x[f][i]-m[i])^2 * v[i]
+   for n frames x[f] = x + f*stride, loading each row of m and v once for
+   up to four frames.  Rows are zero padded beyond nDim, so the kernels
+   run over whole vectors and perform exactly the operations of the
+   HModel kernel of the same width: the results are those of OutP_lv.
+*/
+typedef void (*DistBlockKernel)(float gConst, float *x, int stride, int n,
+                                float *m, float *v, int nDim, float *dist);
+
+static DistBlockKernel distBlock = NULL;
+
+#ifdef LVMODEL_SIMD
+
+/* HSum256: horizontal sum of 8 floats, as in HModel */
+__attribute__((target("avx2")))
+static float HSum256 (__m256 v)
+{
+   __m128 s;
+
+   s = _mm_add_ps (_mm256_castps256_ps128 (v), _mm256_extractf128_ps (v, 1));
+   s = _mm_hadd_ps (s, s); s = _mm_hadd_ps (s, s);
+   return _mm_cvtss_f32 (s);
+}
+
+/* DistBlockAVX2: 8 dimensions per step */
+__attribute__((target("avx2,fma")))
+static void DistBlockAVX2 (float gConst, float *x, int stride, int n,
+                           float *m, float *v, int nDim, float *dist)
 {
-   int m, i;
-   LogDouble bx;
+   int f, i;
+   float *x0, *x1, *x2, *x3;
+   __m256 mm, vv, d, s0, s1, s2, s3;
+
+   for (f = 0; f + 4 <= n; f += 4) {
+      x0 = x + f * stride; x1 = x0 + stride; x2 = x1 + stride; x3 = x2 + stride;
+      s0 = s1 = s2 = s3 = _mm256_setzero_ps ();
+      for (i = 0; i < nDim; i += 8) {
+         mm = _mm256_loadu_ps (m + i);
+         vv = _mm256_loadu_ps (v + i);
+         d = _mm256_sub_ps (_mm256_loadu_ps (x0 + i), mm);
+         s0 = _mm256_fmadd_ps (_mm256_mul_ps (d, d), vv, s0);
+         d = _mm256_sub_ps (_mm256_loadu_ps (x1 + i), mm);
+         s1 = _mm256_fmadd_ps (_mm256_mul_ps (d, d), vv, s1);
+         d = _mm256_sub_ps (_mm256_loadu_ps (x2 + i), mm);
+         s2 = _mm256_fmadd_ps (_mm256_mul_ps (d, d), vv, s2);
+         d = _mm256_sub_ps (_mm256_loadu_ps (x3 + i), mm);
+         s3 = _mm256_fmadd_ps (_mm256_mul_ps (d, d), vv, s3);
+      }
+      dist[f] = gConst + HSum256 (s0);
+      dist[f+1] = gConst + HSum256 (s1);
+      dist[f+2] = gConst + HSum256 (s2);
+      dist[f+3] = gConst + HSum256 (s3);
+   }
+   for (; f < n; ++f) {
+      x0 = x + f * stride;
+      s0 = _mm256_setzero_ps ();
+      for (i = 0; i < nDim; i += 8) {
+         d = _mm256_sub_ps (_mm256_loadu_ps (x0 + i), _mm256_loadu_ps (m + i));
+         s0 = _mm256_fmadd_ps (_mm256_mul_ps (d, d), _mm256_loadu_ps (v + i), s0);
+      }
+      dist[f] = gConst + HSum256 (s0);
+   }
+}
+
+/* DistBlockAVX512: 16 dimensions per step */
+__attribute__((target("avx512f")))
+static void DistBlockAVX512 (float gConst, float *x, int stride, int n,
+                             float *m, float *v, int nDim, float *dist)
+{
+   int f, i;
+   float *x0, *x1, *x2, *x3;
+   __m512 mm, vv, d, s0, s1, s2, s3;
+
+   for (f = 0; f + 4 <= n; f += 4) {
+      x0 = x + f * stride; x1 = x0 + stride; x2 = x1 + stride; x3 = x2 + stride;
+      s0 = s1 = s2 = s3 = _mm512_setzero_ps ();
+      for (i = 0; i < nDim; i += 16) {
+         mm = _mm512_loadu_ps (m + i);
+         vv = _mm512_loadu_ps (v + i);
+         d = _mm512_sub_ps (_mm512_loadu_ps (x0 + i), mm);
+         s0 = _mm512_fmadd_ps (_mm512_mul_ps (d, d), vv, s0);
+         d = _mm512_sub_ps (_mm512_loadu_ps (x1 + i), mm);
+         s1 = _mm512_fmadd_ps (_mm512_mul_ps (d, d), vv, s1);
+         d = _mm512_sub_ps (_mm512_loadu_ps (x2 + i), mm);
+         s2 = _mm512_fmadd_ps (_mm512_mul_ps (d, d), vv, s2);
+         d = _mm512_sub_ps (_mm512_loadu_ps (x3 + i), mm);
+         s3 = _mm512_fmadd_ps (_mm512_mul_ps (d, d), vv, s3);
+      }
+      dist[f] = gConst + _mm512_reduce_add_ps (s0);
+      dist[f+1] = gConst + _mm512_reduce_add_ps (s1);
+      dist[f+2] = gConst + _mm512_reduce_add_ps (s2);
+      dist[f+3] = gConst + _mm512_reduce_add_ps (s3);
+   }
+   for (; f < n; ++f) {
+      x0 = x + f * stride;
+      s0 = _mm512_setzero_ps ();
+      for (i = 0; i < nDim; i += 16) {
+         d = _mm512_sub_ps (_mm512_loadu_ps (x0 + i), _mm512_loadu_ps (m + i));
+         s0 = _mm512_fmadd_ps (_mm512_mul_ps (d, d), _mm512_loadu_ps (v + i), s0);
+      }
+      dist[f] = gConst + _mm512_reduce_add_ps (s0);
+   }
+}
+
+#endif /* LVMODEL_SIMD */
+
+/* InitBlockScoring: use the DistBlock kernel matching the HModel
+   Gaussian kernel if there is one */
+static void InitBlockScoring (MemHeap *heap, StateInfo_lv *si)
+{
+   ViewStream *vs = &si->view->str[1];
+
+   if (vs->ckind != INVDIAGC)
+      return;
+#ifdef LVMODEL_SIMD
+   switch (GetGaussKernel ()) {
+   case AVX2GK:   distBlock = DistBlockAVX2; break;
+   case AVX512GK: distBlock = DistBlockAVX512; break;
+   default:       distBlock = NULL; break;
+   }
+#endif
+   if (distBlock)
+      si->xf = (float *) AlignedNew (heap, MAXBLOCKOBS * vs->stride * sizeof (float));
+}
+
+/* OutPBlockView: as OutP_lv for n frames of the scratch rows si->xf
+   without Gaussian selection */
+static void OutPBlockView (StateInfo_lv *si, int n, int sIdx, LogFloat *outP)
+{
+   ViewStream *vs = &si->view->str[1];
+   float dist[MAXBLOCKOBS];
+   LogDouble bx[MAXBLOCKOBS], lx[MAXBLOCKOBS][LADDVECSIZE];
    LogFloat px;
-   float *base;
-   float *mean;
-   float *invVar;
-   int nMix;
-   LogFloat mixw, xmm;
-
-   base = HLVMODEL_BLOCK_BASE(si, s);
-   nMix = HLVMODEL_BLOCK_NMIX(si,base);
-   mean = base + HLVMODEL_BLOCK_MEAN_OFFSET(si);
-   invVar = base + HLVMODEL_BLOCK_INVVAR_OFFSET(si);
-
-   bx = LZERO;                   /* Multi Mixture Case */
-   for (m = 1; m <= nMix; m++) {
-      mixw = HLVMODEL_BLOCK_MIXW(si,base);
-
-      px = HLVMODEL_BLOCK_GCONST(si,base);
+   int i, m, nl, r, M;
+
+   r = vs->first[sIdx]; M = vs->nMix[sIdx];
+   if (M == 1) {                /* single mixture case */
+      distBlock (vs->gConst[r], si->xf, vs->stride, n, vs->mean + r * vs->stride,
+                 vs->var + r * vs->stride, vs->nDim, dist);
+      for (i = 0; i < n; ++i)
+         outP[i] = -0.5 * dist[i];
+      return;
+   }
+   for (i = 0; i < n; ++i)
+      bx[i] = LZERO;
+   nl = 0;
+   for (m = 1; m <= M; ++m, ++r) {
+      if (vs->logWt[r] <= LMINMIX)
+         continue;
+      distBlock (vs->gConst[r], si->xf, vs->stride, n, vs->mean + r * vs->stride,
+                 vs->var + r * vs->stride, vs->nDim, dist);
+      for (i = 0; i < n; ++i) {
+         px = -0.5 * dist[i];
+         lx[i][nl] = vs->logWt[r] + px;
+      }
+      if (++nl == LADDVECSIZE) {
+         for (i = 0; i < n; ++i)
+            bx[i] = LAddVec (bx[i], lx[i], nl);
+         nl = 0;
+      }
+   }
+   for (i = 0; i < n; ++i)
+      outP[i] = LAddVec (bx[i], lx[i], nl);
+}
+
+
+/* --------------------------- Quantised store ---------------------- */
+
+/* QDist8Scalar: sum of (r*(xq-mq))^2 for the 8 bit store */
+static float QDist8Scalar (short *xq, signed char *mq, signed char *r, int n)
+{
+   int i, d, y;
+   float sum = 0.0;
+
+   for (i = 0; i < n; ++i) {
+      d = xq[i] - mq[i];
+      if (d > Q8_MAXDIF) d = Q8_MAXDIF;
+      else if (d < -Q8_MAXDIF) d = -Q8_MAXDIF;
+      y = d * r[i];
+      sum += (float) (y * y);
+   }
+   return sum;
+}
+
+/* QDist16Scalar: sum of (r*(xq-mq))^2 for the 16 bit store */
+static float QDist16Scalar (short *xq, short *mq, short *r, int n)
+{
+   int i;
+   float y, sum = 0.0;
+
+   for (i = 0; i < n; ++i) {
+      y = (float) (xq[i] - mq[i]) * r[i];
+      sum += y * y;
+   }
+   return sum;
+}
+
+#ifdef LVMODEL_SIMD
+
+/* QDist8SSE2: 8 bit kernel, 16 dimensions per step in 16bit-ints */
+__attribute__((target("sse2")))
+static float QDist8SSE2 (short *xq, signed char *mq, signed char *r, int n)
+{
+   int i;
+   __m128i m, v, d, y, lim, nlim;
+   __m128 sum;
+   float t[4];
+
+   lim = _mm_set1_epi16 (Q8_MAXDIF);
+   nlim = _mm_set1_epi16 (-Q8_MAXDIF);
+   sum = _mm_setzero_ps ();
+   for (i = 0; i < n; i += 16) {
+      m = _mm_loadu_si128 ((__m128i *) (mq + i));
+      v = _mm_loadu_si128 ((__m128i *) (r + i));
+      /* sign extend low and high 8 bytes to 16 bits */
+      d = _mm_sub_epi16 (_mm_loadu_si128 ((__m128i *) (xq + i)),
+                         _mm_srai_epi16 (_mm_unpacklo_epi8 (m, m), 8));
+      d = _mm_min_epi16 (_mm_max_epi16 (d, nlim), lim);
+      y = _mm_mullo_epi16 (d, _mm_srai_epi16 (_mm_unpacklo_epi8 (v, v), 8));
+      sum = _mm_add_ps (sum, _mm_cvtepi32_ps (_mm_madd_epi16 (y, y)));
+      d = _mm_sub_epi16 (_mm_loadu_si128 ((__m128i *) (xq + i + 8)),
+                         _mm_srai_epi16 (_mm_unpackhi_epi8 (m, m), 8));
+      d = _mm_min_epi16 (_mm_max_epi16 (d, nlim), lim);
+      y = _mm_mullo_epi16 (d, _mm_srai_epi16 (_mm_unpackhi_epi8 (v, v), 8));
+      sum = _mm_add_ps (sum, _mm_cvtepi32_ps (_mm_madd_epi16 (y, y)));
+   }
+   _mm_storeu_ps (t, sum);
+   return t[0] + t[1] + t[2] + t[3];
+}
+
+/* QDist16SSE2: 16 bit kernel, differences in 32bit-ints */
+__attribute__((target("sse2")))
+static float QDist16SSE2 (short *xq, short *mq, short *r, int n)
+{
+   int i;
+   __m128i x, m, v, d;
+   __m128 y, sum;
+   float t[4];
+
+   sum = _mm_setzero_ps ();
+   for (i = 0; i < n; i += 8) {
+      x = _mm_loadu_si128 ((__m128i *) (xq + i));
+      m = _mm_loadu_si128 ((__m128i *) (mq + i));
+      v = _mm_loadu_si128 ((__m128i *) (r + i));
+      d = _mm_sub_epi32 (_mm_srai_epi32 (_mm_unpacklo_epi16 (x, x), 16),
+                         _mm_srai_epi32 (_mm_unpacklo_epi16 (m, m), 16));
+      y = _mm_mul_ps (_mm_cvtepi32_ps (d), 
+                      _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16)));
+      sum = _mm_add_ps (sum, _mm_mul_ps (y, y));
+      d = _mm_sub_epi32 (_mm_srai_epi32 (_mm_unpackhi_epi16 (x, x), 16),
+                         _mm_srai_epi32 (_mm_unpackhi_epi16 (m, m), 16));
+      y = _mm_mul_ps (_mm_cvtepi32_ps (d), 
+                      _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16)));
+      sum = _mm_add_ps (sum, _mm_mul_ps (y, y));
+   }
+   _mm_storeu_ps (t, sum);
+   return t[0] + t[1] + t[2] + t[3];
+}
+
+/* QDist8AVX2: 8 bit kernel, 16 dimensions per step in 16bit-ints */
+__attribute__((target("avx2")))
+static float QDist8AVX2 (short *xq, signed char *mq, signed char *r, int n)
+{
+   int i;
+   __m256i d, y, lim, nlim;
+   __m256 sum;
+
+   lim = _mm256_set1_epi16 (Q8_MAXDIF);
+   nlim = _mm256_set1_epi16 (-Q8_MAXDIF);
+   sum = _mm256_setzero_ps ();
+   for (i = 0; i < n; i += 16) {
+      d = _mm256_sub_epi16 (_mm256_loadu_si256 ((__m256i *) (xq + i)),
+                            _mm256_cvtepi8_epi16 (_mm_loadu_si128 ((__m128i *) (mq + i))));
+      d = _mm256_min_epi16 (_mm256_max_epi16 (d, nlim), lim);
+      y = _mm256_mullo_epi16 (d, _mm256_cvtepi8_epi16 (_mm_loadu_si128 ((__m128i *) (r + i))));
+      sum = _mm256_add_ps (sum, _mm256_cvtepi32_ps (_mm256_madd_epi16 (y, y)));
+   }
+   return HSum256 (sum);
+}
+
+/* QDist16AVX2: 16 bit kernel, 8 dimensions per step in 32bit-ints */
+__attribute__((target("avx2,fma")))
+static float QDist16AVX2 (short *xq, short *mq, short *r, int n)
+{
+   int i;
+   __m256i d;
+   __m256 y, sum;
+
+   sum = _mm256_setzero_ps ();
+   for (i = 0; i < n; i += 8) {
+      d = _mm256_sub_epi32 (_mm256_cvtepi16_epi32 (_mm_loadu_si128 ((__m128i *) (xq + i))),
+                            _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((__m128i *) (mq + i))));
+      y = _mm256_mul_ps (_mm256_cvtepi32_ps (d), _mm256_cvtepi32_ps (
+                            _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((__m128i *) (r + i)))));
+      sum = _mm256_fmadd_ps (y, y, sum);
+   }
+   return HSum256 (sum);
+}
+
+/* QDist8AVX512: 8 bit kernel, 32 dimensions per step in 16bit-ints */
+__attribute__((target("avx512f,avx512bw")))
+static float QDist8AVX512 (short *xq, signed char *mq, signed char *r, int n)
+{
+   int i;
+   __m512i d, y, lim, nlim;
+   __m512 sum;
+
+   lim = _mm512_set1_epi16 (Q8_MAXDIF);
+   nlim = _mm512_set1_epi16 (-Q8_MAXDIF);
+   sum = _mm512_setzero_ps ();
+   for (i = 0; i < n; i += 32) {
+      d = _mm512_sub_epi16 (_mm512_loadu_si512 ((void *) (xq + i)),
+                            _mm512_cvtepi8_epi16 (_mm256_loadu_si256 ((__m256i *) (mq + i))));
+      d = _mm512_min_epi16 (_mm512_max_epi16 (d, nlim), lim);
+      y = _mm512_mullo_epi16 (d, _mm512_cvtepi8_epi16 (_mm256_loadu_si256 ((__m256i *) (r + i))));
+      sum = _mm512_add_ps (sum, _mm512_cvtepi32_ps (_mm512_madd_epi16 (y, y)));
+   }
+   return _mm512_reduce_add_ps (sum);
+}
+
+/* QDist16AVX512: 16 bit kernel, 16 dimensions per step in 32bit-ints */
+__attribute__((target("avx512f")))
+static float QDist16AVX512 (short *xq, short *mq, short *r, int n)
+{
+   int i;
+   __m512i d;
+   __m512 y, sum;
+
+   sum = _mm512_setzero_ps ();
+   for (i = 0; i < n; i += 16) {
+      d = _mm512_sub_epi32 (_mm512_cvtepi16_epi32 (_mm256_loadu_si256 ((__m256i *) (xq + i))),
+                            _mm512_cvtepi16_epi32 (_mm256_loadu_si256 ((__m256i *) (mq + i))));
+      y = _mm512_mul_ps (_mm512_cvtepi32_ps (d), _mm512_cvtepi32_ps (
+                            _mm512_cvtepi16_epi32 (_mm256_loadu_si256 ((__m256i *) (r + i)))));
+      sum = _mm512_fmadd_ps (y, y, sum);
+   }
+   return _mm512_reduce_add_ps (sum);
+}
+
+#endif /* LVMODEL_SIMD */
+
+static float (*qDist8)(short *xq, signed char *mq, signed char *r, int n) = QDist8Scalar;
+static float (*qDist16)(short *xq, short *mq, short *r, int n) = QDist16Scalar;
+
+/* QRound: round and clip to [lo,hi] */
+static int QRound (double x, int lo, int hi)
+{
+   int q;
+
+   q = (int) floor (x + 0.5);
+   return (q < lo) ? lo : ((q > hi) ? hi : q);
+}
+
+/* QuantiseBlocks: create the qBits store of si from si->hset */
+static void QuantiseBlocks (MemHeap *heap, StateInfo_lv *si, int qBits)
+{
+   HMMScanState hss;
+   StreamElem *se;
+   MixtureElem *me;
+   MixPDF *mp;
+   float *hdr, *mmin, *mmax;
+   double c, sw, maxSW;
+   char *base;
+   int m, i, level, rMax, step;
+
+   /* kernel and dimensions per step */
+   step = (qBits == 8) ? 16 : 8;
+#ifdef LVMODEL_SIMD
+   switch (GetGaussKernel ()) {
+   case SCALARGK: 
+      break;
+   case AVX2GK:   
+      qDist8 = QDist8AVX2; qDist16 = QDist16AVX2; 
+      break;
+   case AVX512GK: 
+      __builtin_cpu_init ();
+      qDist8 = __builtin_cpu_supports ("avx512bw") ? QDist8AVX512 : QDist8AVX2;
+      qDist16 = QDist16AVX512; 
+      if (qBits == 16 || qDist8 == QDist8AVX512)
+         step *= 2;
+      break;
+   default:       
+      qDist8 = QDist8SSE2; qDist16 = QDist16SSE2;
+      break;
+   }
+#endif
+
+   si->qBits = qBits;
+   si->nQDim = RoundAlign (si->nDim, step);
+   si->bytesPerMix = 16 + 2 * si->nQDim * (qBits / 8);
+   si->bytesPerBlock = si->mixPerBlock * si->bytesPerMix;
+   si->qbase = (char *) AlignedNew (heap, si->nBlocks * si->bytesPerBlock);
+   si->qOffset = (float *) New (heap, si->nDim * sizeof (float));
+   si->qStep = (float *) New (heap, si->nDim * sizeof (float));
+   si->xq = (short *) AlignedNew (heap, MAXBLOCKOBS * si->nQDim * sizeof (short));
+   level = (qBits == 8) ? Q8_LEVEL : Q16_LEVEL;
+   rMax = (qBits == 8) ? Q8_LEVEL : Q16_MAXR;
+
+   /* per dimension offset and step from the range of the means */
+   mmin = (float *) New (&gstack, 2 * si->nDim * sizeof (float));
+   mmax = mmin + si->nDim;
+   for (i = 0; i < si->nDim; ++i) {
+      mmin[i] = 1.0E10; mmax[i] = -1.0E10;
+   }
+   NewHMMScan (si->hset, &hss);
+   while (GoNextMix (&hss, FALSE)) {
       for (i = 0; i < si->nDim; ++i) {
-         xmm = x[i] - mean[i];
-         px += xmm*xmm * invVar[i];
+         if (hss.mp->mean[i+1] < mmin[i]) mmin[i] = hss.mp->mean[i+1];
+         if (hss.mp->mean[i+1] > mmax[i]) mmax[i] = hss.mp->mean[i+1];
       }
-      px = -0.5 * px;;
-      
-      bx = LAdd (bx, mixw + px);
-
-      base += si->floatsPerMix;
-      mean += si->floatsPerMix;
-      invVar += si->floatsPerMix;
-      
    }
-   return bx;
+   EndHMMScan (&hss);
+   for (i = 0; i < si->nDim; ++i) {
+      si->qOffset[i] = 0.5 * (mmax[i] + mmin[i]);
+      si->qStep[i] = (mmax[i] - mmin[i]) / (2 * level);
+      if (si->qStep[i] <= 0.0) si->qStep[i] = 1.0;
+   }
+
+   /* global scale of sqrt inverse variances in units of one step */
+   maxSW = 0.0;
+   NewHMMScan (si->hset, &hss);
+   while (GoNextMix (&hss, FALSE)) {
+      assert (hss.mp->ckind == INVDIAGC);
+      for (i = 0; i < si->nDim; ++i) {
+         sw = sqrt (hss.mp->cov.var[i+1]) * si->qStep[i];
+         if (sw > maxSW) maxSW = sw;
+      }
+   }
+   EndHMMScan (&hss);
+   c = maxSW / rMax;
+   si->qScale2 = c * c;
+
+   NewHMMScan (si->hset, &hss);
+   while (GoNextState (&hss, FALSE)) {
+      se = &hss.si->pdf[1];
+      base = HLVMODEL_QBLOCK_BASE(si, hss.si->sIdx);
+      hdr = HLVMODEL_QBLOCK_HDR(base);
+      HLVMODEL_BLOCK_NMIX(si,hdr) = se->nMix;
+      for (m = 1; m <= se->nMix; ++m, base += si->bytesPerMix) {
+         me = &se->spdf.cpdf[m];
+         mp = me->mpdf;
+         hdr = HLVMODEL_QBLOCK_HDR(base);
+         HLVMODEL_BLOCK_GCONST(si, hdr) = mp->gConst;
+         HLVMODEL_BLOCK_MIDX(si, hdr) = mp->mIdx;
+         HLVMODEL_BLOCK_MIXW(si, hdr) = MixLogWeight (si->hset, me->weight);
+         assert (HLVMODEL_BLOCK_MIXW(si, hdr) > LSMALL);
+         for (i = 0; i < si->nDim; ++i) {
+            if (qBits == 8) {
+               ((signed char *) HLVMODEL_QBLOCK_MEAN(si,base))[i] = 
+                  QRound ((mp->mean[i+1] - si->qOffset[i]) / si->qStep[i], -level, level);
+               ((signed char *) HLVMODEL_QBLOCK_INVVAR(si,base))[i] = 
+                  QRound (sqrt (mp->cov.var[i+1]) * si->qStep[i] / c, 0, rMax);
+            }
+            else {
+               ((short *) HLVMODEL_QBLOCK_MEAN(si,base))[i] = 
+                  QRound ((mp->mean[i+1] - si->qOffset[i]) / si->qStep[i], -level, level);
+               ((short *) HLVMODEL_QBLOCK_INVVAR(si,base))[i] = 
+                  QRound (sqrt (mp->cov.var[i+1]) * si->qStep[i] / c, 0, rMax);
+            }
+         }
+      }
+   }
+   EndHMMScan (&hss);
+   Dispose (&gstack, mmin);
+   if (trace & T_TOP) {
+      printf ("HLVModel: %d bit store for %lu blocks: %.2f MB (float store %.2f MB)\n",
+              qBits, si->nBlocks, si->nBlocks * si->bytesPerBlock / 1048576.0,
+              si->nBlocks * si->mixPerBlock * (2 * si->nDim + 4) * 
+              sizeof (float) / 1048576.0);
+      fflush (stdout);
+   }
 }
 
+/* EXPORT-> QuantObs_lv: quantise n frames into si->xq */
+void QuantObs_lv (StateInfo_lv *si, Observation **obsBlock, int n)
+{
+   int i, d, maxq;
+   float *x;
+   short *xq;
+
+   assert (n <= MAXBLOCKOBS);
+   maxq = (si->qBits == 8) ? Q8_MAXOBS : Q16_MAXOBS;
+   for (i = 0; i < n; ++i) {
+      x = &obsBlock[i]->fv[1][1];
+      xq = si->xq + i * si->nQDim;
+      for (d = 0; d < si->nDim; ++d)
+         xq[d] = QRound ((x[d] - si->qOffset[d]) / si->qStep[d], -maxq, maxq);
+   }
+}
+
+/* EXPORT-> LoadObs_lv: copy or quantise n frames for OutPBlock */
+void LoadObs_lv (StateInfo_lv *si, Observation **obsBlock, int n)
+{
+   int i, stride;
+
+   if (si->qBits > 0)
+      QuantObs_lv (si, obsBlock, n);
+   else if (si->xf) {
+      assert (n <= MAXBLOCKOBS);
+      stride = si->view->str[1].stride;
+      for (i = 0; i < n; ++i)
+         memcpy (si->xf + i * stride, &obsBlock[i]->fv[1][1], si->nDim * sizeof (float));
+   }
+}
+
+/* EXPORT-> OutPQ_lv: returns log prob for state s of quantised observation xq */
+LogFloat OutPQ_lv (StateInfo_lv *si,  unsigned short s, short *xq,
+                   unsigned char *cell)
+{
+   int m, nMix, nSel, n;
+   LogDouble bx, lx[LADDVECSIZE];
+   LogFloat px;
+   char *base;
+   float *hdr;
+
+   base = HLVMODEL_QBLOCK_BASE(si, s);
+   nMix = HLVMODEL_BLOCK_NMIX(si, HLVMODEL_QBLOCK_HDR(base));
+
+   if (nMix == 1) cell = NULL;
+   bx = LZERO; nSel = 0; n = 0;
+   for (m = 1; m <= nMix; m++, base += si->bytesPerMix) {
+      hdr = HLVMODEL_QBLOCK_HDR(base);
+      if (cell && !GSEL_ISSET(cell, HLVMODEL_BLOCK_MIDX(si,hdr)))
+         continue;
+      ++nSel;
+      if (si->qBits == 8)
+         px = qDist8 (xq, (signed char *) HLVMODEL_QBLOCK_MEAN(si,base),
+                      (signed char *) HLVMODEL_QBLOCK_INVVAR(si,base), si->nQDim);
+      else
+         px = qDist16 (xq, (short *) HLVMODEL_QBLOCK_MEAN(si,base),
+                       (short *) HLVMODEL_QBLOCK_INVVAR(si,base), si->nQDim);
+      px = -0.5 * (HLVMODEL_BLOCK_GCONST(si,hdr) + si->qScale2 * px);
+      lx[n++] = HLVMODEL_BLOCK_MIXW(si,hdr) + px;
+      if (n == LADDVECSIZE) {
+         bx = LAddVec (bx, lx, n); n = 0;
+      }
+   }
+   bx = LAddVec (bx, lx, n);
+   if (cell && nSel == 0)       /* empty shortlist */
+      bx = (si->hset->gsel->floor > LSMALL) ? si->hset->gsel->floor :
+         OutPQ_lv (si, s, xq, NULL);
+   return bx;
+}
 
 void OutPBlock (StateInfo_lv *si, Observation **obsBlock, 
                 int n, int sIdx, float acScale, LogFloat *outP)
 {
    int i;
 
-   for (i = 0; i < n; ++i) {
-      outP[i] = OutP_lv (si, sIdx, &obsBlock[i]->fv[1][1]);
+   if (si->xf && n > 1 && si->hset->gsel == NULL)
+      OutPBlockView (si, n, sIdx, outP);
+   else for (i = 0; i < n; ++i) {
+      if (si->qBits > 0)
+         outP[i] = OutPQ_lv (si, sIdx, si->xq + i * si->nQDim,
+                             GSelCell (si->hset, 1, obsBlock[i]));
+      else
+         outP[i] = OutP_lv (si, sIdx, &obsBlock[i]->fv[1][1],
+                            GSelCell (si->hset, 1, obsBlock[i]));
    }
 
    /* acoustic scaling */
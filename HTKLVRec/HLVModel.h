@@ -76,10 +76,10 @@ extern "C" {
 
   For fast access we want:
 
-    - vectors (means, vars, etc.) aligned on 16(?) Byte boundary for SSE
-    - all vecotrs zero-padded to nearest multiple of 4 elements for SSE
+    - vectors (means, vars, etc.) aligned and zero-padded for SIMD
     - trade off CPU for memory saving (calc loop transP as 1-step)
-    - maybe: quantise 4byte-floats for storage into 16bit-ints?
+    - optionally quantise 4byte-floats for storage into 8 or 16bit-ints
+      (HLVMODEL: QUANTBITS, see below)
     - store log values if we log the all the time anyway (mixweights, gConst)
     - assume fixed minimum number of mixes for all states. If a state has more mixes
       then skip stateIds and use multiple blocks. 
@@ -87,14 +87,36 @@ extern "C" {
 
   We won't bother doing the following:
 
-   - perform calculation based on (quantised) 8/16bit-ints
    - assume fixed number of states
 
-*/
 
-#define HLVMODEL_VEC_ALIGN 16
-#define HLVMODEL_VEC_PAD 4
+  Float store:
+
+  The float store is the HModel scoring view of the set (see
+  GetScoreView), built after the state indexes have been reassigned,
+  so OutP_lv scores exactly like the other HTK recognisers.  For blocks
+  of frames (HDecode -k) OutPBlock reads each mean and variance row once
+  for up to four frames, using AVX2 or AVX-512 kernels matching the 
+  HModel Gaussian kernel in use (HMODEL: GAUSSKERNEL), so the block
+  scores equal the single frame ones.
+
+
+  Quantised store (QUANTBITS = 8 or 16):
 
+  Each dimension d of the means is mapped onto [-L,L] by a per dimension
+  offset o[d] and step h[d].  The inverse variances are stored as the 
+  square root of the weight of one squared step, 
+     r = sqrt(invVar[d]) * h[d] / c
+  where c is a single scale for the whole set, so that
+     invVar[d] * (x[d]-mean[d])^2 = c^2 * (r * (xq[d]-mq[d]))^2
+  and the distance of a quantised observation xq is accumulated from
+  integer products without any per dimension factors.  For 8 bits
+  all products fit in 16bit-ints and are summed pairwise into 32bit-ints.
+  Quantised observations are computed once per frame by QuantObs_lv().
+  The integer kernels (SSE2, AVX2 or AVX-512) are chosen together with 
+  the Gaussian kernel and nQDim is padded to a whole kernel step.
+
+*/
 
    /* the info about states is arranged in blocks, normally one state 
       corresponds to one block, but states with many mixes can use multiple blocks */
@@ -103,50 +125,73 @@ extern "C" {
 typedef struct _StateInfo_lv StateInfo_lv;
 
 struct _StateInfo_lv {
-   float *base;
    unsigned long mixPerBlock;
    unsigned long nBlocks;
    unsigned long nDim;         /* real number of dimensions, e.g. 39 */
-   unsigned long nVec;         /* number of vecotrs (e.g. 10 = RoundAlign (nDim,  HLVMODEL_VEC_PAD) */
-   size_t floatsPerMix;
-   size_t floatsPerBlock;        /* mixPerBlock * floatsPerMix */
-   /*   size_t meanOffset;  */
-   size_t invVarOffset;         /* 4 + nDim * floatsPerMix*/
 
    HMMSet *hset;
    Boolean useHModel;
    StateInfo **si;              /* pointers to HModel:StateInfos  for USEHMODEL=T */
+   ScoreView *view;             /* float store, NULL if not used */
+
+   int qBits;                   /* 0 for float store, else 8 or 16 */
+   char *qbase;                 /* quantised blocks */
+   unsigned long nQDim;         /* nDim padded to a whole kernel step */
+   size_t bytesPerMix;          /* 16 + 2 * nQDim * qBits/8 */
+   size_t bytesPerBlock;        /* mixPerBlock * bytesPerMix */
+   float *qOffset;              /* [0..nDim-1] per dimension mean offset */
+   float *qStep;                /* [0..nDim-1] per dimension mean step */
+   float qScale2;               /* c^2 */
+   short *xq;                   /* [MAXBLOCKOBS][nQDim] quantised observations */
+   float *xf;                   /* [MAXBLOCKOBS][view stride] observations for
+                                   block scoring of the float store or NULL */
 };
 
-   /* layout of a block:
+   /* layout of a quantised block:
       for each of the mixPerBlock mixes:
         LogFloat gConst;
         LogFloat mixWeight;
         int nMix;               only valid for first mix 
-        StreamElem *se; 
-        float pad[HLVMODEL_VEC_PAD - 4];
-        float mean[nDim];
-        float invVar[nDim];
+        int mIdx;               HModel index of mixture component
+        mq[nQDim], r[nQDim]     signed char (8 bits) or short (16 bits),
+                                zero padded
 
  relies on sizeof (int)==sizeof (float)  
-      and  sizeof (MixPDF *)==sizeof (float)
    */
 
-#define HLVMODEL_BLOCK_BASE(si, s)   ((si)->base + (s) * (si)->floatsPerBlock)
-#define HLVMODEL_BLOCK_GCONST_OFFSET(si) (0)
-#define HLVMODEL_BLOCK_MIXW_OFFSET(si) (1)
 #define HLVMODEL_BLOCK_GCONST(si,base) (*((base) + 0))
 #define HLVMODEL_BLOCK_MIXW(si,base) (*((base) + 1))
 #define HLVMODEL_BLOCK_NMIX(si,base) (*((int *) ((base) + 2)))
-#define HLVMODEL_BLOCK_MPDF(si,base) (*((MixPDF **) ((base) + 3)))
-#define HLVMODEL_BLOCK_MEAN_OFFSET(si) (4)
-#define HLVMODEL_BLOCK_INVVAR_OFFSET(si) ((si)->invVarOffset)
+#define HLVMODEL_BLOCK_MIDX(si,base) (*((int *) ((base) + 3)))
+
+#define HLVMODEL_QBLOCK_BASE(si, s)  ((si)->qbase + (s) * (si)->bytesPerBlock)
+#define HLVMODEL_QBLOCK_HDR(base) ((float *) (base))
+#define HLVMODEL_QBLOCK_MEAN(si,base) ((base) + 16)
+#define HLVMODEL_QBLOCK_INVVAR(si,base) ((base) + 16 + (si)->nQDim * ((si)->qBits / 8))
 
 
 
 
+void InitLVModel(void);
 StateInfo_lv *ConvertHSet(MemHeap *heap, HMMSet *hset, Boolean useHModel);
-LogFloat OutP_lv (StateInfo_lv *si,  unsigned short s, float *x);
+/* uses a quantised store if QUANTBITS is set and useHModel is FALSE */
+StateInfo_lv *ConvertHSetQuant(MemHeap *heap, HMMSet *hset, Boolean useHModel,
+                               int qBits);
+/* qBits is 0 for the float store, else 8 or 16 */
+StateInfo_lv *ShareStateInfo_lv(MemHeap *heap, StateInfo_lv *si);
+/* copy of si for another decoder: the model store is shared read-only,
+   the observation scratch space is private */
+LogFloat OutP_lv (StateInfo_lv *si,  unsigned short s, float *x,
+                  unsigned char *cell);
+/* cell is the Gaussian selection shortlist of x (see GSelCell) or NULL */
+void QuantObs_lv (StateInfo_lv *si, Observation **obsBlock, int n);
+/* quantise n frames for OutPBlock, call once per block if si->qBits>0 */
+void LoadObs_lv (StateInfo_lv *si, Observation **obsBlock, int n);
+/* quantise or copy n frames into the scratch space of si for OutPBlock,
+   call once per block */
+LogFloat OutPQ_lv (StateInfo_lv *si,  unsigned short s, short *xq,
+                   unsigned char *cell);
+/* as OutP_lv for quantised observation xq and store */
 void OutPBlock (StateInfo_lv *si, Observation **obsBlock, 
                 int n, int sIdx, float acScale, LogFloat *outP);
 
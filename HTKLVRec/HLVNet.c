@@ -48,6 +48,13 @@ char *hlvnet_vc_id = "$Id: HLVNet.c,v 1.1.1.1 2006/10/11 09:54:55 jal58 Exp $";
 #include "HLVNet.h"
 
 #include <assert.h>
+#include <stddef.h>
+#ifdef WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/mman.h>
+#endif
 
 
 #define LIST_BLOCKSIZE 70
@@ -1546,6 +1553,545 @@ LexNet *CreateLexNet (MemHeap *heap, Vocab *voc, HMMSet *hset,
 }
 
 
+/* -------------- compiled images --------------- */
+
+/*
+   Images hold decoder data structures (networks, see below, and
+   n-gram LMs, see HLVLM) in the form used in memory
+      LVImgHeader
+      object area
+      relocation table - offsets of every pointer in the object area
+   As for HMM set images (see HModel) pointers hold the address they
+   would have with the file mapped at its preferred base and are
+   shifted once at load time if the mapping lands elsewhere, so that
+   usually the pages are shared by all processes using the image.  An
+   image is only used if its key, a checksum of the inputs it was made
+   from, matches.
+*/
+
+#define LVIMGORDER 0x01020304   /* detects a byte order mismatch */
+#define LVIMGALIGN 16           /* alignment of every object */
+
+/* LVImgGrow: double the capacity *max of array p of elSize elements */
+static Ptr LVImgGrow (Ptr p, size_t *max, size_t elSize)
+{
+   *max = (*max == 0) ? 4096 : 2 * *max;
+   if ((p = realloc (p, *max * elSize)) == NULL)
+      HError (9999, "LVImgGrow: cannot allocate %lu bytes for image",
+              (unsigned long) (*max * elSize));
+   return p;
+}
+
+/* EXPORT->LVImgInit: start image b for base, return offset of root */
+size_t LVImgInit (LVImgBuild *b, size_t base, size_t rootSize)
+{
+   b->buf = NULL; b->used = b->size = 0;
+   b->base = base;
+   b->reloc = NULL; b->nReloc = b->maxReloc = 0;
+   LVImgAlloc (b, sizeof (LVImgHeader));
+   b->root = LVImgAlloc (b, rootSize);
+   return b->root;
+}
+
+/* EXPORT->LVImgAlloc: return offset of n zeroed bytes in image b */
+size_t LVImgAlloc (LVImgBuild *b, size_t n)
+{
+   size_t off;
+
+   off = (b->used + LVIMGALIGN-1) / LVIMGALIGN * LVIMGALIGN;
+   while (off + n > b->size)
+      b->buf = (char *) LVImgGrow (b->buf, &b->size, 1);
+   memset (b->buf + b->used, 0, off + n - b->used);
+   b->used = off + n;
+   return off;
+}
+
+/* EXPORT->LVImgLink: set pointer at offset at to image offset target (0=NULL) */
+void LVImgLink (LVImgBuild *b, size_t at, size_t target)
+{
+   if (target == 0) {
+      *(Ptr *) (b->buf + at) = NULL; return;
+   }
+   if (b->nReloc == b->maxReloc)
+      b->reloc = (size_t *) LVImgGrow (b->reloc, &b->maxReloc, sizeof (size_t));
+   *(size_t *) (b->buf + at) = b->base + target;
+   b->reloc[b->nReloc++] = at;
+}
+
+/* EXPORT->LVImgFree: discard image b */
+void LVImgFree (LVImgBuild *b)
+{
+   free (b->buf); free (b->reloc);
+   b->buf = NULL; b->reloc = NULL;
+}
+
+/* EXPORT->LVImgWrite: write image b as fn and free it.  The image is
+   written to a temporary file which is then renamed to fn, so that
+   processes which have the old image mapped are not disturbed and an
+   image is never seen half written */
+ReturnStatus LVImgWrite (LVImgBuild *b, char *fn, char *magic, unsigned long key)
+{
+   LVImgHeader *h;
+   FILE *f;
+   size_t rel;
+   Boolean ok;
+   char tmp[MAXFNAMELEN+32];
+   ReturnStatus r = SUCCESS;
+
+   rel = LVImgAlloc (b, b->nReloc * sizeof (size_t));
+   memcpy (b->buf + rel, b->reloc, b->nReloc * sizeof (size_t));
+   h = (LVImgHeader *) b->buf;
+   memcpy (h->magic, magic, 8);
+   h->order = LVIMGORDER; h->ptrSize = sizeof (Ptr);
+   h->key = key;
+   h->size = b->used; h->base = b->base;
+   h->root = b->root; h->relocs = rel; h->nRelocs = b->nReloc;
+
+   sprintf (tmp, "%s.tmp.%d", fn, (int) getpid ());
+   if ((f = fopen (tmp, "wb")) == NULL) {
+      HRError (9999, "LVImgWrite: cannot create image %s", tmp);
+      r = FAIL;
+   }
+   else {
+      ok = (fwrite (b->buf, 1, b->used, f) == b->used);
+      ok = (fflush (f) == 0) && ok;
+      ok = (fclose (f) == 0) && ok;
+#ifdef WIN32
+      if (ok) remove (fn);   /* rename does not replace fn on WIN32 */
+#endif
+      if (!ok || rename (tmp, fn) != 0) {
+         remove (tmp);
+         HRError (9999, "LVImgWrite: cannot write image %s", fn);
+         r = FAIL;
+      }
+   }
+   if (r == SUCCESS && (trace & T_TOP))
+      printf ("HLVNet: image %s written, %lu bytes\n", fn, (unsigned long) b->used);
+   LVImgFree (b);
+   return r;
+}
+
+/* EXPORT->LVImgMap: map image fn with given magic and key and return
+   its base, or NULL if it is missing or out of date */
+char *LVImgMap (MemHeap *heap, char *fn, char *magic, unsigned long key)
+{
+   FILE *f;
+   LVImgHeader h;
+   char *base;
+   size_t i, delta, *reloc;
+
+   if ((f = fopen (fn, "rb")) == NULL)
+      return NULL;
+   if (fread (&h, sizeof (LVImgHeader), 1, f) != 1 ||
+       strncmp (h.magic, magic, 8) != 0 ||
+       h.order != LVIMGORDER || h.ptrSize != sizeof (Ptr) || h.key != key ||
+       fseek (f, 0, SEEK_END) != 0 || (size_t) ftell (f) < h.size) {
+      fclose (f);
+      if (trace & T_TOP)
+         printf ("HLVNet: image %s out of date\n", fn);
+      return NULL;
+   }
+#ifdef WIN32
+   base = (char *) New (heap, h.size);
+   rewind (f);
+   if (fread (base, 1, h.size, f) != h.size) {
+      fclose (f);
+      return NULL;
+   }
+#else
+   base = (char *) mmap ((void *) h.base, h.size, PROT_READ|PROT_WRITE,
+                         MAP_PRIVATE, fileno (f), 0);
+   if (base == (char *) MAP_FAILED) {
+      fclose (f);
+      HRError (-9999, "LVImgMap: cannot map image %s", fn);
+      return NULL;
+   }
+#endif
+   fclose (f);
+   if ((size_t) base != h.base) {
+      delta = (size_t) base - h.base;
+      reloc = (size_t *) (base + h.relocs);
+      for (i = 0; i < h.nRelocs; ++i)
+         *(size_t *) (base + reloc[i]) += delta;
+   }
+   if (trace & T_TOP)
+      printf ("HLVNet: image %s mapped at %p\n", fn, base);
+   return base;
+}
+
+/* EXPORT->LVImgUnmap: release image mapped at base */
+void LVImgUnmap (char *base)
+{
+#ifndef WIN32
+   munmap (base, ((LVImgHeader *) base)->size);
+#endif
+}
+
+
+/*
+   A network image holds in its object area
+      LNImgRoot
+      the LexNode array, the foll arrays, the LMlaTree node arrays,
+      the HMM name table and the PronId to pron table
+   Model nodes hold the index of their HMM in the name table instead
+   of the HLink.  The key is a checksum of the marked dictionary
+   entries, the HMM list and the physical models.
+*/
+
+#define LNIMGMAGIC "HTKLNET1"
+#if defined(__LP64__) || defined(_WIN64)
+#define LNIMGBASEADDR ((size_t)0x3f0000000000) /* preferred mapping */
+#else
+#define LNIMGBASEADDR ((size_t)0x70000000)
+#endif
+
+typedef struct {
+   int nNodes;                  /* LexNet fields */
+   int nLayers;
+   int wordEndLayerId;
+   int spSkipLayer;
+   Boolean silDict;
+   PronId startPron;
+   PronId endPron;
+   int start, end;              /* node indices, -1 for none */
+   int lnSEsp, lnSEsil;
+   int nPronIds;                /* voc->nprons of writer */
+   int nHMM;                    /* entries in HMM name table */
+   int laNodes;                 /* LMlaTree sizes */
+   int laCompNodes;
+   size_t node;                 /* offset of LexNode [nNodes] */
+   size_t layerStart;           /* offset of int [nLayers] node indices */
+   size_t laNode;               /* offset of LMlaNode [laNodes] */
+   size_t laCompNode;           /* offset of CompLMlaNode [laCompNodes] */
+   size_t hmmName;              /* offset of size_t [nHMM] name offsets */
+   size_t pronWord;             /* offset of size_t [nPronIds+1] word names */
+   size_t pronIdx;              /* offset of int [nPronIds+1] pron positions */
+} LNImgRoot;
+
+typedef struct {                /* physical HMM and its macro name */
+   HLink hmm;
+   char *name;
+} LNImgHMM;
+
+static int lnimghmm_cmp (const void *v1, const void *v2)
+{
+   HLink h1 = ((LNImgHMM *) v1)->hmm, h2 = ((LNImgHMM *) v2)->hmm;
+
+   return (h1 < h2) ? -1 : (h1 > h2) ? 1 : 0;
+}
+
+/* LNImgHMMTable: return the physical HMMs of hset sorted by HLink */
+static LNImgHMM *LNImgHMMTable (HMMSet *hset, int *n)
+{
+   LNImgHMM *tab;
+   MLink m;
+   int i;
+
+   *n = 0;
+   for (i = 0; i < MACHASHSIZE; ++i)
+      for (m = hset->mtab[i]; m; m = m->next)
+         if (m->type == 'h') ++*n;
+   tab = (LNImgHMM *) New (&gcheap, (*n + 1) * sizeof (LNImgHMM));
+   *n = 0;
+   for (i = 0; i < MACHASHSIZE; ++i)
+      for (m = hset->mtab[i]; m; m = m->next)
+         if (m->type == 'h') {
+            tab[*n].hmm = (HLink) m->structure;
+            tab[*n].name = m->id->name;
+            ++*n;
+         }
+   qsort (tab, *n, sizeof (LNImgHMM), lnimghmm_cmp);
+   return tab;
+}
+
+/* LNImgFindHMM: index of hmm in tab or -1 */
+static int LNImgFindHMM (LNImgHMM *tab, int n, HLink hmm)
+{
+   LNImgHMM key, *e;
+
+   key.hmm = hmm;
+   e = (LNImgHMM *) bsearch (&key, tab, n, sizeof (LNImgHMM), lnimghmm_cmp);
+   return e ? e - tab : -1;
+}
+
+static unsigned long LNImgStrHash (unsigned long h, char *s)
+{
+   while (*s)
+      h = h * 31 + (unsigned char) *s++;
+   return h ^ (h >> 15);
+}
+
+/* LexNetKey
+
+     checksum of everything CreateLexNet depends on: the marked words and
+     prons of voc, the logical to physical HMM mapping and the sizes of
+     the physical HMMs.  Sums are used so the order of hash tables does 
+     not matter.
+*/
+static unsigned long LexNetKey (Vocab *voc, HMMSet *hset, LNImgHMM *tab, int nHMM,
+                                char *startWord, char *endWord, Boolean silDict)
+{
+   unsigned long key, h;
+   LabId startId, endId;
+   Word word;
+   Pron pron;
+   MLink m;
+   int i, j;
+
+   key = LNImgStrHash (LNImgStrHash (silDict ? 1 : 2, startWord), endWord);
+   key += voc->nprons;
+   startId = GetLabId (startWord, FALSE);
+   endId = GetLabId (endWord, FALSE);
+   for (i = 0; i < VHASHSIZE; ++i)
+      for (word = voc->wtab[i]; word; word = word->next) {
+         if (word->aux != (Ptr) 1 && word->wordName != startId && word->wordName != endId)
+            continue;
+         h = LNImgStrHash (0, word->wordName->name);
+         for (pron = word->pron; pron; pron = pron->next) {
+            h = h * 31 + (pron->aux == (Ptr) 1);
+            h = h * 31 + (long) (pron->prob * 1000.0);
+            for (j = 0; j < pron->nphones; ++j)
+               h = LNImgStrHash (h, pron->phones[j]->name);
+         }
+         key += h * 2 + 1;
+      }
+   for (i = 0; i < MACHASHSIZE; ++i)
+      for (m = hset->mtab[i]; m; m = m->next)
+         if (m->type == 'l') {
+            j = LNImgFindHMM (tab, nHMM, (HLink) m->structure);
+            h = LNImgStrHash (0, m->id->name);
+            key += LNImgStrHash (h, j >= 0 ? tab[j].name : "");
+         }
+         else if (m->type == 'h')
+            key += LNImgStrHash (((HLink) m->structure)->numStates, m->id->name);
+   return key;
+}
+
+/* SaveLexNetImage
+
+     write net as image fn with given key
+*/
+static ReturnStatus SaveLexNetImage (LexNet *net, char *fn, unsigned long key,
+                                     LNImgHMM *tab, int nHMM)
+{
+   LVImgBuild b;
+   LNImgRoot *r;
+   LexNode *ln;
+   Pron pron, p;
+   size_t root, node, at, foll, name, t;
+   int i, j, k, nPronIds;
+   LMlaTree *laTree = net->laTree;
+
+   root = LVImgInit (&b, LNIMGBASEADDR, sizeof (LNImgRoot));
+
+   /* nodes and their successors */
+   node = LVImgAlloc (&b, net->nNodes * sizeof (LexNode));
+   memcpy (b.buf + node, net->node, net->nNodes * sizeof (LexNode));
+   for (i = 0, ln = net->node; i < net->nNodes; ++i, ++ln) {
+      at = node + i * sizeof (LexNode);
+      if (ln->type == LN_MODEL) {
+         k = LNImgFindHMM (tab, nHMM, ln->data.hmm);
+         if (k < 0) {
+            LVImgFree (&b);
+            HRError (9999, "SaveLexNetImage: model of node %d not in HMM set", i);
+            return FAIL;
+         }
+         ((LexNode *) (b.buf + at))->data.hmm = (HLink) (size_t) k;
+      }
+      foll = 0;
+      if (ln->nfoll > 0) {
+         foll = LVImgAlloc (&b, ln->nfoll * sizeof (LexNode *));
+         for (j = 0; j < ln->nfoll; ++j)
+            LVImgLink (&b, foll + j * sizeof (LexNode *),
+                       node + (ln->foll[j] - net->node) * sizeof (LexNode));
+      }
+      LVImgLink (&b, at + offsetof (LexNode, foll), foll);
+   }
+   t = LVImgAlloc (&b, net->nLayers * sizeof (int));
+   for (i = 0; i < net->nLayers; ++i)
+      ((int *) (b.buf + t))[i] = net->layerStart[i] - net->node;
+   ((LNImgRoot *) (b.buf + root))->layerStart = t;
+
+   /* LM lookahead tree */
+   t = LVImgAlloc (&b, laTree->nNodes * sizeof (LMlaNode));
+   memcpy (b.buf + t, laTree->node, laTree->nNodes * sizeof (LMlaNode));
+   ((LNImgRoot *) (b.buf + root))->laNode = t;
+   t = LVImgAlloc (&b, laTree->nCompNodes * sizeof (CompLMlaNode));
+   ((LNImgRoot *) (b.buf + root))->laCompNode = t;
+   for (i = 0; i < laTree->nCompNodes; ++i) {
+      k = laTree->compNode[i].n;
+      at = LVImgAlloc (&b, k * sizeof (int));
+      memcpy (b.buf + at, laTree->compNode[i].lmlaIdx, k * sizeof (int));
+      ((CompLMlaNode *) (b.buf + t))[i].n = k;
+      LVImgLink (&b, t + i * sizeof (CompLMlaNode) + offsetof (CompLMlaNode, lmlaIdx), at);
+   }
+
+   /* HMM names */
+   t = LVImgAlloc (&b, nHMM * sizeof (size_t));
+   ((LNImgRoot *) (b.buf + root))->hmmName = t;
+   for (i = 0; i < nHMM; ++i) {
+      name = LVImgAlloc (&b, strlen (tab[i].name) + 1);
+      strcpy (b.buf + name, tab[i].name);
+      ((size_t *) (b.buf + t))[i] = name;
+   }
+
+   /* PronId -> (word, position of pron) */
+   nPronIds = net->voc->nprons;
+   t = LVImgAlloc (&b, (nPronIds + 1) * sizeof (size_t));
+   ((LNImgRoot *) (b.buf + root))->pronWord = t;
+   at = LVImgAlloc (&b, (nPronIds + 1) * sizeof (int));
+   ((LNImgRoot *) (b.buf + root))->pronIdx = at;
+   for (i = 1; i <= nPronIds; ++i) {
+      if ((pron = net->pronlist[i]) == NULL)
+         continue;
+      for (k = 0, p = pron->word->pron; p != pron; p = p->next)
+         ++k;
+      name = LVImgAlloc (&b, strlen (pron->word->wordName->name) + 1);
+      strcpy (b.buf + name, pron->word->wordName->name);
+      ((size_t *) (b.buf + t))[i] = name;
+      ((int *) (b.buf + at))[i] = k;
+   }
+
+   r = (LNImgRoot *) (b.buf + root);
+   r->nNodes = net->nNodes; r->nLayers = net->nLayers;
+   r->wordEndLayerId = net->wordEndLayerId; r->spSkipLayer = net->spSkipLayer;
+   r->silDict = net->silDict;
+   r->startPron = net->startPron; r->endPron = net->endPron;
+   r->start = net->start - net->node; r->end = net->end - net->node;
+   r->lnSEsp = net->silDict ? net->lnSEsp - net->node : -1;
+   r->lnSEsil = net->silDict ? net->lnSEsil - net->node : -1;
+   r->nPronIds = nPronIds; r->nHMM = nHMM;
+   r->laNodes = laTree->nNodes; r->laCompNodes = laTree->nCompNodes;
+   r->node = node;
+
+   return LVImgWrite (&b, fn, LNIMGMAGIC, key);
+}
+
+/* LoadLexNetImage
+
+     map image fn and return its net, or NULL if the image is missing,
+     written for other inputs or cannot be matched to voc and hset
+*/
+static LexNet *LoadLexNetImage (MemHeap *heap, char *fn, unsigned long key,
+                                Vocab *voc, HMMSet *hset)
+{
+   LNImgRoot *r;
+   LexNet *net;
+   LexNode *node;
+   LMlaTree *laTree;
+   HLink *hmm;
+   Pron *pronlist, p;
+   Word word;
+   LabId id;
+   MLink m;
+   char *base;
+   size_t *name;
+   int j, k, n, *idx;
+
+   if ((base = LVImgMap (heap, fn, LNIMGMAGIC, key)) == NULL)
+      return NULL;
+   r = (LNImgRoot *) (base + ((LVImgHeader *) base)->root);
+   node = (LexNode *) (base + r->node);
+
+   /* find HMMs and prons before anything is changed */
+   hmm = (HLink *) New (&gcheap, (r->nHMM + 1) * sizeof (HLink));
+   pronlist = (Pron *) New (heap, (voc->nprons + 1) * sizeof (Pron));
+   name = (size_t *) (base + r->hmmName);
+   for (k = 0; k < r->nHMM; ++k) {
+      id = GetLabId (base + name[k], FALSE);
+      if (!id || (m = FindMacroName (hset, 'h', id)) == NULL)
+         break;
+      hmm[k] = (HLink) m->structure;
+   }
+   name = (size_t *) (base + r->pronWord);
+   idx = (int *) (base + r->pronIdx);
+   pronlist[0] = NULL;
+   for (j = 1; k == r->nHMM && r->nPronIds == voc->nprons && j <= r->nPronIds; ++j) {
+      pronlist[j] = NULL;
+      if (name[j] == 0)
+         continue;
+      id = GetLabId (base + name[j], FALSE);
+      word = id ? GetWord (voc, id, FALSE) : NULL;
+      for (p = word ? word->pron : NULL, n = 0; p && n < idx[j]; p = p->next)
+         ++n;
+      if (!p)
+         break;
+      pronlist[j] = p;
+   }
+   if (k < r->nHMM || j <= r->nPronIds || r->nPronIds != voc->nprons) {
+      Dispose (&gcheap, hmm);
+      LVImgUnmap (base);
+      HRError (-9999, "LoadLexNetImage: image %s does not match models or dictionary", fn);
+      return NULL;
+   }
+
+   for (j = 0; j < r->nNodes; ++j)
+      if (node[j].type == LN_MODEL)
+         node[j].data.hmm = hmm[(size_t) node[j].data.hmm];
+   Dispose (&gcheap, hmm);
+   for (j = 1; j <= r->nPronIds; ++j)
+      if (pronlist[j])
+         pronlist[j]->aux = (Ptr) (size_t) j;
+
+   net = (LexNet *) New (heap, sizeof (LexNet));
+   net->heap = heap;
+   net->voc = voc;
+   net->vocabFN = NULL;
+   net->hset = hset;
+   net->node = node;
+   net->nNodes = r->nNodes;
+   net->nLayers = r->nLayers;
+   net->layerStart = (LexNode **) New (heap, net->nLayers * sizeof (LexNode *));
+   for (j = 0; j < net->nLayers; ++j)
+      net->layerStart[j] = node + ((int *) (base + r->layerStart))[j];
+   net->wordEndLayerId = r->wordEndLayerId;
+   net->spSkipLayer = r->spSkipLayer;
+   net->silDict = r->silDict;
+   net->start = node + r->start;
+   net->end = node + r->end;
+   net->lnSEsp = (r->lnSEsp >= 0) ? node + r->lnSEsp : NULL;
+   net->lnSEsil = (r->lnSEsil >= 0) ? node + r->lnSEsil : NULL;
+   net->startPron = r->startPron;
+   net->endPron = r->endPron;
+   net->pronlist = pronlist;
+   if (!(id = GetLabId ("sp", FALSE)))
+      HError (9999, "cannot find 'sp' model.");
+   net->hmmSP = FindHMM (hset, id);
+
+   laTree = (LMlaTree *) New (heap, sizeof (LMlaTree));
+   laTree->nNodes = r->laNodes;
+   laTree->node = (LMlaNode *) (base + r->laNode);
+   laTree->nCompNodes = r->laCompNodes;
+   laTree->compNode = (CompLMlaNode *) (base + r->laCompNode);
+   net->laTree = laTree;
+
+   if (trace & T_TOP)
+      printf ("HLVNet: network image %s has %d nodes\n", fn, net->nNodes);
+   return net;
+}
+
+/* EXPORT->LoadLexNet: CreateLexNet reusing or writing the image in fn */
+LexNet *LoadLexNet (MemHeap *heap, char *fn, Vocab *voc, HMMSet *hset, 
+                    char *startWord, char *endWord, Boolean silDict)
+{
+   LNImgHMM *tab;
+   int nHMM;
+   unsigned long key;
+   LexNet *net;
+
+   tab = LNImgHMMTable (hset, &nHMM);
+   key = LexNetKey (voc, hset, tab, nHMM, startWord, endWord, silDict);
+   net = LoadLexNetImage (heap, fn, key, voc, hset);
+   if (!net) {
+      net = CreateLexNet (heap, voc, hset, startWord, endWord, silDict);
+      if (SaveLexNetImage (net, fn, key, tab, nHMM) < SUCCESS)
+         HError (-9999, "LoadLexNet: continuing without network image");
+   }
+   Dispose (&gcheap, tab);
+   return net;
+}
+
+
 /* -------------- vocab handling --------------- */
 
 Boolean CompareBasePron (Pron b, Pron p)
@@ -70,8 +70,8 @@ typedef enum _LexNodeType {
 } LexNodeType;
 
 
-struct _LexNode {
-   LexNodeInst *inst;		/* model instance or NULL if inactive */
+struct _LexNode {              /* read-only once the net is built, the
+                                   instances live in the DecoderInst */
    union {
       HLink hmm;                /* #### switch to HMM Ids (2 byte ints) */
       PronId pron;
@@ -277,6 +277,29 @@ struct _LMlaTree {
    CompLMlaNode *compNode;      /* [0..nCompNodes-1] arry of entries */
 };
 
+/* compiled images of decoder structures (see HLVNet.c) */
+typedef struct {
+   char magic[8];               /* identifies the kind of image */
+   int order;                   /* LVIMGORDER in writer's byte order */
+   int ptrSize;                 /* sizeof(Ptr) of writer */
+   unsigned long key;           /* checksum of the inputs */
+   size_t size;                 /* total bytes in image */
+   size_t base;                 /* preferred mapping address */
+   size_t root;                 /* offset of root object */
+   size_t relocs;               /* offset of relocation table */
+   size_t nRelocs;              /* number of pointers to relocate */
+} LVImgHeader;
+
+typedef struct {                /* image under construction */
+   char *buf;                   /* header and object area */
+   size_t used;                 /* bytes used in buf */
+   size_t size;                 /* bytes allocated to buf */
+   size_t base;                 /* preferred mapping address */
+   size_t root;                 /* offset of root object */
+   size_t *reloc;               /* offsets in buf of pointers */
+   size_t nReloc, maxReloc;
+} LVImgBuild;
+
 
 void InitLVNet(void);
 
@@ -285,6 +308,30 @@ void InitLVNet(void);
 LexNet *CreateLexNet (MemHeap *heap, Vocab *voc, HMMSet *hset, 
                       char *startWord, char *endWord, Boolean silDict);
 
+/* as CreateLexNet but map the compiled network image fn instead if it
+   was made from the same dictionary, HMM list and models, otherwise
+   build the net and write it to fn */
+
+LexNet *LoadLexNet (MemHeap *heap, char *fn, Vocab *voc, HMMSet *hset, 
+                    char *startWord, char *endWord, Boolean silDict);
+
+/* build an image: LVImgInit starts image b with a zeroed root object
+   of rootSize bytes, LVImgAlloc returns the offset of n zeroed bytes,
+   LVImgLink makes the pointer at offset at point to offset target
+   (0 for NULL) and LVImgWrite writes b to fn and frees it */
+
+size_t LVImgInit (LVImgBuild *b, size_t base, size_t rootSize);
+size_t LVImgAlloc (LVImgBuild *b, size_t n);
+void LVImgLink (LVImgBuild *b, size_t at, size_t target);
+void LVImgFree (LVImgBuild *b);
+ReturnStatus LVImgWrite (LVImgBuild *b, char *fn, char *magic, unsigned long key);
+
+/* map image fn and return its header, relocated if needed, or NULL if
+   it is missing or its magic or key do not match */
+
+char *LVImgMap (MemHeap *heap, char *fn, char *magic, unsigned long key);
+void LVImgUnmap (char *base);
+
 
 void ConvertSilDict (Vocab *voc, LabId spLab, LabId silLab, 
                      LabId startLab, LabId endLab);
@@ -31,6 +31,20 @@
 
 /* #### this should be generalised and moved into HMem as MHEAP-GC */
 
+/*
+   Traceback structures (WordendHyps, AltWordendHyps and ModendHyps)
+   are managed in two generations.  New ones are allocated from the
+   MSTAK newPathHeap.  Every gcFreq frames the ones still reachable
+   from active tokens are copied ("promoted") to the MHEAPs weHypHeap,
+   altweHypHeap and modendHypHeap and newPathHeap is reset as a whole,
+   so the cost depends on the number of tokens and of surviving new
+   paths only.  This works because a path is only changed in the frame
+   it was created in, so old paths never point to new ones.  Paths that
+   die after being promoted are reclaimed by a mark & sweep of the old
+   generation, which is only run when it has grown by a factor of
+   gcGrowth since the last such full collection.
+*/
+
 /* use highest bit in path->user for GC marking */
 /* # alternative would be a bitmap for each block in HMem
    # advantage would be that the sweep phase would be trivial
@@ -44,17 +58,17 @@
 /* mark AltWordendHyp in least significant bit of a->prev, which is normally 
    always 0, since pointers are aligned */
 #define MARK_ALTPATH_MASK     0x00000001UL
-#define MARK_ALTPATH(a)         (a->prev = (int)(a->prev) | MARK_ALTPATH_MASK)
-#define MARKED_ALTPATH_P(a)     ((int)((a)->prev) & MARK_ALTPATH_MASK)
-#define UNMARK_ALTPATH(a)       (a->prev = (int)(a->prev) & ~MARK_ALTPATH_MASK)
+#define MARK_ALTPATH(a)         (a->prev = (WordendHyp *) ((size_t)(a->prev) | MARK_ALTPATH_MASK))
+#define MARKED_ALTPATH_P(a)     ((size_t)((a)->prev) & MARK_ALTPATH_MASK)
+#define UNMARK_ALTPATH(a)       (a->prev = (WordendHyp *) ((size_t)(a->prev) & ~MARK_ALTPATH_MASK))
 
-#define GC_ALTPATH_PREV(a)      ((WordendHyp *) ((int)(a)->prev & ~MARK_ALTPATH_MASK))
+#define GC_ALTPATH_PREV(a)      ((WordendHyp *) ((size_t)(a)->prev & ~MARK_ALTPATH_MASK))
 
 #ifdef MODALIGN
 #define MARK_MODPATH_MASK     0x00000001UL
-#define MARK_MODPATH(m)         (m->ln = (int)((m)->ln) | MARK_MODPATH_MASK)
-#define MARKED_MODPATH_P(m)     ((int)((m)->ln) & MARK_MODPATH_MASK)
-#define UNMARK_MODPATH(m)       (m->ln = (int)((m)->ln) & ~MARK_MODPATH_MASK)
+#define MARK_MODPATH(m)         (m->ln = (LexNode *) ((size_t)((m)->ln) | MARK_MODPATH_MASK))
+#define MARKED_MODPATH_P(m)     ((size_t)((m)->ln) & MARK_MODPATH_MASK)
+#define UNMARK_MODPATH(m)       (m->ln = (LexNode *) ((size_t)((m)->ln) & ~MARK_MODPATH_MASK))
 
 
 static void MarkModPath (ModendHyp *m)
@@ -116,7 +130,7 @@ static void MarkTokSet (TokenSet *ts)
    }
 }
 
-static void SweepPaths (MemHeap *heap)
+static int SweepPaths (MemHeap *heap)
 {
    int i;
    BlockP b;
@@ -169,9 +183,10 @@ static void SweepPaths (MemHeap *heap)
 
    if (trace&T_GC)
       printf ("freed %d of %d Paths\n", freed, total);
+   return freed;
 }
 
-static void SweepAltPaths (MemHeap *heap)
+static int SweepAltPaths (MemHeap *heap)
 {
    int i;
    BlockP b;
@@ -222,10 +237,11 @@ static void SweepAltPaths (MemHeap *heap)
 
    if (trace&T_GC)
       printf ("freed %d of %d AltPaths\n", freed, total);
+   return freed;
 }
 
 #ifdef MODALIGN
-static void SweepModPaths (MemHeap *heap)
+static int SweepModPaths (MemHeap *heap)
 {
    int i;
    BlockP b;
@@ -275,35 +291,173 @@ static void SweepModPaths (MemHeap *heap)
 
    if (trace&T_GC)
       printf ("freed %d of %d ModPaths\n", freed, total);
+   return freed;
+}
+#endif
+
+/* forwarding of promoted new paths: the copy is stored in prev
+   (WordendHyp, ModendHyp) or next (AltWordendHyp) of the original */
+#define FWD_PATH_MASK  0x4000
+#define FWD_PATH(p,q)           ((p)->prev = (q), (p)->user |= FWD_PATH_MASK)
+#define FWD_PATH_P(p)           ((p)->user & FWD_PATH_MASK)
+
+#define FWD_ALTPATH(a,q)        ((a)->next = (AltWordendHyp *) ((size_t)(q) | 1))
+#define FWD_ALTPATH_P(a)        ((size_t)((a)->next) & 1)
+#define FWD_ALTPATH_DEST(a)     ((AltWordendHyp *) ((size_t)((a)->next) & ~1UL))
+
+#ifdef MODALIGN
+#define FWD_MODPATH(m,q)        ((m)->prev = (q), \
+                                 (m)->ln = (LexNode *) ((size_t)((m)->ln) | 1))
+#define FWD_MODPATH_P(m)        ((size_t)((m)->ln) & 1)
+#endif
+
+/* NewPathP
+
+     TRUE if p was allocated in newPathHeap
+*/
+static Boolean NewPathP (DecoderInst *dec, Ptr p)
+{
+   BlockP b;
+
+   for (b = dec->newPathHeap.heap; b; b = b->next)
+      if ((ByteP) p >= (ByteP) b->data && (ByteP) p < (ByteP) b->data + b->firstFree)
+         return TRUE;
+   return FALSE;
+}
+
+#ifdef MODALIGN
+/* PromoteModPath
+
+     copy the new ModendHyps on path m to the old generation and
+     return the new start of m
+*/
+static ModendHyp *PromoteModPath (DecoderInst *dec, ModendHyp *m)
+{
+   ModendHyp *head, **p, *q;
+
+   p = &head;
+   while (m && NewPathP (dec, m)) {
+      if (FWD_MODPATH_P (m)) {
+         m = m->prev;
+         break;
+      }
+      q = (ModendHyp *) New (&dec->modendHypHeap, sizeof (ModendHyp));
+      *q = *m;
+      FWD_MODPATH (m, q);
+      dec->gcPromoted += sizeof (ModendHyp);
+      *p = q;
+      p = &q->prev;
+      m = q->prev;
+   }
+   *p = m;
+   return head;
+}
+#endif
+
+static AltWordendHyp *PromoteAltPaths (DecoderInst *dec, AltWordendHyp *alt);
+
+/* PromotePath
+
+     copy the new WordendHyps on path, and everything reachable from
+     them, to the old generation and return the new start of path
+*/
+static WordendHyp *PromotePath (DecoderInst *dec, WordendHyp *path)
+{
+   WordendHyp *head, **p, *q;
+
+   p = &head;
+   while (path && NewPathP (dec, path)) {
+      if (FWD_PATH_P (path)) {
+         path = path->prev;
+         break;
+      }
+      q = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+      *q = *path;
+      FWD_PATH (path, q);
+      dec->gcPromoted += sizeof (WordendHyp);
+      *p = q;
+      p = &q->prev;
+      q->alt = PromoteAltPaths (dec, q->alt);
+#ifdef MODALIGN
+      q->modpath = PromoteModPath (dec, q->modpath);
+#endif
+      path = q->prev;
+   }
+   *p = path;
+   return head;
+}
+
+/* PromoteAltPaths
+
+     as PromotePath for a list of alternatives
+*/
+static AltWordendHyp *PromoteAltPaths (DecoderInst *dec, AltWordendHyp *alt)
+{
+   AltWordendHyp *head, **p, *q;
+
+   p = &head;
+   while (alt && NewPathP (dec, alt)) {
+      if (FWD_ALTPATH_P (alt)) {
+         alt = FWD_ALTPATH_DEST (alt);
+         break;
+      }
+      q = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+      *q = *alt;
+      FWD_ALTPATH (alt, q);
+      dec->gcPromoted += sizeof (AltWordendHyp);
+      *p = q;
+      p = &q->next;
+      q->prev = PromotePath (dec, q->prev);
+#ifdef MODALIGN
+      q->modpath = PromoteModPath (dec, q->modpath);
+#endif
+      alt = q->next;
+   }
+   *p = alt;
+   return head;
 }
+
+/* OldPathBytes
+
+     bytes used by the old generation of paths
+*/
+static size_t OldPathBytes (DecoderInst *dec)
+{
+   size_t n;
+
+   n = dec->weHypHeap.totUsed * sizeof (WordendHyp);
+   if (dec->latgen)
+      n += dec->altweHypHeap.totUsed * sizeof (AltWordendHyp);
+#ifdef MODALIGN
+   if (dec->modAlign)
+      n += dec->modendHypHeap.totUsed * sizeof (ModendHyp);
 #endif
+   return n;
+}
 
 /* GarbageCollectPaths
 
-     dispose all WordEndhyps that are not reachable by active tokens
-     anymore
-     uses simple mark & sweep GC
+     promote the new paths reachable by active tokens to the old
+     generation and discard all other new paths.  If the old
+     generation has grown too much also dispose all old paths that are
+     not reachable any more, using simple mark & sweep GC
 */
 static void GarbageCollectPaths (DecoderInst *dec)
 {
    int i, l, N;
    LexNodeInst *inst;
    TokenSet *ts;
+   RelToken *tok;
+   Boolean full;
+   double start, pause, reclaimed;
+   size_t newUsed;
 
-   if (trace&T_GC) {
-      printf ("Garbage Collecting paths.\n");
-      PrintHeapStats (&dec->weHypHeap);
-      PrintHeapStats (&dec->altweHypHeap);
-#ifdef MODALIGN
-      if (dec->modAlign)
-        PrintHeapStats (&dec->modendHypHeap);
-#endif
-   }
-   /*# mark phase */
-   for (l = 0; l < dec->nLayers; ++l) {
-      if (trace&T_GC)
-         printf (" layer %d...\n", l);
+   start = ThreadCPUTime ();
 
+   /* promote new paths of all tokens */
+   dec->gcPromoted = 0;
+   newUsed = dec->newPathHeap.totUsed;
+   for (l = 0; l < dec->nLayers; ++l) {
       for (inst = dec->instsLayer[l]; inst; inst = inst->next) {
          switch (inst->node->type) {
          case LN_MODEL:
@@ -316,27 +470,69 @@ static void GarbageCollectPaths (DecoderInst *dec)
 
          for (i = 0; i < N; ++i) {
             ts = &inst->ts[i];
-            if (ts->n > 0)
-               MarkTokSet (ts);
+            for (tok = ts->relTok; tok < ts->relTok + ts->n; ++tok) {
+               tok->path = PromotePath (dec, tok->path);
+#ifdef MODALIGN
+               tok->modpath = PromoteModPath (dec, tok->modpath);
+#endif
+            }
          }
       }
    }
-
-   /* sweep phase */
-   SweepPaths (&dec->weHypHeap);
-   SweepAltPaths (&dec->altweHypHeap);
+   ResetHeap (&dec->newPathHeap);
+   reclaimed = (double) newUsed - dec->gcPromoted;
+
+   full = OldPathBytes (dec) > dec->gcFullLimit;
+   if (full) {
+      if (trace&T_GC) {
+         printf ("Garbage Collecting old paths.\n");
+         PrintHeapStats (&dec->weHypHeap);
+         if (dec->latgen)
+            PrintHeapStats (&dec->altweHypHeap);
 #ifdef MODALIGN
-   if (dec->modAlign)
-      SweepModPaths (&dec->modendHypHeap);
+         if (dec->modAlign)
+            PrintHeapStats (&dec->modendHypHeap);
 #endif
+      }
+      /*# mark phase */
+      for (l = 0; l < dec->nLayers; ++l) {
+         for (inst = dec->instsLayer[l]; inst; inst = inst->next) {
+            N = (inst->node->type == LN_MODEL) ? inst->node->data.hmm->numStates : 1;
+            for (i = 0; i < N; ++i) {
+               ts = &inst->ts[i];
+               if (ts->n > 0)
+                  MarkTokSet (ts);
+            }
+         }
+      }
 
-   if (trace&T_GC) {
-      printf ("Garbage Collection finished.\n");
-      PrintHeapStats (&dec->weHypHeap);
-      PrintHeapStats (&dec->altweHypHeap);
+      /* sweep phase */
+      reclaimed += (double) SweepPaths (&dec->weHypHeap) * sizeof (WordendHyp);
+      if (dec->latgen)
+         reclaimed += (double) SweepAltPaths (&dec->altweHypHeap) * sizeof (AltWordendHyp);
 #ifdef MODALIGN
-   if (dec->modAlign)
-      PrintHeapStats (&dec->modendHypHeap);
+      if (dec->modAlign)
+         reclaimed += (double) SweepModPaths (&dec->modendHypHeap) * sizeof (ModendHyp);
 #endif
+      dec->gcFullLimit = gcGrowth * OldPathBytes (dec);
+      if (dec->gcFullLimit < GC_MIN_FULL)
+         dec->gcFullLimit = GC_MIN_FULL;
+   }
+
+   pause = ThreadCPUTime () - start;
+   if (full)
+      ++dec->gcStats.nFull;
+   else
+      ++dec->gcStats.nMinor;
+   dec->gcStats.reclaimed += reclaimed;
+   dec->gcStats.pause += pause;
+   if (pause > dec->gcStats.maxPause)
+      dec->gcStats.maxPause = pause;
+
+   if (trace&T_GC) {
+      printf ("GC frame %d %s: %.1f kB promoted, %.1f kB reclaimed, %.1f kB old, %.3f ms\n",
+              dec->frame, full ? "full" : "new", dec->gcPromoted / 1024.0,
+              reclaimed / 1024.0, OldPathBytes (dec) / 1024.0, pause * 1000.0);
+      fflush (stdout);
    }
 }
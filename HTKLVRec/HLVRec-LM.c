@@ -51,7 +51,7 @@ static void UpdateLMlookahead(DecoderInst *dec, LexNode *ln)
    assert (lmlaIdx != 0);
    assert (lmlaIdx < dec->net->laTree->nNodes + dec->net->laTree->nCompNodes);
    
-   ts = ln->inst->ts;
+   ts = LNINST(dec,ln)->ts;
    assert (ts->n > 0);
 
    bestDelta = LZERO;
@@ -146,6 +146,198 @@ static void ResetLMCache (LMCache *cache)
    cache->laHit = cache->laMiss = 0;
 }
 
+/******************* shared LM cache */
+
+/* With LMCACHESIZE > 0 the raw (unscaled) results of LMTransProb() and
+   LMLookAhead() are also kept in a cache of that many entries which
+   lives as long as the decoder and is shared by all its clones.  The
+   per-utterance LMCache above is consulted first.  When full the least
+   recently used entry is replaced.  Only n-gram LMs are cached. */
+
+typedef struct _SLMEntry SLMEntry;
+struct _SLMEntry {
+   LMState src;
+   int a;                       /* pronid for trans, loWE for lookahead */
+   int b;                       /* -1 for trans, hiWE for lookahead */
+   LogFloat prob;               /* unscaled LM log prob */
+   LMState dest;                /* dest state of trans */
+   SLMEntry *chain;             /* next entry in hash bucket */
+   SLMEntry *prev, *next;       /* LRU list, most recent after head */
+};
+
+struct _SharedLMCache {
+   FSLM *lm;                    /* LM the entries belong to */
+   int size;                    /* max number of entries */
+   int nUsed;                   /* entries taken from pool */
+   unsigned long mask;          /* number of buckets - 1 */
+   SLMEntry *pool;              /* [0..size-1] */
+   SLMEntry **bucket;           /* [0..mask] hash chains */
+   SLMEntry head;               /* sentinel of circular LRU list */
+   Boolean shared;              /* used by several decoders? */
+   HLock lock;                  /* protects everything when shared */
+   long hit, miss;
+};
+
+/* CreateSharedLMCache
+
+     create a shared LM cache of size entries in heap or return NULL for size 0
+*/
+static SharedLMCache *CreateSharedLMCache (MemHeap *heap, int size)
+{
+   SharedLMCache *c;
+   unsigned long nb;
+
+   if (size <= 0)
+      return NULL;
+   c = (SharedLMCache *) New (heap, sizeof (SharedLMCache));
+   c->lm = NULL;
+   c->size = size;
+   for (nb = 1; nb < (unsigned long) size; nb <<= 1)
+      ;
+   c->mask = nb - 1;
+   c->pool = (SLMEntry *) New (heap, size * sizeof (SLMEntry));
+   c->bucket = (SLMEntry **) New (heap, nb * sizeof (SLMEntry *));
+   c->shared = FALSE;
+   c->lock = CreateHLock (heap);
+   c->hit = c->miss = 0;
+   FlushSharedLMCache (c);
+   return c;
+}
+
+/* FlushSharedLMCache
+
+     remove all entries
+*/
+static void FlushSharedLMCache (SharedLMCache *c)
+{
+   unsigned long i;
+
+   for (i = 0; i <= c->mask; ++i)
+      c->bucket[i] = NULL;
+   c->nUsed = 0;
+   c->head.prev = c->head.next = &c->head;
+}
+
+static unsigned long SLMHash (SharedLMCache *c, LMState src, int a, int b)
+{
+   unsigned long h;
+
+   h = (unsigned long) src;
+   h ^= h >> 16;
+   h = h * 0x45d9f3bUL + (unsigned long) a;
+   h ^= h >> 13;
+   h = h * 0x45d9f3bUL + (unsigned long) b;
+   h ^= h >> 16;
+   return h & c->mask;
+}
+
+/* SharedLMCacheFind
+
+     look up (src,a,b), return the entry moved to the front of the LRU
+     list or NULL; called with the lock held
+*/
+static SLMEntry *SharedLMCacheFind (SharedLMCache *c, LMState src, int a, int b)
+{
+   SLMEntry *e;
+
+   for (e = c->bucket[SLMHash (c, src, a, b)]; e; e = e->chain)
+      if (e->src == src && e->a == a && e->b == b)
+         break;
+   if (!e) {
+      ++c->miss;
+      return NULL;
+   }
+   ++c->hit;
+   e->prev->next = e->next; e->next->prev = e->prev;
+   e->next = c->head.next; e->prev = &c->head;
+   c->head.next->prev = e; c->head.next = e;
+   return e;
+}
+
+/* SharedLMCacheAdd
+
+     enter (src,a,b) replacing the least recently used entry if full;
+     called with the lock held
+*/
+static void SharedLMCacheAdd (SharedLMCache *c, LMState src, int a, int b,
+                              LogFloat prob, LMState dest)
+{
+   SLMEntry *e, **p;
+
+   if (c->nUsed < c->size)
+      e = &c->pool[c->nUsed++];
+   else {
+      e = c->head.prev;
+      for (p = &c->bucket[SLMHash (c, e->src, e->a, e->b)]; *p != e; p = &(*p)->chain)
+         ;
+      *p = e->chain;
+      e->prev->next = e->next; e->next->prev = e->prev;
+   }
+   e->src = src; e->a = a; e->b = b;
+   e->prob = prob; e->dest = dest;
+   p = &c->bucket[SLMHash (c, src, a, b)];
+   e->chain = *p; *p = e;
+   e->next = c->head.next; e->prev = &c->head;
+   c->head.next->prev = e; c->head.next = e;
+}
+
+/* SharedLMProb
+
+     return the unscaled LMTransProb() (b < 0) or LMLookAhead() for lm
+     using the shared cache
+*/
+static LogFloat SharedLMProb (SharedLMCache *c, FSLM *lm, LMState src, 
+                              int a, int b, LMState *dest)
+{
+   SLMEntry *e;
+   LogFloat prob;
+
+   if (c->shared) AcquireHLock (c->lock);
+   if (c->lm != lm) {
+      FlushSharedLMCache (c);
+      c->lm = lm;
+   }
+   e = SharedLMCacheFind (c, src, a, b);
+   if (e) {
+      prob = e->prob;
+      if (dest) *dest = e->dest;
+      if (c->shared) ReleaseHLock (c->lock);
+      return prob;
+   }
+   if (c->shared) ReleaseHLock (c->lock);
+
+   /* compute outside the lock, a racing thread may add the same entry */
+   if (b < 0)
+      prob = LMTransProb (lm, src, (PronId) a, dest);
+   else
+      prob = LMLookAhead (lm, src, (PronId) a, (PronId) b);
+
+   if (c->shared) AcquireHLock (c->lock);
+   if (c->lm == lm)
+      SharedLMCacheAdd (c, src, a, b, prob, dest ? *dest : NULL);
+   if (c->shared) ReleaseHLock (c->lock);
+   return prob;
+}
+
+/* EXPORT->GetSharedLMCacheStats: usage of the shared LM cache of dec
+
+     returns FALSE if dec has no shared LM cache
+*/
+Boolean GetSharedLMCacheStats (DecoderInst *dec, long *hit, long *miss,
+                               int *nUsed, size_t *mem)
+{
+   SharedLMCache *c = dec->sharedLM;
+
+   if (!c)
+      return FALSE;
+   if (c->shared) AcquireHLock (c->lock);
+   *hit = c->hit; *miss = c->miss; *nUsed = c->nUsed;
+   *mem = sizeof (SharedLMCache) + c->size * sizeof (SLMEntry) + 
+      (c->mask + 1) * sizeof (SLMEntry *);
+   if (c->shared) ReleaseHLock (c->lock);
+   return TRUE;
+}
+
 #if 0
 static void CacheLMLAprob (DecoderInst *dec, LMState lmState, int lmlaIdx, 
                            int hash, LMTokScore lmscore)
@@ -203,6 +395,8 @@ LMNodeCache* AllocLMNodeCache (LMCache *cache, int lmlaIdx)
 static LMTokScore LMCacheTransProb (DecoderInst *dec, FSLM *lm, 
                                     LMState src, PronId pronid, LMState *dest)
 {
+   if (dec->sharedLM && lm->type == fslm_ngram)
+      return dec->lmScale * SharedLMProb (dec->sharedLM, lm, src, pronid, -1, dest);
    return dec->lmScale * LMTransProb (lm, src, pronid, dest);
 
 #if 0
@@ -338,8 +532,12 @@ static LMTokScore LMCacheLookaheadProb (DecoderInst *dec, LMState lmState,
          
          laNode = &laTree->node[lmlaIdx];
          ++cache->laMiss;
-         lmscore = dec->lmScale * LMLookAhead (dec->lm, lmState, 
-                                               laNode->loWE, laNode->hiWE);
+         if (dec->sharedLM && dec->lm->type == fslm_ngram)
+            lmscore = dec->lmScale * SharedLMProb (dec->sharedLM, dec->lm, lmState, 
+                                                   laNode->loWE, laNode->hiWE, NULL);
+         else
+            lmscore = dec->lmScale * LMLookAhead (dec->lm, lmState, 
+                                                  laNode->loWE, laNode->hiWE);
       }
       else {         /* complex node */
          CompLMlaNode *laNode;
@@ -142,14 +142,14 @@ static WordendHyp *CombinePaths (DecoderInst *dec, RelToken *winner, RelToken *l
 
    /*   assert (winner->path->score > loser->path->score);  */
 
-   weHyp = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+   weHyp = (WordendHyp *) New (&dec->newPathHeap, sizeof (WordendHyp));
    *weHyp = *winner->path;
 
    weHyp->frame = dec->frame;
 
    p = &weHyp->alt;
    for (alt = winner->path->alt; alt; alt = alt->next) {
-      newalt = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+      newalt = (AltWordendHyp *) New (&dec->newPathHeap, sizeof (AltWordendHyp));
       *newalt = *alt;
       newalt->next = NULL;
       *p = newalt;
@@ -158,7 +158,7 @@ static WordendHyp *CombinePaths (DecoderInst *dec, RelToken *winner, RelToken *l
 
    /* add info from looser */
 
-   newalt = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+   newalt = (AltWordendHyp *) New (&dec->newPathHeap, sizeof (AltWordendHyp));
    newalt->prev = loser->path->prev;
    newalt->score = diff;
    newalt->lm = loser->path->lm;
@@ -174,7 +174,7 @@ static WordendHyp *CombinePaths (DecoderInst *dec, RelToken *winner, RelToken *l
          it anyway later on */
       /* should be latprunebeam? */
       if (diff + alt->score > -dec->beamWidth) {
-         newalt = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+         newalt = (AltWordendHyp *) New (&dec->newPathHeap, sizeof (AltWordendHyp));
          *newalt = *alt;
          newalt->score = diff + alt->score;
          newalt->next = NULL;
@@ -202,8 +202,9 @@ static WordendHyp *CombinePaths (DecoderInst *dec, RelToken *winner, RelToken *l
   Debug_DumpNet
 
 */
-void Debug_DumpNet (LexNet *net)
+void Debug_DumpNet (DecoderInst *dec)
 {
+   LexNet *net = dec->net;
    int i, j, k, N;
    LexNode *ln;
    LexNodeInst *inst;
@@ -224,7 +225,7 @@ void Debug_DumpNet (LexNet *net)
 
    for (i = 0; i < net->nNodes; ++i) {
       ln = &net->node[i];
-      inst = ln->inst;
+      inst = LNINST(dec,ln);
       if (inst) {
          fprintf (debugFile, "node %d  (LexNode *) %p", i, ln);
          fprintf (debugFile, " type %d nfoll %d", ln->type, ln->nfoll);
@@ -188,6 +188,25 @@ static void OutPBlock (DecoderInst *dec, Observation **obsBlock,
 #endif
 
 
+/* ScoreState
+
+     calculate the outP of state sIdx for the current block of observations
+     and store it in the cache
+*/
+static void ScoreState (DecoderInst *dec, int sIdx)
+{
+   OutPCache *cache = dec->outPCache;
+
+   /* #### handle boundary case where we don't have cache->block obs left */
+   if (!dec->si->useHModel) 
+      OutPBlock (dec->si, &dec->obsBlock[0], cache->block,
+                 sIdx, dec->acScale, &cache->stateOutP[sIdx * cache->block]);
+   else
+      OutPBlock_HMod (dec, &dec->obsBlock[0], cache->block,
+                      sIdx, &cache->stateOutP[sIdx * cache->block],
+                      dec->frame);
+}
+
 /* cOutP
 
      caching version of OutP from HModel. This only caches only on a state 
@@ -223,16 +242,7 @@ static LogFloat cOutP (DecoderInst *dec, Observation *x, HLink hmm, int state)
    else {
       ++cache->cacheMiss;
       if (!cache->mixOutP) {     /* don't bother caching mixtures */
-         /* #### handle boundary case where we don't have cache->block obs left */
-
-         if (!dec->si->useHModel) 
-            OutPBlock (dec->si, &dec->obsBlock[0], cache->block,
-                       sIdx, dec->acScale, &cache->stateOutP[sIdx * cache->block]);
-         else
-            OutPBlock_HMod (dec->si, &dec->obsBlock[0], cache->block,
-                            sIdx, dec->acScale, &cache->stateOutP[sIdx * cache->block],
-                            dec->frame);
-            
+         ScoreState (dec, sIdx);
          cache->stateT[sIdx] = dec->frame;
          outP = cache->stateOutP[sIdx * cache->block];
 #if 0   /* sanity checking for OutPBlock */
@@ -265,14 +275,18 @@ x      CACHE_FLAG_SET(dec, sIdx);
 /*  outP calculation from HModel.c and extended for new adapt code */
 
 
-static LogFloat SOutP_HMod (HMMSet *hset, int s, Observation *x, StreamElem *se,
+static LogFloat SOutP_HMod (DecoderInst *dec, int s, Observation *x, StreamElem *se,
                             int id)
 {
-   int m;
+   HMMSet *hset = dec->hset;
+   ScoreContext *sc = dec->sctx;
+   AdaptXForm *inXForm = dec->inXForm;
+   int m,nSel;
    LogFloat bx,px,wt,det;
    MixtureElem *me;
    MixPDF *mp;
    Vector v,otvs;
+   unsigned char *cell;
    
    /* Note hset->kind == SHAREDHS */
    assert (hset->hsKind == SHAREDHS);
@@ -280,18 +294,31 @@ static LogFloat SOutP_HMod (HMMSet *hset, int s, Observation *x, StreamElem *se,
    v=x->fv[s];
    me=se->spdf.cpdf+1;
    if (se->nMix==1){     /* Single Mixture Case */
-      bx= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
+      bx= CtxMOutP(sc,ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
       bx += det;
    } else if (!pde) {
-      bx=LZERO;                   /* Multi Mixture Case */
+      cell = GSelCell(hset,s,x);
+      bx=LZERO; nSel=0;           /* Multi Mixture Case */
       for (m=1; m<=se->nMix; m++,me++) {
          wt = MixLogWeight(hset,me->weight);
-         if (wt>LMINMIX) {   
-            px= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
+         if (wt>LMINMIX && (!cell || GSEL_ISSET(cell,me->mpdf->mIdx))) {   
+            px= CtxMOutP(sc,ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
             px += det;
-            bx=LAdd(bx,wt+px);
+            bx=LAdd(bx,wt+px); ++nSel;
          }
       }
+      if (cell && nSel == 0) {     /* empty shortlist */
+         if (hset->gsel->floor > LSMALL)
+            bx = hset->gsel->floor;
+         else
+            for (m=1,me=se->spdf.cpdf+1; m<=se->nMix; m++,me++) {
+               wt = MixLogWeight(hset,me->weight);
+               if (wt>LMINMIX) {   
+                  px= CtxMOutP(sc,ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
+                  bx=LAdd(bx,wt+px+det);
+               }
+            }
+      }
    } else {   /* Partial distance elimination */
       wt = MixLogWeight(hset,me->weight);
       mp = me->mpdf;
@@ -303,7 +330,7 @@ static LogFloat SOutP_HMod (HMMSet *hset, int s, Observation *x, StreamElem *se,
 	 if (wt>LMINMIX){
 	    mp = me->mpdf;
 	    otvs = ApplyCompFXForm(mp,v,inXForm,&det,id);
-	    if (PDEMOutP(otvs,mp,&px,bx-wt-det) == TRUE)
+	    if (CtxPDEMOutP(sc,otvs,mp,&px,bx-wt-det) == TRUE)
 	      bx = LAdd(bx,wt+px+det);
 	 }
       }
@@ -311,7 +338,7 @@ static LogFloat SOutP_HMod (HMMSet *hset, int s, Observation *x, StreamElem *se,
    return bx;
 }
 
-LogFloat POutP_HModel (HMMSet *hset,Observation *x, StateInfo *si, int id)
+LogFloat POutP_HModel (DecoderInst *dec, Observation *x, StateInfo *si, int id)
 {
    LogFloat bx;
    StreamElem *se;
@@ -319,26 +346,210 @@ LogFloat POutP_HModel (HMMSet *hset,Observation *x, StateInfo *si, int id)
    int s,S = x->swidth[0];
    
    if (S==1 && si->weights==NULL)
-      return SOutP_HMod(hset,1,x,si->pdf+1, id);
+      return SOutP_HMod(dec,1,x,si->pdf+1, id);
    bx=0.0; se=si->pdf+1; w = si->weights;
    for (s=1;s<=S;s++,se++)
-      bx += w[s]*SOutP_HMod(hset,s,x,se, id);
+      bx += w[s]*SOutP_HMod(dec,s,x,se, id);
    return bx;
 }
 
-void OutPBlock_HMod (StateInfo_lv *si, Observation **obsBlock, 
-                int n, int sIdx, float acScale, LogFloat *outP, int id)
+void OutPBlock_HMod (DecoderInst *dec, Observation **obsBlock, 
+                int n, int sIdx, LogFloat *outP, int id)
 {
    int i;
+   StateInfo_lv *si = dec->si;
 
    assert  (si->useHModel);
    
    for (i = 0; i < n; ++i) {
-      outP[i] = POutP_HModel (si->hset, obsBlock[i], si->si[sIdx], id);
+      outP[i] = POutP_HModel (dec, obsBlock[i], si->si[sIdx], id);
    }
    
    /* acoustic scaling */
-   if (acScale != 1.0)
+   if (dec->acScale != 1.0)
       for (i = 0; i < n; ++i)
-         outP[i] *= acScale;
+         outP[i] *= dec->acScale;
+}
+
+
+/* ---------------------- parallel scoring ---------------------- */
+
+/* With SCORETHREADS > 1 the states needed in a frame are collected before
+   the internal propagation and scored into the OutPCache by a pool of
+   helper threads together with the decoding thread. cOutP() then only
+   finds cache hits. */
+
+#define SCORECHUNK 8            /* states taken by a thread at a time */
+
+struct _ScorePool {
+   int nThreads;                /* scoring threads incl. the decoder's own */
+   HLock lock;                  /* protects the fields below */
+   HSignal start;               /* broadcast when a new job is available */
+   HSignal done;                /* broadcast when the last helper finishes */
+   int job;                     /* number of the current job */
+   int nBusy;                   /* helpers still working on the job */
+   int next;                    /* next unclaimed entry of list */
+   int nList;                   /* number of states in list */
+   int *list;                   /* sIdx of the states to score */
+   Boolean *live;               /* [1..maxNStates] live token sets of a model */
+   DecoderInst *dec;
+};
+
+/* ScoreShare
+
+     claim and score chunks of the job until none are left,
+     called and returns with pool->lock held
+*/
+static void ScoreShare (ScorePool *pool)
+{
+   int i, end;
+
+   while (pool->next < pool->nList) {
+      i = pool->next;
+      end = i + SCORECHUNK;
+      if (end > pool->nList)
+         end = pool->nList;
+      pool->next = end;
+      ReleaseHLock (pool->lock);
+      for ( ; i < end; ++i)
+         ScoreState (pool->dec, pool->list[i]);
+      AcquireHLock (pool->lock);
+   }
+}
+
+/* ScoreHelper: body of a helper thread */
+static Ptr ScoreHelper (Ptr arg)
+{
+   ScorePool *pool = (ScorePool *) arg;
+   int job = 0;
+
+   AcquireHLock (pool->lock);
+   for (;;) {
+      while (pool->job == job)
+         WaitHSignal (pool->start, pool->lock);
+      job = pool->job;
+      ScoreShare (pool);
+      if (--pool->nBusy == 0)
+         BroadcastHSignal (pool->done);
+   }
+   /* never reached, helpers live as long as the decoder */
+   return NULL;
+}
+
+/* CreateScorePool
+
+     start nThreads-1 helper threads scoring for dec,
+     returns NULL if states are to be scored on demand
+*/
+static ScorePool *CreateScorePool (DecoderInst *dec, int nThreads)
+{
+   ScorePool *pool;
+   int i;
+
+   if (nThreads <= 1)
+      return NULL;
+   if (!ThreadsAvailable ()) {
+      HError (-9999, "CreateScorePool: no thread support, ignoring SCORETHREADS");
+      return NULL;
+   }
+   if (dec->si->useHModel) {
+      HError (-9999, "CreateScorePool: SCORETHREADS not supported with USEHMODEL, ignored");
+      return NULL;
+   }
+
+   pool = (ScorePool *) New (&dec->heap, sizeof (ScorePool));
+   pool->nThreads = nThreads;
+   pool->lock = CreateHLock (&dec->heap);
+   pool->start = CreateHSignal (&dec->heap);
+   pool->done = CreateHSignal (&dec->heap);
+   pool->job = pool->nBusy = pool->next = pool->nList = 0;
+   pool->list = (int *) New (&dec->heap, dec->outPCache->nStates * sizeof (int));
+   pool->live = (Boolean *) New (&dec->heap, (dec->maxNStates+1) * sizeof (Boolean));
+   pool->dec = dec;
+
+   for (i = 1; i < nThreads; ++i)
+      CreateHThread (&dec->heap, ScoreHelper, pool);
+
+   return pool;
 }
+
+/* AddStateToScore
+
+     add state j of hmm to the job unless it is cached already
+*/
+static void AddStateToScore (DecoderInst *dec, ScorePool *pool, HLink hmm, int j)
+{
+   OutPCache *cache = dec->outPCache;
+   int sIdx;
+
+   sIdx = hmm->svec[j].info->sIdx;
+   if (dec->frame - cache->stateT[sIdx] >= cache->block) {
+      ++cache->cacheMiss;
+      cache->stateT[sIdx] = dec->frame;
+      pool->list[pool->nList++] = sIdx;
+   }
+}
+
+/* ScoreActiveStates
+
+     score all states that PropagateInternal() will need in this frame.
+     The token sets are tested exactly as in PropagateInternal(), including
+     the beam pruning at its start, so the same states are scored as
+     on demand and the results are identical.
+*/
+static void ScoreActiveStates (DecoderInst *dec)
+{
+   ScorePool *pool = dec->scorePool;
+   LexNodeInst *inst;
+   TokenSet *instTS;
+   HLink hmm;
+   SMatrix trP;
+   Boolean *live = pool->live;
+   int l, i, j, N;
+
+   pool->nList = 0;
+   for (l = 0; l < dec->nLayers; ++l) {
+      for (inst = dec->instsLayer[l]; inst; inst = inst->next) {
+         if (inst->node->type != LN_MODEL)
+            continue;
+         hmm = inst->node->data.hmm;
+         N = hmm->numStates;
+         trP = hmm->transP;
+         instTS = inst->ts;
+         for (i = 1; i < N; ++i)
+            live[i] = instTS[i-1].n > 0 && instTS[i-1].score >= dec->beamLimit;
+
+         if (hmm->tIdx < 0) {           /* left-to-right, see PropagateInternal */
+            for (j = 2; j < N; ++j)
+               if (live[j] || (j > 2 && live[j-1]) || 
+                   (j == 2 && live[1] && trP[1][2] > LSMALL))
+                  AddStateToScore (dec, pool, hmm, j);
+         }
+         else {
+            for (j = 2; j < N; ++j)
+               for (i = 1; i < N; ++i)
+                  if (live[i] && trP[i][j] > LSMALL) {
+                     AddStateToScore (dec, pool, hmm, j);
+                     break;
+                  }
+         }
+      }
+   }
+
+   if (pool->nList <= SCORECHUNK) {     /* not worth waking the helpers */
+      for (i = 0; i < pool->nList; ++i)
+         ScoreState (dec, pool->list[i]);
+      return;
+   }
+
+   AcquireHLock (pool->lock);
+   pool->next = 0;
+   pool->nBusy = pool->nThreads - 1;
+   ++pool->job;
+   BroadcastHSignal (pool->start);
+   ScoreShare (pool);
+   while (pool->nBusy > 0)
+      WaitHSignal (pool->done, pool->lock);
+   ReleaseHLock (pool->lock);
+}
+
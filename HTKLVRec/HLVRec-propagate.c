@@ -32,23 +32,74 @@
 char *hlvrec_prop_vc_id = "$Id: HLVRec-propagate.c,v 1.1.1.1 2006/10/11 09:54:56 jal58 Exp $";
 
 
-static int winTok_cmp (const void *v1,const void *v2)
+/* SelectDelta
+
+     return the k-th largest (1 <= k <= n) of the n deltas d[],
+     reordering d[] (Hoare's selection)
+*/
+static RelTokScore SelectDelta (RelTokScore *d, int n, int k)
 {
-   RelToken **tok1,**tok2;
+   int lo, hi, i, j;
+   RelTokScore pivot, t;
 
-   tok1 = (RelToken **) v1;
-   tok2 = (RelToken **) v2;
-   return ((int) ((*tok2)->delta - (*tok1)->delta));   /* reverse! i.e. largest first */
+   lo = 0; hi = n - 1; --k;
+   while (lo < hi) {
+      pivot = d[(lo + hi) / 2];
+      i = lo; j = hi;
+      do {
+         while (d[i] > pivot) ++i;
+         while (d[j] < pivot) --j;
+         if (i <= j) {
+            t = d[i]; d[i] = d[j]; d[j] = t;
+            ++i; --j;
+         }
+      } while (i <= j);
+      if (k <= j)
+         hi = j;
+      else if (k >= i)
+         lo = i;
+      else
+         break;
+   }
+   return d[k];
 }
 
+/* KthDelta
 
-/* stats for TokenSet Id optimisation */
-static int mts_copy = 0;
-static int mts_fast = 0;
-static int mts_slow = 0;
-static int mts_newid = 0;
-static int mts_newidNTOK = 0;
+     return the k-th largest (1 <= k <= n) of the n deltas d[],
+     overwriting d[]. A histogram of the deltas finds the bin holding
+     it and only the deltas in that bin are passed to SelectDelta,
+     which avoids most of its unpredictable branches.
+*/
+#define KD_NBINS 64
+static RelTokScore KthDelta (RelTokScore *d, int n, int k)
+{
+   int hist[KD_NBINS], i, b, m, c;
+   RelTokScore lo, hi, scale;
 
+   lo = hi = d[0];
+   for (i = 1; i < n; ++i) {
+      if (d[i] < lo) lo = d[i];
+      if (d[i] > hi) hi = d[i];
+   }
+   if (lo == hi)
+      return hi;
+   scale = (KD_NBINS - 0.5) / (lo - hi);   /* bin 0 holds the best */
+
+   for (b = 0; b < KD_NBINS; ++b)
+      hist[b] = 0;
+   for (i = 0; i < n; ++i)
+      ++hist[(int) ((d[i] - hi) * scale)];
+   for (b = 0, m = 0; m + hist[b] < k; ++b)
+      m += hist[b];
+
+   /* move the deltas in bin b to the front of d[] */
+   for (i = 0, c = 0; i < n; ++i) {
+      d[c] = d[i];
+      c += ((int) ((d[i] - hi) * scale) == b);
+   }
+   return SelectDelta (d, c, k - m);
+}
 
 /* MergeTokSet
 
@@ -74,10 +125,10 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
       dest->score = src->score + score;
       dest->id = src->id;
 
-      ++mts_copy;
-      for (i = 0, srcTok = src->relTok, destTok = dest->relTok; i < src->n; ++i, ++srcTok, ++destTok)
-         *destTok = *srcTok;
-      /*         dest->relTok[i] = src->relTok[i]; */
+#ifdef COLLECT_STATS
+      ++dec->stats.mtsCopy;
+#endif
+      memcpy (dest->relTok, src->relTok, src->n * sizeof (RelToken));
       return;
    } else if (prune && src->score + score < dec->beamLimit) {
       /*       printf ("MergeTokSet: pruned src TS\n"); */
@@ -87,7 +138,9 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
    else if (src->id == dest->id) {      /* TokenSet Id optimisation from [Odell:2000] */
       TokScore srcScore;
 
-      ++mts_fast;
+#ifdef COLLECT_STATS
+      ++dec->stats.mtsFast;
+#endif
       /* only compare Tokensets' best scores and pick better */
       srcScore = src->score + score;
       
@@ -101,28 +154,30 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
    }
 #endif
    else {    /* expensive MergeTokSet, #### move into separate function */
-#if 1
-      /* exploit & retain RelTok order (sorted by lmState?) */
-      int srcTokCount, destTokCount, nWinTok;
-      int nWin[2], winLoc;
-      RelToken *winTok;
+      /* both sets are sorted by (lmState, we_tag), the merged set is
+         built in that order in winTok, with the deltas also in
+         winDelta for KthDelta. Tokens outside deltaLimit are not
+         copied at all */
+      int srcTokCount, destTokCount, nWinTok, nWinSrc;
+      Boolean fromSrc;
+      RelToken *winTok, *tok;
+      RelTokScore *winDelta;
       TokScore winScore;
-      RelTokScore srcCorr, destCorr, deltaLimit;
+      RelTokScore srcCorr, destCorr, srcOff, deltaLimit, delta;
 
-      ++mts_slow;
+#ifdef COLLECT_STATS
+      ++dec->stats.mtsSlow;
+#endif
 
       winTok = dec->winTok;
-      nWinTok = 0;
+      winDelta = dec->winDelta;
+      nWinTok = nWinSrc = 0;
 
       srcTok = &src->relTok[0];
       destTok = &dest->relTok[0];
       srcTokCount = src->n;
       destTokCount = dest->n;
 
-      /* #### first go at sorted Tok merge, 
-         #### very explicit, no optimisation at all, yet! */
-      
-
       /* find best score */
       if (src->score + score > dest->score) {
          winScore = src->score + score;
@@ -133,6 +188,7 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
          srcCorr = src->score - winScore;
          destCorr = 0.0;
       }
+      srcOff = srcCorr + score;
 
       deltaLimit = dec->nTok * dec->relBeamWidth;  /* scaled relative beam, must initialize !!!*/;
       if (prune) {
@@ -150,65 +206,55 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
 #endif
       }
 
-      /* find winning tokens */
-      nWin[0] = nWin[1] = 0;    /* location where winnning toks came from:
-                                   0 == src   1 == dest */
+      /* find winning tokens, counting those from src in nWinSrc */
       do {
          if (TOK_LMSTATE_EQ(srcTok, destTok)) {
             /* pick winner */
-            if (src->score + srcTok->delta + score > dest->score + destTok->delta) {
-               /* store srcTok */
-               winTok[nWinTok] = *srcTok;
-               winTok[nWinTok].delta += srcCorr + score;
-               winLoc = 0;
-            } else {
-               /* store destTok */
-               winTok[nWinTok] = *destTok;
-               winTok[nWinTok].delta += destCorr;
-               winLoc = 1;
-            }
+            fromSrc = (src->score + srcTok->delta + score > dest->score + destTok->delta);
+            tok = fromSrc ? srcTok : destTok;
             ++srcTok;
             --srcTokCount;
             ++destTok;
             --destTokCount;
          } else if (TOK_LMSTATE_LT(srcTok, destTok)) {
-            /* store srcTok */
-            winTok[nWinTok] = *srcTok;
-            winTok[nWinTok].delta += srcCorr + score;
-            winLoc = 0;
+            fromSrc = TRUE;
+            tok = srcTok;
             ++srcTok;
             --srcTokCount;
          } else {
-            /* store destTok */
-            winTok[nWinTok] = *destTok;
-            winTok[nWinTok].delta += destCorr;
-            winLoc = 1;
+            fromSrc = FALSE;
+            tok = destTok;
             ++destTok;
             --destTokCount;
          }
-         
-         if (winTok[nWinTok].delta >= deltaLimit) {      /* keep or prune? */
+
+         delta = tok->delta + (fromSrc ? srcOff : destCorr);
+         if (delta >= deltaLimit) {      /* keep or prune? */
+            winTok[nWinTok] = *tok;
+            winTok[nWinTok].delta = winDelta[nWinTok] = delta;
             ++nWinTok;
-            ++nWin[winLoc];
+            if (fromSrc)
+               ++nWinSrc;
          }
       } while (srcTokCount != 0 && destTokCount != 0);
 
       /* add left overs to winTok set 
          only at most one of the two loops will actually do something */
-      for (i = srcTokCount; i > 0; --i, ++srcTok) {
-         winTok[nWinTok] = *srcTok;
-         winTok[nWinTok].delta += srcCorr + score;
-         if (winTok[nWinTok].delta >= deltaLimit) {     /* keep or prune? */
+      for (; srcTokCount > 0; --srcTokCount, ++srcTok) {
+         delta = srcTok->delta + srcOff;
+         if (delta >= deltaLimit) {
+            winTok[nWinTok] = *srcTok;
+            winTok[nWinTok].delta = winDelta[nWinTok] = delta;
             ++nWinTok;
-            ++nWin[0];
+            ++nWinSrc;
          }
       }
-      for (i = destTokCount; i > 0; --i, ++destTok) {
-         winTok[nWinTok] = *destTok;
-         winTok[nWinTok].delta += destCorr;
-         if (winTok[nWinTok].delta >= deltaLimit) {     /* keep or prune? */
+      for (; destTokCount > 0; --destTokCount, ++destTok) {
+         delta = destTok->delta + destCorr;
+         if (delta >= deltaLimit) {
+            winTok[nWinTok] = *destTok;
+            winTok[nWinTok].delta = winDelta[nWinTok] = delta;
             ++nWinTok;
-            ++nWin[1];
          }
       }
 
@@ -217,112 +263,54 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
 
       if (nWinTok <= dec->nTok) {
          /* just copy */
-         for (i = 0; i < nWinTok; ++i)
-            dest->relTok[i] = winTok[i];
+         memcpy (dest->relTok, winTok, nWinTok * sizeof (RelToken));
          dest->n = nWinTok;
          dest->score = winScore;
 
-         /*          printf ("MTS: %d nWin  %d src  %d dest\n", nWinTok, nWin[0], nWin[1]); */
-         if (nWin[0] == nWinTok)
+         if (nWinSrc == nWinTok)
             dest->id = src->id;          /* copy src->id */
-         else if (nWin[1] == nWinTok)
-            dest->id = dest->id;         /* copy dest->id */
-         else {
+         else if (nWinSrc > 0) {
             dest->id = ++dec->tokSetIdCount;    /* new id */
-            ++mts_newid;
+#ifdef COLLECT_STATS
+            ++dec->stats.mtsNewId;
+#endif
          }
       } else {
-         /* perform Bucket sort/Histogram pruning to reduce to dec->nTok tokens */
-#define NBINS 64
-
-         int n[NBINS], binLimit;
-         int nTok;
-
-         LogFloat binWidth, limit;
+         /* keep the dec->nTok tokens with the largest deltas in
+            LMState order. Of several tokens with delta equal to the
+            smallest one kept, the last ones are kept */
+         RelTokScore limit;
+         int nBetter, nSkip;
 
          dest->id = ++dec->tokSetIdCount;    /* #### new id always necessary? */
-         ++mts_newidNTOK;
-
-         binWidth = deltaLimit*1.001 / NBINS;   /* handle delta==deltaLimit case */
+#ifdef COLLECT_STATS
+         ++dec->stats.mtsNewIdNTOK;
+#endif
 
-         for (i = 0; i < NBINS; ++i)
-            n[i] = 0;
+         limit = KthDelta (winDelta, nWinTok, dec->nTok);
 
+         nBetter = nSkip = 0;
          for (i = 0; i < nWinTok; ++i) {
-            assert (((int) (winTok[i].delta / binWidth)) >= 0);
-            assert (((int) (winTok[i].delta / binWidth)) < NBINS);
-            ++n[(int) (winTok[i].delta / binWidth)];
-         }
-         
-         nTok = 0;
-         i = -1;
-         while (nTok < dec->nTok) {
-            ++i;
-            nTok += n[i];
+            nBetter += (winTok[i].delta > limit);
+            nSkip += (winTok[i].delta == limit);
          }
-         
-         if (nTok == dec->nTok) {
-            binLimit = i;
-            limit = binWidth * (i+1);
-
-
-            for (i = 0, j = 0; i < nWinTok; ++i) { 
-               if ((int) (winTok[i].delta / binWidth) <= binLimit) {
-                  dest->relTok[j] = winTok[i];
-                  ++j;
-               }
+         nSkip -= dec->nTok - nBetter;    /* tokens at limit to drop */
+
+         for (i = 0, j = 0; i < nWinTok; ++i) {
+            if (winTok[i].delta > limit)
+               dest->relTok[j++] = winTok[i];
+            else if (winTok[i].delta == limit) {
+               if (nSkip > 0)
+                  --nSkip;
+               else
+                  dest->relTok[j++] = winTok[i];
             }
-            assert (j == dec->nTok);
-         }
-         else {
-            int nBetter;
-            LogFloat bestDelta;
-            
-            /* do not include last bin */
-            limit = binWidth * i;
-            nTok -= n[i]; 
-
-            /* need to relax limit so that we get an extra (dec->nTok - nTok) tokens */
-            /* #### very simplistic implementation -- imporve? */
-
-            
-            bestDelta = limit;
-            do {
-               limit = bestDelta;
-               bestDelta = LZERO;
-               nBetter = 0;
-               for (i = 0, j = 0; i < nWinTok; ++i) {
-                  if (winTok[i].delta >= limit)
-                     ++nBetter;
-                  else
-                     if (winTok[i].delta > bestDelta)
-                        bestDelta = winTok[i].delta;
-               }
-            } while (nBetter < dec->nTok);
-            /*             printf ("nBetter %d\n", nBetter); */
-
-            if (nBetter > dec->nTok) {  /* multiple tokens with delta == limit
-                                           ==> delete some */
-               for (i = 0; nBetter > dec->nTok; ++i)
-                  if (winTok[i].delta == limit) {
-                     winTok[i].delta = LZERO;
-                     --nBetter;
-                  }
-            }
-         
-            for (i = 0, j = 0; i < nWinTok; ++i) { 
-               if (winTok[i].delta >= limit) {
-                  dest->relTok[j] = winTok[i];
-                  ++j;
-               }
-            }
-            assert (j == dec->nTok);
          }
+         assert (j == dec->nTok);
 
          dest->n = dec->nTok;
          dest->score = winScore;
       }
-#endif
       
 #ifndef NDEBUG   /* sanity check for reltoks */
    for (i = 0; i < dest->n; ++i) {
@@ -349,8 +337,6 @@ static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest,
 }
 
 
-static int PI_LR = 0;
-static int PI_GEN = 0;
 /* PropagateInternal
 
      Internal token propagation
@@ -387,7 +373,9 @@ static void PropagateInternal (DecoderInst *dec, LexNodeInst *inst)
    if (hmm->tIdx < 0) {
       /*         PropagateInternal_LR (dec, inst);  */
       
-      PI_LR++;
+#ifdef COLLECT_STATS
+      ++dec->stats.nPropLR;
+#endif
       bestScore = LZERO;
       
       /* loop transition for state N-1 (which has no forward trans) */
@@ -466,7 +454,9 @@ static void PropagateInternal (DecoderInst *dec, LexNodeInst *inst)
       
       tempTS = dec->tempTS[N];
       
-      PI_GEN++;
+#ifdef COLLECT_STATS
+      ++dec->stats.nPropGen;
+#endif
 #ifdef DEBUG_TRACE
       if (trace & T_PROP)
          printf ("#########################PropagateInternal hmm %p '%s':\n", inst->node,
@@ -595,7 +585,7 @@ void UpdateModPaths (DecoderInst *dec, TokenSet *ts, LexNode *ln)
       /* #### optimise by sharing ModendHyp's between tokens with
          same tok->modpath */
       for (i = 0, tok = ts->relTok; i < ts->n; ++i, ++tok) {
-         m = New (&dec->modendHypHeap, sizeof (ModendHyp));
+         m = New (&dec->newPathHeap, sizeof (ModendHyp));
          m->frame = dec->frame;
          m->ln = ln;
          m->prev = tok->modpath;
@@ -616,10 +606,10 @@ static void PropIntoNode (DecoderInst *dec, TokenSet *ts, LexNode *ln, Boolean u
    LexNodeInst *inst;
    TokScore best;
 
-   if (!ln->inst)                /* activate if necessary */
-      ActivateNode (dec, ln);
+   inst = LNINST(dec,ln);
+   if (!inst)                   /* activate if necessary */
+      inst = ActivateNode (dec, ln);
 
-   inst = ln->inst;
          
    /* propagate tokens from ln's exit into follLN's entry state */
    MergeTokSet (dec, ts, &inst->ts[0], 0.0, TRUE);
@@ -759,7 +749,7 @@ static void HandleWordend (DecoderInst *dec, LexNode *ln)
 
    assert (ln->type == LN_WORDEND);
 
-   inst = ln->inst;
+   inst = LNINST(dec,ln);
    assert (inst);
    ts = inst->ts;
    
@@ -850,7 +840,7 @@ static void HandleWordend (DecoderInst *dec, LexNode *ln)
             else {      /* latgen */
                AltWordendHyp *alt;
 
-               alt = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+               alt = (AltWordendHyp *) New (&dec->newPathHeap, sizeof (AltWordendHyp));
                
                if (newDelta > tokJ->delta) {
                   /* move tokJ->path to alt */
@@ -911,7 +901,10 @@ static void HandleWordend (DecoderInst *dec, LexNode *ln)
          ++newN;
 
          /* new wordendHyp */
-         weHyp = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+         weHyp = (WordendHyp *) New (&dec->newPathHeap, sizeof (WordendHyp));
+#ifdef COLLECT_STATS
+         ++dec->stats.nWordend;
+#endif
       
          weHyp->prev = prev;
          weHyp->pron = ln->data.pron;
@@ -998,7 +991,7 @@ static void UpdateWordEndHyp (DecoderInst *dec, LexNodeInst *inst)
 
       /* don't copy weHyp, if it is up-to-date (i.e. for <s>) */
       if (oldweHyp->frame != dec->frame || oldweHyp->pron != dec->net->startPron) {
-         weHyp = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+         weHyp = (WordendHyp *) New (&dec->newPathHeap, sizeof (WordendHyp));
          *weHyp = *oldweHyp;
          weHyp->score = ts->score + tok->delta;
          weHyp->frame = dec->frame;
@@ -1044,7 +1037,7 @@ static void AddPronProbs (DecoderInst *dec, TokenSet *ts, int var)
       if (path->user != var) {
          WordendHyp *weHyp;
 
-         weHyp = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+         weHyp = (WordendHyp *) New (&dec->newPathHeap, sizeof (WordendHyp));
          *weHyp = *path;
          weHyp->user = var;
          tok->path = weHyp;
@@ -1075,13 +1068,13 @@ void HandleSpSkipLayer (DecoderInst *dec, LexNodeInst *inst)
       lnSA = ln->foll[0]->foll[0];
                   
       /* node should be either inactive or empty */
-      assert (!lnSA->inst || lnSA->inst->ts[0].n == 0);
+      assert (!LNINST(dec,lnSA) || LNINST(dec,lnSA)->ts[0].n == 0);
       
       PropIntoNode (dec, &inst->ts[0], ln->foll[0]->foll[0], FALSE);
       
       /* add pronprobs and keep record of variant in path->user */
       /*   user = 0: - variant, 1: sp, 2: sil */
-      AddPronProbs (dec, &lnSA->inst->ts[0], 0);
+      AddPronProbs (dec, &LNINST(dec,lnSA)->ts[0], 0);
       
       /* now add sp variant pronprob to token set and propagate as normal */
       AddPronProbs (dec, &inst->ts[0], 1);
@@ -1135,6 +1128,88 @@ void HandleSpSkipLayer (DecoderInst *dec, LexNodeInst *inst)
    }
 }
 
+/* CountActive
+
+     count active instances and tokens at the end of a frame
+*/
+static void CountActive (DecoderInst *dec)
+{
+   LexNodeInst *inst;
+   int l, i, N, nInst, nTok, nLayer;
+
+   nInst = nTok = 0;
+   for (l = 0; l < dec->nLayers; ++l) {
+      nLayer = 0;
+      for (inst = dec->instsLayer[l]; inst; inst = inst->next) {
+         ++nLayer;
+         N = (inst->node->type == LN_MODEL) ? inst->node->data.hmm->numStates : 1;
+         for (i = 0; i < N; ++i)
+            nTok += inst->ts[i].n;
+      }
+      nInst += nLayer;
+#ifdef COLLECT_STATS
+      dec->stats.nLayerInst[l] = nLayer;
+#endif
+   }
+   dec->nActInst = nInst;
+   dec->nActTok = nTok;
+   if (nInst > dec->peakActInst)
+      dec->peakActInst = nInst;
+   if (nTok > dec->peakActTok)
+      dec->peakActTok = nTok;
+   dec->sumActInst += nInst;
+   dec->sumActTok += nTok;
+}
+
+/* AdaptBeams
+
+     adaptive pruning: scale the main beam by (active/target)^-adaptGain
+     so that the number of active instances and tokens approaches 
+     TARGETINSTS and TARGETTOKENS. The beam stays between ADAPTBEAMFLR 
+     times and once the -t beam, the wordend beam follows it.
+*/
+static void AdaptBeams (DecoderInst *dec)
+{
+   double r, f;
+   TokScore beam;
+
+   r = 0.0;
+   if (targetInsts > 0)
+      r = (double) dec->nActInst / targetInsts;
+   if (targetToks > 0 && (double) dec->nActTok / targetToks > r)
+      r = (double) dec->nActTok / targetToks;
+   if (r <= 0.0)
+      return;
+
+   f = pow (r, -adaptGain);
+   if (f < 0.5)                 /* limit change per frame */
+      f = 0.5;
+   else if (f > 2.0)
+      f = 2.0;
+   beam = dec->curBeamWidth * f;
+   if (beam > dec->beamWidth)
+      beam = dec->beamWidth;
+   else if (beam < adaptBeamFlr * dec->beamWidth)
+      beam = adaptBeamFlr * dec->beamWidth;
+
+   if (trace & T_PRUNE)
+      printf ("adapt beam: %d insts %d tokens, beam %f -> %f\n", 
+              dec->nActInst, dec->nActTok, dec->curBeamWidth, beam);
+   dec->curBeamWidth = beam;
+}
+
+/* STAGE_END
+
+     charge the wall clock time since t to stage s of the current
+     frame and restart the clock at the current time
+*/
+#ifdef COLLECT_STATS
+#define STAGE_END(dec,s,t) do { if ((dec)->stats.timing) { double now = WallClockTime (); \
+   (dec)->stats.stageTime[s] = now - (t); (t) = now; } } while (0)
+#else
+#define STAGE_END(dec,s,t)
+#endif
+
 /* ProcessFrame
 
      Takes the observation vector and propatagets all tokens and
@@ -1147,27 +1222,48 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
    LexNodeInst *inst, *prevInst, *next;
    int nActive, modelActive;
    TokScore beamLimit;
-   
-   inXForm = xform; /* sepcifies the transform to use */
+#ifdef COLLECT_STATS
+   double stageT = 0.0;
+
+   if (dec->stats.timing)
+      stageT = WallClockTime ();
+#endif
+   dec->inXForm = xform; /* sepcifies the transform to use */
    
    dec->obs = obsBlock[0];
    dec->nObs = nObs;
    for (i = 0; i < nObs; ++i)
       dec->obsBlock[i] = obsBlock[i];
+   if (!dec->si->useHModel)
+      LoadObs_lv (dec->si, dec->obsBlock, nObs);
    dec->bestScore = LZERO;
    dec->bestInst = NULL;
    ++dec->frame;
+   STAGE_END (dec, STAGE_OBS, stageT);
 
    if (dec->frame % gcFreq == 0)
       GarbageCollectPaths (dec);
+   STAGE_END (dec, STAGE_GC, stageT);
 
-   mts_copy = mts_fast = mts_slow = 0;
-   mts_newid = mts_newidNTOK = 0;
+#ifdef COLLECT_STATS
+   dec->stats.mtsCopy = dec->stats.mtsFast = dec->stats.mtsSlow = 0;
+   dec->stats.mtsNewId = dec->stats.mtsNewIdNTOK = 0;
+   dec->stats.nPropLR = dec->stats.nPropGen = 0;
+   dec->stats.nWordend = 0;
+#endif
+   /* per frame cache counters, read by the caller after ProcessFrame */
+   dec->outPCache->cacheHit = dec->outPCache->cacheMiss = 0;
+   dec->lmCache->transHit = dec->lmCache->transMiss = 0;
+   dec->lmCache->laHit = dec->lmCache->laMiss = 0;
 
    if (trace & T_BEST) {
       printf ("frame: %d beamLimit: %f\n", dec->frame, dec->beamLimit);
    }
 
+   if (dec->scorePool)
+      ScoreActiveStates (dec);
+   STAGE_END (dec, STAGE_OUTP, stageT);
+
    /* internal token propagation:
       order doesn't really matter, but we use the same as for external propagation */
    modelActive = 0;
@@ -1204,8 +1300,8 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
          /*         printf ("BEST %p %f\n", inst->node, inst->best); */
       }
 #if 0
-   printf ("MTS_copy: %d MTS_fast: %d  MTS slow: %d ", mts_copy, mts_fast, mts_slow);
-   printf ("MTS_newid: %d MTS_newidNTOK: %d\n", mts_newid, mts_newidNTOK);
+   printf ("MTS_copy: %d MTS_fast: %d  MTS slow: %d ", dec->stats.mtsCopy, dec->stats.mtsFast, dec->stats.mtsSlow);
+   printf ("MTS_newid: %d MTS_newidNTOK: %d\n", dec->stats.mtsNewId, dec->stats.mtsNewIdNTOK);
 #endif
       if (trace & T_TOKSTATS)
          printf ("Pass1: %d active nodes in layer %d\n", nActive, l);
@@ -1213,6 +1309,7 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
 
    if (trace & T_TOKSTATS)
       printf ("Sum Pass1: %d active models\n", modelActive);
+   STAGE_END (dec, STAGE_INT, stageT);
 
 
    /* now for all LN_MODEL nodes inst->best is set, this is used to determine 
@@ -1281,7 +1378,7 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
                prevInst = inst;
             }
          }
-         beamLimit = bestWEscore - dec->weBeamWidth;
+         beamLimit = bestWEscore - dec->curWeBeamWidth;
          if (dec->beamLimit > beamLimit)  /* global beam is tighter */
             beamLimit = dec->beamLimit; 
       }
@@ -1426,8 +1523,8 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
       } /* for inst */
 
 #if 0
-      printf ("MTS_copy: %d MTS_fast: %d  MTS slow: %d ", mts_copy, mts_fast, mts_slow);
-      printf ("MTS_newid: %d MTS_newidNTOK: %d\n", mts_newid, mts_newidNTOK);
+      printf ("MTS_copy: %d MTS_fast: %d  MTS slow: %d ", dec->stats.mtsCopy, dec->stats.mtsFast, dec->stats.mtsSlow);
+      printf ("MTS_newid: %d MTS_newidNTOK: %d\n", dec->stats.mtsNewId, dec->stats.mtsNewIdNTOK);
       printf ("LMCacheLA:  %d hits  %d misses\n", 
               dec->lmCache->laHit, dec->lmCache->laMiss);
 #endif
@@ -1438,7 +1535,12 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
 
    if (trace & T_TOKSTATS)
       printf ("Sum Pass2: %d %f \n", modelActive, dec->curBeamWidth);
+   STAGE_END (dec, STAGE_EXT, stageT);
 
+   /* size of search space for next frame */
+   CountActive (dec);
+   if (targetInsts > 0 || targetToks > 0)
+      AdaptBeams (dec);
 
 #if 1   /* max model pruning (using histogram pruning) */
 #define MMP_NBINS 128
@@ -1489,7 +1591,7 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
          if (trace & T_PRUNE)
             printf ("  new: %f\n", dec->curBeamWidth);
       }
-      else {       /* modelActive < maxModel */
+      else if (targetInsts <= 0 && targetToks <= 0) {  /* modelActive < maxModel */
          /* slowly increase beamWidth again */
          dec->curBeamWidth *= dynBeamInc;
          if (dec->curBeamWidth > dec->beamWidth)
@@ -1499,6 +1601,11 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
 #endif
 
    dec->beamLimit = dec->bestScore - dec->curBeamWidth;
+   if (targetInsts > 0 || targetToks > 0)
+      dec->curWeBeamWidth = dec->weBeamWidth * dec->curBeamWidth / dec->beamWidth;
+   if (dec->curBeamWidth < dec->minBeamWidth)
+      dec->minBeamWidth = dec->curBeamWidth;
+   STAGE_END (dec, STAGE_PRUNE, stageT);
 
 
 #ifdef COLLECT_STATS
@@ -1508,25 +1615,20 @@ void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
 #if 0
    printf ("cacheHits: %d  cacheMisses: %d\n", 
            dec->outPCache->cacheHit, dec->outPCache->cacheMiss);
-   printf ("MTS_copy: %d MTS_fast: %d  MTS slow: %d ", mts_copy, mts_fast, mts_slow);
-   printf ("MTS_newid: %d MTS_newidNTOK: %d\n", mts_newid, mts_newidNTOK);
+   printf ("MTS_copy: %d MTS_fast: %d  MTS slow: %d ", dec->stats.mtsCopy, dec->stats.mtsFast, dec->stats.mtsSlow);
+   printf ("MTS_newid: %d MTS_newidNTOK: %d\n", dec->stats.mtsNewId, dec->stats.mtsNewIdNTOK);
    printf ("tokSetIDcount: %d\n", dec->tokSetIdCount);
-   printf ("PI_LR: %d  PI_GEN: %d\n", PI_LR, PI_GEN);
+   printf ("PI_LR: %d  PI_GEN: %d\n", dec->stats.nPropLR, dec->stats.nPropGen);
 #endif
-   PI_LR = PI_GEN = 0;
-   dec->outPCache->cacheHit = dec->outPCache->cacheMiss = 0;
-
 #if 0
    printf ("LMCacheTrans:  %d hits  %d misses\n", 
            dec->lmCache->transHit, dec->lmCache->transMiss);
    printf ("LMCacheLA:  %d hits  %d misses\n", 
            dec->lmCache->laHit, dec->lmCache->laMiss);
 #endif
-   dec->lmCache->transHit = dec->lmCache->transMiss = 0;
-   dec->lmCache->laHit = dec->lmCache->laMiss = 0;
 
 #if 0
-   Debug_DumpNet (dec->net);
+   Debug_DumpNet (dec);
 #endif
 #if 0
    AccumulateStats (dec);
@@ -28,6 +28,16 @@
 /*                                  HTK LV Decoder             */
 /* ----------------------------------------------------------- */
 
+/* TraceBackInfo warnings, see PrintTraceBackInfo */
+#define TBW_NOENDTOK    0001    /* no token survived to sent end */
+#define TBW_DEAD        0002    /* best inst is dead as well */
+#define TBW_ENDINACTIVE 0004    /* end node not active */
+#define TBW_NOSENTEND   0010    /* no tokens in sentend, BuildLattice used */
+#define TBW_NOSILWE     0020    /* no active sil wordend nodes */
+#define TBW_FORCE       0040    /* forcing lattice output */
+#define TBW_FORCENOLM   0100    /* forced lattice without LM transitions */
+#define TBW_FORCEFAIL   0200    /* forced lattice failed */
+
 /* Print Path
  */
 static void PrintPath (DecoderInst *dec, WordendHyp *we)
@@ -91,6 +101,8 @@ TokenSet *BestTokSet (DecoderInst *dec)
    int i, N;
 
    bestInst = dec->bestInst;
+   if (!bestInst)
+      return NULL;
    switch (bestInst->node->type) {
    case LN_MODEL:
       N = bestInst->node->data.hmm->numStates;
@@ -108,8 +120,10 @@ TokenSet *BestTokSet (DecoderInst *dec)
    best = LZERO;
    for (i = 0; i < N; ++i) {
       tsi = &bestInst->ts[i];
-      if (tsi->n > 0 && tsi->score > best)
+      if (tsi->n > 0 && tsi->score > best) {
          ts = tsi;
+         best = tsi->score;
+      }
    }
    return (ts);
 }
@@ -123,24 +137,20 @@ Transcription *TraceBack(MemHeap *heap, DecoderInst *dec)
 {
    Transcription *trans;
    LabList *ll;
-   LLink lab, nextlab;
-   WordendHyp *weHyp;
    TokenSet *ts;
    RelToken *bestTok;
-   LogFloat prevScore, score;
    RelTokScore bestDelta;
-   Pron pron;
    int i;
-   HTime start;
 
-   if (dec->net->end->inst && dec->net->end->inst->ts->n > 0)
-      ts = dec->net->end->inst->ts;
+   dec->tbInfo.warn = 0;
+   if (LNINST(dec,dec->net->end) && LNINST(dec,dec->net->end)->ts->n > 0)
+      ts = LNINST(dec,dec->net->end)->ts;
    else {
-      HError (-9999, "no token survived to sent end!");
+      dec->tbInfo.warn |= TBW_NOENDTOK;
 
       ts = BestTokSet (dec);
       if (!ts) {        /* return empty transcription */
-         HError (-9999, "best inst is dead as well!");
+         dec->tbInfo.warn |= TBW_DEAD;
          trans = CreateTranscription (heap);
          ll = CreateLabelList (heap, 0);
          AddLabelList (ll, trans);
@@ -165,11 +175,29 @@ Transcription *TraceBack(MemHeap *heap, DecoderInst *dec)
       PrintRelTok (dec, bestTok);
    }
 
+   return Path2Transcription (heap, dec, bestTok->path);
+}
+
+/* Path2Transcription
+
+     create transcription of the words on path
+*/
+static Transcription *Path2Transcription (MemHeap *heap, DecoderInst *dec, 
+                                          WordendHyp *path)
+{
+   Transcription *trans;
+   LabList *ll;
+   LLink lab, nextlab;
+   WordendHyp *weHyp;
+   LogFloat prevScore, score;
+   Pron pron;
+   HTime start;
+
    trans = CreateTranscription (heap);
    ll = CreateLabelList (heap, 0);
 
    /* going backwards from </s> to <s> */
-   for (weHyp = bestTok->path; weHyp; weHyp = weHyp->prev) {
+   for (weHyp = path; weHyp; weHyp = weHyp->prev) {
       lab = CreateLabel (heap, ll->maxAuxLab);
       pron = dec->net->pronlist[weHyp->pron];
       if ((weHyp->user & 3) == 1)
@@ -207,6 +235,85 @@ Transcription *TraceBack(MemHeap *heap, DecoderInst *dec)
    return trans;
 }
 
+/* CommonPath
+
+     returns the latest WordendHyp shared by paths a and b or NULL.
+     Frame numbers decrease strictly along a path.
+*/
+static WordendHyp *CommonPath (WordendHyp *a, WordendHyp *b)
+{
+   while (a != b) {
+      if (!a || !b)
+         return NULL;
+      if (a->frame > b->frame)
+         a = a->prev;
+      else if (b->frame > a->frame)
+         b = b->prev;
+      else {
+         a = a->prev;
+         b = b->prev;
+      }
+   }
+   return a;
+}
+
+/* PartialTraceBack
+
+     returns the words on the path of the best token of the current frame
+     without changing the decoder state. *nStable is set to the number of
+     leading words that are on the paths of all active tokens, i.e. that
+     can no longer change.
+*/
+Transcription *PartialTraceBack (MemHeap *heap, DecoderInst *dec, int *nStable)
+{
+   Transcription *trans;
+   LabList *ll;
+   LLink lab;
+   LexNodeInst *inst;
+   TokenSet *ts;
+   RelToken *bestTok;
+   RelTokScore bestDelta;
+   WordendHyp *conv;
+   HTime convEnd;
+   int i, l, k, N;
+
+   *nStable = 0;
+   ts = BestTokSet (dec);
+   if (!ts || LNINST(dec,dec->bestInst->node) != dec->bestInst) {
+      trans = CreateTranscription (heap);
+      ll = CreateLabelList (heap, 0);
+      AddLabelList (ll, trans);
+      return trans;
+   }
+
+   bestDelta = LZERO;
+   bestTok = &ts->relTok[0];
+   for (i = 0; i < ts->n; ++i)
+      if (ts->relTok[i].delta > bestDelta) {
+         bestTok = &ts->relTok[i];
+         bestDelta = bestTok->delta;
+      }
+
+   /* find the point where the paths of all active tokens converge */
+   conv = bestTok->path;
+   for (l = 0; l < dec->nLayers && conv; ++l)
+      for (inst = dec->instsLayer[l]; inst && conv; inst = inst->next) {
+         N = (inst->node->type == LN_MODEL) ? inst->node->data.hmm->numStates : 1;
+         for (i = 0; i < N; ++i)
+            for (k = 0; k < inst->ts[i].n; ++k)
+               conv = CommonPath (conv, inst->ts[i].relTok[k].path);
+      }
+
+   trans = Path2Transcription (heap, dec, bestTok->path);
+   if (conv) {
+      convEnd = conv->frame * dec->frameDur * 1.0e7;
+      ll = trans->head;
+      for (lab = ll->head->succ; lab != ll->tail && lab->end <= convEnd; lab = lab->succ)
+         ++*nStable;
+   }
+   return trans;
+}
+
 /* LatTraceBackCount
 
      recursively assign numbers to wordendHyps (lattice nodes) and at the 
@@ -388,23 +495,28 @@ Lattice *LatTraceBack (MemHeap *heap, DecoderInst *dec)
    int i, nnodes = 0, nlinks = 0;
    WordendHyp *sentEndWE;
 
-   if (!dec->net->end->inst)
-      HError (-9999, "LatTraceBack: end node not active");
+   dec->tbInfo.latWarn = 0;
+   dec->tbInfo.nArcs = -1;
+   dec->tbInfo.nNodes = dec->tbInfo.nLinks = 0;
+   if (!LNINST(dec,dec->net->end)) {
+      dec->tbInfo.latWarn |= TBW_ENDINACTIVE;
+      dec->tbInfo.endToks = -1;
+   }
    else
-      printf ("found %d tokens in end state\n", dec->net->end->inst->ts->n);
+      dec->tbInfo.endToks = LNINST(dec,dec->net->end)->ts->n;
 
-   if (buildLatSE && dec->net->end->inst && dec->net->end->inst->ts->n == 1)
-      sentEndWE = dec->net->end->inst->ts->relTok[0].path;
+   if (buildLatSE && LNINST(dec,dec->net->end) && LNINST(dec,dec->net->end)->ts->n == 1)
+      sentEndWE = LNINST(dec,dec->net->end)->ts->relTok[0].path;
    else {
       if (buildLatSE)
-         HError (-9999, "no tokens in sentend -- falling back to BUILDLATSENTEND = F");
+         dec->tbInfo.latWarn |= TBW_NOSENTEND;
       sentEndWE = BuildLattice (dec);
    }
 
    if (!sentEndWE) {
-      HError (-9999, "LatTraceBack: no active sil wordend nodes");
+      dec->tbInfo.latWarn |= TBW_NOSILWE;
       if (forceLatOut) {
-         HError (-9999, "LatTraceBack: forcing lattice output");
+         dec->tbInfo.latWarn |= TBW_FORCE;
 #ifdef MODALIGN
          if (dec->modAlign) 
 /*             HError (-9999, "LatTraceBack: forced lattice output not supported with model-alignment"); */
@@ -421,7 +533,8 @@ Lattice *LatTraceBack (MemHeap *heap, DecoderInst *dec)
    LatTraceBackCount (dec, sentEndWE, &nnodes, &nlinks);
 
    ++nnodes;    /* !NULL lattice start node */
-   printf ("nnodes %d nlinks %d\n", nnodes, nlinks);
+   dec->tbInfo.nNodes = nnodes;
+   dec->tbInfo.nLinks = nlinks;
 
    /*# create lattice */
    lat = NewLattice (heap, nnodes, nlinks);
@@ -454,6 +567,42 @@ Lattice *LatTraceBack (MemHeap *heap, DecoderInst *dec)
    return lat;
 }
 
+/* EXPORT->PrintTraceBackInfo
+
+     print what TraceBack (lattice FALSE) or LatTraceBack (lattice
+     TRUE) recorded in dec->tbInfo, in the order they found it
+*/
+void PrintTraceBackInfo (DecoderInst *dec, Boolean lattice)
+{
+   TraceBackInfo *tb = &dec->tbInfo;
+
+   if (!lattice) {
+      if (tb->warn & TBW_NOENDTOK)
+         HError (-9999, "no token survived to sent end!");
+      if (tb->warn & TBW_DEAD)
+         HError (-9999, "best inst is dead as well!");
+      return;
+   }
+   if (tb->latWarn & TBW_ENDINACTIVE)
+      HError (-9999, "LatTraceBack: end node not active");
+   else
+      printf ("found %d tokens in end state\n", tb->endToks);
+   if (tb->latWarn & TBW_NOSENTEND)
+      HError (-9999, "no tokens in sentend -- falling back to BUILDLATSENTEND = F");
+   if (tb->latWarn & TBW_NOSILWE)
+      HError (-9999, "LatTraceBack: no active sil wordend nodes");
+   if (tb->latWarn & TBW_FORCE)
+      HError (-9999, "LatTraceBack: forcing lattice output");
+   if (tb->latWarn & TBW_FORCENOLM)
+      HError (-9999, "BuildForceLat: no tokens survived with valid LM transitions, inserting LM 0.0 arcs.");
+   if (tb->latWarn & TBW_FORCEFAIL)
+      HError (-9999, "BuildForceLat: unable to force building lattice, giving up. THIS SHOULDN'T HAPPEN!");
+   if (tb->nArcs >= 0)
+      printf ("found %d arcs\n", tb->nArcs);
+   if (tb->nNodes > 0)
+      printf ("nnodes %d nlinks %d\n", tb->nNodes, tb->nLinks);
+}
+
 
 
 /************      model-level traceback */
@@ -665,7 +814,7 @@ AltWordendHyp *FakeSEpath (DecoderInst *dec, RelToken *tok, Boolean useLM)
       assert (!useLM || dest == (Ptr) 0xfffffffe);
       lmScore += dec->insPen;
 
-      alt = (AltWordendHyp *) New (&dec->altweHypHeap, sizeof (AltWordendHyp));
+      alt = (AltWordendHyp *) New (&dec->newPathHeap, sizeof (AltWordendHyp));
       alt->next = NULL;
 
       if (!dec->fastlmla) {
@@ -701,7 +850,7 @@ WordendHyp *AltPathList2Path (DecoderInst *dec, AltWordendHyp *alt, PronId pron)
       }
    
    /* create full WordendHyp for best */
-   path = (WordendHyp *) New (&dec->weHypHeap, sizeof (WordendHyp));
+   path = (WordendHyp *) New (&dec->newPathHeap, sizeof (WordendHyp));
    path->prev = bestAlt->prev;
    path->pron = pron;
    path->frame = dec->frame;
@@ -721,7 +870,7 @@ WordendHyp *AltPathList2Path (DecoderInst *dec, AltWordendHyp *alt, PronId pron)
    }
    *pAlt = NULL;
 
-   printf ("found %d arcs\n", i);
+   dec->tbInfo.nArcs = i;
    return path;
 }
 
@@ -776,7 +925,7 @@ WordendHyp *BuildLattice (DecoderInst *dec)
                tok->path->modpath = tok->modpath;
                
                if (!silModend) {
-                  silModend = New (&dec->modendHypHeap, sizeof (ModendHyp));
+                  silModend = New (&dec->newPathHeap, sizeof (ModendHyp));
                   silModend->frame = dec->frame;
                   silModend->ln = ln;   /* dodgy, but we just need ln with 'sil' model... */
                   silModend->prev = NULL;
@@ -863,12 +1012,12 @@ WordendHyp *BuildForceLat (DecoderInst *dec)
 
    
    if (!alt) {  /* no valid LM transitions, try without */
-      HError (-9999, "BuildForceLat: no tokens survived with valid LM transitions, inserting LM 0.0 arcs.");
+      dec->tbInfo.latWarn |= TBW_FORCENOLM;
       alt = BuildLatAltList (dec, ts, FALSE);
    }
 
    if (!alt) {   /* how can this happen? */
-      HError (-9999, "BuildForceLat: unable to force building lattice, giving up. THIS SHOULDN'T HAPPEN!");
+      dec->tbInfo.latWarn |= TBW_FORCEFAIL;
       return NULL;
    }
 
@@ -45,6 +45,7 @@ char *hlvrec_vc_id = "$Id: HLVRec.c,v 1.1.1.1 2006/10/11 09:54:56 jal58 Exp $";
 #include "HUtil.h"
 #include "HNet.h"       /* for Lattice -- move to HLattice? */
 #include "HAdapt.h"
+#include "HThreads.h"
 
 #include "config.h"
 
@@ -81,6 +82,8 @@ static Boolean buildLatSE = FALSE;/* build lat from single tok in SENTEND node *
 static Boolean forceLatOut = TRUE;/* always output lattice, even when no token survived */
 
 static int gcFreq = 100;          /* run Garbage Collection every gcFreq frames */
+static float gcGrowth = 2.0;      /* full GC when old paths grow by this factor */
+#define GC_MIN_FULL 1048576       /* no full GC while old paths use fewer bytes */
 
 static Boolean pde = FALSE;      /* partial distance elimination */
 
@@ -88,6 +91,12 @@ static Boolean useOldPrune = FALSE;     /* backward compatibility for max model
 static Boolean mergeTokOnly = TRUE;     /* if merge token set with pruning */
 static float maxLNBeamFlr = 0.8;        /* maximum percentile of glogal beam for max model pruning */
 static float dynBeamInc = 1.3;          /* dynamic beam increment for max model pruning */
+static int targetInsts = 0;             /* adaptive pruning: target number of active insts */
+static int targetToks = 0;              /* adaptive pruning: target number of active tokens */
+static float adaptGain = 0.5;           /* adaptive pruning: exponent of beam update */
+static float adaptBeamFlr = 0.2;        /* adaptive pruning: min fraction of main beam */
+static int scoreThreads = 1;            /* threads scoring the states of a frame */
+static int lmCacheSize = 0;             /* entries in shared LM cache, 0 = none */
 #define LAYER_SIL_NTOK_SCALE 6          /* SIL layer re-adjust token set size e.g. 6 */
 
 /* -------------------------- Global Variables --------------------- */
@@ -99,7 +108,6 @@ Token debug_nullTok = {(void *) 7, LZERO, LZERO, NULL};
 #endif
 MemHeap recCHeap;                       /* CHEAP for small general allocation */
                                         /* avoid wherever possible! */
-static AdaptXForm *inXForm;
 
 /* --------------------------- Prototypes ---------------------- */
 
@@ -116,6 +124,7 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
                       int maxModel, 
                       LogFloat insPen, float acScale, float pronScale, float lmScale,
                       LogFloat fastlmlaBeam);
+DecoderInst *CloneDecoderInst (DecoderInst *dec);
 void CleanDecoderInst (DecoderInst *dec);
 static TokenSet *NewTokSetArray(DecoderInst *dec, int N);
 static TokenSet *NewTokSetArrayVar(DecoderInst *dec, int N, Boolean isSil);
@@ -129,7 +138,8 @@ void ReFormatTranscription(Transcription *trans,HTime frameDur,
                            Boolean killWords,Boolean killModels);
 
 /* HLVRec-propagate.c */
-static int winTok_cmp (const void *v1,const void *v2);
+static RelTokScore SelectDelta (RelTokScore *d, int n, int k);
+static RelTokScore KthDelta (RelTokScore *d, int n, int k);
 static void MergeTokSet (DecoderInst *dec, TokenSet *src, TokenSet *dest, 
                          LogFloat score, Boolean prune);
 static void PropagateInternal (DecoderInst *dec, LexNodeInst *inst);
@@ -143,6 +153,8 @@ static void HandleWordend (DecoderInst *dec, LexNode *ln);
 static void UpdateWordEndHyp (DecoderInst *dec, LexNodeInst *inst);
 static void AddPronProbs (DecoderInst *dec, TokenSet *ts, int var);
 void HandleSpSkipLayer (DecoderInst *dec, LexNodeInst *inst);
+static void CountActive (DecoderInst *dec);
+static void AdaptBeams (DecoderInst *dec);
 void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
                    AdaptXForm *xform);
 
@@ -153,6 +165,12 @@ static void FreeLMCache (LMCache *cache);
 static void ResetLMCache (LMCache *cache);
 static int LMCacheState_hash (LMState lmstate);
 LMNodeCache* AllocLMNodeCache (LMCache *cache, int lmlaIdx);
+static SharedLMCache *CreateSharedLMCache (MemHeap *heap, int size);
+static void FlushSharedLMCache (SharedLMCache *c);
+static LogFloat SharedLMProb (SharedLMCache *c, FSLM *lm, LMState src, 
+                              int a, int b, LMState *dest);
+Boolean GetSharedLMCacheStats (DecoderInst *dec, long *hit, long *miss,
+                               int *nUsed, size_t *mem);
 static LMTokScore LMCacheTransProb (DecoderInst *dec, FSLM *lm, 
                                     LMState src, PronId pronid, LMState *dest);
 LMTokScore LMLA_nocache (DecoderInst *dec, LMState lmState, int lmlaIdx);
@@ -165,10 +183,14 @@ static void PrintRelTok(DecoderInst *dec, RelToken *tok);
 static void PrintTokSet (DecoderInst *dec, TokenSet *ts);
 TokenSet *BestTokSet (DecoderInst *dec);
 Transcription *TraceBack(MemHeap *heap, DecoderInst *dec);
+static Transcription *Path2Transcription (MemHeap *heap, DecoderInst *dec, 
+                                          WordendHyp *path);
+Transcription *PartialTraceBack (MemHeap *heap, DecoderInst *dec, int *nStable);
 static void LatTraceBackCount (DecoderInst *dec, WordendHyp *path, int *nnodes, int *nlinks);
 static void Paths2Lat (DecoderInst *dec, Lattice *lat, WordendHyp *path,
                        int *na);
 Lattice *LatTraceBack (MemHeap *heap, DecoderInst *dec);
+void PrintTraceBackInfo (DecoderInst *dec, Boolean lattice);
 #ifdef MODALIGN
 LAlign *LAlignFromModpath (DecoderInst *dec, MemHeap *heap,
                            ModendHyp *modpath, int wordStart, short *nLAlign);
@@ -190,10 +212,10 @@ static void MarkModPath (ModendHyp *m);
 #endif
 static void MarkPath (WordendHyp *path);
 static void MarkTokSet (TokenSet *ts);
-static void SweepPaths (MemHeap *heap);
-static void SweepAltPaths (MemHeap *heap);
+static int SweepPaths (MemHeap *heap);
+static int SweepAltPaths (MemHeap *heap);
 #ifdef MODALIGN
-static void SweepModPaths (MemHeap *heap);
+static int SweepModPaths (MemHeap *heap);
 #endif
 static void GarbageCollectPaths (DecoderInst *dec);
 
@@ -203,15 +225,18 @@ static void ResetOutPCache (OutPCache *cache);
 static OutPCache *CreateOutPCache (MemHeap *heap, HMMSet *hset, int block);
 LogFloat SOutP_ID_mix_Block(HMMSet *hset, int s, Observation *x, StreamElem *se);
 static LogFloat cOutP (DecoderInst *dec, Observation *x, HLink hmm, int state);
-void OutPBlock_HMod (StateInfo_lv *si, Observation **obsBlock, 
-                     int n, int sIdx, float acScale, LogFloat *outP, int id);
+static void ScoreState (DecoderInst *dec, int sIdx);
+static ScorePool *CreateScorePool (DecoderInst *dec, int nThreads);
+static void ScoreActiveStates (DecoderInst *dec);
+void OutPBlock_HMod (DecoderInst *dec, Observation **obsBlock, 
+                     int n, int sIdx, LogFloat *outP, int id);
 
 
 /* HLVRec-misc.c */
 void CheckTokenSetOrder (DecoderInst *dec, TokenSet *ts);
 static void CheckTokenSetId (DecoderInst *dec, TokenSet *ts1, TokenSet *ts2);
 static WordendHyp *CombinePaths (DecoderInst *dec, RelToken *winner, RelToken *loser, LogFloat diff);
-void Debug_DumpNet (LexNet *net);
+void Debug_DumpNet (DecoderInst *dec);
 void Debug_Check_Score (DecoderInst *dec);
 void InitPhonePost (DecoderInst *dec);
 void CalcPhonePost (DecoderInst *dec);
@@ -245,11 +270,18 @@ void InitLVRec(void)
       if (GetConfBool (cParm, nParm, "BUILDLATSENTEND",&b)) buildLatSE = b;
       if (GetConfBool (cParm, nParm, "FORCELATOUT",&b)) forceLatOut = b;
       if (GetConfInt (cParm, nParm,"GCFREQ", &i)) gcFreq = i;
+      if (GetConfFlt (cParm, nParm, "GCGROWTH", &f)) gcGrowth = f;
       if (GetConfBool (cParm, nParm, "PDE",&b)) pde = b;
       if (GetConfBool (cParm, nParm, "USEOLDPRUNE",&b)) useOldPrune = b;
       if (GetConfBool (cParm, nParm, "MERGETOKONLY",&b)) mergeTokOnly = b;
       if (GetConfFlt (cParm, nParm, "MAXLNBEAMFLR", &f)) maxLNBeamFlr = f;
       if (GetConfFlt (cParm, nParm, "DYNBEAMINC", &f)) dynBeamInc = f;
+      if (GetConfInt (cParm, nParm, "SCORETHREADS", &i)) scoreThreads = i;
+      if (GetConfInt (cParm, nParm, "TARGETINSTS", &i)) targetInsts = i;
+      if (GetConfInt (cParm, nParm, "TARGETTOKENS", &i)) targetToks = i;
+      if (GetConfFlt (cParm, nParm, "ADAPTGAIN", &f)) adaptGain = f;
+      if (GetConfFlt (cParm, nParm, "ADAPTBEAMFLR", &f)) adaptBeamFlr = f;
+      if (GetConfInt (cParm, nParm, "LMCACHESIZE", &i)) lmCacheSize = i;
 
       if (useOldPrune) {
          mergeTokOnly = FALSE; maxLNBeamFlr = 0.0; dynBeamInc = 1.1;
@@ -269,17 +301,14 @@ void InitLVRec(void)
 /* --------------------------- the real code  ---------------------- */
 
 
-/* CreateDecoderInst
+/* NewDecoderInst
 
-     Create a new instance of the decoding engine. All state information is stored
-     here. 
-     #### Ideally instances should share other structures (i.e.
-          LexNets) this is not implemented, yet.
+     Allocate a decoder instance using compact state info si and create
+     its heaps and caches
 */
-DecoderInst *CreateDecoderInst(HMMSet *hset, FSLM *lm, int nTok, Boolean latgen, 
-                               Boolean useHModel,
-                               int outpBlocksize, Boolean doPhonePost,
-                               Boolean modAlign)
+static DecoderInst *NewDecoderInst(HMMSet *hset, FSLM *lm, StateInfo_lv *si,
+                                   int nTok, Boolean latgen, Boolean useHModel,
+                                   int outpBlocksize, Boolean modAlign)
 {
    DecoderInst *dec;
    int i, N;
@@ -290,12 +319,10 @@ DecoderInst *CreateDecoderInst(HMMSet *hset, FSLM *lm, int nTok, Boolean latgen,
    dec->lm = lm;
    dec->hset = hset;
    dec->useHModel = useHModel;
+   dec->si = si;
+   dec->inXForm = NULL;
    /*    dec->net = net; */
 
-   /* create compact State info. This can change number of shared states! */
-   /* #### this is ugly as we end up doing this twice, if we use adaptation! */
-   dec->si = ConvertHSet (&gcheap, hset, dec->useHModel);
-
    CreateHeap (&dec->heap, "Decoder Instance heap", MSTAK, 1, 1.5, 10000, 100000);
 
    CreateHeap (&dec->nodeInstanceHeap, "Decoder NodeInstance heap", 
@@ -306,6 +333,9 @@ DecoderInst *CreateDecoderInst(HMMSet *hset, FSLM *lm, int nTok, Boolean latgen,
    dec->latgen = latgen;
    dec->nLayers = 0;
    dec->instsLayer = NULL;
+#ifdef COLLECT_STATS
+   dec->stats.timing = FALSE;
+#endif
 
    /* alloc & init Heaps for TokenSets */
    N = MaxStatesInSet (dec->hset);
@@ -322,7 +352,8 @@ DecoderInst *CreateDecoderInst(HMMSet *hset, FSLM *lm, int nTok, Boolean latgen,
                   MHEAP, (i+1) * sizeof (TokenSet), 9, 10, 5000);
    }   
 
-   dec->tempTS = (TokenSet **) New (&dec->heap, N * sizeof (TokenSet *));
+   /* indexed 1..N in InitDecoderInst */
+   dec->tempTS = (TokenSet **) New (&dec->heap, (N+1) * sizeof (TokenSet *));
 
 
    /* alloc Heap for RelToken arrays */
@@ -332,7 +363,8 @@ DecoderInst *CreateDecoderInst(HMMSet *hset, FSLM *lm, int nTok, Boolean latgen,
    CreateHeap (&dec->lrelTokHeap, "Decoder RelToken array heap",
                MHEAP, LAYER_SIL_NTOK_SCALE * dec->nTok * sizeof (RelToken), 1, 1000, 5000);   
    
-   /* alloc heap for word end hyps */
+   /* alloc heaps for word end hyps: new ones and those surviving a GC */
+   CreateHeap (&dec->newPathHeap, "New path heap", MSTAK, 1, 1.0, 100000, 10000000);
    CreateHeap (&dec->weHypHeap, "WordendHyp heap", MHEAP, sizeof (WordendHyp), 
                1.0, 80000, 800000);
    if (dec->latgen) {
@@ -354,6 +386,9 @@ DecoderInst *CreateDecoderInst(HMMSet *hset, FSLM *lm, int nTok, Boolean latgen,
    /* output probability cache */
 
    dec->outPCache = CreateOutPCache (&dec->heap, dec->hset, outpBlocksize);
+   dec->sctx = (dec->si->useHModel) ? CreateScoreContext (&dec->heap, hset) : NULL;
+   dec->scorePool = CreateScorePool (dec, scoreThreads);
+   dec->sharedLM = NULL;
 
    /* cache debug code */
 #if 0
@@ -370,6 +405,31 @@ DecoderInst *CreateDecoderInst(HMMSet *hset, FSLM *lm, int nTok, Boolean latgen,
    /*      printf ("i %d  C_G %lu\n", i, CACHE_FLAG_GET(dec,i)); */
 #endif 
 
+   dec->nPhone = 0;
+   return dec;
+}
+
+/* CreateDecoderInst
+
+     Create a new instance of the decoding engine. All state information is stored
+     here. Further instances sharing the HMMSet, LM and compact state info
+     can be made with CloneDecoderInst().
+*/
+DecoderInst *CreateDecoderInst(HMMSet *hset, FSLM *lm, int nTok, Boolean latgen, 
+                               Boolean useHModel,
+                               int outpBlocksize, Boolean doPhonePost,
+                               Boolean modAlign)
+{
+   DecoderInst *dec;
+   StateInfo_lv *si;
+
+   /* create compact State info. This can change number of shared states! */
+   /* #### this is ugly as we end up doing this twice, if we use adaptation! */
+   si = ConvertHSet (&gcheap, hset, useHModel);
+
+   dec = NewDecoderInst (hset, lm, si, nTok, latgen, useHModel, 
+                         outpBlocksize, modAlign);
+   dec->sharedLM = CreateSharedLMCache (&dec->heap, lmCacheSize);
 
    /* tag left-to-right models */
    {
@@ -390,12 +450,37 @@ DecoderInst *CreateDecoderInst(HMMSet *hset, FSLM *lm, int nTok, Boolean latgen,
 
    if (doPhonePost)
       InitPhonePost (dec);
-   else
-      dec->nPhone = 0;
 
    return dec;
 }
 
+/* EXPORT->CloneDecoderInst: new instance sharing models and LM with dec */
+DecoderInst *CloneDecoderInst (DecoderInst *dec)
+{
+   DecoderInst *clone;
+   Boolean modAlign = FALSE;
+   int i;
+
+#ifdef MODALIGN
+   modAlign = dec->modAlign;
+#endif
+   clone = NewDecoderInst (dec->hset, dec->lm, ShareStateInfo_lv (&gcheap, dec->si),
+                           dec->nTok, dec->latgen, dec->useHModel,
+                           dec->outPCache->block, modAlign);
+   if (dec->sharedLM) {
+      dec->sharedLM->shared = TRUE;
+      clone->sharedLM = dec->sharedLM;
+   }
+   if (dec->nPhone > 0) {       /* monophone table was set up by InitPhonePost */
+      clone->nPhone = dec->nPhone;
+      for (i = 1; i <= dec->nPhone; ++i)
+         clone->monoPhone[i] = dec->monoPhone[i];
+      clone->phonePost = (LogDouble *) New (&gcheap, (dec->nPhone+1) * sizeof (LogDouble));
+      clone->phoneFreq = (int *) New (&gcheap, (dec->nPhone+1) * sizeof (int));
+   }
+   return clone;
+}
+
 /* CheckLRTransP
 
      determine wheter transition matrix is left-to-right, i.e. no backward transitions
@@ -433,6 +518,7 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
                       LogFloat fastlmlaBeam)
 {       
    int i;
+   LexNodeInst *inst;
 
    dec->net = net;
 
@@ -443,12 +529,14 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
    /* alloc InstsLayer start pointers */
    dec->nLayers = net->nLayers;
    dec->instsLayer = (LexNodeInst **) New (&dec->heap, net->nLayers * sizeof (LexNodeInst *));
+   dec->lnInst = (LexNodeInst **) New (&dec->heap, net->nNodes * sizeof (LexNodeInst *));
 
    /* reset inst (i.e. reset pruning, etc.)
       purge all heaps
    */
 
    ResetHeap (&dec->nodeInstanceHeap);
+   ResetHeap (&dec->newPathHeap);
    ResetHeap (&dec->weHypHeap);
    if (dec->latgen)
       ResetHeap (&dec->altweHypHeap);
@@ -474,8 +562,16 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
    dec->weBeamWidth = weBeamWidth;
    dec->zsBeamWidth = zsBeamWidth;
    dec->curBeamWidth = dec->beamWidth;
+   dec->curWeBeamWidth = dec->weBeamWidth;
+   dec->minBeamWidth = dec->beamWidth;
    dec->relBeamWidth = - relBeamWidth;
+   dec->nActInst = dec->nActTok = 0;
+   dec->peakActInst = dec->peakActTok = 0;
+   dec->sumActInst = dec->sumActTok = 0.0;
    dec->beamLimit = LZERO;
+   dec->gcFullLimit = GC_MIN_FULL;
+   dec->gcStats.nMinor = dec->gcStats.nFull = 0;
+   dec->gcStats.reclaimed = dec->gcStats.pause = dec->gcStats.maxPause = 0.0;
 
    if (fastlmlaBeam < -LSMALL) {
       dec->fastlmla = TRUE;
@@ -506,6 +602,7 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
 
    /* alloc winTok array for MergeTokSet */
    dec->winTok = (RelToken *) New (&dec->heap, LAYER_SIL_NTOK_SCALE * dec->nTok * sizeof (RelToken));
+   dec->winDelta = (RelTokScore *) New (&dec->heap, LAYER_SIL_NTOK_SCALE * dec->nTok * sizeof (RelTokScore));
 
 
    /* init lists of active LexNode Instances  */
@@ -514,17 +611,17 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
 
    /* deactivate all nodes */
    for (i = 0; i < dec->net->nNodes; ++i) {
-      dec->net->node[i].inst = NULL;
+      dec->lnInst[i] = NULL;
 #ifdef COLLECT_STATS_ACTIVATION
       dec->net->node[i].eventT = -1;
 #endif
    }
 
-   ActivateNode (dec, dec->net->start);
-   dec->net->start->inst->ts[0].n = 1;
-   dec->net->start->inst->ts[0].score = 0.0;
-   dec->net->start->inst->ts[0].relTok[0] = startTok;
-   dec->net->start->inst->ts[0].relTok[0].lmState = LMInitial (dec->lm);
+   inst = ActivateNode (dec, dec->net->start);
+   inst->ts[0].n = 1;
+   inst->ts[0].score = 0.0;
+   inst->ts[0].relTok[0] = startTok;
+   inst->ts[0].relTok[0].lmState = LMInitial (dec->lm);
 
 #ifdef COLLECT_STATS
    dec->stats.nTokSet = 0;
@@ -535,6 +632,10 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
    dec->stats.nFrames = 0;
    dec->stats.nLMlaCacheHit = 0;
    dec->stats.nLMlaCacheMiss = 0;
+   dec->stats.mtsCopy = dec->stats.mtsFast = dec->stats.mtsSlow = 0;
+   dec->stats.mtsNewId = dec->stats.mtsNewIdNTOK = 0;
+   dec->stats.nPropLR = dec->stats.nPropGen = 0;
+   dec->stats.nWordend = 0;
 #ifdef COLLECT_STATS_ACTIVATION
 
    dec->stats.lnINF = 0;
@@ -627,12 +728,12 @@ static LexNodeInst *ActivateNode (DecoderInst *dec, LexNode *ln)
    ln->eventT = dec->frame;
 #endif
 
-   assert (!ln->inst);
+   assert (!LNINST(dec,ln));
 
    inst = (LexNodeInst *) New (&dec->nodeInstanceHeap, 0);
 
    inst->node = ln;
-   ln->inst = inst;
+   LNINST(dec,ln) = inst;
 
    switch (ln->type) {
    case LN_MODEL:
@@ -680,6 +781,7 @@ static LexNodeInst *ActivateNode (DecoderInst *dec, LexNode *ln)
 static void DeactivateNode (DecoderInst *dec, LexNode *ln)
 {
    int N, i, l;
+   LexNodeInst *inst;
 
 #ifdef COLLECT_STATS
    ++dec->stats.nDeActivate;
@@ -695,7 +797,8 @@ static void DeactivateNode (DecoderInst *dec, LexNode *ln)
    ln->eventT = dec->frame;
 #endif
 
-   assert (ln->inst);
+   inst = LNINST(dec,ln);
+   assert (inst);
    
    switch (ln->type) {
    case LN_MODEL:
@@ -718,15 +821,15 @@ static void DeactivateNode (DecoderInst *dec, LexNode *ln)
       assert (l >= 0);
    }
    for (i = 0; i < N; ++i) {
-      if (l == LAYER_SIL) Dispose (&dec->lrelTokHeap, ln->inst->ts[i].relTok);
-      else Dispose (&dec->relTokHeap, ln->inst->ts[i].relTok);
+      if (l == LAYER_SIL) Dispose (&dec->lrelTokHeap, inst->ts[i].relTok);
+      else Dispose (&dec->relTokHeap, inst->ts[i].relTok);
    }
 
-   Dispose (&dec->tokSetHeap[N-1], ln->inst->ts);
-   Dispose (&dec->nodeInstanceHeap, ln->inst);
+   Dispose (&dec->tokSetHeap[N-1], inst->ts);
+   Dispose (&dec->nodeInstanceHeap, inst);
 #endif
 
-   ln->inst = NULL;
+   LNINST(dec,ln) = NULL;
 }
 
 
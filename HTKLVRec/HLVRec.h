@@ -151,6 +151,14 @@ struct _LexNodeInst {           /* attached to active LexNode's, contains info a
 #ifdef COLLECT_STATS_ACTIVATION
 #  define  STATS_MAXT 100
 #endif
+/* stages of ProcessFrame timed in Stats.stageTime */
+#define STAGE_GC 0              /* path garbage collection */
+#define STAGE_OBS 1             /* loading observations */
+#define STAGE_OUTP 2            /* scoring states in advance (score pool only) */
+#define STAGE_INT 3             /* internal propagation (incl. lazy scoring) */
+#define STAGE_EXT 4             /* pruning, external propagation, word ends */
+#define STAGE_PRUNE 5           /* counting and beam adaptation */
+#define NSTAGES 6
 typedef struct _Stats Stats;    /* statistics about pruning etc. */
 struct _Stats {
    unsigned long nTokSet;
@@ -161,6 +169,17 @@ struct _Stats {
    unsigned long nFrames;
    unsigned long nLMlaCacheHit;
    unsigned long nLMlaCacheMiss;
+   int mtsCopy;                 /* MergeTokSet cases in the current frame */
+   int mtsFast;
+   int mtsSlow;
+   int mtsNewId;
+   int mtsNewIdNTOK;
+   int nPropLR;                 /* PropagateInternal for L-R/general models */
+   int nPropGen;
+   int nWordend;                /* word end hyps created in the current frame */
+   int nLayerInst[NLAYERS];     /* active insts per layer at end of frame */
+   Boolean timing;              /* measure stageTime in ProcessFrame? */
+   double stageTime[NSTAGES];   /* wall clock seconds per stage of frame */
 #ifdef COLLECT_STATS_ACTIVATION
    unsigned long lnDeadT[STATS_MAXT+1];
    unsigned long lnLiveT[STATS_MAXT+1];
@@ -187,6 +206,8 @@ struct _LMLACacheEntry {
 /* output prob cache */
 
 typedef struct _OutPCache OutPCache;
+typedef struct _ScorePool ScorePool;    /* see HLVRec-outP.c */
+typedef struct _SharedLMCache SharedLMCache;    /* see HLVRec-LM.c */
 struct _OutPCache {
    int block;
    int nMix;
@@ -280,6 +301,22 @@ struct _LMCache {
 
 
 
+typedef struct {                /* path collections in current utterance */
+   int nMinor;                  /* collections of new paths only */
+   int nFull;                   /* collections of all paths */
+   double reclaimed;            /* bytes reclaimed */
+   double pause;                /* total CPU seconds spent collecting */
+   double maxPause;             /* longest collection */
+} PathGCStats;
+
+typedef struct {                /* diagnostics of the last traceback */
+   unsigned int warn;           /* TraceBack warnings (TBW_ flags) */
+   unsigned int latWarn;        /* LatTraceBack warnings (TBW_ flags) */
+   int endToks;                 /* tokens in end state, -1 if not active */
+   int nArcs;                   /* alternatives merged at sentence end, -1 if none */
+   int nNodes, nLinks;          /* lattice size, 0 if no lattice */
+} TraceBackInfo;
+
 /**** decoder instance */
 
 typedef struct _DecoderInst DecoderInst;  /* contains all state information about one instance
@@ -297,19 +334,27 @@ struct _DecoderInst {
 
    MemHeap heap;                /* MSTACK for general allocation */
    MemHeap nodeInstanceHeap;    /* MHEAP for LexNodeInsts */
-   MemHeap weHypHeap;           /* MHEAP for word end hyps */
+   MemHeap newPathHeap;         /* MSTAK for word and model end hyps since last GC */
+   MemHeap weHypHeap;           /* MHEAP for word end hyps surviving a GC */
    MemHeap altweHypHeap;        /* MHEAP for alt word end hyps (for latgen) */
+   size_t gcPromoted;           /* bytes of paths promoted in current GC */
+   size_t gcFullLimit;          /* run full GC when old paths use more bytes */
+   PathGCStats gcStats;         /* path GC statistics of current utterance */
+   TraceBackInfo tbInfo;        /* printed by PrintTraceBackInfo */
    MemHeap *tokSetHeap;         /* MHEAPs for N TokenSet arrays */
    MemHeap relTokHeap;          /* MHEAP for RelToken arrays (dec->nTok-1 elements) */
    MemHeap lrelTokHeap;         /* MHEAP for larger size RelToken arrays (e.g. 6 * dec->nTok-1 elements) */
 
    TokenSet **tempTS;           /* temp tokset arrays for PropagateInternal() */
    RelToken *winTok;            /* RelTok array fro MergeTokSet() */
+   RelTokScore *winDelta;       /* deltas of winTok, scratch for SelectDelta() */
 
    int maxNStates;              /* max number of states in a HMM in HMMSet */
    int nLayers;                 /* nuber of node layers */
    LexNodeInst **instsLayer;    /* array of pointers to the linked list of 
                                    active LexNodeInsts in each layer */
+   LexNodeInst **lnInst;        /* [0..net->nNodes-1] instance of each LexNode
+                                   or NULL if inactive, see LNINST() */
    char *utterFN;               /* name of current utterance */
    Observation *obs;            /* Observation for current frame */
    Observation *obsBlock[MAXBLOCKOBS]; /* block of current and future Observations */
@@ -329,6 +374,15 @@ struct _DecoderInst {
    TokScore zsBeamWidth;        /* Z-S beam width (set by -v cmd line option) */
    TokScore curBeamWidth;       /* current dynamic beamWidth (due to max model pruning) */
    TokScore beamLimit;          /* threshold of the main beam (bestScore - beamWidth) */
+   TokScore curWeBeamWidth;     /* current wordend beam width (due to adaptive pruning) */
+   TokScore minBeamWidth;       /* narrowest curBeamWidth in current utterance */
+
+   int nActInst;                /* active LexNodeInsts at end of last frame */
+   int nActTok;                 /* active tokens at end of last frame */
+   int peakActInst;             /* peak nActInst in current utterance */
+   int peakActTok;              /* peak nActTok in current utterance */
+   double sumActInst;           /* sum of nActInst over frames of utterance */
+   double sumActTok;            /* sum of nActTok over frames of utterance */
 
    RelTokScore relBeamWidth;    /* beamWidth of relative tokenset  beam */
                                 /* (set by -t BW RBW cmd line option) */
@@ -344,11 +398,15 @@ struct _DecoderInst {
    LogFloat fastlmlaBeam;       /* beam in which to use full lmla */
    
    Boolean useHModel;           /* use normal HModel OutP() functions? */
+   ScoreContext *sctx;          /* context for HModel OutP() functions */
+   AdaptXForm *inXForm;         /* input transform of current frame */
    /*    outP cache */
    OutPCache *outPCache;        /* cache of outP values for block of observations */
+   ScorePool *scorePool;        /* threads filling outPCache or NULL */
 
    /* LM lookahead cache */
    LMCache *lmCache;
+   SharedLMCache *sharedLM;     /* cross-utterance LM cache or NULL */
 
    /* relToken set identifier */
    unsigned int tokSetIdCount;/* max id used so far for token sets */
@@ -372,6 +430,9 @@ struct _DecoderInst {
 };
 
 
+/* instance of LexNode ln in decoder dec, NULL if inactive */
+#define LNINST(dec,ln) ((dec)->lnInst[(ln) - (dec)->net->node])
+
 /*
 #define TOK_TOTSCORE(t) ((t)->score + (t)->lmscore)
 #define TOK_LMSCORE(t) ((t)->lmscore)
@@ -389,12 +450,31 @@ void InitDecoderInst (DecoderInst *dec, LexNet *net, HTime sampRate, LogFloat be
                       LogFloat insPen, float acScale, float pronScale, float lmScale,
                       LogFloat fastlmlaBeam);
 
+DecoderInst *CloneDecoderInst (DecoderInst *dec);
+/* new decoder instance with the settings of dec, sharing its HMMSet,
+   LM and compact state info, so that several utterances can be
+   decoded at once.  The net passed to InitDecoderInst can be shared 
+   as well.  Input transforms must not be used with shared instances. */
+
 void CleanDecoderInst (DecoderInst *dec);
 void ProcessFrame (DecoderInst *dec, Observation **obsBlock, int nObs,
                    AdaptXForm *xform);
 
 Transcription *TraceBack (MemHeap *heap, DecoderInst *dec);
+Transcription *PartialTraceBack (MemHeap *heap, DecoderInst *dec, int *nStable);
+/* best word sequence so far, the first *nStable words of which are 
+   shared by all active hypotheses and will not change any more */
 Lattice *LatTraceBack (MemHeap *heap, DecoderInst *dec);
+void PrintTraceBackInfo (DecoderInst *dec, Boolean lattice);
+/* print the warnings and sizes recorded by TraceBack (lattice FALSE)
+   or LatTraceBack (lattice TRUE).  The tracebacks themselves print
+   nothing by default, so callers running several decoders can do
+   them in parallel and still print in order. */
+
+Boolean GetSharedLMCacheStats (DecoderInst *dec, long *hit, long *miss,
+                               int *nUsed, size_t *mem);
+/* lookups, entries in use and memory of the LM cache shared by dec and 
+   its clones since creation; FALSE if LMCACHESIZE is not set */
 
 void ReFormatTranscription(Transcription *trans,HTime frameDur,
                            Boolean states,Boolean models,Boolean triStrip,
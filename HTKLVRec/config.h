@@ -62,8 +62,6 @@ typedef LogFloat LMTokScore;
 
 #define MAXBLOCKOBS 16
 
-#undef USE_INTEL_SSE
-
 
 #undef LEGACY_CUHTK2_MLLR
 
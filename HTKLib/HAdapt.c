@@ -4116,6 +4116,7 @@ void ApplyHMMSetXForm(HMMSet *hset, AdaptXForm *xform)
     }
   } while (GoNextHMM(&hss));
   EndHMMScan(&hss);
+  SyncScoreView(hset);
   if (trace&T_ADT) printf("Adapted %d components\n",nAdpt);
 }
 
@@ -4135,6 +4136,7 @@ void ResetXFormHMMSet(HMMSet *hset)
       }
    } while (GoNextHMM(&hss));
    EndHMMScan(&hss);
+   SyncScoreView(hset);
 }
 
 
@@ -48,6 +48,7 @@ char *hfb_vc_id = "$Id: HFB.c,v 1.1.1.1 2006/10/11 09:54:57 jal58 Exp $";
 #include "HTrain.h"
 #include "HUtil.h"
 #include "HAdapt.h"
+#include "HThreads.h"
 #include "HFB.h"
 
 
@@ -83,8 +84,14 @@ static struct {
 } pruneSetting = { NOPRUNE, 0.0, NOPRUNE, 10.0 };
 
 static Boolean pde = FALSE;  /* partial distance elimination */
+static Boolean exactLAdd = TRUE;  /* LADDKIND=EXACT, mixtures summed by LAdd */
 static Boolean sharedMix = FALSE; /* true if shared mixtures */
 
+static int obsBlock = 1;     /* frames scored together by ShStrP */
+
+static int nSlots = 1;       /* accumulator slots, one per FBInfo */
+static HLock egLock = NULL;  /* serialises numEg counts when nSlots>1 */
+
 /* ------------------------- Min HMM Duration -------------------------- */
 
 /* Recusively calculate topological order for transition matrix */
@@ -156,35 +163,40 @@ void SetMinDurs(HMMSet *hset)
 
 /* ----------------------------------------------------------------------- */
 
-/* CreateTrAcc: create an accumulator for transition counts */
-static TrAcc *CreateTrAcc(MemHeap *x, int numStates)
+/* CreateTrAcc: create nPara accumulators for transition counts */
+static TrAcc *CreateTrAcc(MemHeap *x, int numStates, int nPara)
 {
    TrAcc *ta;
+   int i;
   
-   ta = (TrAcc *) New(x,sizeof(TrAcc));
-   ta->tran = CreateMatrix(x,numStates,numStates);
-   ZeroMatrix(ta->tran);
-   ta->occ = CreateVector(x,numStates);
-   ZeroVector(ta->occ);
-  
+   ta = (TrAcc *) New(x,nPara*sizeof(TrAcc));
+   for (i=0; i<nPara; i++) {
+      ta[i].tran = CreateMatrix(x,numStates,numStates);
+      ZeroMatrix(ta[i].tran);
+      ta[i].occ = CreateVector(x,numStates);
+      ZeroVector(ta[i].occ);
+   }
    return ta;
 }
 
-/* CreateWtAcc: create an accumulator for mixture weights */
-static WtAcc *CreateWtAcc(MemHeap *x, int nMix)
+/* CreateWtAcc: create nPara accumulators for mixture weights */
+static WtAcc *CreateWtAcc(MemHeap *x, int nMix, int nPara)
 {
    WtAcc *wa;
+   int i;
    
-   wa = (WtAcc *) New(x,sizeof(WtAcc));
-   wa->c = CreateVector(x,nMix);
-   ZeroVector(wa->c);
-   wa->occ = 0.0;
-   wa->time = -1; wa->prob = NULL;
+   wa = (WtAcc *) New(x,nPara*sizeof(WtAcc));
+   for (i=0; i<nPara; i++) {
+      wa[i].c = CreateVector(x,nMix);
+      ZeroVector(wa[i].c);
+      wa[i].occ = 0.0;
+      wa[i].time = -1; wa[i].prob = NULL; wa[i].blkLen = 0;
+   }
    return wa;
 }
 
-/* AttachTrAccs: attach transition accumulators to hset */
-static void AttachWtTrAccs(HMMSet *hset, MemHeap *x)
+/* AttachTrAccs: attach nPara transition and weight accumulators to hset */
+static void AttachWtTrAccs(HMMSet *hset, MemHeap *x, int nPara)
 {
    HMMScanState hss;
    StreamElem *ste;
@@ -195,13 +207,13 @@ static void AttachWtTrAccs(HMMSet *hset, MemHeap *x)
       hmm = hss.hmm;
       hmm->hook = (void *)0;  /* used as numEg counter */
       if (!IsSeenV(hmm->transP)) {
-         SetHook(hmm->transP, CreateTrAcc(x,hmm->numStates));
+         SetHook(hmm->transP, CreateTrAcc(x,hmm->numStates,nPara));
          TouchV(hmm->transP);       
       }
       while (GoNextState(&hss,TRUE)) {
          while (GoNextStream(&hss,TRUE)) {
             ste = hss.ste;
-            ste->hook = CreateWtAcc(x,hss.M);
+            ste->hook = CreateWtAcc(x,hss.M,nPara);
          }
       }
    } while (GoNextHMM(&hss));
@@ -230,8 +242,16 @@ void InitFB(void)
          if (GetConfFlt(cParm,nParm,"MINFORPROB", &d)) pruneSetting.minFrwdP = d;
          if (GetConfBool(cParm,nParm,"ALIGNCOMPLEVEL",&b)) alCompLevel = b;
          if (GetConfBool(cParm,nParm,"PDE",&b)) pde = b;
+         if (GetConfInt(cParm,nParm,"OBSBLOCK",&i)) {
+            if (i<1 || i>OUTPBLOCK)
+               HError(7399,"InitFB: OBSBLOCK must be in range 1..%d",OUTPBLOCK);
+            obsBlock = i;
+         }
       }
    }
+   if (GetLAddKind() == MAXLA)
+      HError(-7340,"InitFB: LADDKIND=MAX, occupation counts will not be valid");
+   exactLAdd = (GetLAddKind() == EXACTLA);
 }
 
 /* Allow tools to enable top-level tracing in HFB. Only here for historical reasons */
@@ -246,26 +266,48 @@ void InitialiseForBack(FBInfo *fbInfo, MemHeap *x, HMMSet *hset, UPDSet uset,
                        LogDouble pruneInit, LogDouble pruneInc, 
                        LogDouble pruneLim, float minFrwdP)
 {
-   int s;
+   InitialiseForBackParallel(fbInfo,x,hset,uset,pruneInit,pruneInc,
+                             pruneLim,minFrwdP,1);
+}
+
+/* Initialise nPara FBInfos, each updating its own accumulator slot */
+void InitialiseForBackParallel(FBInfo *fbInfo, MemHeap *x, HMMSet *hset,
+                               UPDSet uset, LogDouble pruneInit, 
+                               LogDouble pruneInc, LogDouble pruneLim,
+                               float minFrwdP, int nPara)
+{
+   int i,s;
    AlphaBeta *ab;
+   FBInfo *fbi;
   
-   fbInfo->uFlags = uset;
-   fbInfo->up_hset = fbInfo->al_hset = hset;
-   fbInfo->twoModels = FALSE;
-   fbInfo->hsKind = hset->hsKind;
+   if (nPara>1 && hset->hsKind!=PLAINHS && hset->hsKind!=SHAREDHS)
+      HError(7399,"InitialiseForBack: Parallel slots need PLAIN or SHARED models");
+   nSlots = nPara;
+   if (nPara>1) egLock = CreateHLock(x);
    /* Accumulators attached using AttachAccs() in HERest are overwritten
       by the following line. This is ugly and needs to be sorted out. Note:
       this function is called by HERest and HVite */
-   AttachWtTrAccs(hset, x);
+   AttachWtTrAccs(hset, x, nPara);
    SetMinDurs(hset);
-   fbInfo->maxM = MaxMixInSet(hset);
-   fbInfo->skipstart = skipstartInit;
-   fbInfo->skipend   = skipendInit;
-   for (s=1;s<=hset->swidth[0];s++)
-      fbInfo->maxMixInS[s] = MaxMixInSetS(hset, s);
-   fbInfo->ab = (AlphaBeta *) New(x, sizeof(AlphaBeta));
-   ab = fbInfo->ab;
-   CreateHeap(&ab->abMem,  "AlphaBetaFB",  MSTAK, 1, 1.0, 100000, 5000000);
+   for (i=0; i<nPara; i++) {
+      fbi = fbInfo+i;
+      fbi->slot = i;
+      fbi->uFlags = uset;
+      fbi->up_hset = fbi->al_hset = hset;
+      fbi->twoModels = FALSE;
+      fbi->hsKind = hset->hsKind;
+      fbi->maxM = MaxMixInSet(hset);
+      fbi->skipstart = skipstartInit;
+      fbi->skipend   = skipendInit;
+      for (s=1;s<=hset->swidth[0];s++)
+         fbi->maxMixInS[s] = MaxMixInSetS(hset, s);
+      fbi->sc = CreateScoreContext(x,hset);
+      fbi->ab = (AlphaBeta *) New(x, sizeof(AlphaBeta));
+      ab = fbi->ab;
+      CreateHeap(&ab->abMem,  "AlphaBetaFB",  MSTAK, 1, 1.0, 100000, 5000000);
+      ab->compProb = CreateVector(x,fbi->maxM);
+      ab->ovec = CreateVector(x,hset->vecSize);
+   }
 
    if (pruneInit < NOPRUNE) {   /* cmd line takes precedence over config file */
       pruneSetting.pruneInit = pruneInit;
@@ -298,6 +340,8 @@ void UseAlignHMMSet(FBInfo* fbInfo, MemHeap* x, HMMSet *al_hset)
    int s,S;
 
    /* First check 2-model mode allowed for current up_hset */
+   if (nSlots>1)
+      HError(7392,"UseAlignHMMSet: 2-model re-estimation needs a single slot");
    if ((fbInfo->hsKind != PLAINHS) && (fbInfo->hsKind != SHAREDHS))
       HError(7392,"Model kind not supported for fixed alignments");
    if (al_hset->hsKind != fbInfo->hsKind)
@@ -321,8 +365,9 @@ void UseAlignHMMSet(FBInfo* fbInfo, MemHeap* x, HMMSet *al_hset)
    /* update the global alignment set features */
    fbInfo->hsKind = al_hset->hsKind;      
    fbInfo->maxM = MaxMixInSet(al_hset);
+   fbInfo->ab->compProb = CreateVector(x,fbInfo->maxM);
    /* dummy accs to accomodate minDir */
-   AttachWtTrAccs(al_hset, x);
+   AttachWtTrAccs(al_hset, x, 1);
    SetMinDurs(al_hset);
    /* precomps */
    if ( al_hset->hsKind == SHAREDHS)
@@ -504,6 +549,25 @@ static void SummarisePruning(PruneInfo *p, int Q, int T)
    fflush(stdout);
 }
 
+/* ResetSlotProbs: as ResetHMMWtAccs for the wt accs of given slot */
+static void ResetSlotProbs(HLink hmm, int nStreams, int slot)
+{
+   StateElem *se;
+   StreamElem *ste;
+   WtAcc *wa;
+   int i,s,nStates;
+
+   nStates = hmm->numStates;
+   se = hmm->svec+2;
+   for (i=2; i<nStates; i++,se++){
+      ste = se->info->pdf+1;
+      for (s=1;s<=nStreams; s++,ste++){
+         wa = (WtAcc *)ste->hook+slot;
+         wa->time = -1; wa->prob = NULL; wa->blkLen = 0;
+      }
+   }
+}
+
 /* CreateInsts: create array of hmm instances for current transcription */
 static int CreateInsts(FBInfo *fbInfo, AlphaBeta *ab, int Q, Transcription *tr)
 {
@@ -556,7 +620,9 @@ static int CreateInsts(FBInfo *fbInfo, AlphaBeta *ab, int Q, Transcription *tr)
 
       if (q>1 && qDms[q]==0 && qDms[q-1]==0)
          HError(7332,"CreateInsts: Cannot have successive Tee models");
-      if (al_hset->hsKind==SHAREDHS)
+      if (nSlots>1)
+         ResetSlotProbs(al_qList[q],al_hset->swidth[0],fbInfo->slot);
+      else if (al_hset->hsKind==SHAREDHS)
          ResetHMMPreComps(al_qList[q],al_hset->swidth[0]);
       else if (al_hset->hsKind==PLAINHS)
          ResetHMMWtAccs(al_qList[q],al_hset->swidth[0]);         
@@ -894,70 +960,94 @@ static float * NewOtprobVec(MemHeap *x, int M)
    return v;
 }
 
-/* ShStrP: Stream Outp calculation exploiting sharing */
-static float * ShStrP(HMMSet *hset, StreamElem *ste, Vector v, int t,
-		       AdaptXForm *xform, MemHeap *abmem)
+/* ShStrP: Stream Outp calculation exploiting sharing, stream s of
+   state sIdx is scored through view sv if not NULL */
+static float * ShStrP(FBInfo *fbInfo, StreamElem *ste, Vector v, int t,
+		       MemHeap *abmem, ScoreView *sv, int s, int sIdx)
 {
+   HMMSet *hset;
+   AdaptXForm *xform;
    WtAcc *wa;
    MixtureElem *me;
    MixPDF *mp;
    float *outprobjs;
-   int m,M;
+   int m,M,n;
    PreComp *pMix;
    LogFloat det,x,mixp,wt;
+   LogDouble bx,lx[LADDVECSIZE];
    Vector otvs;
    
-   wa = (WtAcc *)ste->hook;
+   hset = fbInfo->al_hset; xform = fbInfo->al_inXForm;
+   wa = (WtAcc *)ste->hook+fbInfo->slot;
    if (wa->time==t)           /* seen this state before */
       outprobjs = wa->prob;
    else {
       M = ste->nMix;
       outprobjs = NewOtprobVec(abmem,M);
       me = ste->spdf.cpdf+1;
-      if (M==1){                 /* Single Mix Case */
+      if (sv!=NULL)              /* contiguous copy, no sharing */
+         x = ViewSOutP(sv,s,sIdx,v+1,NULL,outprobjs);
+      else if (M==1){            /* Single Mix Case */
          mp = me->mpdf;
-         pMix = (PreComp *)mp->hook;
+         pMix = (nSlots==1) ? (PreComp *)mp->hook : NULL;
          if ((pMix != NULL) && (pMix->time == t))
             x = pMix->prob;
          else {
-            x = MOutP(ApplyCompFXForm(mp,v,xform,&det,t),mp);	 
+            x = CtxMOutP(fbInfo->sc,ApplyCompFXForm(mp,v,xform,&det,t),mp);
             x += det;
             if (pMix != NULL) {
                pMix->prob = x; pMix->time = t;
             }
          }
       } else if (sharedMix) { /* Multiple Mixture Case - general case */
-         x = LZERO;
+         x = bx = LZERO; n = 0;
          for (m=1;m<=M;m++,me++) {
             wt = MixLogWeight(hset,me->weight);
             if (wt>LMINMIX){
                mp = me->mpdf;
-               pMix = (PreComp *)mp->hook;
+               pMix = (nSlots==1) ? (PreComp *)mp->hook : NULL;
                if ((pMix != NULL) && (pMix->time == t))
                   mixp = pMix->prob;
                else {
-                  mixp = MOutP(ApplyCompFXForm(mp,v,xform,&det,t),mp);
+                  mixp = CtxMOutP(fbInfo->sc,
+                                  ApplyCompFXForm(mp,v,xform,&det,t),mp);
 		  mixp += det;
                   if (pMix != NULL) {
                      pMix->prob = mixp; pMix->time = t;
                   }
                }
-               x = LAdd(x,wt+mixp);
+               if (exactLAdd)
+                  x = LAdd(x,wt+mixp);
+               else {
+                  lx[n++] = wt+mixp;
+                  if (n == LADDVECSIZE) {
+                     bx = LAddVec(bx,lx,n); n = 0;
+                  }
+               }
 	       outprobjs[m] = mixp;
             }
          }
+         if (!exactLAdd) x = LAddVec(bx,lx,n);
       } else if (!pde) { /* Multiple Mixture Case - no shared mix case */
-         x = LZERO;
+         x = bx = LZERO; n = 0;
          for (m=1;m<=M;m++,me++) {
             wt = MixLogWeight(hset,me->weight);
             if (wt>LMINMIX){
                mp = me->mpdf;
-	       mixp = MOutP(ApplyCompFXForm(mp,v,xform,&det,t),mp);
+	       mixp = CtxMOutP(fbInfo->sc,ApplyCompFXForm(mp,v,xform,&det,t),mp);
 	       mixp += det;
-               x = LAdd(x,wt+mixp);
+               if (exactLAdd)
+                  x = LAdd(x,wt+mixp);
+               else {
+                  lx[n++] = wt+mixp;
+                  if (n == LADDVECSIZE) {
+                     bx = LAddVec(bx,lx,n); n = 0;
+                  }
+               }
 	       outprobjs[m] = mixp;
             }
          }
+         if (!exactLAdd) x = LAddVec(bx,lx,n);
       } else {    /* Partial distance elimination */
 	 /* first Gaussian computed exactly in PDE */
 	 wt = MixLogWeight(hset,me->weight);
@@ -987,8 +1077,59 @@ static float * ShStrP(HMMSet *hset, StreamElem *ste, Vector v, int t,
    return outprobjs;
 }
    
+/* BlkShStrP: as ShStrP but when stream element ste has not been
+   seen at time t, its mixtures are scored for all frames winLo..t of
+   utt in one pass and the results kept for the following (earlier)
+   frames */
+static float * BlkShStrP(FBInfo *fbInfo, UttInfo *utt, StreamElem *ste, 
+                         int s, int t, MemHeap *abmem, ScoreView *sv, 
+                         int sIdx)
+{
+   HMMSet *hset;
+   WtAcc *wa;
+   MixtureElem *me;
+   float **blk;
+   int i,m,n,M;
+   LogFloat wt,px[OUTPBLOCK],bx[OUTPBLOCK];
+   Vector v[OUTPBLOCK];
+
+   hset = fbInfo->al_hset;
+   wa = (WtAcc *)ste->hook+fbInfo->slot;
+   if (wa->time==t)           /* seen this state before */
+      return wa->prob;
+   if (wa->blkLen==0 || t<wa->blkTime || t>=wa->blkTime+wa->blkLen) {
+      M = ste->nMix; n = t-utt->winLo+1;
+      blk = (float **)New(abmem,n*sizeof(float *));
+      for (i=0; i<n; i++) {
+         blk[i] = NewOtprobVec(abmem,M);
+         v[i] = utt->obsWin[i].fv[s];
+         bx[i] = LZERO;
+      }
+      if (sv!=NULL)
+         ViewSOutPBlock(sv,s,sIdx,v,n,bx,(M>1)?blk:NULL);
+      else for (m=1,me=ste->spdf.cpdf+1; m<=M; m++,me++) {
+         wt = MixLogWeight(hset,me->weight);
+         if (M==1 || wt>LMINMIX) {
+            CtxMOutPBlock(fbInfo->sc,v,n,me->mpdf,px);
+            for (i=0; i<n; i++) {
+               if (M==1) bx[i] = px[i];
+               else {
+                  bx[i] = LAdd(bx[i],wt+px[i]);
+                  blk[i][m] = px[i];
+               }
+            }
+         }
+      }
+      for (i=0; i<n; i++) blk[i][0] = bx[i];
+      wa->blkProb = blk; wa->blkTime = utt->winLo; wa->blkLen = n;
+   }
+   wa->prob = wa->blkProb[t-wa->blkTime];
+   wa->time = t;
+   return wa->prob;
+}
+
 /* Setotprob: allocate and calculate otprob matrix at time t */
-static void Setotprob(AlphaBeta *ab, FBInfo *fbInfo, ParmBuf pbuf, 
+static void Setotprob(AlphaBeta *ab, FBInfo *fbInfo, UttInfo *utt, 
                       Observation ot, int t, int S, int qHi, int qLo)
 {
    int q,j,Nq,s;
@@ -999,14 +1140,25 @@ static void Setotprob(AlphaBeta *ab, FBInfo *fbInfo, ParmBuf pbuf,
    PruneInfo *p;
    int skipstart, skipend;
    HMMSet *hset;
-   Boolean seenState=FALSE;
+   Boolean seenState=FALSE,useBlk;
+   ScoreView *sv;
+   int sIdx;
    
    hset = fbInfo->al_hset;
    skipstart = fbInfo->skipstart;
    skipend = fbInfo->skipend;
    p = ab->pInfo;
    otprob = ab->otprob;
-   ReadAsTable(pbuf,t-1,&ot);
+   ReadAsTable(utt->pbuf,t-1,&ot);
+   useBlk = obsBlock>1 && fbInfo->al_inXForm==NULL && !pde && !sharedMix &&
+      (hset->hsKind==PLAINHS || hset->hsKind==SHAREDHS);
+   sv = (fbInfo->al_inXForm==NULL && !pde && !sharedMix) ? 
+      GetScoreView(hset) : NULL;
+   if (useBlk && (t<utt->winLo || t>utt->winHi)) { /* beta pass runs T..1 */
+      utt->winHi = t; utt->winLo = (t>obsBlock) ? t-obsBlock+1 : 1;
+      for (j=utt->winLo; j<=utt->winHi; j++)
+         ReadAsTable(utt->pbuf,j-1,utt->obsWin+j-utt->winLo);
+   }
    if (hset->hsKind == TIEDHS)
       PrecomputeTMix(hset,&ot,pruneSetting.minFrwdP,0);
    if (trace&T_OUT && NonSkipRegion(skipstart,skipend,t)) 
@@ -1022,6 +1174,7 @@ static void Setotprob(AlphaBeta *ab, FBInfo *fbInfo, ParmBuf pbuf,
             outprob = otprob[t][q] = CreateOjsprob(&ab->abMem,Nq,S);
             for (j=2;j<Nq;j++){
                ste=hmm->svec[j].info->pdf+1; sum = 0.0;
+               sIdx=hmm->svec[j].info->sIdx;
                outprobj = outprob[j];
                for (s=1;s<=S;s++,ste++){
                   switch (hset->hsKind){
@@ -1039,11 +1192,16 @@ static void Setotprob(AlphaBeta *ab, FBInfo *fbInfo, ParmBuf pbuf,
                   case PLAINHS:  
                   case SHAREDHS: 
 		     if (S==1)
-		        outprobj[0] = ShStrP(hset,ste,ot.fv[s],t,fbInfo->al_inXForm,&ab->abMem);
+		        outprobj[0] = useBlk ? 
+                           BlkShStrP(fbInfo,utt,ste,s,t,&ab->abMem,sv,sIdx) :
+                           ShStrP(fbInfo,ste,ot.fv[s],t,&ab->abMem,sv,s,sIdx);
 		     else {
-                        if (((WtAcc *)ste->hook)->time==t) seenState=TRUE;
+                        if (((WtAcc *)ste->hook+fbInfo->slot)->time==t) 
+                           seenState=TRUE;
                         else seenState=FALSE;
-		        outprobj[s] = ShStrP(hset,ste,ot.fv[s],t,fbInfo->al_inXForm,&ab->abMem);
+		        outprobj[s] = useBlk ? 
+                           BlkShStrP(fbInfo,utt,ste,s,t,&ab->abMem,sv,sIdx) :
+                           ShStrP(fbInfo,ste,ot.fv[s],t,&ab->abMem,sv,s,sIdx);
                      }
 		    break;
                   default:
@@ -1149,7 +1307,6 @@ static void SetBeamTaper(PruneInfo *p, short *qDms, int Q, int T)
 static LogDouble SetBeta(AlphaBeta *ab, FBInfo *fbInfo, UttInfo *utt)
 {
 
-   ParmBuf pbuf;
    int i,j,t,q,Nq,lNq=0,q_at_gMax,startq,endq;
    int S, Q, T;
    DVector bqt=NULL,bqt1,bq1t1,maxP, **beta;
@@ -1163,18 +1320,18 @@ static LogDouble SetBeta(AlphaBeta *ab, FBInfo *fbInfo, UttInfo *utt)
    hset = fbInfo->al_hset;
    skipstart = fbInfo->skipstart;
    skipend = fbInfo->skipend;
-   pbuf=utt->pbuf;
    S=utt->S;
    Q=utt->Q;
    T=utt->T;
    p=ab->pInfo;
    beta=ab->beta;
 
-   maxP = CreateDVector(&gstack, Q);   /* for calculating beam width */
+   maxP = CreateDVector(&ab->abMem, Q); /* for calculating beam width */
+   utt->winLo = utt->winHi = 0;         /* invalidate block window */
   
    /* Last Column t = T */
    p->qHi[T] = Q; endq = p->qLo[T];
-   Setotprob(ab,fbInfo,pbuf,utt->ot,T,S,Q,endq);
+   Setotprob(ab,fbInfo,utt,utt->ot,T,S,Q,endq);
    beta[T] = CreateBetaQ(&ab->abMem,endq,Q,Q);
    gMax = LZERO;   q_at_gMax = 0;    /* max value of beta at time T */
    for (q=Q; q>=endq; q--){
@@ -1212,7 +1369,7 @@ static LogDouble SetBeta(AlphaBeta *ab, FBInfo *fbInfo, UttInfo *utt)
       /*  unless this is outside the beam taper.     */
       /*  + 1 to allow for state q+1[1] -> q[N]      */
       /*  + 1 for each tee model preceding endq.     */
-      Setotprob(ab,fbInfo,pbuf,utt->ot,t,S,startq,endq);
+      Setotprob(ab,fbInfo,utt,utt->ot,t,S,startq,endq);
       beta[t] = CreateBetaQ(&ab->abMem,endq,startq,Q);
       for (q=startq;q>=endq;q--) {
          lMax = LZERO;                 /* max value of beta in model q */
@@ -1381,7 +1538,7 @@ static void UpTranParms(FBInfo *fbInfo, HLink hmm, int t, int q,
 
    N = hmm->numStates;
    ab = fbInfo->ab;
-   ta = (TrAcc *) GetHook(hmm->transP);
+   ta = (TrAcc *) GetHook(hmm->transP)+fbInfo->slot;
    outprob = ab->otprob[t][q]; 
    if (bqt1!=NULL) outprob1 = ab->otprob[t+1][q];  /* Bug fix */
    else outprob1 = NULL;
@@ -1465,11 +1622,10 @@ static void UpMixParms(FBInfo *fbInfo, int q, HLink hmm, HLink al_hmm,
              t,q,ab->qIds[q]->name);
    }
    
-   /* allows a clean tidy of the space */
-   comp_prob = CreateVector(&gstack,fbInfo->maxM);
+   comp_prob = ab->compProb;
 
    if (strmProj) { /* recreate full vector */
-      ovec = CreateVector(&gstack,hset->vecSize);
+      ovec = ab->ovec;
       for (i=1,s=1;s<=S;s++)
          for (k=1;k<=hset->swidth[s];k++,i++)
             ovec[i] = ot.fv[s][k];
@@ -1513,7 +1669,7 @@ static void UpMixParms(FBInfo *fbInfo, int q, HLink hmm, HLink al_hmm,
             break;
          }
          /* update weight occupation count */
-         wa = (WtAcc *) ste->hook; steSumLr = 0.0;
+         wa = (WtAcc *) ste->hook+fbInfo->slot; steSumLr = 0.0;
 
          if (fbInfo->twoModels) { /* component probs of update hmm */
             norm = LZERO;
@@ -1541,7 +1697,7 @@ static void UpMixParms(FBInfo *fbInfo, int q, HLink hmm, HLink al_hmm,
                   otvs = ApplyCompFXForm(mp,ot.fv[s],inxform,&det,t);
                }
                wght = MixLogWeight(hset,me->weight);
-               comp_prob[mx]=wght+MOutP(otvs,mp)+det;
+               comp_prob[mx]=wght+CtxMOutP(fbInfo->sc,otvs,mp)+det;
                norm = LAdd(norm,comp_prob[mx]);
             }
          }
@@ -1626,8 +1782,8 @@ static void UpMixParms(FBInfo *fbInfo, int q, HLink hmm, HLink al_hmm,
                      this accumulates "true" outer products to allow multiple streams
                   */ 
                   if (fbInfo->uFlags&UPSEMIT) {
-                     ma = (MuAcc *) GetHook(mp->mean);
-                     va = (VaAcc *) GetHook(mp->cov.var);
+                     ma = (MuAcc *) GetHook(mp->mean)+fbInfo->slot;
+                     va = (VaAcc *) GetHook(mp->cov.var)+fbInfo->slot;
                      ma->occ += Lr;
                      va->occ += Lr;
                      mu_jm = ma->mu;
@@ -1663,8 +1819,8 @@ static void UpMixParms(FBInfo *fbInfo, int q, HLink hmm, HLink al_hmm,
                      if ((fbInfo->uFlags&UPMEANS) || (fbInfo->uFlags&UPVARS))
                         mean = mp->mean; 
                      if ((fbInfo->uFlags&UPMEANS) && (fbInfo->uFlags&UPVARS)) {
-                        ma = (MuAcc *) GetHook(mean);
-                        va = (VaAcc *) GetHook(mp->cov.var);
+                        ma = (MuAcc *) GetHook(mean)+fbInfo->slot;
+                        va = (VaAcc *) GetHook(mp->cov.var)+fbInfo->slot;
                         ma->occ += Lr;
                         va->occ += Lr;
                         mu_jm = ma->mu;
@@ -1691,7 +1847,7 @@ static void UpMixParms(FBInfo *fbInfo, int q, HLink hmm, HLink al_hmm,
                         }
                      }
                      else if (fbInfo->uFlags&UPMEANS){
-                        ma = (MuAcc *) GetHook(mean);
+                        ma = (MuAcc *) GetHook(mean)+fbInfo->slot;
                         mu_jm = ma->mu;
                         ma->occ += Lr;
                         for (k=1;k<=vSize;k++)     /* sum zero mean */
@@ -1699,7 +1855,7 @@ static void UpMixParms(FBInfo *fbInfo, int q, HLink hmm, HLink al_hmm,
                      }
                      else if (fbInfo->uFlags&UPVARS){
                         /* update covariance counts */
-                        va = (VaAcc *) GetHook(mp->cov.var);
+                        va = (VaAcc *) GetHook(mp->cov.var)+fbInfo->slot;
                         va->occ += Lr;
                         if ((mp->ckind==DIAGC)||(mp->ckind==INVDIAGC)){
                            var = va->cov.var;
@@ -1739,8 +1895,6 @@ static void UpMixParms(FBInfo *fbInfo, int q, HLink hmm, HLink al_hmm,
             printf("[%7.2f]\n",wa->occ);
       }
    }
-
-   FreeVector(&gstack,comp_prob);
 }
 
 /* -------------------- Top Level of F-B Updating ---------------- */
@@ -1765,11 +1919,13 @@ static void StepForward(FBInfo *fbInfo, UttInfo *utt)
    ab->occa = NULL;
    if (trace&T_OCC) 
       CreateTraceOcc(ab,utt);
+   if (egLock!=NULL) AcquireHLock(egLock);
    for (q=1;q<=utt->Q;q++){             /* inc access counters */
       up_hmm = ab->up_qList[q];
       negs = (int)up_hmm->hook+1;
       up_hmm->hook = (void *)negs;
    }
+   if (egLock!=NULL) ReleaseHLock(egLock);
 
    ResetObsCache();
 
@@ -1904,6 +2060,10 @@ void InitUttObservations(UttInfo *utt, HMMSet *al_hset,
    if (utt->twoDataFiles)
        utt->ot2 = MakeObservation(&gstack,al_hset->swidth,info2.tgtPK,
                                   al_hset->hsKind==DISCRETEHS,eSep);
+   if (obsBlock>1)
+      for (i=0; i<obsBlock; i++)
+         utt->obsWin[i] = MakeObservation(&gstack,al_hset->swidth,info.tgtPK,
+                                     al_hset->hsKind==DISCRETEHS,eSep);
    
    if (al_hset->hsKind==DISCRETEHS){ 
       for (i=0; i<utt->T; i++){
@@ -51,6 +51,8 @@ typedef struct {
                                single pass re-training */
 
   LogDouble pr;        /* log prob of current utterance */
+  Observation obsWin[OUTPBLOCK]; /* frames winLo..winHi scored together */
+  int winLo, winHi;    /* block window of the beta pass */
 
 } UttInfo;
 
@@ -83,6 +85,8 @@ typedef struct {
   LogDouble pr;       /* log prob of current utterance */
   Vector occt;        /* occ probs for current time t */
   Vector *occa;       /* array[1..Q][1..Nq] of occ probs (trace only) */
+  Vector compProb;    /* array[1..maxM] of component probs (2-model) */
+  Vector ovec;        /* full observation vector (stream projection) */
 
 } AlphaBeta;
 
@@ -102,6 +106,8 @@ typedef struct {
   AdaptXForm *inXForm;/* current input transform (if any) */
   AdaptXForm *al_inXForm;/* current input transform for al_hset (if any) */
   AdaptXForm *paXForm;/* current parent transform (if any) */
+  int slot;           /* index of the accumulators updated */
+  ScoreContext *sc;   /* context for output probability calculation */
 } FBInfo;
 
 
@@ -117,6 +123,20 @@ void SetTraceFB(void);
 void InitialiseForBack(FBInfo *fbInfo, MemHeap *x, HMMSet *set, UPDSet uset, 
                        LogDouble pruneInit, LogDouble pruneInc, 
                        LogDouble pruneLim, float minFrwdP);
+void InitialiseForBackParallel(FBInfo *fbInfo, MemHeap *x, HMMSet *set,
+                               UPDSet uset, LogDouble pruneInit, 
+                               LogDouble pruneInc, LogDouble pruneLim,
+                               float minFrwdP, int nPara);
+/* 
+   InitialiseForBack equals InitialiseForBackParallel(...,1).  With
+   nPara>1, fbInfo is an array[0..nPara-1] and fbInfo[i] accumulates
+   into accumulator slot i (see AttachAccsParallel), so that each
+   FBInfo can be used by a different thread at the same time.  The
+   threads must serialise LoadLabs, LoadData and InitUttObservations,
+   build the score view (GetScoreView) before they start, and set is
+   restricted to PLAINHS or SHAREDHS without input transforms or
+   2-model re-estimation.
+*/
 
 /* Use a different model set for alignment */
 void UseAlignHMMSet(FBInfo* fbInfo, MemHeap* x, HMMSet *al_hset);
@@ -123,6 +123,11 @@ float hfwdbkwd_totalProbScale = 1.0;          /* (not a config.) Product of all
                                                  HMMIRest.c */
 static FBLatInfo *fbInfo; /* current fbInfo, so don't have to pass it around. */
 
+static int obsBlock = 1;     /* frames scored together by ShStrP */
+static Observation obsWin[OUTPBLOCK]; /* frames winLo..winHi */
+static int winLo = 0, winHi = 0;
+static Boolean winMade = FALSE;
+
 static ConfParam *cParm[MAXGLOBS];  /* config parameters */
 static int nParm = 0;
 
@@ -818,6 +823,49 @@ static float * ShStrP(Vector v, int t, StreamElem *ste, AdaptXForm *xform, MemHe
 }
    
 
+/* BlkShStrP: as ShStrP but when stream element ste has not been
+   seen at time t, score frames winLo..t together and keep the 
+   results for the earlier frames of the backward pass */
+static float * BlkShStrP(int s, int t, StreamElem *ste, MemHeap *amem)
+{
+   WtAcc *wa;
+   MixtureElem *me;
+   float **blk;
+   int i,m,n,M,tt;
+   LogFloat px[OUTPBLOCK],bx[OUTPBLOCK];
+   Vector v[OUTPBLOCK];
+
+   wa = (WtAcc *)ste->hook; tt = t+StartTime;
+   if (wa->time==tt)           /* seen this state before */
+      return wa->prob;
+   if (wa->blkLen==0 || tt<wa->blkTime || tt>=wa->blkTime+wa->blkLen) {
+      M = ste->nMix; n = t-winLo+1;
+      blk = (float **)New(amem,n*sizeof(float *));
+      for (i=0; i<n; i++) {
+         blk[i] = NewOtprobVec(amem,M);
+         v[i] = obsWin[i].fv[s];
+         bx[i] = LZERO;
+      }
+      for (m=1,me=ste->spdf.cpdf+1; m<=M; m++,me++) {
+         if (M==1 || MixWeight(fbInfo->hset,me->weight)>MINMIX) {
+            MOutPBlock(v,n,me->mpdf,px);
+            for (i=0; i<n; i++) {
+               if (M==1) bx[i] = px[i];
+               else {
+                  bx[i] = LAdd(bx[i],MixLogWeight(fbInfo->hset,me->weight)+px[i]);
+                  blk[i][m] = px[i];
+               }
+            }
+         }
+      }
+      for (i=0; i<n; i++) blk[i][0] = bx[i];
+      wa->blkProb = blk; wa->blkTime = winLo+StartTime; wa->blkLen = n;
+   }
+   wa->prob = wa->blkProb[tt-wa->blkTime];
+   wa->time = tt;
+   return wa->prob;
+}
+
 /* Setotprob: allocate and calculate otprob matrix at time t */
 static void Setotprob(int t)
 {
@@ -827,8 +875,16 @@ static void Setotprob(int t)
    HLink hmm;
    LogFloat sum;
    float local_probscale;
+   Boolean useBlk;
   
    ReadAsTable(fbInfo->al_pbuf,t-1,&fbInfo->al_ot); 
+   useBlk = winMade && fbInfo->inXForm==NULL &&
+      (fbInfo->hsKind==PLAINHS || fbInfo->hsKind==SHAREDHS);
+   if (useBlk && (t<winLo || t>winHi)) {   /* backward pass runs T..1 */
+      winHi = t; winLo = (t>obsBlock) ? t-obsBlock+1 : 1;
+      for (j=winLo; j<=winHi; j++)
+         ReadAsTable(fbInfo->al_pbuf,j-1,obsWin+j-winLo);
+   }
     
    local_probscale = probScale;   /* direct scale on acoustics on state level, usu. 1 */
 
@@ -862,9 +918,11 @@ static void Setotprob(int t)
                                 sharing is needed in any case for lattices. */
                case SHAREDHS:
 		  if (fbInfo->S==1)
-		     outprob[j][0] = ShStrP(fbInfo->al_ot.fv[s],t+StartTime,ste,fbInfo->inXForm,fbInfo->aInfo->mem);
+		     outprob[j][0] = useBlk ? BlkShStrP(s,t,ste,fbInfo->aInfo->mem) :
+                        ShStrP(fbInfo->al_ot.fv[s],t+StartTime,ste,fbInfo->inXForm,fbInfo->aInfo->mem);
 		  else
-		     outprob[j][s] = ShStrP(fbInfo->al_ot.fv[s],t+StartTime,ste,fbInfo->inXForm,fbInfo->aInfo->mem);
+		     outprob[j][s] = useBlk ? BlkShStrP(s,t,ste,fbInfo->aInfo->mem) :
+                        ShStrP(fbInfo->al_ot.fv[s],t+StartTime,ste,fbInfo->inXForm,fbInfo->aInfo->mem);
 		  break;
                default:       HError(1, "Unknown hset kind.");
                }
@@ -923,6 +981,7 @@ static void SetBetaPlus()
       Columns T-1 -> 1.
    */
    ResetObsCache();  
+   winLo = winHi = 0;        /* invalidate block window */
    for (t=fbInfo->T;t>=1;t--) {
       Setotprob(t);
       for (q=fbInfo->aInfo->qHi[t];q>=fbInfo->aInfo->qLo[t];q--) { /*MAX(qHi[t],qLo[t]) because of the case for tee models where qHi[t]=qLo[t]-1 .*/
@@ -1524,7 +1583,7 @@ int MPE_GetFileLen(Lattice *lat){
 void FBLatClearUp(FBLatInfo *fbInfo); 
 
 void FBLatFirstPass(FBLatInfo *_fbInfo, FileFormat dff, char * datafn, char *datafn2, Lattice *MPECorrLat){
-   int q,T2=0; Boolean MPE;
+   int q,T2=0,i; Boolean MPE;
   
    fbInfo = _fbInfo;
    if(fbInfo->InUse) FBLatClearUp(fbInfo); 
@@ -1573,6 +1632,12 @@ void FBLatFirstPass(FBLatInfo *_fbInfo, FileFormat dff, char * datafn, char *dat
          fbInfo->up_ot = MakeObservation(&fbInfo->miscStack,fbInfo->hset->swidth,fbInfo->up_info.tgtPK,
                                          fbInfo->hsKind==DISCRETEHS,eSep);
       }
+      if (obsBlock>1 && !winMade) {
+         for (i=0; i<obsBlock; i++)
+            obsWin[i] = MakeObservation(&gstack,fbInfo->hset->swidth,fbInfo->al_info.tgtPK,
+                                        fbInfo->hsKind==DISCRETEHS,eSep);
+         winMade = TRUE;
+      }
       fbInfo->firstTime = FALSE;
    }
   
@@ -1810,6 +1875,11 @@ void InitFBLat(void)
       if (nParm>0){
          if (GetConfInt(cParm,nParm,"TRACE",&i)) trace = i;
          if (GetConfFlt(cParm,nParm,"MINFORPROB",&f))  minFrwdP = f;
+         if (GetConfInt(cParm,nParm,"OBSBLOCK",&i)) {
+            if (i<1 || i>OUTPBLOCK)
+               HError(1,"InitFBLat: OBSBLOCK must be in range 1..%d",OUTPBLOCK);
+            obsBlock = i;
+         }
          if (GetConfFlt(cParm,nParm,"PROBSCALE",&f))  probScale = f;
          if (GetConfFlt(cParm,nParm,"LANGPROBSCALE",&f))  langProbScale = f;
          if (GetConfFlt(cParm,nParm,"LATPROBSCALE",&f))  latProbScale = f; /* this config also used in HExactMPE.c */
@@ -481,6 +481,50 @@ void LatDetachInfo (MemHeap *heap, Lattice *lat)
 }
 
 
+/* LatSumVec
+
+     forward and backward sums over lat with nodes in topOrder for the
+     approximate log additions: the arcs entering (leaving) each node
+     are gathered and merged in blocks of LADDVECSIZE by LAddVec
+*/
+static void LatSumVec (Lattice *lat, LNode **topOrder)
+{
+   int i, n;
+   LNode *ln;
+   LArc *la;
+   LogDouble lx[LADDVECSIZE];
+
+   /* forward direction */
+   for (i = 0; i < lat->nn; ++i) {
+      ln = topOrder[i];
+      n = 0;
+      for (la = ln->pred; la; la = la->parc) {
+         assert (la->end == ln);
+         lx[n++] = LNodeFw (la->start) + LArcTotLike (lat, la);
+         if (n == LADDVECSIZE) {
+            LNodeFw (ln) = LAddVec (LNodeFw (ln), lx, n);
+            n = 0;
+         }
+      }
+      LNodeFw (ln) = LAddVec (LNodeFw (ln), lx, n);
+   }
+
+   /* backward direction */
+   for (i = lat->nn - 1; i >= 0; --i) {
+      ln = topOrder[i];
+      n = 0;
+      for (la = ln->foll; la; la = la->farc) {
+         assert (la->start == ln);
+         lx[n++] = LNodeBw (la->end) + LArcTotLike (lat, la);
+         if (n == LADDVECSIZE) {
+            LNodeBw (ln) = LAddVec (LNodeBw (ln), lx, n);
+            n = 0;
+         }
+      }
+      LNodeBw (ln) = LAddVec (LNodeBw (ln), lx, n);
+   }
+}
+
 /* LatForwBackw
 
      perform forward-backward algorithm on lattice and store scores in
@@ -513,44 +557,50 @@ LogDouble LatForwBackw (Lattice *lat, LatFBType type)
       nicer this could be done in one loop. The only readable way now 
       would be defining a couple of macros... */
 
-   /* forward direction */
-   for (i = 0; i < lat->nn; ++i) {
-      ln = topOrder[i];
-      for (la = ln->foll; la; la = la->farc) {
-         assert (la->start == ln);
+   /* in EXACT mode the sums are the original LAdd chains per arc, so
+      that scores do not depend on the log add batching */
+   if (type == LATFB_SUM && GetLAddKind () != EXACTLA)
+      LatSumVec (lat, topOrder);
+   else {
+      /* forward direction */
+      for (i = 0; i < lat->nn; ++i) {
+         ln = topOrder[i];
+         for (la = ln->foll; la; la = la->farc) {
+            assert (la->start == ln);
          
-         score = LNodeFw (ln) + LArcTotLike (lat, la);
-         switch (type) {
-         case LATFB_SUM:
-            LNodeFw (la->end) = LAdd (LNodeFw (la->end), score);
-            break;
-         case LATFB_MAX:
-            if (score > LNodeFw (la->end))
-               LNodeFw (la->end) = score;
-            break;
-         default:
-            abort ();
+            score = LNodeFw (ln) + LArcTotLike (lat, la);
+            switch (type) {
+            case LATFB_SUM:
+               LNodeFw (la->end) = LAdd (LNodeFw (la->end), score);
+               break;
+            case LATFB_MAX:
+               if (score > LNodeFw (la->end))
+                  LNodeFw (la->end) = score;
+               break;
+            default:
+               abort ();
+            }
          }
       }
-   }
 
-   /* backward direction */
-   for (i = lat->nn - 1; i >= 0; --i) {
-      ln = topOrder[i];
-      for (la = ln->pred; la; la = la->parc) {
-         assert (la->end == ln);
+      /* backward direction */
+      for (i = lat->nn - 1; i >= 0; --i) {
+         ln = topOrder[i];
+         for (la = ln->pred; la; la = la->parc) {
+            assert (la->end == ln);
          
-         score = LNodeBw (ln) + LArcTotLike (lat, la);
-         switch (type) {
-         case LATFB_SUM:
-            LNodeBw (la->start) = LAdd (LNodeBw (la->start), score);
-            break;
-         case LATFB_MAX:
-            if (score > LNodeBw (la->start))
-               LNodeBw (la->start) = score;
-            break;
-         default:
-            abort ();
+            score = LNodeBw (ln) + LArcTotLike (lat, la);
+            switch (type) {
+            case LATFB_SUM:
+               LNodeBw (la->start) = LAdd (LNodeBw (la->start), score);
+               break;
+            case LATFB_MAX:
+               if (score > LNodeBw (la->start))
+                  LNodeBw (la->start) = score;
+               break;
+            default:
+               abort ();
+            }
          }
       }
    }
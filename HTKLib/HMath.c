@@ -40,6 +40,13 @@ char *hmath_vc_id = "$Id: HMath.c,v 1.1.1.1 2006/10/11 09:54:58 jal58 Exp $";
 #include "HMem.h"
 #include "HMath.h"
 
+/* SSE2 version of LAddVec, define NO_LADD_SIMD to disable */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+    (defined(__clang__) || __GNUC__ >= 7) && !defined(NO_LADD_SIMD)
+#define LADD_SIMD
+#include <emmintrin.h>
+#endif
+
 /* ----------------------------- Trace Flags ------------------------- */
 
 static int trace = 0;
@@ -607,6 +614,44 @@ LogFloat CovDet(TriMat c)
    return 2.0*ldet;
 }
 
+/* EXPORT->TriCholeski: puts Choleski factor of c in l, returns log(Det(c)) */
+/*          Note that c must be positive definite */
+LogFloat TriCholeski(TriMat c, TriMat l)
+{
+   DMatrix dl;  /* Lower Tri Choleski Matrix */
+   LogFloat ldet = 0.0;
+   int i,j,n;
+   
+   n = TriMatSize(c);
+   dl = CreateDMatrix(&gstack,n,n);
+   if (Choleski(c,dl)){
+      for (i=1; i<=n; i++) {
+         for (j=1; j<=i; j++)
+            l[i][j] = dl[i][j];
+         ldet += log(dl[i][i]);
+      }
+   } else
+      HError(5220,"TriCholeski: [%f ...] not invertible",c[1][1]);
+   FreeDMatrix(&gstack,dl);
+   return 2.0*ldet;
+}
+
+/* EXPORT->TriCholeskiProd: puts l l' in c */
+void TriCholeskiProd(TriMat l, TriMat c)
+{
+   int i,j,k,n;
+   double sum;
+
+   n = TriMatSize(l);
+   for (i=1; i<=n; i++)
+      for (j=1; j<=i; j++) {
+         sum = 0.0;
+         for (k=1; k<=j; k++)
+            sum += l[i][k]*l[j][k];
+         c[i][j] = sum;
+      }
+}
+
 /* Quadratic prod of a full square matrix C and an arbitry full matrix transform A */
 void LinTranQuaProd(Matrix Prod, Matrix A, Matrix C)
 {
@@ -1571,6 +1616,66 @@ double MatCofact(Matrix c, int r, Vector cofact)
 
 static LogDouble minLogExp;
 
+/*
+   LAdd and LAddVec can use one of four methods, selected by the
+   LADDKIND config variable
+
+      EXACT   log and exp from the C library
+      TABLE   log(1+exp(-d)) from a table with LADDTABRES entries per
+              unit of d and linear interpolation
+      POLY    polynomial approximations of exp and log(1+z) in LAddVec,
+              the TABLE method in LAdd
+      MAX     max(x,y), ie Viterbi approximation of the sum
+
+   In EXACT mode LAddVec is the chain of LAdd calls it replaces so
+   that results are bit-identical to adding the terms one at a time.
+   Otherwise it subtracts the maximum and sums the exponentials of
+   all elements before taking a single log, using the polynomial
+   approximation which on x86 processes 4 elements at a time using
+   SSE2.  A scalar polynomial is slower than the C library for single
+   LAdd calls, so POLY only affects LAddVec and LAdd uses the table.
+*/
+
+static LAddKind lAddKind = EXACTLA;
+static int lAddTabRes = 64;        /* table entries per unit */
+static int lAddTabSize = 0;
+static double *lAddTab = NULL;     /* lAddTab[i] = log(1+exp(-i/lAddTabRes)) */
+static Boolean lAddSSE2 = FALSE;   /* host can run SumExpSSE2 */
+static double pow2Tab[40];         /* pow2Tab[i] = 2^-i, i <= -minLogExp/ln2 */
+
+/* coefficients of the exp polynomial on [-ln2/2,ln2/2] (Cephes expf) */
+#define EXPC1 5.0000001201E-1
+#define EXPC2 1.6666665459E-1
+#define EXPC3 4.1665795894E-2
+#define EXPC4 8.3334519073E-3
+#define EXPC5 1.3981999507E-3
+#define EXPC6 1.9875691500E-4
+#define LOG2E 1.44269504088896341
+#define LN2HI 0.693359375
+#define LN2LO -2.12194440E-4
+
+/* PolyExp: exp(d) for minLogExp <= d <= 0 */
+static double PolyExp(double d)
+{
+   double r,p;
+   int n;
+
+   n = (int) (0.5 - d*LOG2E);   /* d = -n*ln2 + r, |r| <= ln2/2 */
+   r = d + n*LN2HI + n*LN2LO;
+   p = ((((EXPC6*r + EXPC5)*r + EXPC4)*r + EXPC3)*r + EXPC2)*r + EXPC1;
+   return (p*r*r + r + 1.0) * pow2Tab[n];
+}
+
+/* TableLog1PExp: log(1+exp(d)) for minLogExp <= d <= 0 */
+static double TableLog1PExp(double d)
+{
+   double f;
+   int i;
+
+   f = -d*lAddTabRes; i = (int) f; f -= i;
+   return lAddTab[i] + f*(lAddTab[i+1]-lAddTab[i]);
+}
+
 /* EXPORT->LAdd: Return sum x + y on log scale, 
                 sum < LSMALL is floored to LZERO */
 LogDouble LAdd(LogDouble x, LogDouble y)
@@ -1581,14 +1686,115 @@ LogDouble LAdd(LogDouble x, LogDouble y)
       temp = x; x = y; y = temp;
    }
    diff = y-x;
-   if (diff<minLogExp) 
+   if (diff<minLogExp || lAddKind == MAXLA) 
       return  (x<LSMALL)?LZERO:x;
-   else {
+   switch (lAddKind) {
+   case TABLELA:
+   case POLYLA:                 /* the polynomials only pay off in LAddVec */
+      return x+TableLog1PExp(diff);
+   default:
       z = exp(diff);
       return x+log(1.0+z);
    }
 }
 
+#ifdef LADD_SIMD
+/* SumExpSSE2: sum of exp(x[i]-max) over x[i]-max >= minLogExp */
+__attribute__((target("sse2")))
+static double SumExpSSE2(LogDouble *x, int n, LogDouble max)
+{
+   __m128d vmax,lo,hi;
+   __m128 d,r,p,fn,acc,mask,vmin;
+   __m128i e;
+   float part[4];
+   double sum;
+   int i;
+
+   vmax = _mm_set1_pd(max); vmin = _mm_set1_ps((float)minLogExp);
+   acc = _mm_setzero_ps();
+   for (i=0; i+4<=n; i+=4) {
+      lo = _mm_sub_pd(_mm_loadu_pd(x+i),vmax);
+      hi = _mm_sub_pd(_mm_loadu_pd(x+i+2),vmax);
+      d = _mm_movelh_ps(_mm_cvtpd_ps(lo),_mm_cvtpd_ps(hi));
+      mask = _mm_cmpge_ps(d,vmin);
+      d = _mm_max_ps(d,vmin);
+      /* n = round(d/ln2), r = d - n*ln2 */
+      e = _mm_cvtps_epi32(_mm_mul_ps(d,_mm_set1_ps((float)LOG2E)));
+      fn = _mm_cvtepi32_ps(e);
+      r = _mm_sub_ps(d,_mm_mul_ps(fn,_mm_set1_ps((float)LN2HI)));
+      r = _mm_sub_ps(r,_mm_mul_ps(fn,_mm_set1_ps((float)LN2LO)));
+      p = _mm_set1_ps((float)EXPC6);
+      p = _mm_add_ps(_mm_mul_ps(p,r),_mm_set1_ps((float)EXPC5));
+      p = _mm_add_ps(_mm_mul_ps(p,r),_mm_set1_ps((float)EXPC4));
+      p = _mm_add_ps(_mm_mul_ps(p,r),_mm_set1_ps((float)EXPC3));
+      p = _mm_add_ps(_mm_mul_ps(p,r),_mm_set1_ps((float)EXPC2));
+      p = _mm_add_ps(_mm_mul_ps(p,r),_mm_set1_ps((float)EXPC1));
+      p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p,r),r),r);
+      p = _mm_add_ps(p,_mm_set1_ps(1.0f));
+      /* scale by 2^n */
+      e = _mm_slli_epi32(_mm_add_epi32(e,_mm_set1_epi32(127)),23);
+      p = _mm_mul_ps(p,_mm_castsi128_ps(e));
+      acc = _mm_add_ps(acc,_mm_and_ps(p,mask));
+   }
+   _mm_storeu_ps(part,acc);
+   sum = (double) part[0] + part[1] + part[2] + part[3];
+   for (; i<n; i++)
+      if (x[i]-max >= minLogExp) sum += PolyExp(x[i]-max);
+   return sum;
+}
+#endif
+
+/* EXPORT->LAddVec: Return sum + x[0] + ... + x[n-1] on log scale,
+                   sum < LSMALL is floored to LZERO */
+LogDouble LAddVec(LogDouble sum, LogDouble *x, int n)
+{
+   LogDouble max,diff,esum;
+   int i;
+
+   if (n <= 0) return sum;
+   if (lAddKind == EXACTLA) {   /* same chain of LAdd calls as the callers */
+      for (i=0; i<n; i++) sum = LAdd(sum,x[i]);
+      return sum;
+   }
+   max = x[0];
+   for (i=1; i<n; i++)
+      if (x[i] > max) max = x[i];
+   if (max < LSMALL) return LAdd(sum,LZERO);
+   if (lAddKind == MAXLA || n == 1) return LAdd(sum,max);
+#ifdef LADD_SIMD
+   if (lAddSSE2) return LAdd(sum,max+log(SumExpSSE2(x,n,max)));
+#endif
+   esum = 0.0;
+   for (i=0; i<n; i++) {
+      diff = x[i]-max;
+      if (diff >= minLogExp) esum += PolyExp(diff);
+   }
+   return LAdd(sum,max+log(esum));
+}
+
+/* EXPORT->GetLAddKind: return the log add method in use */
+LAddKind GetLAddKind(void)
+{
+   return lAddKind;
+}
+
+/* InitLAdd: check for SSE2 and build the log add table for TABLE and POLY */
+static void InitLAdd(void)
+{
+   int i;
+
+   for (i=0; i<40; i++) pow2Tab[i] = ldexp(1.0,-i);
+#ifdef LADD_SIMD
+   __builtin_cpu_init();
+   lAddSSE2 = __builtin_cpu_supports("sse2") ? TRUE : FALSE;
+#endif
+   if (lAddKind != TABLELA && lAddKind != POLYLA) return;
+   lAddTabSize = (int) (-minLogExp*lAddTabRes) + 2;
+   lAddTab = (double *) New(&gcheap,lAddTabSize*sizeof(double));
+   for (i=0; i<lAddTabSize; i++)
+      lAddTab[i] = log(1.0+exp(-(double)i/lAddTabRes));
+}
+
 /* EXPORT->LSub: Return diff x - y on log scale, 
                  diff < LSMALL is floored to LZERO */
 LogDouble LSub(LogDouble x, LogDouble y)
@@ -1674,6 +1880,7 @@ float GaussDeviate(float mu, float sigma)
 void InitMath(void)
 {
    int i;
+   char buf[MAXSTRLEN];
 
    Register(hmath_version,hmath_vc_id);
    RandInit(-1);
@@ -1681,7 +1888,21 @@ void InitMath(void)
    numParm = GetConfig("HMATH", TRUE, cParm, MAXGLOBS);
    if (numParm>0){
       if (GetConfInt(cParm,numParm,"TRACE",&i)) trace = i;
+      if (GetConfStr(cParm,numParm,"LADDKIND",buf)) {
+         if (strcmp(buf,"EXACT")==0) lAddKind = EXACTLA;
+         else if (strcmp(buf,"TABLE")==0) lAddKind = TABLELA;
+         else if (strcmp(buf,"POLY")==0) lAddKind = POLYLA;
+         else if (strcmp(buf,"MAX")==0) lAddKind = MAXLA;
+         else
+            HError(5272,"InitMath: Unknown log add kind %s",buf);
+      }
+      if (GetConfInt(cParm,numParm,"LADDTABRES",&i)) {
+         if (i < 1)
+            HError(5272,"InitMath: LADDTABRES must be positive");
+         lAddTabRes = i;
+      }
    }
+   InitLAdd();
 }
 
 /* ------------------------- End of HMath.c ------------------------- */
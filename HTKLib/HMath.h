@@ -43,6 +43,7 @@ extern "C" {
 #define LSMALL (-0.5E10)   /* log values < LSMALL are set to LZERO */
 #define MINEARG (-708.3)   /* lowest exp() arg  = log(MINLARG) */
 #define MINLARG 2.45E-308  /* lowest log() arg  = exp(MINEARG) */
+#define LADDVECSIZE 64     /* block size for LAddVec buffers */
 
 /* NOTE: On some machines it may be necessary to reduce the
          values of MINEARG and MINLARG
@@ -51,6 +52,13 @@ extern "C" {
 typedef float  LogFloat;   /* types just to signal log values */
 typedef double LogDouble;
 
+typedef enum {  /* Methods for log addition */
+   EXACTLA,       /* exp and log from C library */
+   TABLELA,       /* table lookup */
+   POLYLA,        /* polynomial approximation */
+   MAXLA          /* maximum only, Viterbi approximation */
+} LAddKind;
+
 typedef enum {  /* Various forms of covariance matrix */
    DIAGC,         /* diagonal covariance */
    INVDIAGC,      /* inverse diagonal covariance */
@@ -180,6 +188,19 @@ LogFloat CovDet(TriMat c);
    Returns log of Det(c), c must be positive definite.
 */
 
+LogFloat TriCholeski(TriMat c, TriMat l);
+/*
+   Computes the lower triangular Choleski factor of c in l, so that
+   c = l l', and returns the log of Det(c).  l may be the same
+   matrix as c, c must be positive definite.
+*/
+
+void TriCholeskiProd(TriMat l, TriMat c);
+/*
+   Computes c = l l' for lower triangular l, the inverse of 
+   TriCholeski.  c and l must be different matrices.
+*/
+
 /* EXPORT->MatDet: determinant of a matrix */
 float MatDet(Matrix c);
 
@@ -218,6 +239,24 @@ LogDouble LAdd(LogDouble x, LogDouble y);
    sum < LSMALL is floored to LZERO 
 */
 
+LogDouble LAddVec(LogDouble sum, LogDouble *x, int n);
+/*
+   Return sum+x[0]+...+x[n-1] where sum and the x[i] are stored as 
+   logs, sum < LSMALL is floored to LZERO.  In EXACT mode this is 
+   the chain sum=LAdd(sum,x[i]), otherwise the block x[] is summed 
+   with a single log.  Callers summing an unknown number of terms 
+   collect them in blocks of LADDVECSIZE and pass the running sum.
+*/
+
+LAddKind GetLAddKind(void);
+/*
+   Return the method used by LAdd and LAddVec, set by the LADDKIND 
+   config variable (EXACT, TABLE, POLY or MAX, default EXACT).
+   TABLE and POLY are approximations accurate to about 1E-5 that 
+   only differ in LAddVec, MAX replaces the sum by the maximum and 
+   is meant for recognition.
+*/
+
 LogDouble LSub(LogDouble x, LogDouble y);
 /*
    Return x-y where x and y are stored as logs, 
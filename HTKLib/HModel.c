@@ -46,6 +46,20 @@ char *hmodel_vc_id = "$Id: HModel.c,v 1.2 2006/12/07 11:09:08 mjfg Exp $";
 #include "HUtil.h"
 #include "HTrain.h"
 #include "HAdapt.h"
+#include "HVQ.h"
+#include <stddef.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+/* Vectorised diagonal Gaussian kernels are compiled in only where the
+   compiler supports per-function target attributes so that a single
+   binary can run on any x86 host; the choice is made at run time */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+    (defined(__clang__) || __GNUC__ >= 7) && !defined(NO_GAUSS_SIMD)
+#define GAUSS_SIMD
+#include <immintrin.h>
+#endif
 
 /* --------------------------- Trace Flags ------------------------- */
 
@@ -62,6 +76,7 @@ static int trace = 0;
 #define T_GMX  00400       /* GMP optimisation */
 #define T_XFM  01000       /* Loading of xform macros */
 #define T_XFD  02000       /* Additional detail of loading of xform macros */
+#define T_KRN  04000       /* Gaussian kernel selection and check */
 
 #define CREATEFIDX -1
 #define LOADFIDX   -2
@@ -99,18 +114,40 @@ static Boolean indexSet = FALSE;        /* have the indexes been set for the mod
 
 static MemHeap xformStack;              /* For Storage of xforms with no model sets ... */
 
+static char gselFN[MAXSTRLEN] = "";    /* Gaussian selection index */
+static LogFloat gselFloor = LZERO;     /* back off for empty shortlists */
+
+static Boolean useScoreView = TRUE;    /* let GetScoreView build views */
+
 static int pde1BlockEnd = 13;          /* size of PDE blocks */
 static int pde2BlockEnd = 26;          /* size of PDE blocks */
 static LogFloat pdeTh1 = -5.0;         /* threshold for 1/3 PDE */
 static LogFloat pdeTh2 = 0.0;          /* threshold for 2/3 PDE */
 
-#ifdef PDE_STATS
-static int nGaussTot = 0;
-static int nGaussPDE1 = 0;
-static int nGaussPDE2 = 0;
-#endif
+/* context of the non-reentrant scoring routines: hset->tmRecs, 
+   scratch vectors from gstack and the global PDE statistics */
+static ScoreContext gCtx = { NULL, NULL, NULL, NULL, 0, 0, 0 };
+
+/* Diagonal Gaussian distance kernel: returns acc + sum_i d_i*d_i*v[i] 
+   (IDist) or acc + sum_i d_i*d_i/v[i] (DDist) where d_i = x[i]-m[i]
+   for i=0..n-1.  Callers pass HTK vectors offset by one. */
+typedef float (*DistKernel)(float acc, float *x, float *m, float *v, int n);
+
+/* Choleski (LLTC) distance kernel: returns acc + |L'd|^2 where L is 
+   the lower triangular TriMat l and d[0..n-1] = x-m.  L'd is formed a
+   block of columns at a time so each block stays in registers while 
+   the rows of l are traversed. */
+typedef float (*LDistKernel)(float acc, TriMat l, float *d, int n);
+
+#define LDISTMAXSIZE 128   /* COutP keeps x-mean on the C stack up to this */
+
+static GKernKind gKernKind = SCALARGK;  /* selected Gaussian kernel */
+static DistKernel iDist;                /* (x-m)^2*v kernel in use */
+static DistKernel dDist;                /* (x-m)^2/v kernel in use */
+static LDistKernel lDist;               /* |L'd|^2 kernel in use */
 
 void InitSymNames(void);
+static void InitGaussKernels(GKernKind kind);
 
 /* EXPORT->InitModel: initialise memory and configuration parameters */
 void InitModel(void)
@@ -119,6 +156,7 @@ void InitModel(void)
    double d;
    Boolean b;
    char buf[MAXSTRLEN];
+   GKernKind kind = AUTOGK;
    
    Register(hmodel_version,hmodel_vc_id);
    CreateHeap(&xformStack,"XFormStore",MSTAK, 1, 0.5, 100 ,  1000 );
@@ -152,7 +190,21 @@ void InitModel(void)
       if (GetConfInt(cParm,nParm,"PDE2BLOCKEND",&i)) pde2BlockEnd = i;
       if (GetConfFlt(cParm,nParm,"PDETHRESHOLD1",&d)) pdeTh1 = d;
       if (GetConfFlt(cParm,nParm,"PDETHRESHOLD2",&d)) pdeTh2 = d;
+      if (GetConfStr (cParm,nParm,"GSELINDEX",buf))
+         strcpy(gselFN,buf);
+      if (GetConfFlt(cParm,nParm,"GSELFLOOR",&d)) gselFloor = d;
+      if (GetConfBool(cParm,nParm,"SCOREVIEW",&b)) useScoreView = b;
+      if (GetConfStr (cParm,nParm,"GAUSSKERNEL",buf)) {
+         if (strcmp(buf,"AUTO")==0) kind = AUTOGK;
+         else if (strcmp(buf,"SCALAR")==0) kind = SCALARGK;
+         else if (strcmp(buf,"SSE4")==0) kind = SSE4GK;
+         else if (strcmp(buf,"AVX2")==0) kind = AVX2GK;
+         else if (strcmp(buf,"AVX512")==0) kind = AVX512GK;
+         else
+            HError(7070,"InitModel: Unknown Gaussian kernel %s",buf);
+      }
    }
+   InitGaussKernels(kind);
 }
 
 /* -------------------- Check Model Consistency -------------------- */
@@ -1055,6 +1107,7 @@ static ReturnStatus GetOptions(HMMSet *hset, Source *src, Token *tok, int *nStat
    while (tok->sym == PARMKIND || tok->sym == INVDIAGCOV || 
           tok->sym == HMMSETID  || tok->sym == INPUTXFORM || 
           tok->sym == PARENTXFORM || tok->sym == PROJSIZE ||
+          tok->sym == LLTCOV ||
           (tok->sym >= NUMSTATES && tok->sym <= XFORMCOV)){
       if(GetOption(hset,src,tok,&p)<SUCCESS){
          HMError(src,"GetOptions: GetOption failed");
@@ -3549,6 +3602,7 @@ void ApplyVFloor(HMMSet *hset)
    Boolean mixFloored;
    Vector vFloor[SMAX],minv;
    Covariance cov;
+   TriMat tm;
    MLink m;
    LabId id;
    char mac[32];
@@ -3612,7 +3666,24 @@ void ApplyVFloor(HMMSet *hset)
          }
          FixFullGConst(hss.mp, CovInvert(cov.inv,cov.inv) ); 
          break;
-      case LLTC:
+      case LLTC: /* Choleski factor of inverse covariance */
+         tm = CreateTriMat(&gstack,vSize);
+         TriCholeskiProd(cov.inv,tm);
+         CovInvert(tm,tm);
+         for (k=1; k<=vSize; k++){
+            if (tm[k][k]<minv[k]) {
+               tm[k][k] = minv[k];
+               nFloorVar++;
+               mixFloored = TRUE;
+            }
+         }
+         if (mixFloored) {
+            CovInvert(tm,tm);
+            TriCholeski(tm,cov.inv);
+            FixLLTGConst(hss.mp);
+         }
+         FreeTriMat(&gstack,tm);
+         break;
       case XFORMC:   
       default:
          HError(7023,"ApplyVFLoor: CovKind not (yet) supported");
@@ -3737,6 +3808,492 @@ void PrintHSetProfile(FILE *f, HMMSet *hset)
 }
 
 
+/* ------------------- Compiled HMM Set Images -------------------- */
+
+/*
+   An image file consists of
+      ImgHeader
+      object area - copies of the HMMDef, StateInfo, StreamElem,
+                    MixtureElem and MixPDF structures with their shared
+                    vectors and matrices, the macro names and an
+                    ImgMacro table, all reached via an ImgRoot
+      relocation table - offsets of every pointer in the object area
+   Pointers in the object area hold the address they would have if the
+   file were mapped at the preferred base address, so when the mapping
+   lands there the structures are used as they stand and their pages
+   are shared with every other process using the image.  Otherwise
+   each listed pointer is shifted once at load time.  Images are in the
+   native byte order and pointer size of the machine that wrote them.
+*/
+
+#define IMGMAGIC  "HTKIMG01"
+#define IMGORDER  0x01020304      /* detects a byte order mismatch */
+#define IMGALIGN  16              /* alignment of every object */
+#define IMGMACROS "hsmuvicwtd"    /* macro types stored in images */
+#if defined(__LP64__) || defined(_WIN64)
+#define IMGBASEADDR ((size_t)0x3e0000000000) /* preferred mapping */
+#else
+#define IMGBASEADDR ((size_t)0x60000000)
+#endif
+
+typedef struct {
+   char magic[8];          /* IMGMAGIC */
+   int order;              /* IMGORDER in writer's byte order */
+   int ptrSize;            /* sizeof(Ptr) of writer */
+   size_t size;            /* total bytes in image */
+   size_t base;            /* preferred mapping address */
+   size_t root;            /* offset of ImgRoot */
+   size_t relocs;          /* offset of relocation table */
+   size_t nRelocs;         /* number of pointers to relocate */
+} ImgHeader;
+
+typedef struct {
+   char type;              /* macro type */
+   size_t name;            /* offset of macro name */
+   size_t structure;       /* offset of macro structure */
+} ImgMacro;
+
+typedef struct {
+   short vecSize;          /* global options of the set */
+   short swidth[SMAX];
+   ParmKind pkind;
+   DurKind dkind;
+   CovKind ckind;
+   HSetKind hsKind;
+   int numPhyHMM;          /* physical HMMs stored */
+   int numStates;          /* counts from SetIndexes when written */
+   int numSharedStates;
+   int numMix;
+   int numSharedMix;
+   int numTransP;
+   int ckUsage[NUMCKIND];
+   int numMacros;          /* entries in macro table */
+   size_t macros;          /* offset of ImgMacro table */
+} ImgRoot;
+
+typedef struct {           /* image under construction */
+   char *buf;              /* header and object area */
+   size_t used;            /* bytes used in buf */
+   size_t size;            /* bytes allocated to buf */
+   size_t *reloc;          /* offsets in buf of pointers */
+   size_t nReloc,maxReloc;
+   Ptr **hooks;            /* hooks of copied source structures */
+   size_t nHook,maxHook;
+} ImgBuild;
+
+/* ImgGrow: double the capacity *max of array p of elSize elements */
+static Ptr ImgGrow(Ptr p, size_t *max, size_t elSize)
+{
+   *max = (*max == 0) ? 4096 : 2 * *max;
+   if ((p = realloc(p,*max * elSize)) == NULL)
+      HError(7028,"ImgGrow: cannot allocate %lu bytes for image",
+             (unsigned long)(*max * elSize));
+   return p;
+}
+
+/* ImgAlloc: return offset of n zeroed bytes in image b */
+static size_t ImgAlloc(ImgBuild *b, size_t n)
+{
+   size_t off;
+
+   off = (b->used + IMGALIGN-1) / IMGALIGN * IMGALIGN;
+   while (off+n > b->size)
+      b->buf = (char *)ImgGrow(b->buf,&b->size,1);
+   memset(b->buf+b->used,0,off+n-b->used);
+   b->used = off+n;
+   return off;
+}
+
+/* ImgLink: set pointer at offset at to image offset target (0=NULL) */
+static void ImgLink(ImgBuild *b, size_t at, size_t target)
+{
+   if (target == 0) {
+      *(Ptr *)(b->buf+at) = NULL; return;
+   }
+   if (b->nReloc == b->maxReloc)
+      b->reloc = (size_t *)ImgGrow(b->reloc,&b->maxReloc,sizeof(size_t));
+   *(size_t *)(b->buf+at) = IMGBASEADDR + target;
+   b->reloc[b->nReloc++] = at;
+}
+
+/* ImgMark: record that source structure with given hook is at off */
+static void ImgMark(ImgBuild *b, Ptr *hook, size_t off)
+{
+   if (b->nHook == b->maxHook)
+      b->hooks = (Ptr **)ImgGrow(b->hooks,&b->maxHook,sizeof(Ptr *));
+   *hook = (Ptr)off;
+   b->hooks[b->nHook++] = hook;
+}
+
+/* ImgSVector: copy shared vector v to b and return its offset */
+static size_t ImgSVector(ImgBuild *b, SVector v)
+{
+   size_t off,n;
+
+   if (v == NULL) return 0;
+   if (GetHook(v) != NULL) return (size_t)GetHook(v);
+   n = SVectorElemSize(VectorSize(v));
+   off = ImgAlloc(b,n);
+   memcpy(b->buf+off,(Ptr *)v-2,n);
+   *(Ptr *)(b->buf+off) = NULL;
+   off += 2*sizeof(Ptr);
+   ImgMark(b,(Ptr *)v-2,off);
+   return off;
+}
+
+/* ImgSMat: copy shared matrix or tri matrix m occupying n bytes with
+   nrows rows to b and return its offset */
+static size_t ImgSMat(ImgBuild *b, Vector *m, int nrows, size_t n)
+{
+   size_t off;
+   int j;
+
+   if (m == NULL) return 0;
+   if (GetHook(m) != NULL) return (size_t)GetHook(m);
+   off = ImgAlloc(b,n);
+   memcpy(b->buf+off,(Ptr *)m-2,n);
+   *(Ptr *)(b->buf+off) = NULL;
+   off += 2*sizeof(Ptr);
+   for (j=1; j<=nrows; j++)
+      ImgLink(b,off+j*sizeof(Vector),off+((char *)m[j]-(char *)m));
+   ImgMark(b,(Ptr *)m-2,off);
+   return off;
+}
+
+/* ImgTriMat: copy shared tri matrix m to b */
+static size_t ImgTriMat(ImgBuild *b, STriMat m)
+{
+   if (m == NULL) return 0;
+   return ImgSMat(b,m,TriMatSize(m),STriMatElemSize(TriMatSize(m)));
+}
+
+/* ImgMatrix: copy shared matrix m to b */
+static size_t ImgMatrix(ImgBuild *b, SMatrix m)
+{
+   if (m == NULL) return 0;
+   return ImgSMat(b,m,NumRows(m),SMatrixElemSize(NumRows(m),NumCols(m)));
+}
+
+/* ImgMixPDF: copy mixture pdf mp to b */
+static size_t ImgMixPDF(ImgBuild *b, MixPDF *mp)
+{
+   size_t off,t;
+
+   if (mp == NULL) return 0;
+   if (mp->hook != NULL) return (size_t)mp->hook;
+   off = ImgAlloc(b,sizeof(MixPDF));
+   memcpy(b->buf+off,mp,sizeof(MixPDF));
+   ImgMark(b,&mp->hook,off);
+   t = ImgSVector(b,mp->mean);  ImgLink(b,off+offsetof(MixPDF,mean),t);
+   if (mp->ckind == FULLC || mp->ckind == LLTC)
+      t = ImgTriMat(b,mp->cov.inv);
+   else
+      t = ImgSVector(b,mp->cov.var);
+   ImgLink(b,off+offsetof(MixPDF,cov),t);
+   t = ImgSVector(b,mp->vFloor); ImgLink(b,off+offsetof(MixPDF,vFloor),t);
+   ImgLink(b,off+offsetof(MixPDF,info),0);
+   ImgLink(b,off+offsetof(MixPDF,hook),0);
+   return off;
+}
+
+/* ImgStateInfo: copy state si of hset, its streams and mixtures to b */
+static size_t ImgStateInfo(ImgBuild *b, HMMSet *hset, StateInfo *si)
+{
+   size_t off,pdf,at,me,t;
+   int s,m,S,M;
+   StreamElem *ste;
+
+   if (si->hook != NULL) return (size_t)si->hook;
+   S = hset->swidth[0];
+   off = ImgAlloc(b,sizeof(StateInfo));
+   memcpy(b->buf+off,si,sizeof(StateInfo));
+   ImgMark(b,&si->hook,off);
+   t = ImgSVector(b,si->weights); ImgLink(b,off+offsetof(StateInfo,weights),t);
+   t = ImgSVector(b,si->dur);     ImgLink(b,off+offsetof(StateInfo,dur),t);
+   ImgLink(b,off+offsetof(StateInfo,hook),0);
+   pdf = ImgAlloc(b,S*sizeof(StreamElem));
+   memcpy(b->buf+pdf,si->pdf+1,S*sizeof(StreamElem));
+   ImgLink(b,off+offsetof(StateInfo,pdf),pdf-sizeof(StreamElem));
+   for (s=1; s<=S; s++) {
+      ste = si->pdf+s; at = pdf+(s-1)*sizeof(StreamElem);
+      ImgLink(b,at+offsetof(StreamElem,hook),0);
+      M = ste->nMix;
+      me = ImgAlloc(b,M*sizeof(MixtureElem));
+      memcpy(b->buf+me,ste->spdf.cpdf+1,M*sizeof(MixtureElem));
+      ImgLink(b,at+offsetof(StreamElem,spdf),me-sizeof(MixtureElem));
+      for (m=1; m<=M; m++) {
+         t = ImgMixPDF(b,ste->spdf.cpdf[m].mpdf);
+         ImgLink(b,me+(m-1)*sizeof(MixtureElem)+offsetof(MixtureElem,mpdf),t);
+      }
+   }
+   return off;
+}
+
+/* ImgHMMDef: copy the definition of hmm to b */
+static size_t ImgHMMDef(ImgBuild *b, HMMSet *hset, HLink hmm)
+{
+   size_t off,sv,t;
+   int i,N;
+
+   if (hmm->hook != NULL) return (size_t)hmm->hook;
+   N = hmm->numStates;
+   off = ImgAlloc(b,sizeof(HMMDef));
+   memcpy(b->buf+off,hmm,sizeof(HMMDef));
+   ImgMark(b,&hmm->hook,off);
+   ImgLink(b,off+offsetof(HMMDef,owner),0);
+   ImgLink(b,off+offsetof(HMMDef,hook),0);
+   sv = ImgAlloc(b,(N-2)*sizeof(StateElem));
+   ImgLink(b,off+offsetof(HMMDef,svec),sv-2*sizeof(StateElem));
+   for (i=2; i<N; i++) {
+      t = ImgStateInfo(b,hset,hmm->svec[i].info);
+      ImgLink(b,sv+(i-2)*sizeof(StateElem)+offsetof(StateElem,info),t);
+   }
+   t = ImgSVector(b,hmm->dur);      ImgLink(b,off+offsetof(HMMDef,dur),t);
+   t = ImgMatrix(b,hmm->transP);    ImgLink(b,off+offsetof(HMMDef,transP),t);
+   return off;
+}
+
+/* ImgStructure: copy the structure of macro of given type to b */
+static size_t ImgStructure(ImgBuild *b, HMMSet *hset, char type, Ptr structure)
+{
+   switch (type) {
+   case 'h': return ImgHMMDef(b,hset,(HLink)structure);
+   case 's': return ImgStateInfo(b,hset,(StateInfo *)structure);
+   case 'm': return ImgMixPDF(b,(MixPDF *)structure);
+   case 'i': 
+   case 'c': return ImgTriMat(b,(STriMat)structure);
+   case 't': return ImgMatrix(b,(SMatrix)structure);
+   default:  return ImgSVector(b,(SVector)structure);
+   }
+}
+
+/* EXPORT->SaveHMMSetImage: write hset as compiled image fname */
+ReturnStatus SaveHMMSetImage(HMMSet *hset, char *fname)
+{
+   ImgBuild b;
+   ImgHeader *h;
+   ImgRoot *r;
+   ImgMacro *im;
+   HMMScanState hss;
+   MLink m;
+   FILE *f;
+   size_t root,tab,name,t,rel,i;
+   int k,n,nPhy,s;
+   CovKind ck;
+
+   if (hset->hsKind != PLAINHS && hset->hsKind != SHAREDHS) {
+      HRError(7028,"SaveHMMSetImage: only PLAIN and SHARED HMM sets supported");
+      return(FAIL);
+   }
+   if (hset->xf != NULL || hset->semiTied != NULL || hset->logWt) {
+      HRError(7028,"SaveHMMSetImage: transforms and log weights not supported");
+      return(FAIL);
+   }
+   NewHMMScan(hset,&hss);
+   while (GoNextMix(&hss,FALSE))
+      if (hss.mp->ckind == XFORMC) {
+         EndHMMScan(&hss);
+         HRError(7028,"SaveHMMSetImage: XFORMC covariance not supported");
+         return(FAIL);
+      }
+   EndHMMScan(&hss);
+
+   b.buf = NULL; b.used = b.size = 0;
+   b.reloc = NULL; b.nReloc = b.maxReloc = 0;
+   b.hooks = NULL; b.nHook = b.maxHook = 0;
+   ImgAlloc(&b,sizeof(ImgHeader));
+   root = ImgAlloc(&b,sizeof(ImgRoot));
+   for (n=0,k=0; k<MACHASHSIZE; k++)
+      for (m=hset->mtab[k]; m!=NULL; m=m->next)
+         if (strchr(IMGMACROS,m->type) != NULL)
+            ++n;
+         else if (m->type != 'l' && m->type != '*')
+            HRError(-7028,"SaveHMMSetImage: ~%c %s not stored in image",
+                    m->type,m->id->name);
+   tab = ImgAlloc(&b,n*sizeof(ImgMacro));
+   for (n=0,nPhy=0,k=0; k<MACHASHSIZE; k++)
+      for (m=hset->mtab[k]; m!=NULL; m=m->next)
+         if (strchr(IMGMACROS,m->type) != NULL) {
+            name = ImgAlloc(&b,strlen(m->id->name)+1);
+            strcpy(b.buf+name,m->id->name);
+            t = ImgStructure(&b,hset,m->type,m->structure);
+            im = (ImgMacro *)(b.buf+tab) + n++;
+            im->type = m->type; im->name = name; im->structure = t;
+            if (m->type == 'h') ++nPhy;
+         }
+   for (i=0; i<b.nHook; i++)
+      *b.hooks[i] = NULL;
+
+   r = (ImgRoot *)(b.buf+root);
+   r->vecSize = hset->vecSize;
+   for (s=0; s<SMAX; s++) r->swidth[s] = hset->swidth[s];
+   r->pkind = hset->pkind; r->dkind = hset->dkind;
+   r->ckind = hset->ckind; r->hsKind = hset->hsKind;
+   r->numPhyHMM = nPhy;
+   r->numStates = hset->numStates; r->numSharedStates = hset->numSharedStates;
+   r->numMix = hset->numMix; r->numSharedMix = hset->numSharedMix;
+   r->numTransP = hset->numTransP;
+   for (ck=0; ck<NUMCKIND; ck++) r->ckUsage[ck] = hset->ckUsage[ck];
+   r->numMacros = n; r->macros = tab;
+
+   rel = ImgAlloc(&b,b.nReloc*sizeof(size_t));
+   memcpy(b.buf+rel,b.reloc,b.nReloc*sizeof(size_t));
+   h = (ImgHeader *)b.buf;
+   memcpy(h->magic,IMGMAGIC,8);
+   h->order = IMGORDER; h->ptrSize = sizeof(Ptr);
+   h->size = b.used; h->base = IMGBASEADDR;
+   h->root = root; h->relocs = rel; h->nRelocs = b.nReloc;
+
+   if ((f = fopen(fname,"wb")) == NULL ||
+       fwrite(b.buf,1,b.used,f) != b.used || fclose(f) != 0) {
+      free(b.buf); free(b.reloc); free(b.hooks);
+      HRError(7011,"SaveHMMSetImage: cannot write image %s",fname);
+      return(FAIL);
+   }
+   if (trace&T_TOP)
+      printf("HModel: image %s: %d macros, %lu bytes, %lu pointers\n",
+             fname,n,(unsigned long)b.used,(unsigned long)b.nReloc);
+   free(b.buf); free(b.reloc); free(b.hooks);
+   return(SUCCESS);
+}
+
+/* IsHMMImage: return TRUE if file fname starts with an image header */
+static Boolean IsHMMImage(char *fname)
+{
+   FILE *f;
+   char magic[8];
+   Boolean isImage = FALSE;
+
+   if ((f = fopen(fname,"rb")) != NULL) {
+      isImage = fread(magic,1,8,f) == 8 && strncmp(magic,IMGMAGIC,8) == 0;
+      fclose(f);
+   }
+   return isImage;
+}
+
+/* MapImage: map image file fname, relocating it if it could not be
+   placed at its preferred address, and return its base or NULL */
+static char *MapImage(HMMSet *hset, char *fname)
+{
+   FILE *f;
+   ImgHeader h;
+   char *base;
+   size_t i,delta,*reloc;
+
+   if ((f = fopen(fname,"rb")) == NULL) {
+      HRError(7010,"MapImage: Can't open image %s",fname);
+      return NULL;
+   }
+   if (fread(&h,sizeof(ImgHeader),1,f) != 1 || 
+       strncmp(h.magic,IMGMAGIC,8) != 0 ||
+       h.order != IMGORDER || h.ptrSize != sizeof(Ptr) ||
+       fseek(f,0,SEEK_END) != 0 || (size_t)ftell(f) < h.size) {
+      fclose(f);
+      HRError(7028,"MapImage: %s is not a complete image for this machine",
+              fname);
+      return NULL;
+   }
+#ifdef WIN32
+   base = (char *)New(hset->hmem,h.size);
+   rewind(f);
+   if (fread(base,1,h.size,f) != h.size) {
+      fclose(f);
+      HRError(7028,"MapImage: cannot read image %s",fname);
+      return NULL;
+   }
+#else
+   base = (char *)mmap((void *)h.base,h.size,PROT_READ|PROT_WRITE,
+                       MAP_PRIVATE,fileno(f),0);
+   if (base == (char *)MAP_FAILED) {
+      fclose(f);
+      HRError(7028,"MapImage: cannot map image %s",fname);
+      return NULL;
+   }
+#endif
+   fclose(f);
+   if ((size_t)base != h.base) {
+      delta = (size_t)base - h.base;
+      reloc = (size_t *)(base+h.relocs);
+      for (i=0; i<h.nRelocs; i++)
+         *(size_t *)(base+reloc[i]) += delta;
+   }
+   if (trace&T_MAC)
+      printf("HModel: image %s mapped at %p, %lu pointers relocated\n",
+             fname,base,(unsigned long)((size_t)base==h.base?0:h.nRelocs));
+   return base;
+}
+
+/* LoadImage: load the macros and HMM defs of compiled image fname */
+static ReturnStatus LoadImage(HMMSet *hset, char *fname, short fidx)
+{
+   char *base;
+   ImgRoot *r;
+   ImgMacro *im;
+   MLink m;
+   HLink hmm,ihmm;
+   LabId id;
+   int i,s,nFilled=0;
+
+   if (trace&T_MAC)
+      printf("HModel: getting Macros from image %s\n",fname);
+   if ((base = MapImage(hset,fname)) == NULL)
+      return(FAIL);
+   r = (ImgRoot *)(base+((ImgHeader *)base)->root);
+   if (hset->optSet) {
+      for (s=0; s<=r->swidth[0]; s++)
+         if (hset->swidth[s] != r->swidth[s]) break;
+      if (hset->vecSize != r->vecSize || hset->pkind != r->pkind || 
+          s <= r->swidth[0]) {
+         HRError(7032,"LoadImage: options of image %s do not match",fname);
+         return(FAIL);
+      }
+   } else {
+      hset->vecSize = r->vecSize;
+      for (s=0; s<SMAX; s++) hset->swidth[s] = r->swidth[s];
+      hset->pkind = r->pkind; hset->dkind = r->dkind;
+      hset->ckind = r->ckind; hset->optSet = TRUE;
+   }
+   hset->hsKind = r->hsKind;
+   im = (ImgMacro *)(base+r->macros);
+   for (i=0; i<r->numMacros; i++,im++) {
+      id = GetLabId(base+im->name,TRUE);
+      if (im->type == 'h') {
+         if ((m = FindMacroName(hset,'h',id)) == NULL) {
+            if (!allowOthers){
+               HRError(7030,"LoadImage: phys HMM %s unexpected in %s",
+                       id->name,fname);
+               return(FAIL);
+            }
+            continue;
+         }
+         hmm = (HLink)m->structure; ihmm = (HLink)(base+im->structure);
+         hmm->numStates = ihmm->numStates; hmm->svec = ihmm->svec;
+         hmm->dur = ihmm->dur; hmm->transP = ihmm->transP;
+         hmm->tIdx = ihmm->tIdx;
+         m->fidx = fidx; ++nFilled;
+      }
+      else
+         NewMacro(hset,fidx,im->type,id,base+im->structure);
+   }
+   /* indexes in the image are only valid if it supplies the whole set */
+   hset->image = (nFilled == hset->numPhyHMM && nFilled == r->numPhyHMM) ?
+      (Ptr)r : NULL;
+   return(SUCCESS);
+}
+
+/* SetImageIndexes: take indexes and counts of hset from its image */
+static void SetImageIndexes(HMMSet *hset)
+{
+   ImgRoot *r = (ImgRoot *)hset->image;
+   CovKind ck;
+
+   indexSet = TRUE;
+   hset->numStates = r->numStates; hset->numSharedStates = r->numSharedStates;
+   hset->numMix = r->numMix; hset->numSharedMix = r->numSharedMix;
+   hset->numTransP = r->numTransP;
+   for (ck=0; ck<NUMCKIND; ck++) hset->ckUsage[ck] = r->ckUsage[ck];
+}
+
 /* ------------------- HMM/Macro Load Routines -------------------- */
 
 /* LoadAllMacros: loads macros from MMF file fname */
@@ -3898,7 +4455,10 @@ static ReturnStatus LoadMacroFiles(HMMSet *hset)
    
    for (mmf=hset->mmfNames; mmf!=NULL; mmf=mmf->next)
       if (!mmf->isLoaded){
-         if(LoadAllMacros(hset,mmf->fName,++i)<SUCCESS) result=FAIL;
+         if (IsHMMImage(mmf->fName)) {
+            if(LoadImage(hset,mmf->fName,++i)<SUCCESS) result=FAIL;
+         }
+         else if(LoadAllMacros(hset,mmf->fName,++i)<SUCCESS) result=FAIL;
          mmf->isLoaded = TRUE;
       }
    return result;
@@ -4062,6 +4622,10 @@ void ResetHMMSet(HMMSet *hset)
    hset->numMacros=0;
    hset->numFiles=0;
    hset->mmfNames=NULL;
+   if (hset->sview!=NULL) {
+      DeleteHeap(&((ScoreView *)hset->sview)->mem);
+      hset->sview=NULL;
+   }
    Dispose(hset->hmem, hset->firstElem);
 }
 
@@ -4075,6 +4639,7 @@ ReturnStatus LoadHMMSet(HMMSet *hset, char *hmmDir, char *hmmExt)
    HLink hmm;
    Source src;
    Token tok;
+   Boolean fromImage;
    
    hset->hsKind = PLAINHS; /* default assumption */
    if(LoadMacroFiles(hset)<SUCCESS){
@@ -4082,6 +4647,8 @@ ReturnStatus LoadHMMSet(HMMSet *hset, char *hmmDir, char *hmmExt)
       ResetHMMSet(hset);
       return(FAIL);
    }
+   /* an image that supplies the whole set was checked when written */
+   fromImage = hset->image != NULL && hset->numFiles == 1;
    for (h=0; h<MACHASHSIZE; h++)
       for (p=hset->mtab[h]; p!=NULL; p=p->next) 
          if (p->type == 'h'){
@@ -4163,15 +4730,19 @@ ReturnStatus LoadHMMSet(HMMSet *hset, char *hmmDir, char *hmmExt)
       if (hset->hsKind == PLAINHS && IsShared(hset))
          hset->hsKind = SHAREDHS;
    }
-   if (checking) {
+   if (checking && !fromImage) {
       if (CheckHSet(hset)<SUCCESS){
          ResetHMMSet(hset);
          HRError(7031,"LoadHMMSet: Invalid HMM data");
          return(FAIL);
       }
    } 
-   SetIndexes(hset);
-   SetCovKindUsage(hset);
+   if (fromImage)
+      SetImageIndexes(hset);
+   else {
+      SetIndexes(hset);
+      SetCovKindUsage(hset);
+   }
    SetParmHMMSet(hset);
    /* HMMSet loading has been completed - now load the semi-tied transform */
    if (hset->semiTiedMacro != NULL) {
@@ -4179,6 +4750,13 @@ ReturnStatus LoadHMMSet(HMMSet *hset, char *hmmDir, char *hmmExt)
       /* set the component variance floors */
       SetSemiTiedVFloor(hset);
    }
+   if (gselFN[0] != '\0' && 
+       (hset->hsKind == PLAINHS || hset->hsKind == SHAREDHS))
+      if (LoadGSelIndex(hset,gselFN)<SUCCESS){
+         ResetHMMSet(hset);
+         HRError(7027,"LoadHMMSet: Cannot load Gaussian selection index");
+         return(FAIL);
+      }
    return(SUCCESS);
 }
 
@@ -4214,6 +4792,9 @@ void CreateHMMSet(HMMSet *hset, MemHeap *heap, Boolean allowTMods)
    hset->semiTiedMacro = NULL;
    hset->semiTied = NULL;
    hset->projSize = 0;
+   hset->gsel = NULL;
+   hset->image = NULL;
+   hset->sview = NULL;
 }
 
 /* CreateHMM: create logical macro. If pId is unknown, create macro for
@@ -5304,20 +5885,123 @@ static int CmpTM(const void *t1, const void *t2)
    return 0;
 }
 
-/* EXPORT->PrecomputeTMix: set up the tmRec[s].probs arrays */
-void PrecomputeTMix(HMMSet *hset, Observation *x, float tmThresh, int topM)
+/* ----------------------- Gaussian Selection --------------------- */
+
+/* EXPORT->LoadGSelIndex: load Gaussian selection index and attach it */
+ReturnStatus LoadGSelIndex(HMMSet *hset, char *fn)
+{
+   Source src;
+   GSelRec *gs;
+   VQTable vq;
+   char buf[MAXSTRLEN];
+   unsigned char *cell;
+   int s,c,i,j,n,m,numMix,numS,nCells,nList,vqidx;
+
+   if (hset->hsKind != PLAINHS && hset->hsKind != SHAREDHS){
+      HRError(7027,"LoadGSelIndex: Gaussian selection needs PLAIN or SHARED HMMs");
+      return(FAIL);
+   }
+   if(InitSource(fn,&src,NoFilter)<SUCCESS){
+      HRError(7010,"LoadGSelIndex: Can't open index file %s",fn);
+      return(FAIL);
+   }
+   if (!ReadString(&src,buf) || !ReadInt(&src,&numMix,1,FALSE) ||
+       !ReadInt(&src,&numS,1,FALSE)){
+      CloseSource(&src);
+      HRError(7027,"LoadGSelIndex: Bad header in %s",fn);
+      return(FAIL);
+   }
+   if (numMix != hset->numMix || numS != hset->swidth[0]){
+      CloseSource(&src);
+      HRError(7027,"LoadGSelIndex: %s built for %d mixes in %d streams not %d in %d",
+              fn,numMix,numS,hset->numMix,hset->swidth[0]);
+      return(FAIL);
+   }
+   vq = LoadVQTab(buf,0);
+   for (s=0; s<=numS; s++)
+      if (vq->swidth[s] != hset->swidth[s]){
+         CloseSource(&src);
+         HRError(7027,"LoadGSelIndex: VQ table %s does not match stream widths",buf);
+         return(FAIL);
+      }
+   gs = (GSelRec *)New(hset->hmem,sizeof(GSelRec));
+   gs->fn = CopyString(hset->hmem,fn);
+   gs->vqTab = (Ptr)vq;
+   gs->nBytes = numMix/8 + 1;
+   gs->floor = gselFloor;
+   for (s=1; s<=numS; s++){
+      if (!ReadInt(&src,&i,1,FALSE) || i != s || 
+          !ReadInt(&src,&nCells,1,FALSE) || nCells < 1 ||
+          !ReadInt(&src,&nList,1,FALSE)){
+         CloseSource(&src);
+         HRError(7027,"LoadGSelIndex: Bad stream %d header in %s",s,fn);
+         return(FAIL);
+      }
+      gs->nCells[s] = nCells;
+      gs->cells[s] = (unsigned char **)New(hset->hmem,nCells*sizeof(unsigned char *));
+      for (c=0; c<nCells; c++) gs->cells[s][c] = NULL;
+      for (c=0; c<nList; c++){
+         if (!ReadInt(&src,&vqidx,1,FALSE) || vqidx<0 || vqidx>=nCells ||
+             !ReadInt(&src,&n,1,FALSE) || n<0 || n>numMix){
+            CloseSource(&src);
+            HRError(7027,"LoadGSelIndex: Bad cell entry in stream %d of %s",s,fn);
+            return(FAIL);
+         }
+         cell = (unsigned char *)New(hset->hmem,gs->nBytes);
+         for (j=0; j<gs->nBytes; j++) cell[j] = 0;
+         for (j=0; j<n; j++){
+            if (!ReadInt(&src,&m,1,FALSE) || m<1 || m>numMix){
+               CloseSource(&src);
+               HRError(7027,"LoadGSelIndex: Bad mix index in stream %d of %s",s,fn);
+               return(FAIL);
+            }
+            cell[m>>3] |= 1<<(m&7);
+         }
+         gs->cells[s][vqidx] = cell;
+      }
+   }
+   CloseSource(&src);
+   hset->gsel = gs;
+   if (trace&T_TOP)
+      printf("HModel: Gaussian selection index %s with VQ table %s loaded\n",
+             fn,buf);
+   return(SUCCESS);
+}
+
+/* EXPORT->GSelObservation: store selection cells of x in x->vq */
+void GSelObservation(HMMSet *hset, Observation *x)
+{
+   if (hset->gsel != NULL)
+      GetVQ((VQTable)hset->gsel->vqTab,hset->swidth[0],x->fv,x->vq);
+}
+
+/* EXPORT->GSelCell: return the shortlist for stream s of x */
+unsigned char *GSelCell(HMMSet *hset, int s, Observation *x)
+{
+   GSelRec *gs = hset->gsel;
+
+   if (gs == NULL || x->vq[s] < 0 || x->vq[s] >= gs->nCells[s])
+      return NULL;
+   return gs->cells[s][x->vq[s]];
+}
+
+static LogFloat CompOutP(ScoreContext *sc, Vector x, int vSize, MixPDF *mp);
+
+/* TMixProbs: set up the tied mixture probs of context sc for hset */
+static void TMixProbs(ScoreContext *sc, HMMSet *hset, Observation *x, 
+                      float tmThresh, int topM)
 {
    TMixRec *tr;
    int m,s,curM;
    LogFloat p,maxP,minP;
    
    for (s=1; s<=hset->swidth[0]; s++) {
-      tr = hset->tmRecs+s;
+      tr = ((sc->tmRecs!=NULL) ? sc->tmRecs : hset->tmRecs)+s;
       if (tr->nMix == 0 || tr->mixes == NULL || tr->probs == NULL)
          HError(7092,"PrecomputeTMix: badly formed TMixRec in stream %d",s);
       maxP = LZERO;
       for (m=1; m<=tr->nMix; m++){
-         p = MOutP(x->fv[s],tr->mixes[m]);
+         p = CompOutP(sc,x->fv[s],VectorSize(x->fv[s]),tr->mixes[m]);
          if (p>maxP) maxP = p;
          tr->probs[m].prob = p; tr->probs[m].index = m;
       }
@@ -5343,29 +6027,395 @@ void PrecomputeTMix(HMMSet *hset, Observation *x, float tmThresh, int topM)
    }
 }
 
-/* DOutP: Log prob of x in given mixture - Diagonal Case */
-static LogFloat DOutP(Vector x, int vecSize, MixPDF *mp)
+/* EXPORT->PrecomputeTMix: set up the tmRec[s].probs arrays */
+void PrecomputeTMix(HMMSet *hset, Observation *x, float tmThresh, int topM)
+{
+   TMixProbs(&gCtx,hset,x,tmThresh,topM);
+}
+
+/* ------------------- Diagonal Gaussian Kernels ------------------- */
+
+/* IDistScalar: reference (x-m)^2*v kernel */
+static float IDistScalar(float acc, float *x, float *m, float *v, int n)
 {
    int i;
-   float sum,xmm;
+   float xmm;
 
-   sum = mp->gConst;
-   for (i=1;i<=vecSize;i++) {
-      xmm=x[i] - mp->mean[i];
-      sum += xmm*xmm/mp->cov.var[i];
+   for (i=0; i<n; i++) {
+      xmm = x[i] - m[i];
+      acc += xmm*xmm*v[i];
    }
-   return -0.5*sum;
+   return acc;
+}
+
+/* DDistScalar: reference (x-m)^2/v kernel */
+static float DDistScalar(float acc, float *x, float *m, float *v, int n)
+{
+   int i;
+   float xmm;
+
+   for (i=0; i<n; i++) {
+      xmm = x[i] - m[i];
+      acc += xmm*xmm/v[i];
+   }
+   return acc;
+}
+
+/* LDistScalar: reference |L'd|^2 kernel */
+static float LDistScalar(float acc, TriMat l, float *d, int n)
+{
+   int i,j;
+   float z;
+
+   for (j=1; j<=n; j++) {
+      z = 0.0;
+      for (i=j; i<=n; i++)
+         z += l[i][j]*d[i-1];
+      acc += z*z;
+   }
+   return acc;
+}
+
+#ifdef GAUSS_SIMD
+
+/* mask table for partial AVX2 loads: tailMask+8-r selects r lanes */
+static const int tailMask[16] = {-1,-1,-1,-1,-1,-1,-1,-1, 0,0,0,0,0,0,0,0};
+
+/* IDistSSE4: 4-wide (x-m)^2*v kernel */
+__attribute__((target("sse4.1")))
+static float IDistSSE4(float acc, float *x, float *m, float *v, int n)
+{
+   int i;
+   __m128 sum,d;
+
+   sum = _mm_setzero_ps();
+   for (i=0; i+4<=n; i+=4) {
+      d = _mm_sub_ps(_mm_loadu_ps(x+i),_mm_loadu_ps(m+i));
+      sum = _mm_add_ps(sum,_mm_mul_ps(_mm_mul_ps(d,d),_mm_loadu_ps(v+i)));
+   }
+   sum = _mm_hadd_ps(sum,sum); sum = _mm_hadd_ps(sum,sum);
+   acc += _mm_cvtss_f32(sum);
+   return IDistScalar(acc,x+i,m+i,v+i,n-i);
+}
+
+/* DDistSSE4: 4-wide (x-m)^2/v kernel */
+__attribute__((target("sse4.1")))
+static float DDistSSE4(float acc, float *x, float *m, float *v, int n)
+{
+   int i;
+   __m128 sum,d;
+
+   sum = _mm_setzero_ps();
+   for (i=0; i+4<=n; i+=4) {
+      d = _mm_sub_ps(_mm_loadu_ps(x+i),_mm_loadu_ps(m+i));
+      sum = _mm_add_ps(sum,_mm_div_ps(_mm_mul_ps(d,d),_mm_loadu_ps(v+i)));
+   }
+   sum = _mm_hadd_ps(sum,sum); sum = _mm_hadd_ps(sum,sum);
+   acc += _mm_cvtss_f32(sum);
+   return DDistScalar(acc,x+i,m+i,v+i,n-i);
+}
+
+/* HSum256: horizontal sum of 8 floats */
+__attribute__((target("avx2")))
+static float HSum256(__m256 v)
+{
+   __m128 s;
+
+   s = _mm_add_ps(_mm256_castps256_ps128(v),_mm256_extractf128_ps(v,1));
+   s = _mm_hadd_ps(s,s); s = _mm_hadd_ps(s,s);
+   return _mm_cvtss_f32(s);
+}
+
+/* IDistAVX2: 8-wide (x-m)^2*v kernel, tail by masked load */
+__attribute__((target("avx2,fma")))
+static float IDistAVX2(float acc, float *x, float *m, float *v, int n)
+{
+   int i;
+   __m256 sum,d;
+   __m256i mask;
+
+   sum = _mm256_setzero_ps();
+   for (i=0; i+8<=n; i+=8) {
+      d = _mm256_sub_ps(_mm256_loadu_ps(x+i),_mm256_loadu_ps(m+i));
+      sum = _mm256_fmadd_ps(_mm256_mul_ps(d,d),_mm256_loadu_ps(v+i),sum);
+   }
+   if (i<n) {
+      mask = _mm256_loadu_si256((__m256i *)(tailMask+8-(n-i)));
+      d = _mm256_sub_ps(_mm256_maskload_ps(x+i,mask),_mm256_maskload_ps(m+i,mask));
+      sum = _mm256_fmadd_ps(_mm256_mul_ps(d,d),_mm256_maskload_ps(v+i,mask),sum);
+   }
+   return acc + HSum256(sum);
+}
+
+/* DDistAVX2: 8-wide (x-m)^2/v kernel, tail handled by scalar code
+   since masked lanes would divide by zero */
+__attribute__((target("avx2,fma")))
+static float DDistAVX2(float acc, float *x, float *m, float *v, int n)
+{
+   int i;
+   __m256 sum,d;
+
+   sum = _mm256_setzero_ps();
+   for (i=0; i+8<=n; i+=8) {
+      d = _mm256_sub_ps(_mm256_loadu_ps(x+i),_mm256_loadu_ps(m+i));
+      sum = _mm256_add_ps(sum,_mm256_div_ps(_mm256_mul_ps(d,d),_mm256_loadu_ps(v+i)));
+   }
+   acc += HSum256(sum);
+   return DDistScalar(acc,x+i,m+i,v+i,n-i);
+}
+
+/* IDistAVX512: 16-wide (x-m)^2*v kernel, tail by mask register */
+__attribute__((target("avx512f")))
+static float IDistAVX512(float acc, float *x, float *m, float *v, int n)
+{
+   int i;
+   __m512 sum,d;
+   __mmask16 k;
+
+   sum = _mm512_setzero_ps();
+   for (i=0; i+16<=n; i+=16) {
+      d = _mm512_sub_ps(_mm512_loadu_ps(x+i),_mm512_loadu_ps(m+i));
+      sum = _mm512_fmadd_ps(_mm512_mul_ps(d,d),_mm512_loadu_ps(v+i),sum);
+   }
+   if (i<n) {
+      k = (__mmask16)((1u<<(n-i))-1);
+      d = _mm512_sub_ps(_mm512_maskz_loadu_ps(k,x+i),_mm512_maskz_loadu_ps(k,m+i));
+      sum = _mm512_fmadd_ps(_mm512_mul_ps(d,d),_mm512_maskz_loadu_ps(k,v+i),sum);
+   }
+   return acc + _mm512_reduce_add_ps(sum);
+}
+
+/* DDistAVX512: 16-wide (x-m)^2/v kernel, masked lanes divide by one */
+__attribute__((target("avx512f")))
+static float DDistAVX512(float acc, float *x, float *m, float *v, int n)
+{
+   int i;
+   __m512 sum,d,one;
+   __mmask16 k;
+
+   sum = _mm512_setzero_ps();
+   for (i=0; i+16<=n; i+=16) {
+      d = _mm512_sub_ps(_mm512_loadu_ps(x+i),_mm512_loadu_ps(m+i));
+      sum = _mm512_add_ps(sum,_mm512_div_ps(_mm512_mul_ps(d,d),_mm512_loadu_ps(v+i)));
+   }
+   if (i<n) {
+      k = (__mmask16)((1u<<(n-i))-1);
+      one = _mm512_set1_ps(1.0);
+      d = _mm512_sub_ps(_mm512_maskz_loadu_ps(k,x+i),_mm512_maskz_loadu_ps(k,m+i));
+      sum = _mm512_add_ps(sum,_mm512_div_ps(_mm512_mul_ps(d,d),
+                                            _mm512_mask_loadu_ps(one,k,v+i)));
+   }
+   return acc + _mm512_reduce_add_ps(sum);
+}
+
+/* LDistSSE4: |L'd|^2 kernel on blocks of 4 columns */
+__attribute__((target("sse4.1")))
+static float LDistSSE4(float acc, TriMat l, float *d, int n)
+{
+   int i,j,k,r;
+   float part[4];
+   __m128 z,sum;
+
+   sum = _mm_setzero_ps();
+   for (j=0; j<n; j+=4) {
+      z = _mm_setzero_ps();
+      for (i=j; i<n; i++) {
+         r = i-j+1;             /* row i has columns 0..i */
+         if (r>=4)
+            z = _mm_add_ps(z,_mm_mul_ps(_mm_set1_ps(d[i]),
+                                        _mm_loadu_ps(l[i+1]+1+j)));
+         else {
+            for (k=0; k<4; k++) part[k] = (k<r) ? l[i+1][1+j+k] : 0.0;
+            z = _mm_add_ps(z,_mm_mul_ps(_mm_set1_ps(d[i]),_mm_loadu_ps(part)));
+         }
+      }
+      sum = _mm_add_ps(sum,_mm_mul_ps(z,z));
+   }
+   sum = _mm_hadd_ps(sum,sum); sum = _mm_hadd_ps(sum,sum);
+   return acc + _mm_cvtss_f32(sum);
+}
+
+/* LDistAVX2: |L'd|^2 kernel on blocks of 8 columns, rows crossing
+   the diagonal by masked load */
+__attribute__((target("avx2,fma")))
+static float LDistAVX2(float acc, TriMat l, float *d, int n)
+{
+   int i,j,r;
+   __m256 z,sum;
+   __m256i mask;
+
+   sum = _mm256_setzero_ps();
+   for (j=0; j<n; j+=8) {
+      z = _mm256_setzero_ps();
+      for (i=j; i<n; i++) {
+         r = i-j+1;
+         if (r>=8)
+            z = _mm256_fmadd_ps(_mm256_set1_ps(d[i]),
+                                _mm256_loadu_ps(l[i+1]+1+j),z);
+         else {
+            mask = _mm256_loadu_si256((__m256i *)(tailMask+8-r));
+            z = _mm256_fmadd_ps(_mm256_set1_ps(d[i]),
+                                _mm256_maskload_ps(l[i+1]+1+j,mask),z);
+         }
+      }
+      sum = _mm256_fmadd_ps(z,z,sum);
+   }
+   return acc + HSum256(sum);
+}
+
+/* LDistAVX512: |L'd|^2 kernel on blocks of 16 columns */
+__attribute__((target("avx512f")))
+static float LDistAVX512(float acc, TriMat l, float *d, int n)
+{
+   int i,j,r;
+   __m512 z,sum;
+   __mmask16 k;
+
+   sum = _mm512_setzero_ps();
+   for (j=0; j<n; j+=16) {
+      z = _mm512_setzero_ps();
+      for (i=j; i<n; i++) {
+         r = i-j+1;
+         k = (r>=16) ? (__mmask16)0xffff : (__mmask16)((1u<<r)-1);
+         z = _mm512_fmadd_ps(_mm512_set1_ps(d[i]),
+                             _mm512_maskz_loadu_ps(k,l[i+1]+1+j),z);
+      }
+      sum = _mm512_fmadd_ps(z,z,sum);
+   }
+   return acc + _mm512_reduce_add_ps(sum);
+}
+
+#endif /* GAUSS_SIMD */
+
+/* GKernSupported: true if host CPU can run given kernel */
+static Boolean GKernSupported(GKernKind kind)
+{
+   switch (kind) {
+   case SCALARGK: return TRUE;
+#ifdef GAUSS_SIMD
+   case SSE4GK:   
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("sse4.1") ? TRUE : FALSE;
+   case AVX2GK:   
+      __builtin_cpu_init();
+      return (__builtin_cpu_supports("avx2") && 
+              __builtin_cpu_supports("fma")) ? TRUE : FALSE;
+   case AVX512GK: 
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx512f") ? TRUE : FALSE;
+#endif
+   default: return FALSE;
+   }
+}
+
+/* CheckValue: next value in [0,1) of the private generator used by
+   CheckGaussKernel, so the check leaves the HMath generator alone */
+static float CheckValue(unsigned long *seed)
+{
+   *seed = (*seed*1103515245UL + 12345UL) & 0xffffffffUL;
+   return ((*seed>>8)&0xffff)/65536.0;
+}
+
+/* CheckGaussKernel: compare selected kernel against the scalar
+   reference on fixed pseudo-random data, return FALSE if outside
+   tolerance */
+static Boolean CheckGaussKernel(void)
+{
+   float x[64],m[64],v[64],ref,val,err,maxErr=0.0;
+   int i,j,n;
+   unsigned long seed = 1;
+   TriMat l;
+   char buf[MAXSTRLEN];
+
+   for (i=0; i<64; i++) {
+      x[i] = 10.0*(CheckValue(&seed)-0.5);
+      m[i] = 10.0*(CheckValue(&seed)-0.5);
+      v[i] = 0.1+CheckValue(&seed);
+   }
+   for (n=1; n<=64; n++) {
+      ref = IDistScalar(0.0,x,m,v,n); val = iDist(0.0,x,m,v,n);
+      err = fabs(val-ref)/ref; if (err>maxErr) maxErr = err;
+      ref = DDistScalar(0.0,x,m,v,n); val = dDist(0.0,x,m,v,n);
+      err = fabs(val-ref)/ref; if (err>maxErr) maxErr = err;
+   }
+   l = CreateTriMat(&gstack,64);
+   for (i=1; i<=64; i++)
+      for (j=1; j<=i; j++) l[i][j] = m[j-1]*v[i-1];
+   for (n=1; n<=64; n++) {
+      ref = LDistScalar(1.0,l,x,n); val = lDist(1.0,l,x,n);
+      err = fabs(val-ref)/ref; if (err>maxErr) maxErr = err;
+   }
+   FreeTriMat(&gstack,l);
+   if (trace&T_KRN)
+      printf("HModel: %s Gaussian kernel max rel error %e\n",
+             GKernKind2Str(gKernKind,buf),maxErr);
+   if (maxErr > 1.0E-5) {
+      HError(-7026,"CheckGaussKernel: %s kernel differs from scalar by %e",
+             GKernKind2Str(gKernKind,buf),maxErr);
+      return FALSE;
+   }
+   return TRUE;
+}
+
+/* InitGaussKernels: select kernel, falling back to narrower ones */
+static void InitGaussKernels(GKernKind kind)
+{
+   char buf[MAXSTRLEN];
+
+   if (kind == AUTOGK) kind = AVX512GK;
+   else if (!GKernSupported(kind))
+      HError(-7026,"InitGaussKernels: %s kernel not supported on this host",
+             GKernKind2Str(kind,buf));
+   while (!GKernSupported(kind)) kind = (GKernKind) (kind-1);
+   gKernKind = kind;
+   switch (kind) {
+#ifdef GAUSS_SIMD
+   case SSE4GK:   
+      iDist = IDistSSE4;   dDist = DDistSSE4;   lDist = LDistSSE4;   break;
+   case AVX2GK:   
+      iDist = IDistAVX2;   dDist = DDistAVX2;   lDist = LDistAVX2;   break;
+   case AVX512GK: 
+      iDist = IDistAVX512; dDist = DDistAVX512; lDist = LDistAVX512; break;
+#endif
+   default:       
+      iDist = IDistScalar; dDist = DDistScalar; lDist = LDistScalar; break;
+   }
+   if (trace&T_KRN)
+      printf("HModel: using %s Gaussian kernel\n",GKernKind2Str(kind,buf));
+   if (kind != SCALARGK && !CheckGaussKernel()) {
+      gKernKind = SCALARGK; iDist = IDistScalar; dDist = DDistScalar;
+      lDist = LDistScalar;
+   }
+}
+
+/* EXPORT->SetGaussKernel: select the diagonal Gaussian kernel */
+GKernKind SetGaussKernel(GKernKind kind)
+{
+   InitGaussKernels(kind);
+   return gKernKind;
+}
+
+/* EXPORT->GetGaussKernel: return the diagonal Gaussian kernel in use */
+GKernKind GetGaussKernel(void)
+{
+   return gKernKind;
+}
+
+/* DOutP: Log prob of x in given mixture - Diagonal Case */
+static LogFloat DOutP(Vector x, int vecSize, MixPDF *mp)
+{
+   return -0.5*dDist(mp->gConst,x+1,mp->mean+1,mp->cov.var+1,vecSize);
 }
 
 /* FOutP: Log prob of x in given mixture - Full Covariance Case */
-static LogFloat FOutP(Vector x, int vecSize, MixPDF *mp)
+static LogFloat FOutP(Vector x, int vecSize, MixPDF *mp, ScoreContext *sc)
 {
    float sum;
    int i,j;
    Vector xmm;
    TriMat m = mp->cov.inv;
    
-   xmm = CreateVector(&gstack,vecSize);
+   xmm = (sc->xmm!=NULL) ? sc->xmm : CreateVector(&gstack,vecSize);
    for (i=1;i<=vecSize;i++)
       xmm[i] = x[i] - mp->mean[i];
    sum = 0.0;
@@ -5376,20 +6426,35 @@ static LogFloat FOutP(Vector x, int vecSize, MixPDF *mp)
    sum += mp->gConst;
    for (i=1;i<=vecSize;i++)
       sum += xmm[i] * xmm[i] * m[i][i];
-   FreeVector(&gstack,xmm);
+   if (sc->xmm==NULL) FreeVector(&gstack,xmm);
    return -0.5*sum;
 }
 
 
 /* COutP: Log prob of x in given mixture - LLT (Choleski) Cov Case */
-static LogFloat COutP(Vector x, int vecSize, MixPDF *mp)
+/*        cov.inv holds L with inverse covariance L L'              */
+static LogFloat COutP(Vector x, int vecSize, MixPDF *mp, ScoreContext *sc)
 {
-   HError(7001,"COutP: Choleski storage not yet implemented");
-   return 0.0;
+   float xmm[LDISTMAXSIZE];
+   float sum;
+   int i;
+   Vector vxmm;
+   
+   if (vecSize <= LDISTMAXSIZE) {
+      for (i=0;i<vecSize;i++)
+         xmm[i] = x[i+1] - mp->mean[i+1];
+      return -0.5*lDist(mp->gConst,mp->cov.inv,xmm,vecSize);
+   }
+   vxmm = (sc->xmm!=NULL) ? sc->xmm : CreateVector(&gstack,vecSize);
+   for (i=1;i<=vecSize;i++)
+      vxmm[i] = x[i] - mp->mean[i];
+   sum = lDist(mp->gConst,mp->cov.inv,vxmm+1,vecSize);
+   if (sc->xmm==NULL) FreeVector(&gstack,vxmm);
+   return -0.5*sum;
 }
 
 /* XOutP: Log prob of x in given mixture - XForm Case */
-static LogFloat XOutP(Vector x, int vecSize, MixPDF *mp)
+static LogFloat XOutP(Vector x, int vecSize, MixPDF *mp, ScoreContext *sc)
 {
    Vector xmm,trans_xmm;
    int i,j;
@@ -5397,8 +6462,12 @@ static LogFloat XOutP(Vector x, int vecSize, MixPDF *mp)
    Vector xrow;
    LogFloat sum;
 
-   xmm = CreateVector(&gstack,vecSize);
-   trans_xmm = CreateVector(&gstack,vecSize);
+   if (sc->xmm!=NULL) {
+      xmm = sc->xmm; trans_xmm = sc->txmm;
+   } else {
+      xmm = CreateVector(&gstack,vecSize);
+      trans_xmm = CreateVector(&gstack,vecSize);
+   }
    for (j=1;j<=vecSize;j++)
       xmm[j] = x[j] - mp->mean[j];
    numrows=NumRows(mp->cov.xform);
@@ -5412,22 +6481,14 @@ static LogFloat XOutP(Vector x, int vecSize, MixPDF *mp)
    for (i=1;i<=numrows;i++)
       sum += trans_xmm[i]*trans_xmm[i];
    sum += mp->gConst;
-   FreeVector(&gstack,xmm);
+   if (sc->xmm==NULL) FreeVector(&gstack,xmm);
    return -0.5*sum;
 }
 
 /* EXPORT-> IDOutP: Log prob of x in given mixture - Inverse Diagonal Case */
 LogFloat IDOutP(Vector x, int vecSize, MixPDF *mp)
 {
-   int i;
-   float sum,xmm;
-
-   sum = mp->gConst;
-   for (i=1;i<=vecSize;i++) {
-      xmm=x[i] - mp->mean[i];
-      sum += xmm*xmm*mp->cov.var[i];
-   }
-   return -0.5*sum;
+   return -0.5*iDist(mp->gConst,x+1,mp->mean+1,mp->cov.var+1,vecSize);
 }
 
 /* EXPORT-> PDEMOutP: Mixture Outp calculation exploiting sharing and PDE 
@@ -5438,36 +6499,37 @@ LogFloat IDOutP(Vector x, int vecSize, MixPDF *mp)
    BTW, works only with INVDIAGC */
 Boolean PDEMOutP(Vector otvs, MixPDF *mp, LogFloat *mixp, LogFloat xwtdet)
 {
-   int i,vs;
-   LogFloat xmm;
+   return CtxPDEMOutP(&gCtx,otvs,mp,mixp,xwtdet);
+}
+
+/* EXPORT-> CtxPDEMOutP: PDEMOutP counting statistics in sc */
+Boolean CtxPDEMOutP(ScoreContext *sc, Vector otvs, MixPDF *mp, 
+                    LogFloat *mixp, LogFloat xwtdet)
+{
+   int vs,e1,e2;
+   float *x,*m,*v;
+   float sum;
    
-   *mixp = mp->gConst;
+   vs = VectorSize(otvs);
+   e1 = (pde1BlockEnd<vs) ? pde1BlockEnd : vs;
+   e2 = (pde2BlockEnd<vs) ? pde2BlockEnd : vs;
+   x = otvs+1; m = mp->mean+1; v = mp->cov.var+1;
 #ifdef PDE_STATS
-   nGaussTot++;
+   sc->nGaussTot++;
 #endif
-   for (i=1; i<=pde1BlockEnd; i++) { /* first block */
-      xmm = otvs[i] - mp->mean[i];
-      *mixp += xmm*xmm*mp->cov.var[i];
-   }
+   sum = iDist(mp->gConst,x,m,v,e1);             /* first block */
    /* test the first threshold */
-   if (xwtdet+0.5*(*mixp) < pdeTh1) {
+   if (xwtdet+0.5*sum < pdeTh1) {
 #ifdef PDE_STATS
-      nGaussPDE1++;
+      sc->nGaussPDE1++;
 #endif
-      for (; i<=pde2BlockEnd; i++) { /* second block */
-	 xmm = otvs[i] - mp->mean[i];
-	 *mixp += xmm*xmm*mp->cov.var[i];
-      }
+      sum = iDist(sum,x+e1,m+e1,v+e1,e2-e1);     /* second block */
       /* test the second threshold */
-      if (xwtdet+0.5*(*mixp) < pdeTh2) {
+      if (xwtdet+0.5*sum < pdeTh2) {
 #ifdef PDE_STATS
-	 nGaussPDE2++;
+	 sc->nGaussPDE2++;
 #endif
-	 vs = VectorSize(otvs);
-	 for (; i<=vs; i++) { /* third block */
-	    xmm = otvs[i] - mp->mean[i];
-	    *mixp += xmm*xmm*mp->cov.var[i];
-	 }
+	 sum = iDist(sum,x+e2,m+e2,v+e2,vs-e2);  /* third block */
       } else {
 	 *mixp = LZERO;
 	 return FALSE;
@@ -5476,42 +6538,77 @@ Boolean PDEMOutP(Vector otvs, MixPDF *mp, LogFloat *mixp, LogFloat xwtdet)
       *mixp = LZERO;
       return FALSE;
    }
-   *mixp *= -0.5;
+   *mixp = -0.5*sum;
    return TRUE;
 }
 
-/* EXPORT-> MOutP: returns log prob of vector x for given mixture */
-LogFloat MOutP(Vector x, MixPDF *mp)
+/* CompOutP: log prob of vector x for given mixture using context sc */
+static LogFloat CompOutP(ScoreContext *sc, Vector x, int vSize, MixPDF *mp)
 {
-   int vSize;
-   LogFloat px;
-   
-   vSize=VectorSize(x);
    switch (mp->ckind) {
-   case DIAGC:    px=DOutP(x,vSize,mp); break;
-   case INVDIAGC: px=IDOutP(x,vSize,mp); break;
-   case FULLC:    px=FOutP(x,vSize,mp); break;
-   case LLTC:     px=COutP(x,vSize,mp); break;
-   case XFORMC:   px=XOutP(x,vSize,mp); break;
-   default:       px = LZERO;
+   case DIAGC:    return DOutP(x,vSize,mp);
+   case INVDIAGC: return IDOutP(x,vSize,mp);
+   case FULLC:    return FOutP(x,vSize,mp,sc);
+   case LLTC:     return COutP(x,vSize,mp,sc);
+   case XFORMC:   return XOutP(x,vSize,mp,sc);
    }
-   return px;
+   return LZERO;
 }
 
+/* EXPORT-> MOutP: returns log prob of vector x for given mixture */
+LogFloat MOutP(Vector x, MixPDF *mp)
+{
+   return CompOutP(&gCtx,x,VectorSize(x),mp);
+}
 
-/* EXPORT-> SOutP: returns log prob of stream s of observation x */
-LogFloat SOutP(HMMSet *hset, int s, Observation *x, StreamElem *se)
+/* EXPORT-> CtxMOutP: MOutP using context sc */
+LogFloat CtxMOutP(ScoreContext *sc, Vector x, MixPDF *mp)
 {
-   int m,vSize;
-   LogDouble bx,px;
-   double sum;
+   return CompOutP(sc,x,VectorSize(x),mp);
+}
+
+
+/* MixOutP: log prob of v for the multi-mixture stream se.  If cell
+   is not NULL only components listed in it are scored, and nSel is
+   set to the number scored */
+static LogDouble MixOutP(ScoreContext *sc, HMMSet *hset, Vector v, int vSize,
+                         StreamElem *se, unsigned char *cell, int *nSel)
+{
+   int m,n;
+   LogDouble bx,px,lx[LADDVECSIZE];
    MixtureElem *me;
    MixPDF *mp;
+   LogFloat wt;
+
+   bx = LZERO; *nSel = 0; n = 0;
+   for (m=1,me=se->spdf.cpdf+1; m<=se->nMix; m++,me++) {
+      wt=MixLogWeight(hset,me->weight);
+      if (wt>LMINMIX) {  
+         mp = me->mpdf; 
+         if (cell != NULL && mp->mIdx > 0 && !GSEL_ISSET(cell,mp->mIdx))
+            continue;
+         px = CompOutP(sc,v,vSize,mp);
+         lx[n++] = wt+px; ++(*nSel);
+         if (n == LADDVECSIZE) {
+            bx = LAddVec(bx,lx,n); n = 0;
+         }
+      }
+   }
+   return LAddVec(bx,lx,n);
+}
+
+/* StreamOutP: log prob of stream s of observation x using context sc */
+static LogFloat StreamOutP(ScoreContext *sc, HMMSet *hset, int s, 
+                           Observation *x, StreamElem *se)
+{
+   int m,vSize,nSel;
+   LogDouble bx;
+   unsigned char *cell;
+   double sum;
    TMixRec *tr;
    TMProb *tm;
    ShortVec uv;
    Vector v,tv;
-   LogFloat wt;
    int ix;
 
    switch (hset->hsKind){
@@ -5522,36 +6619,14 @@ LogFloat SOutP(HMMSet *hset, int s, Observation *x, StreamElem *se)
       if (vSize != hset->swidth[s])
          HError(7071,"SOutP: incompatible stream widths %d vs %d",
                 vSize,hset->swidth[s]);
-      me = se->spdf.cpdf+1;
-      if (se->nMix == 1){     /* Single Mixture Case */
-         mp = me->mpdf; 
-         switch (mp->ckind) {
-         case DIAGC:    px=DOutP(v,vSize,mp); break;
-         case INVDIAGC: px=IDOutP(v,vSize,mp); break;
-         case FULLC:    px=FOutP(v,vSize,mp); break;
-         case LLTC:     px=COutP(v,vSize,mp); break;
-         case XFORMC:   px=XOutP(v,vSize,mp); break;
-         default:       px=LZERO;
-         }
-         return px;
-      } else {
-         bx = LZERO;                   /* Multi Mixture Case */
-         for (m=1; m<=se->nMix; m++,me++) {
-            wt=MixLogWeight(hset,me->weight);
-            if (wt>LMINMIX) {  
-               mp = me->mpdf; 
-               switch (mp->ckind) {
-               case DIAGC:    px=DOutP(v,vSize,mp); break;
-               case INVDIAGC: px=IDOutP(v,vSize,mp); break;
-               case FULLC:    px=FOutP(v,vSize,mp); break;
-               case LLTC:     px=COutP(v,vSize,mp); break;
-               case XFORMC:   px=XOutP(v,vSize,mp); break;
-               default:       px = LZERO;
-               }
-               bx = LAdd(bx,wt+px);
-            }
-         }
-      }
+      if (se->nMix == 1)      /* Single Mixture Case */
+         return CompOutP(sc,v,vSize,se->spdf.cpdf[1].mpdf);
+      /* Multi Mixture Case */
+      cell = GSelCell(hset,s,x);
+      bx = MixOutP(sc,hset,v,vSize,se,cell,&nSel);
+      if (cell != NULL && nSel == 0)    /* empty shortlist */
+         bx = (hset->gsel->floor > LSMALL) ? hset->gsel->floor :
+            MixOutP(sc,hset,v,vSize,se,NULL,&nSel);
       return bx;
    case TIEDHS:
       v = x->fv[s];
@@ -5559,7 +6634,7 @@ LogFloat SOutP(HMMSet *hset, int s, Observation *x, StreamElem *se)
       if (vSize != hset->swidth[s])
          HError(7071,"SOutP: incompatible stream widths %d vs %d",
                 vSize,hset->swidth[s]);
-      sum = 0.0; tr = hset->tmRecs+s;
+      sum = 0.0; tr = ((sc->tmRecs!=NULL) ? sc->tmRecs : hset->tmRecs)+s;
       tm = tr->probs+1; tv = se->spdf.tpdf;
       for (m=1; m<=tr->topM; m++,tm++)
          sum += tm->prob * tv[tm->index];
@@ -5575,9 +6650,21 @@ LogFloat SOutP(HMMSet *hset, int s, Observation *x, StreamElem *se)
    return LZERO; /* to keep compiler happy */
 }
 
+/* EXPORT-> SOutP: returns log prob of stream s of observation x */
+LogFloat SOutP(HMMSet *hset, int s, Observation *x, StreamElem *se)
+{
+   return StreamOutP(&gCtx,hset,s,x,se);
+}
 
-/* EXPORT-> POutP: returns log prob of streams x for given StateInfo */
-LogFloat POutP(HMMSet *hset,Observation *x, StateInfo *si)
+/* EXPORT-> CtxSOutP: SOutP using context sc */
+LogFloat CtxSOutP(ScoreContext *sc, int s, Observation *x, StreamElem *se)
+{
+   return StreamOutP(sc,sc->hset,s,x,se);
+}
+
+/* StateOutP: log prob of observation x in state si using context sc */
+static LogFloat StateOutP(ScoreContext *sc, HMMSet *hset, Observation *x, 
+                          StateInfo *si)
 {
    LogFloat bx;
    StreamElem *se;
@@ -5585,33 +6672,509 @@ LogFloat POutP(HMMSet *hset,Observation *x, StateInfo *si)
    int s,S = x->swidth[0];
    
    if (S==1 && si->weights==NULL)
-      return SOutP(hset,1,x,si->pdf+1);
+      return StreamOutP(sc,hset,1,x,si->pdf+1);
    bx=0.0; se=si->pdf+1; w = si->weights;
    for (s=1;s<=S;s++,se++)
-      bx += w[s]*SOutP(hset,s,x,se);
+      bx += w[s]*StreamOutP(sc,hset,s,x,se);
    return bx;
 }
 
+/* EXPORT-> POutP: returns log prob of streams x for given StateInfo */
+LogFloat POutP(HMMSet *hset,Observation *x, StateInfo *si)
+{
+   return StateOutP(&gCtx,hset,x,si);
+}
+
+/* EXPORT-> CtxPOutP: POutP using context sc */
+LogFloat CtxPOutP(ScoreContext *sc, Observation *x, StateInfo *si)
+{
+   return StateOutP(sc,sc->hset,x,si);
+}
 
 /* EXPORT-> OutP: Returns probability (log) of observation x for given state */
 LogFloat OutP(Observation *x, HLink hmm, int state)
 {
-   StateInfo *si;
-   LogFloat bx;
+   return StateOutP(&gCtx,hmm->owner,x,hmm->svec[state].info);
+}
+
+/* EXPORT-> CtxOutP: OutP using context sc */
+LogFloat CtxOutP(ScoreContext *sc, Observation *x, HLink hmm, int state)
+{
+   return StateOutP(sc,hmm->owner,x,hmm->svec[state].info);
+}
+
+         
+/* CompOutPBlock: log probs of x[0..n-1] for mixture mp using context sc */
+static void CompOutPBlock(ScoreContext *sc, Vector *x, int n, MixPDF *mp, 
+                          LogFloat *outp)
+{
+   int i,vSize;
+   float *mean,*var;
+
+   vSize = VectorSize(x[0]);
+   mean = mp->mean+1; var = mp->cov.var+1;
+   switch (mp->ckind) {
+   case DIAGC:
+      for (i=0; i<n; i++) 
+         outp[i] = -0.5*dDist(mp->gConst,x[i]+1,mean,var,vSize);
+      break;
+   case INVDIAGC:
+      for (i=0; i<n; i++) 
+         outp[i] = -0.5*iDist(mp->gConst,x[i]+1,mean,var,vSize);
+      break;
+   default:
+      for (i=0; i<n; i++) 
+         outp[i] = CompOutP(sc,x[i],vSize,mp);
+   }
+}
+
+/* EXPORT-> MOutPBlock: log probs of vectors x[0..n-1] for given mixture */
+void MOutPBlock(Vector *x, int n, MixPDF *mp, LogFloat *outp)
+{
+   CompOutPBlock(&gCtx,x,n,mp,outp);
+}
+
+/* EXPORT-> CtxMOutPBlock: MOutPBlock using context sc */
+void CtxMOutPBlock(ScoreContext *sc, Vector *x, int n, MixPDF *mp, 
+                   LogFloat *outp)
+{
+   CompOutPBlock(sc,x,n,mp,outp);
+}
+
+/* StreamOutPBlock: log probs of stream s of x[0..n-1] using context sc */
+static void StreamOutPBlock(ScoreContext *sc, HMMSet *hset, int s, 
+                            Observation **x, int n, StreamElem *se, 
+                            LogFloat *outp)
+{
+   int i,m,nb,vSize;
+   MixtureElem *me;
+   LogFloat wt,px[OUTPBLOCK];
+   LogDouble bx[OUTPBLOCK];
+   Vector v[OUTPBLOCK];
+
+   switch (hset->hsKind){
+   case PLAINHS:
+   case SHAREDHS:
+      if (hset->gsel != NULL) {   /* shortlists differ frame by frame */
+         for (i=0; i<n; i++) 
+            outp[i] = StreamOutP(sc,hset,s,x[i],se);
+         break;
+      }
+      for (; n>0; n-=nb,x+=nb,outp+=nb) {
+         nb = (n<OUTPBLOCK) ? n : OUTPBLOCK;
+         for (i=0; i<nb; i++) {
+            v[i] = x[i]->fv[s];
+            vSize = VectorSize(v[i]);
+            if (vSize != hset->swidth[s])
+               HError(7071,"SOutPBlock: incompatible stream widths %d vs %d",
+                      vSize,hset->swidth[s]);
+         }
+         me = se->spdf.cpdf+1;
+         if (se->nMix == 1) {    /* Single Mixture Case */
+            CompOutPBlock(sc,v,nb,me->mpdf,outp);
+            continue;
+         }
+         for (i=0; i<nb; i++) bx[i] = LZERO;
+         for (m=1; m<=se->nMix; m++,me++) {   /* Multi Mixture Case */
+            wt = MixLogWeight(hset,me->weight);
+            if (wt>LMINMIX) {
+               CompOutPBlock(sc,v,nb,me->mpdf,px);
+               for (i=0; i<nb; i++)
+                  bx[i] = LAdd(bx[i],wt+px[i]);
+            }
+         }
+         for (i=0; i<nb; i++) outp[i] = bx[i];
+      }
+      break;
+   case DISCRETEHS:
+      for (i=0; i<n; i++) 
+         outp[i] = StreamOutP(sc,hset,s,x[i],se);
+      break;
+   default: 
+      HError(7071,"SOutPBlock: hsKind %d cannot be scored in blocks",
+             hset->hsKind);
+   }
+}
+
+/* EXPORT-> SOutPBlock: log probs of stream s of observations x[0..n-1] */
+void SOutPBlock(HMMSet *hset, int s, Observation **x, int n, 
+                StreamElem *se, LogFloat *outp)
+{
+   StreamOutPBlock(&gCtx,hset,s,x,n,se,outp);
+}
+
+/* EXPORT-> CtxSOutPBlock: SOutPBlock using context sc */
+void CtxSOutPBlock(ScoreContext *sc, int s, Observation **x, int n, 
+                   StreamElem *se, LogFloat *outp)
+{
+   StreamOutPBlock(sc,sc->hset,s,x,n,se,outp);
+}
+
+/* StateOutPBlock: log probs of x[0..n-1] for si using context sc */
+static void StateOutPBlock(ScoreContext *sc, HMMSet *hset, Observation **x,
+                           int n, StateInfo *si, LogFloat *outp)
+{
+   LogFloat sx[OUTPBLOCK];
    StreamElem *se;
    Vector w;
-   int s,S = x->swidth[0];
+   int i,nb,s,S = x[0]->swidth[0];
    
-   si = (hmm->svec+state)->info;
-   if (S==1 && si->weights==NULL)
-      return SOutP(hmm->owner,1,x,si->pdf+1);
-   bx=0.0; se=si->pdf+1; w = si->weights;
-   for (s=1;s<=S;s++,se++)
-      bx += w[s]*SOutP(hmm->owner,s,x,se);
+   if (S==1 && si->weights==NULL) {
+      StreamOutPBlock(sc,hset,1,x,n,si->pdf+1,outp);
+      return;
+   }
+   w = si->weights;
+   for (; n>0; n-=nb,x+=nb,outp+=nb) {
+      nb = (n<OUTPBLOCK) ? n : OUTPBLOCK;
+      for (i=0; i<nb; i++) outp[i] = 0.0;
+      for (s=1,se=si->pdf+1; s<=S; s++,se++) {
+         StreamOutPBlock(sc,hset,s,x,nb,se,sx);
+         for (i=0; i<nb; i++) 
+            outp[i] += w[s]*sx[i];
+      }
+   }
+}
+
+/* EXPORT-> POutPBlock: log probs of observations x[0..n-1] for StateInfo */
+void POutPBlock(HMMSet *hset, Observation **x, int n, StateInfo *si,
+                LogFloat *outp)
+{
+   StateOutPBlock(&gCtx,hset,x,n,si,outp);
+}
+
+/* EXPORT-> CtxPOutPBlock: POutPBlock using context sc */
+void CtxPOutPBlock(ScoreContext *sc, Observation **x, int n, StateInfo *si,
+                   LogFloat *outp)
+{
+   StateOutPBlock(sc,sc->hset,x,n,si,outp);
+}
+
+/* EXPORT-> CreateScoreContext: scoring context for hset allocated in x */
+ScoreContext *CreateScoreContext(MemHeap *x, HMMSet *hset)
+{
+   ScoreContext *sc;
+   TMixRec *tr;
+   int s;
+
+   sc = (ScoreContext *)New(x,sizeof(ScoreContext));
+   sc->hset = hset;
+   sc->xmm = CreateVector(x,hset->vecSize);
+   sc->txmm = CreateVector(x,hset->vecSize);
+   sc->nGaussTot = sc->nGaussPDE1 = sc->nGaussPDE2 = 0;
+   sc->tmRecs = NULL;
+   if (hset->hsKind == TIEDHS) {   /* own copy of the probs arrays */
+      sc->tmRecs = (TMixRec *)New(x,SMAX*sizeof(TMixRec));
+      for (s=1; s<=hset->swidth[0]; s++) {
+         tr = sc->tmRecs+s;
+         *tr = hset->tmRecs[s];
+         if (tr->nMix > 0 && tr->probs != NULL) {
+            tr->probs = (TMProb *)New(x,tr->nMix*sizeof(TMProb));
+            tr->probs--;
+         }
+      }
+   }
+   return sc;
+}
+
+/* EXPORT-> CtxPrecomputeTMix: PrecomputeTMix into the probs of sc */
+void CtxPrecomputeTMix(ScoreContext *sc, Observation *x, float tmThresh, 
+                       int topM)
+{
+   TMixProbs(sc,sc->hset,x,tmThresh,topM);
+}
+
+/* ------------------------- Scoring Views ------------------------- */
+
+/*
+   The view of a set is built on the first GetScoreView call and
+   rebuilt in place by SyncScoreView, so pointers to it stay valid.
+   The scoring routines repeat the arithmetic of SOutP, MixOutP and
+   SOutPBlock exactly, using the same kernels, so that switching to
+   the view does not change any result.
+*/
+
+/* ViewAlloc: return n zeroed bytes from x aligned on SVIEWALIGN */
+static Ptr ViewAlloc(MemHeap *x, size_t n)
+{
+   char *p;
+
+   p = (char *)New(x,n+SVIEWALIGN);
+   p += (SVIEWALIGN - (size_t)p % SVIEWALIGN) % SVIEWALIGN;
+   memset(p,0,n);
+   return (Ptr)p;
+}
+
+/* BuildScoreView: fill the arrays of sv from sv->hset, return FALSE
+   if the set cannot be viewed */
+static Boolean BuildScoreView(ScoreView *sv)
+{
+   HMMSet *hset = sv->hset;
+   HMMScanState hss;
+   ViewStream *vs;
+   StreamElem *se;
+   MixtureElem *me;
+   MixPDF *mp;
+   float *mean,*var;
+   int i,m,r,s,S,sIdx;
+   Boolean ok = TRUE;
+
+   if (hset->hsKind!=PLAINHS && hset->hsKind!=SHAREDHS) return FALSE;
+   S = sv->nStreams = hset->swidth[0];
+   for (s=1; s<=S; s++) {
+      vs = sv->str+s;
+      vs->nDim = hset->swidth[s]; vs->ckind = NULLC; vs->nRow = 0;
+      vs->stride = ((vs->nDim*sizeof(float)+SVIEWALIGN-1)/SVIEWALIGN)*
+         (SVIEWALIGN/sizeof(float));
+   }
+   /* check covariance kinds, count rows and find largest index */
+   sv->maxIdx = -1;
+   NewHMMScan(hset,&hss);
+   while (ok && GoNextState(&hss,FALSE)) {
+      if (hss.si->sIdx<0) ok = FALSE;
+      if (hss.si->sIdx>sv->maxIdx) sv->maxIdx = hss.si->sIdx;
+      for (s=1,se=hss.si->pdf+1; ok && s<=S; s++,se++) {
+         vs = sv->str+s; vs->nRow += se->nMix;
+         for (m=1,me=se->spdf.cpdf+1; m<=se->nMix; m++,me++) {
+            if ((mp=me->mpdf) == NULL) continue;
+            if ((mp->ckind!=DIAGC && mp->ckind!=INVDIAGC) ||
+                (vs->ckind!=NULLC && vs->ckind!=mp->ckind) ||
+                VectorSize(mp->mean)!=vs->nDim) {
+               ok = FALSE; break;
+            }
+            vs->ckind = mp->ckind;
+         }
+      }
+   }
+   EndHMMScan(&hss);
+   if (!ok || sv->maxIdx<0) return FALSE;
+
+   sv->weights = (Vector *)New(&sv->mem,(sv->maxIdx+1)*sizeof(Vector));
+   for (s=1; s<=S; s++) {
+      vs = sv->str+s;
+      vs->mean = (float *)ViewAlloc(&sv->mem,vs->nRow*vs->stride*sizeof(float));
+      vs->var = (float *)ViewAlloc(&sv->mem,vs->nRow*vs->stride*sizeof(float));
+      vs->gConst = (float *)New(&sv->mem,vs->nRow*sizeof(float));
+      vs->logWt = (float *)New(&sv->mem,vs->nRow*sizeof(float));
+      vs->mIdx = (int *)New(&sv->mem,vs->nRow*sizeof(int));
+      vs->first = (int *)New(&sv->mem,(sv->maxIdx+1)*sizeof(int));
+      vs->nMix = (int *)New(&sv->mem,(sv->maxIdx+1)*sizeof(int));
+      for (i=0; i<=sv->maxIdx; i++) {
+         vs->first[i] = 0; vs->nMix[i] = -1;
+      }
+      vs->nRow = 0;
+   }
+   NewHMMScan(hset,&hss);
+   while (ok && GoNextState(&hss,FALSE)) {
+      sIdx = hss.si->sIdx;
+      if (sv->str[1].nMix[sIdx]>=0) {     /* sIdx not unique */
+         ok = FALSE; break;
+      }
+      sv->weights[sIdx] = hss.si->weights;
+      for (s=1,se=hss.si->pdf+1; s<=S; s++,se++) {
+         vs = sv->str+s;
+         vs->first[sIdx] = vs->nRow; vs->nMix[sIdx] = se->nMix;
+         for (m=1,me=se->spdf.cpdf+1; m<=se->nMix; m++,me++) {
+            r = vs->nRow++;
+            vs->logWt[r] = MixLogWeight(hset,me->weight);
+            if ((mp=me->mpdf) == NULL) {
+               vs->logWt[r] = LZERO; vs->gConst[r] = 0.0; vs->mIdx[r] = 0;
+               continue;
+            }
+            vs->gConst[r] = mp->gConst; vs->mIdx[r] = mp->mIdx;
+            mean = vs->mean+r*vs->stride; var = vs->var+r*vs->stride;
+            for (i=0; i<vs->nDim; i++) {
+               mean[i] = mp->mean[i+1]; var[i] = mp->cov.var[i+1];
+            }
+         }
+      }
+   }
+   EndHMMScan(&hss);
+   for (s=1; s<=S; s++)
+      for (i=0; i<=sv->maxIdx; i++)
+         if (sv->str[s].nMix[i]<0) sv->str[s].nMix[i] = 0;
+   return ok;
+}
+
+/* EXPORT->GetScoreView: return view of hset, NULL if not viewable */
+ScoreView *GetScoreView(HMMSet *hset)
+{
+   ScoreView *sv;
+   int s;
+   long nRow;
+
+   if (!useScoreView) return NULL;
+   if ((sv = (ScoreView *)hset->sview) == NULL) {
+      sv = (ScoreView *)New(hset->hmem,sizeof(ScoreView));
+      sv->hset = hset; sv->sumDouble = FALSE;
+      CreateHeap(&sv->mem,"ScoreView",MSTAK,1,1.0,100000,10000000);
+      hset->sview = sv;
+      sv->valid = BuildScoreView(sv);
+      if (trace&T_TOP) {
+         if (sv->valid) {
+            for (s=1,nRow=0; s<=sv->nStreams; s++) nRow += sv->str[s].nRow;
+            printf("HModel: score view of %d states, %ld components, %.2f MB\n",
+                   sv->maxIdx+1,nRow,sv->mem.totAlloc/1048576.0);
+         } else
+            printf("HModel: HMM set cannot be scored through a view\n");
+         fflush(stdout);
+      }
+   }
+   return sv->valid ? sv : NULL;
+}
+
+/* EXPORT->SyncScoreView: rebuild view of hset after model changes */
+void SyncScoreView(HMMSet *hset)
+{
+   ScoreView *sv;
+
+   if ((sv = (ScoreView *)hset->sview) == NULL) return;
+   ResetHeap(&sv->mem);
+   sv->valid = BuildScoreView(sv);
+}
+
+/* ViewMixOutP: as MixOutP for state sIdx of stream vs, in EXACT log
+   add mode the sum is the chain of LAdd calls of the scorer replaced,
+   rounded to LogFloat after each term unless dbl */
+static LogDouble ViewMixOutP(ViewStream *vs, int sIdx, float *x, Boolean dbl,
+                             unsigned char *cell, float *mixp, int *nSel)
+{
+   DistKernel dist;
+   LogDouble bx,lx[LADDVECSIZE];
+   LogFloat px;
+   float *mean,*var;
+   int m,n,r,M;
+   Boolean exact;
+
+   dist = (vs->ckind==INVDIAGC) ? iDist : dDist;
+   exact = (GetLAddKind()==EXACTLA);
+   r = vs->first[sIdx]; M = vs->nMix[sIdx];
+   mean = vs->mean+r*vs->stride; var = vs->var+r*vs->stride;
+   bx = LZERO; *nSel = 0; n = 0;
+   for (m=1; m<=M; m++,r++,mean+=vs->stride,var+=vs->stride) {
+      if (vs->logWt[r]>LMINMIX) {
+         if (cell != NULL && vs->mIdx[r] > 0 && !GSEL_ISSET(cell,vs->mIdx[r]))
+            continue;
+         px = -0.5*dist(vs->gConst[r],x,mean,var,vs->nDim);
+         if (mixp != NULL) mixp[m] = px;
+         ++(*nSel);
+         if (exact) {
+            bx = LAdd(bx,vs->logWt[r]+px);
+            if (!dbl) bx = (LogFloat) bx;
+            continue;
+         }
+         lx[n++] = vs->logWt[r]+px;
+         if (n == LADDVECSIZE) {
+            bx = LAddVec(bx,lx,n); n = 0;
+         }
+      }
+   }
+   return LAddVec(bx,lx,n);
+}
+
+/* EXPORT->ViewSOutP: log prob of stream s of x for state sIdx */
+LogFloat ViewSOutP(ScoreView *sv, int s, int sIdx, float *x, 
+                   unsigned char *cell, float *mixp)
+{
+   ViewStream *vs = sv->str+s;
+   DistKernel dist;
+   LogDouble bx;
+   int r,nSel;
+
+   if (vs->nMix[sIdx] == 1) {     /* Single Mixture Case */
+      dist = (vs->ckind==INVDIAGC) ? iDist : dDist;
+      r = vs->first[sIdx];
+      return -0.5*dist(vs->gConst[r],x,vs->mean+r*vs->stride,
+                       vs->var+r*vs->stride,vs->nDim);
+   }
+   bx = ViewMixOutP(vs,sIdx,x,sv->sumDouble,cell,mixp,&nSel);
+   if (cell != NULL && nSel == 0)    /* empty shortlist */
+      bx = (sv->hset->gsel->floor > LSMALL) ? sv->hset->gsel->floor :
+         ViewMixOutP(vs,sIdx,x,sv->sumDouble,NULL,mixp,&nSel);
    return bx;
 }
 
-         
+/* EXPORT->ViewPOutP: log prob of x for state sIdx */
+LogFloat ViewPOutP(ScoreView *sv, Observation *x, int sIdx)
+{
+   LogFloat bx;
+   Vector w;
+   int s,S = x->swidth[0];
+
+   w = sv->weights[sIdx];
+   if (S==1 && w==NULL)
+      return ViewSOutP(sv,1,sIdx,x->fv[1]+1,GSelCell(sv->hset,1,x),NULL);
+   bx = 0.0;
+   for (s=1; s<=S; s++)
+      bx += w[s]*ViewSOutP(sv,s,sIdx,x->fv[s]+1,GSelCell(sv->hset,s,x),NULL);
+   return bx;
+}
+
+/* EXPORT->ViewSOutPBlock: log probs of stream s of x[0..n-1] for sIdx */
+void ViewSOutPBlock(ScoreView *sv, int s, int sIdx, Vector *x, int n,
+                    LogFloat *outp, float **mixp)
+{
+   ViewStream *vs = sv->str+s;
+   DistKernel dist;
+   LogDouble bx[OUTPBLOCK];
+   LogFloat px[OUTPBLOCK];
+   float *mean,*var;
+   int i,m,r,nb,M;
+
+   dist = (vs->ckind==INVDIAGC) ? iDist : dDist;
+   M = vs->nMix[sIdx];
+   for (; n>0; n-=nb,x+=nb,outp+=nb) {
+      nb = (n<OUTPBLOCK) ? n : OUTPBLOCK;
+      r = vs->first[sIdx];
+      mean = vs->mean+r*vs->stride; var = vs->var+r*vs->stride;
+      if (M == 1) {              /* Single Mixture Case */
+         for (i=0; i<nb; i++)
+            outp[i] = -0.5*dist(vs->gConst[r],x[i]+1,mean,var,vs->nDim);
+         continue;
+      }
+      for (i=0; i<nb; i++) bx[i] = LZERO;
+      for (m=1; m<=M; m++,r++,mean+=vs->stride,var+=vs->stride) {
+         if (vs->logWt[r]>LMINMIX) {
+            for (i=0; i<nb; i++) 
+               px[i] = -0.5*dist(vs->gConst[r],x[i]+1,mean,var,vs->nDim);
+            for (i=0; i<nb; i++) 
+               bx[i] = LAdd(bx[i],vs->logWt[r]+px[i]);
+            if (!sv->sumDouble)
+               for (i=0; i<nb; i++) bx[i] = (LogFloat) bx[i];
+            if (mixp != NULL)
+               for (i=0; i<nb; i++) mixp[i][m] = px[i];
+         }
+      }
+      for (i=0; i<nb; i++) outp[i] = bx[i];
+      if (mixp != NULL) mixp += nb;
+   }
+}
+
+/* EXPORT->ViewPOutPBlock: log probs of x[0..n-1] for state sIdx */
+void ViewPOutPBlock(ScoreView *sv, Observation **x, int n, int sIdx,
+                    LogFloat *outp)
+{
+   LogFloat sx[OUTPBLOCK];
+   Vector v[OUTPBLOCK],w;
+   int i,nb,s,S = x[0]->swidth[0];
+
+   w = sv->weights[sIdx];
+   for (; n>0; n-=nb,x+=nb,outp+=nb) {
+      nb = (n<OUTPBLOCK) ? n : OUTPBLOCK;
+      if (S==1 && w==NULL) {
+         for (i=0; i<nb; i++) v[i] = x[i]->fv[1];
+         ViewSOutPBlock(sv,1,sIdx,v,nb,outp,NULL);
+         continue;
+      }
+      for (i=0; i<nb; i++) outp[i] = 0.0;
+      for (s=1; s<=S; s++) {
+         for (i=0; i<nb; i++) v[i] = x[i]->fv[s];
+         ViewSOutPBlock(sv,s,sIdx,v,nb,sx,NULL);
+         for (i=0; i<nb; i++) 
+            outp[i] += w[s]*sx[i];
+      }
+   }
+}
+
 /* EXPORT->DProb2Short: convert prob to scaled log form */
 short DProb2Short(float p)
 {
@@ -5630,8 +7193,10 @@ LogFloat Short2DProb(short s)
 /* EXPORT->PrintPDEstats: print PDE stats */
 void PrintPDEstats()
 {
-   printf("PDE Gaussians: total %d, eliminated at th1 %d, at th2 %d\n",nGaussTot,nGaussTot-nGaussPDE1,nGaussPDE1-nGaussPDE2);
-   nGaussTot = nGaussPDE1 = nGaussPDE2 = 0;
+   printf("PDE Gaussians: total %ld, eliminated at th1 %ld, at th2 %ld\n",
+          gCtx.nGaussTot,gCtx.nGaussTot-gCtx.nGaussPDE1,
+          gCtx.nGaussPDE1-gCtx.nGaussPDE2);
+   gCtx.nGaussTot = gCtx.nGaussPDE1 = gCtx.nGaussPDE2 = 0;
 }
 #endif
 
@@ -5669,10 +7234,17 @@ void FixInvDiagGConst(MixPDF *mp)
    mp->gConst = sum;
 }
 
-/* EXPORT->FixLLTGConst: Sets gConst for given MixPDF in INVDIAGC case */
+/* EXPORT->FixLLTGConst: Sets gConst for given MixPDF in LLTC case */
 void FixLLTGConst(MixPDF *mp)
 {
-   mp->gConst = 0.0;
+   float sum;
+   int i,n;
+   TriMat l = mp->cov.inv;
+
+   n = TriMatSize(l); sum = n*log(TPI);
+   for (i=1; i<=n; i++)     /* log Det(cov) = -2 sum log l[i][i] */
+      sum -= (l[i][i]<=0.0)?LZERO:2.0*log(l[i][i]);
+   mp->gConst = sum;
 }
 
 /* EXPORT->FixFullGConst: Sets gConst for given MixPDF in FULLC case */
@@ -5728,6 +7300,7 @@ void FixTiedGConsts(HMMSet *hset)
          switch (mp->ckind) {
          case DIAGC:    FixDiagGConst(mp); break;
          case INVDIAGC: FixInvDiagGConst(mp); break;
+         case LLTC:     FixLLTGConst(mp); break;
          case FULLC:    FixFullGConst(mp,-CovDet(mp->cov.inv)); break;
          case XFORMC:   break;
          }
@@ -5752,10 +7325,18 @@ void FixAllGConsts(HMMSet *hset)
    }
    else if (hset->hsKind == TIEDHS)
       FixTiedGConsts(hset);
+   SyncScoreView(hset);
 }
 
 /* ----------------------- Enum Conversions ------------------------------ */
 
+/* EXPORT-> GKernKind2Str: Return string representation of enum GKernKind */
+char *GKernKind2Str(GKernKind kind, char *buf)
+{
+   static char *gkmap[] = {"AUTO","SCALAR","SSE4","AVX2","AVX512"};
+   return strcpy(buf,gkmap[kind]);
+}
+
 /* EXPORT-> DurKind2Str: Return string representation of enum DurKind */
 char *DurKind2Str(DurKind dkind, char *buf)
 {
@@ -5766,7 +7347,7 @@ char *DurKind2Str(DurKind dkind, char *buf)
 /* EXPORT-> CovKind2Str: Return string representation of enum CovKind */
 char *CovKind2Str(CovKind ckind, char *buf)
 {
-   static char *covmap[] = {"DIAGC","INVDIAGC","FULLC","XFORMC"};
+   static char *covmap[] = {"DIAGC","INVDIAGC","FULLC","XFORMC","LLTC","NULLC"};
    return strcpy(buf,covmap[ckind]);
 }
 
@@ -82,6 +82,9 @@ typedef enum _DurKind DurKind;
 enum _HSetKind {PLAINHS, SHAREDHS, TIEDHS, DISCRETEHS};
 typedef enum _HSetKind HSetKind;
 
+enum _GKernKind {AUTOGK, SCALARGK, SSE4GK, AVX2GK, AVX512GK};
+typedef enum _GKernKind GKernKind;   /* diagonal Gaussian kernel */
+
 typedef struct {
    SVector mean;        /* mean vector */
    CovKind ckind;       /* kind of covariance */
@@ -294,6 +297,15 @@ typedef struct _PtrMap {   /* used for finding macros via ptr's */
 
 /* ---------------------- HMM Sets ----------------------------- */
 
+typedef struct {        /* Gaussian selection index, see LoadGSelIndex */
+   char *fn;               /* name of index file */
+   Ptr vqTab;              /* VQTable used to quantise each stream */
+   int nBytes;             /* bytes in each shortlist bit set */
+   short nCells[SMAX];     /* number of VQ cells in each stream */
+   unsigned char **cells[SMAX]; /* [s][vqidx] bit set of listed mIdx's */
+   LogFloat floor;         /* stream log prob if shortlist is empty */
+} GSelRec;
+
 typedef struct _HMMSet{
    MemHeap *hmem;          /* memory heap for this HMM Set */   
    Boolean *firstElem;     /* first element added to hmem during MakeHMMSet*/
@@ -337,6 +349,15 @@ typedef struct _HMMSet{
    /* Added to support delayed loading of the semi-tied transform */
    char *semiTiedMacro;  /* macroname of semi-tied transform */
 
+   /* Added to support Gaussian selection */
+   GSelRec *gsel;        /* Gaussian selection index or NULL */
+
+   /* Added to support compiled HMM set images */
+   Ptr image;            /* mapped image supplying the whole set or NULL */
+
+   /* Added to support scoring views */
+   Ptr sview;            /* ScoreView of the set (see GetScoreView) or NULL */
+
 } HMMSet;
 
 /* --------------------------- Initialisation ---------------------- */
@@ -493,6 +514,19 @@ ReturnStatus SaveHMMList(HMMSet *hset, char *fname);
    Save a HMM list in fname describing given HMM set 
 */
 
+ReturnStatus SaveHMMSetImage(HMMSet *hset, char *fname);
+/*
+   Store the loaded PLAINHS or SHAREDHS set hset as a compiled image
+   in fname.  An image holds the HMMDef, StateInfo, StreamElem,
+   MixtureElem and MixPDF structures and their shared vectors and
+   matrices laid out ready for use, plus the macro names, so that
+   loading it needs no parsing.  An image file may be given to a tool
+   wherever an MMF can (ie via AddMMF); it is recognised by its
+   header and memory mapped.  Adaptation transforms, input transforms
+   and semi-tied sets cannot be stored.  All hooks of the set must be
+   NULL on entry.
+*/
+
 
 /* -------------- Shared Structure "Seen" Flags -------------- */
 
@@ -539,6 +573,7 @@ int MaxStatesInSet(HMMSet *hset);
 
 char *DurKind2Str(DurKind dkind, char *buf);
 char *CovKind2Str(CovKind ckind, char *buf);
+char *GKernKind2Str(GKernKind kind, char *buf);
 /*
    Utility routines to convert enum types to strings.  In each case,
    string is stored in *buf and pointer to buf is returned
@@ -547,6 +582,19 @@ char *CovKind2Str(CovKind ckind, char *buf);
 
 /* ------------- HMM Output Probability Calculations --------------- */
 
+GKernKind SetGaussKernel(GKernKind kind);
+GKernKind GetGaussKernel(void);
+/*
+   Select/return the kernel used for diagonal Gaussian distances in
+   the output probability routines below (including PDEMOutP).  The
+   initial choice is set by the GAUSSKERNEL config variable (default
+   AUTO, the widest kernel supported by the host CPU).  If the host
+   cannot run the requested kernel the next narrower one is used.
+   A SIMD kernel is checked against the scalar one on fixed data 
+   when selected and replaced by it if they disagree.
+   SetGaussKernel returns the kernel actually selected.
+*/
+
 void PrecomputeTMix(HMMSet *hset, Observation *x, float tmThresh, int topM);
 /*
    Precompute the tied mixture probs stored in hset->tmRecs.  The
@@ -555,6 +603,33 @@ void PrecomputeTMix(HMMSet *hset, Observation *x, float tmThresh, int topM);
    of the max are used
 */
 
+ReturnStatus LoadGSelIndex(HMMSet *hset, char *fn);
+/*
+   Load the Gaussian selection index fn built by HGSel, and the VQ
+   table it names, and attach it to hset.  The index lists for each
+   VQ cell of each stream the mixture components (by mIdx) worth
+   evaluating for vectors falling in that cell.  LoadHMMSet calls 
+   this when GSELINDEX is set.
+*/
+
+void GSelObservation(HMMSet *hset, Observation *x);
+/*
+   Quantise x with the codebook of the Gaussian selection index
+   of hset and store the cell of each stream in x->vq.  Decoders call
+   this once per frame, like PrecomputeTMix.  SOutP then only scores
+   the components on the shortlist of that cell, backing off to
+   GSELFLOOR (or to all components if unset) when a stream has no
+   listed component.  Has no effect if hset has no index.
+*/
+
+unsigned char *GSelCell(HMMSet *hset, int s, Observation *x);
+#define GSEL_ISSET(cell,i) ((cell)[(i)>>3] & (1<<((i)&7)))
+/*
+   Return the shortlist bit set for stream s of x, or NULL if
+   Gaussian selection does not apply to x.  Component mp is listed
+   if GSEL_ISSET(cell,mp->mIdx).
+*/
+
 
    
 LogFloat  OutP(Observation *x, HLink hmm, int state);
@@ -569,15 +644,76 @@ LogFloat SOutP(HMMSet *hset, int s, Observation *x, StreamElem *se);
    Return Stream log output prob of stream s of observation x
 */
 
+#define OUTPBLOCK 16    /* frames scored per pass in the block routines */
+
+void POutPBlock(HMMSet *hset, Observation **x, int n, StateInfo *si,
+                LogFloat *outp);
+void SOutPBlock(HMMSet *hset, int s, Observation **x, int n, 
+                StreamElem *se, LogFloat *outp);
+/*
+   Block versions of POutP and SOutP: set outp[i] to the log output
+   prob of observation x[i] for i=0..n-1.  Each mixture component is
+   scored against all n frames before moving to the next, so that its
+   mean and variance stay in cache.  Not available for TIEDHS sets
+   since PrecomputeTMix only holds one frame.
+*/
+
 /*
    Return Mixture log output probability for given vector x.  
 */
 
 Boolean PDEMOutP(Vector otvs, MixPDF *mp, LogFloat *mixp, LogFloat xwtdet);
 LogFloat MOutP(Vector x, MixPDF *mp);
+void MOutPBlock(Vector *x, int n, MixPDF *mp, LogFloat *outp);
 LogFloat IDOutP(Vector x, int vecSize, MixPDF *mp);
 short DProb2Short(float p);
 
+/*
+   The routines above keep their tied mixture probs in hset->tmRecs
+   and take scratch space for FULLC, LLTC and XFORMC components from
+   gstack, so only one thread may use them at a time.  Threads that
+   score the same HMM set concurrently should each create a
+   ScoreContext (from their own heap, or before the threads are
+   started) and use the Ctx versions below instead.  The scoring view
+   routines (ViewSOutP etc.) need no context.  Input xforms applied
+   through HAdapt are not covered and must not be active.
+*/
+
+typedef struct {
+   HMMSet *hset;           /* set scored */
+   TMixRec *tmRecs;        /* [1..S] tied mixture probs, NULL for hset's */
+   Vector xmm;             /* scratch vectors of hset->vecSize */
+   Vector txmm;            /*   NULL to use gstack */
+   long nGaussTot;         /* PDE statistics, kept if PDE_STATS defined */
+   long nGaussPDE1;
+   long nGaussPDE2;
+} ScoreContext;
+
+ScoreContext *CreateScoreContext(MemHeap *x, HMMSet *hset);
+/*
+   Create a scoring context for hset in heap x, with its own tied
+   mixture probs and scratch vectors
+*/
+
+void CtxPrecomputeTMix(ScoreContext *sc, Observation *x, float tmThresh,
+                       int topM);
+LogFloat CtxOutP(ScoreContext *sc, Observation *x, HLink hmm, int state);
+LogFloat CtxPOutP(ScoreContext *sc, Observation *x, StateInfo *si);
+LogFloat CtxSOutP(ScoreContext *sc, int s, Observation *x, StreamElem *se);
+LogFloat CtxMOutP(ScoreContext *sc, Vector x, MixPDF *mp);
+Boolean CtxPDEMOutP(ScoreContext *sc, Vector otvs, MixPDF *mp,
+                    LogFloat *mixp, LogFloat xwtdet);
+void CtxPOutPBlock(ScoreContext *sc, Observation **x, int n, StateInfo *si,
+                   LogFloat *outp);
+void CtxSOutPBlock(ScoreContext *sc, int s, Observation **x, int n,
+                   StreamElem *se, LogFloat *outp);
+void CtxMOutPBlock(ScoreContext *sc, Vector *x, int n, MixPDF *mp,
+                   LogFloat *outp);
+/*
+   As the routines without the Ctx prefix, but using the tied mixture
+   probs, scratch vectors and PDE statistics of sc and scoring sc->hset
+*/
+
 #ifdef PDE_STATS
 /* 
    Get PDE stats
@@ -594,6 +730,88 @@ LogFloat Short2DProb(short s);
    Convert scaled log prob (s) to prob p = exp(s/DLOGSCALE)
 */
 
+/* ------------------------- Scoring Views ------------------------- */
+
+/*
+   A scoring view holds the parameters of every diagonal covariance
+   component of a PLAINHS/SHAREDHS set in contiguous arrays, so that
+   recognisers and trainers can score states without following the
+   StateInfo->StreamElem->MixtureElem->MixPDF pointers.  Within each
+   stream the components of a state are consecutive rows, and each
+   row of the mean and variance arrays is zero padded to a multiple
+   of SVIEWALIGN bytes and aligned on that boundary.  States are
+   indexed by their sIdx at the time the view is built.
+*/
+
+#define SVIEWALIGN 64   /* byte alignment and padding of view rows */
+
+typedef struct {        /* the components of one stream */
+   int nDim;               /* stream width */
+   int stride;             /* floats per row, nDim padded to SVIEWALIGN */
+   CovKind ckind;          /* DIAGC (variances) or INVDIAGC (inverses) */
+   int nRow;               /* number of component rows */
+   float *mean;            /* [nRow*stride] means */
+   float *var;             /* [nRow*stride] variances or inverse variances */
+   float *gConst;          /* [nRow] gConsts */
+   float *logWt;           /* [nRow] log mixture weights */
+   int *mIdx;              /* [nRow] HModel component indices */
+   int *first;             /* [0..maxIdx] first row of each state */
+   int *nMix;              /* [0..maxIdx] rows of each state, 0 if none */
+} ViewStream;
+
+typedef struct {
+   HMMSet *hset;           /* set viewed */
+   Boolean valid;          /* FALSE if hset cannot be viewed */
+   int maxIdx;             /* largest state index */
+   int nStreams;           /* number of streams */
+   ViewStream str[SMAX];   /* [1..nStreams] streams */
+   Vector *weights;        /* [0..maxIdx] stream weights of each state */
+   Boolean sumDouble;      /* mixture sums kept in double, else LogFloat */
+   MemHeap mem;            /* holds the arrays */
+} ScoreView;
+
+ScoreView *GetScoreView(HMMSet *hset);
+/*
+   Return the scoring view of hset, building it on first use, or NULL
+   if the set cannot be viewed (not PLAINHS/SHAREDHS, covariances
+   other than a single diagonal kind per stream, states without a
+   unique sIdx) or views are disabled by SCOREVIEW=F.  The view does
+   not apply input transforms, so callers must fall back to the
+   routines above when one is in use.
+*/
+
+void SyncScoreView(HMMSet *hset);
+/*
+   Bring the view of hset, if it has one, up to date with the model
+   parameters and state indexes.  FixAllGConsts, ApplyHMMSetXForm
+   and ResetXFormHMMSet call this, so tools only need to call it
+   after changing parameters in some other way.
+*/
+
+LogFloat ViewSOutP(ScoreView *sv, int s, int sIdx, float *x, 
+                   unsigned char *cell, float *mixp);
+LogFloat ViewPOutP(ScoreView *sv, Observation *x, int sIdx);
+/*
+   As SOutP and POutP for state sIdx of view sv.  ViewSOutP takes
+   the stream vector x as x[0..nDim-1] and the Gaussian selection
+   shortlist cell (or NULL), and if mixp is not NULL and the state
+   has more than one component sets mixp[m] to the log prob of
+   component m of each component scored.  Mixture sums are rounded
+   to LogFloat after each component, as HRec and HFB did, unless
+   sv->sumDouble is set.
+*/
+
+void ViewSOutPBlock(ScoreView *sv, int s, int sIdx, Vector *x, int n,
+                    LogFloat *outp, float **mixp);
+void ViewPOutPBlock(ScoreView *sv, Observation **x, int n, int sIdx,
+                    LogFloat *outp);
+/*
+   As SOutPBlock and POutPBlock for state sIdx of view sv, with
+   Gaussian selection ignored.  If mixp is not NULL and the state has
+   more than one component, mixp[i][m] is set to the log prob of
+   component m for frame i.
+*/
+
 void FixFullGConst(MixPDF *mp, LogFloat ldet);
 void FixLLTGConst(MixPDF *mp);
 void FixInvDiagGConst(MixPDF *mp);
@@ -47,6 +47,11 @@ char *hnet_vc_id = "$Id: HNet.c,v 1.1.1.1 2006/10/11 09:54:58 jal58 Exp $";
 #include "HDict.h"
 #include "HNet.h"
 
+#ifdef WIN32
+#include <process.h>
+#define getpid _getpid
+#endif
+
 /* ----------------------------- Trace Flags ------------------------- */
 
 #define T_CXT 0001         /* Trace context definitions */
@@ -2290,6 +2295,21 @@ typedef struct pinstinfo {
 }
 PInstInfo;
 
+/* NullWord: return !NULL word if it is really null, else NULL */
+static Word NullWord(Vocab *voc)
+{
+   Word nullWord;
+   Pron thisPron;
+
+   nullWord = GetWord(voc,GetLabId("!NULL", TRUE),TRUE);
+   for (thisPron=nullWord->pron;thisPron!=NULL;thisPron=thisPron->next)
+      if (thisPron->nphones!=0)
+         return(NULL);
+   if (nullWord->pron==NULL)
+      NewPron(voc,nullWord,0,NULL,nullWord->wordName,1.0);
+   return(nullWord);
+}
+
 static int InitPronHolders(Network *net,Lattice *lat,HMMSetCxtInfo *hci,
                            Vocab *voc,MemHeap *heap,char *frcSil)
 {
@@ -2308,16 +2328,7 @@ static int InitPronHolders(Network *net,Lattice *lat,HMMSetCxtInfo *hci,
       wnHashTab[i]=NULL;
 
    /* Determine if we have a real !NULL word */
-   net->nullWord = GetWord(voc,GetLabId("!NULL", TRUE),TRUE);
-   for (thisPron=net->nullWord->pron;thisPron!=NULL;thisPron=thisPron->next)
-      if (thisPron->nphones!=0) {
-         net->nullWord=NULL;
-         break;
-      }
-   if (net->nullWord!=NULL) {
-      if (net->nullWord->pron==NULL)
-         NewPron(voc,net->nullWord,0,NULL,net->nullWord->wordName,1.0);
-   }
+   net->nullWord = NullWord(voc);
    if (frcSil!=NULL && strlen(frcSil)>0) {
       for(nSil=nAdd=0,ptr=frcSil;ptr!=NULL;ptr=nxt) {
          if ((nxt=ParseString(ptr,name))==NULL) break;
@@ -3658,4 +3669,370 @@ Network *ExpandWordNet(MemHeap *heap,Lattice *lat,Vocab *voc,HMMSet *hset)
    return(net);
 }   
 
+/* ------------------------ Network Cache ------------------------- */
+
+/*
+   A cached network file holds, in binary,
+     the identifier NETCACHEID and the key it was saved with,
+     the names of the physical hmms and the word names and numbers
+     of the pronunciations used in the network,
+     the type, hmm/pronunciation, number of links and tag of each
+     node (initial, final then the chain in order),
+     the tags and finally the target node and likelihood of each link.
+   Models and pronunciations are looked up by name when the network
+   is read so the file remains valid if the HMMSet or dictionary is
+   loaded in a different order.
+*/
+
+#define NETCACHEID "#!HNETCACHE-1.0\n"
+#define CHKBASIS 2166136261U    /* FNV-1a 32 bit offset basis */
+#define CHKPRIME 16777619U      /* FNV-1a 32 bit prime */
+
+/* AddChecksum: accumulate n bytes from p into checksum sum */
+static unsigned int AddChecksum(unsigned int sum,unsigned char *p,size_t n)
+{
+   size_t i;
+
+   for (i=0; i<n; i++)
+      sum=(sum^p[i])*CHKPRIME;
+   return(sum & 0xffffffff);
+}
+
+/* FileChecksum: return checksum of contents of fn and its size */
+static unsigned int FileChecksum(char *fn,long *size)
+{
+   FILE *f;
+   unsigned char buf[4096];
+   unsigned int sum;
+   size_t n;
+
+   sum=CHKBASIS; *size=-1;
+   if (fn==NULL || (f=fopen(fn,"rb"))==NULL)
+      return(sum);
+   for (*size=0; (n=fread(buf,1,sizeof(buf),f))>0; *size+=n)
+      sum=AddChecksum(sum,buf,n);
+   fclose(f);
+   return(sum);
+}
+
+/* EXPORT->NetCacheKey: key identifying network built from given files */
+char *NetCacheKey(char *key,char *latFn,char *dictFn,char *hmmListFn)
+{
+   char buf[MAXSTRLEN];
+   unsigned int lc,dc,hc,oc;
+   long ls,ds,hs;
+
+   lc=FileChecksum(latFn,&ls);
+   dc=FileChecksum(dictFn,&ds);
+   hc=FileChecksum(hmmListFn,&hs);
+   sprintf(buf,"%d%d%d%d%d%d%d%d%d",forceCxtExp,forceLeftBiphones,
+           forceRightBiphones,allowCxtExp,allowXWrdExp,cfWordBoundary,
+           factorLM,remDupPron,sublatmarkers);
+   oc=AddChecksum(CHKBASIS,(unsigned char*)buf,strlen(buf)+1);
+   if (frcSil!=NULL)
+      oc=AddChecksum(oc,(unsigned char*)frcSil,strlen(frcSil));
+   oc=AddChecksum(oc,(unsigned char*)subLatStart,strlen(subLatStart)+1);
+   oc=AddChecksum(oc,(unsigned char*)subLatEnd,strlen(subLatEnd));
+   sprintf(key,"%08x-%lx.%08x-%lx.%08x-%lx.%08x",lc,ls,dc,ds,hc,hs,oc);
+   return(key);
+}
+
+/* QSCmpPtrs: order pointers by address */
+static int QSCmpPtrs(const void *v1,const void *v2)
+{
+   char *p1,*p2;
+
+   p1=*((char**)v1); p2=*((char**)v2);
+   if (p1==p2) return(0);
+   return((p1<p2)?-1:1);
+}
+
+/* UniquePtrs: sort n pointers in p, remove duplicates and return count */
+static int UniquePtrs(Ptr *p,int n)
+{
+   int i,k;
+
+   if (n==0) return(0);
+   qsort(p,n,sizeof(Ptr),QSCmpPtrs);
+   for (i=1,k=0; i<n; i++)
+      if (p[i]!=p[k]) p[++k]=p[i];
+   return(k+1);
+}
+
+/* PtrIndex: find index of q in sorted array p[0..n-1] */
+static int PtrIndex(Ptr *p,int n,Ptr q)
+{
+   Ptr *r;
+
+   r=(Ptr*)bsearch(&q,p,n,sizeof(Ptr),QSCmpPtrs);
+   if (r==NULL)
+      HError(8290,"PtrIndex: Pointer not found");
+   return(r-p);
+}
+
+/* WriteNetName: write length then characters of name */
+static void WriteNetName(FILE *f,char *name)
+{
+   int n;
+
+   n=strlen(name);
+   WriteInt(f,&n,1,TRUE);
+   fwrite(name,1,n,f);
+}
+
+/* ReadNetName: read name written by WriteNetName into buf */
+static Boolean ReadNetName(Source *src,char *buf)
+{
+   int n;
+
+   if (!ReadInt(src,&n,1,TRUE) || n<0 || n>=MAXSTRLEN) return(FALSE);
+   if (fread(buf,1,n,src->f)!=n) return(FALSE);
+   buf[n]=0;
+   return(TRUE);
+}
+
+/* EXPORT->WriteNetwork: save net in binary form in fn tagged with key.
+   The net is written to a temporary file which is then renamed to fn,
+   so fn is either the old or the complete new cache file */
+ReturnStatus WriteNetwork(Network *net,HMMSet *hset,char *fn,char *key)
+{
+   FILE *f;
+   Boolean ok;
+   char tmp[MAXFNAMELEN+32];
+   NetNode **nodes,*node;
+   Ptr *hmms,*prons;
+   MLink m;
+   HLink hmm;
+   Pron pron;
+   int i,j,k,nn,nh,np,hdr[6],*ibuf;
+   float *fbuf;
+   char *tags;
+
+   sprintf(tmp,"%s.tmp.%d",fn,(int)getpid());
+   if ((f=fopen(tmp,"wb"))==NULL) {
+      HRError(8260,"WriteNetwork: Cannot create network cache file %s",tmp);
+      return(FAIL);
+   }
+   /* Number nodes in order, using aux which is zero after expansion */
+   nn=net->numNode;
+   nodes=(NetNode**) New(&gstack,nn*sizeof(NetNode*));
+   nodes[0]=&net->initial; nodes[1]=&net->final;
+   for (node=net->chain,i=2; node!=NULL && i<nn; node=node->chain,i++)
+      nodes[i]=node;
+   if (i!=nn || node!=NULL)
+      HError(8290,"WriteNetwork: Network has %d nodes not %d",i,nn);
+   for (i=0; i<nn; i++) nodes[i]->aux=i;
+   hmms=(Ptr*) New(&gstack,nn*sizeof(Ptr));
+   prons=(Ptr*) New(&gstack,nn*sizeof(Ptr));
+   for (i=nh=np=0; i<nn; i++)
+      if (nodes[i]->type&n_hmm) hmms[nh++]=nodes[i]->info.hmm;
+      else if (nodes[i]->info.pron!=NULL) prons[np++]=nodes[i]->info.pron;
+   nh=UniquePtrs(hmms,nh); np=UniquePtrs(prons,np);
+
+   fputs(NETCACHEID,f);
+   WriteNetName(f,key);
+   k=(nn>nh)?nn:nh;
+   if (net->numLink>k) k=net->numLink;
+   ibuf=(int*) New(&gstack,k*sizeof(int));
+   hdr[0]=nh; hdr[1]=np; hdr[2]=nn; hdr[3]=net->numLink;
+   hdr[4]=net->teeWords; hdr[5]=(net->nullWord!=NULL);
+   WriteInt(f,hdr,6,TRUE);
+   for (i=0; i<nh; i++) {
+      hmm=(HLink)hmms[i];
+      if ((m=FindMacroStruct(hset,'h',hmm))==NULL)
+         HError(8290,"WriteNetwork: Cannot find physical name of hmm");
+      WriteNetName(f,m->id->name);
+      ibuf[i]=(hmm->transP[1][hmm->numStates]>LSMALL);
+   }
+   WriteInt(f,ibuf,nh,TRUE);
+   for (i=0; i<np; i++) {
+      pron=(Pron)prons[i];
+      WriteNetName(f,pron->word->wordName->name);
+      k=pron->pnum;
+      WriteInt(f,&k,1,TRUE);
+   }
+   for (i=0; i<nn; i++) ibuf[i]=nodes[i]->type;
+   WriteInt(f,ibuf,nn,TRUE);
+   for (i=0; i<nn; i++)
+      if (nodes[i]->type&n_hmm)
+         ibuf[i]=PtrIndex(hmms,nh,nodes[i]->info.hmm);
+      else if (nodes[i]->info.pron!=NULL)
+         ibuf[i]=PtrIndex(prons,np,nodes[i]->info.pron);
+      else
+         ibuf[i]=-1;
+   WriteInt(f,ibuf,nn,TRUE);
+   for (i=0; i<nn; i++) ibuf[i]=nodes[i]->nlinks;
+   WriteInt(f,ibuf,nn,TRUE);
+   for (i=0; i<nn; i++)
+      ibuf[i]=(nodes[i]->tag==NULL)?-1:strlen(nodes[i]->tag);
+   WriteInt(f,ibuf,nn,TRUE);
+   for (i=0; i<nn; i++)
+      if ((tags=nodes[i]->tag)!=NULL) fwrite(tags,1,strlen(tags),f);
+   fbuf=(float*) New(&gstack,(net->numLink+1)*sizeof(float));
+   for (i=k=0; i<nn; i++)
+      for (j=0,node=nodes[i]; j<node->nlinks; j++,k++) {
+         ibuf[k]=node->links[j].node->aux;
+         fbuf[k]=node->links[j].like;
+      }
+   if (k!=net->numLink)
+      HError(8290,"WriteNetwork: Network has %d links not %d",k,net->numLink);
+   WriteInt(f,ibuf,k,TRUE);
+   WriteFloat(f,fbuf,k,TRUE);
+   for (i=0; i<nn; i++) nodes[i]->aux=0;
+   Dispose(&gstack,nodes);
+   ok=(fflush(f)==0) && !ferror(f);
+   ok=(fclose(f)==0) && ok;
+#ifdef WIN32
+   if (ok) remove(fn);   /* rename does not replace fn on WIN32 */
+#endif
+   if (!ok || rename(tmp,fn)!=0) {
+      remove(tmp);
+      HRError(8260,"WriteNetwork: Cannot write network cache file %s",fn);
+      return(FAIL);
+   }
+   return(SUCCESS);
+}
+
+/* EXPORT->ReadNetwork: read network saved in fn with given key */
+Network *ReadNetwork(MemHeap *heap,char *fn,char *key,Vocab *voc,HMMSet *hset)
+{
+   FILE *f;
+   Source src;
+   Network *net;
+   NetNode **nodes,*node;
+   NetLink *links;
+   HLink *hmms;
+   Pron *prons,pron;
+   Word word,nullWord;
+   LabId id;
+   MLink m;
+   Boolean ok;
+   int i,j,k,nn,nh,np,nl,hdr[6],tlen;
+   int *tee,*types,*refs,*nlinks,*taglen,*ends;
+   float *likes;
+   char buf[MAXSTRLEN],*tags,*tag;
+
+   if ((f=fopen(fn,"rb"))==NULL)
+      return(NULL);
+   AttachSource(f,&src);
+   ok=(fread(buf,1,strlen(NETCACHEID),f)==strlen(NETCACHEID) &&
+       strncmp(buf,NETCACHEID,strlen(NETCACHEID))==0);
+   if (!ok || !ReadNetName(&src,buf) || strcmp(buf,key)!=0 ||
+       !ReadInt(&src,hdr,6,TRUE)) {
+      if (trace&T_CST)
+         printf("ReadNetwork: %s is not a network cache for %s\n",fn,key);
+      fclose(f);
+      return(NULL);
+   }
+   nh=hdr[0]; np=hdr[1]; nn=hdr[2]; nl=hdr[3];
+   nullWord=NullWord(voc);
+   ok=(nh>=0 && np>=0 && nn>=2 && nl>=0 && (nullWord!=NULL)==(hdr[5]!=0));
+
+   /* Find the models and pronunciations by name */
+   hmms=(HLink*) New(&gstack,(nh+1)*sizeof(HLink));
+   tee=(int*) New(&gstack,(nh+1)*sizeof(int));
+   for (i=0; ok && i<nh; i++) {
+      ok=ReadNetName(&src,buf);
+      if (ok && (id=GetLabId(buf,FALSE))!=NULL &&
+          (m=FindMacroName(hset,'h',id))!=NULL)
+         hmms[i]=(HLink)m->structure;
+      else
+         ok=FALSE;
+   }
+   if (ok) ok=ReadInt(&src,tee,nh,TRUE);
+   for (i=0; ok && i<nh; i++)
+      if ((hmms[i]->transP[1][hmms[i]->numStates]>LSMALL)!=(tee[i]!=0))
+         ok=FALSE;
+   prons=(Pron*) New(&gstack,(np+1)*sizeof(Pron));
+   for (i=0; ok && i<np; i++) {
+      ok=ReadNetName(&src,buf) && ReadInt(&src,&k,1,TRUE);
+      pron=NULL;
+      if (ok && (id=GetLabId(buf,FALSE))!=NULL &&
+          (word=GetWord(voc,id,FALSE))!=NULL)
+         for (pron=word->pron; pron!=NULL; pron=pron->next)
+            if (pron->pnum==k) break;
+      if ((prons[i]=pron)==NULL) ok=FALSE;
+   }
+   if (!ok) {
+      if (trace&T_CST)
+         printf("ReadNetwork: %s does not match models or dictionary\n",fn);
+      Dispose(&gstack,hmms);
+      fclose(f);
+      return(NULL);
+   }
+
+   /* Read and check node and link arrays */
+   types=(int*) New(&gstack,nn*sizeof(int));
+   refs=(int*) New(&gstack,nn*sizeof(int));
+   nlinks=(int*) New(&gstack,nn*sizeof(int));
+   taglen=(int*) New(&gstack,nn*sizeof(int));
+   ok=(ReadInt(&src,types,nn,TRUE) && ReadInt(&src,refs,nn,TRUE) &&
+       ReadInt(&src,nlinks,nn,TRUE) && ReadInt(&src,taglen,nn,TRUE));
+   for (i=j=tlen=0; ok && i<nn; i++) {
+      if (types[i]&n_hmm)
+         ok=(refs[i]>=0 && refs[i]<nh);
+      else
+         ok=(refs[i]>=-1 && refs[i]<np);
+      ok=ok && nlinks[i]>=0 && taglen[i]>=-1;
+      j+=nlinks[i];
+      if (taglen[i]>0) tlen+=taglen[i];
+   }
+   ok=ok && j==nl;
+   tags=(char*) New(&gstack,tlen+1);
+   ends=(int*) New(&gstack,(nl+1)*sizeof(int));
+   likes=(float*) New(&gstack,(nl+1)*sizeof(float));
+   ok=ok && fread(tags,1,tlen,f)==tlen &&
+      ReadInt(&src,ends,nl,TRUE) && ReadFloat(&src,likes,nl,TRUE);
+   for (i=0; ok && i<nl; i++)
+      ok=(ends[i]>=0 && ends[i]<nn);
+   fclose(f);
+   if (!ok) {
+      HRError(-8260,"ReadNetwork: Network cache file %s is corrupt",fn);
+      Dispose(&gstack,hmms);
+      return(NULL);
+   }
+
+   /* Build the network */
+   net=(Network*) New(heap,sizeof(Network));
+   nodes=(NetNode**) New(&gstack,nn*sizeof(NetNode*));
+   nodes[0]=&net->initial; nodes[1]=&net->final;
+   node=(nn>2)?(NetNode*) New(heap,(nn-2)*sizeof(NetNode)):NULL;
+   for (i=2; i<nn; i++) nodes[i]=node++;
+   links=(nl>0)?(NetLink*) New(heap,nl*sizeof(NetLink)):NULL;
+   for (i=k=0,tag=tags; i<nn; i++) {
+      node=nodes[i];
+      node->type=types[i];
+      if (types[i]&n_hmm)
+         node->info.hmm=hmms[refs[i]];
+      else
+         node->info.pron=(refs[i]<0)?NULL:prons[refs[i]];
+      if (taglen[i]<0)
+         node->tag=NULL;
+      else {
+         node->tag=(char*) New(heap,taglen[i]+1);
+         strncpy(node->tag,tag,taglen[i]);
+         node->tag[taglen[i]]=0;
+         tag+=taglen[i];
+      }
+      node->nlinks=nlinks[i];
+      node->links=(nlinks[i]>0)?links+k:NULL;
+      for (j=0; j<nlinks[i]; j++,k++) {
+         links[k].node=nodes[ends[k]];
+         links[k].like=likes[k];
+      }
+      node->inst=NULL;
+      node->chain=(i>=2 && i<nn-1)?nodes[i+1]:NULL;
+      node->aux=0;
+   }
+   net->heap=heap;
+   net->vocab=voc;
+   net->nullWord=nullWord;
+   net->teeWords=(hdr[4]!=0);
+   net->numNode=nn;
+   net->numLink=nl;
+   net->chain=(nn>2)?nodes[2]:NULL;
+   Dispose(&gstack,hmms);
+   return(net);
+}
+
 /* ------------------------ End of HNet.c ------------------------- */
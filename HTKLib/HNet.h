@@ -498,6 +498,29 @@ Network *ExpandWordNet(MemHeap *heap,Lattice *lat,Vocab *voc,HMMSet *hset);
      and last phone of context dependent models ].
 */
 
+char *NetCacheKey(char *key,char *latFn,char *dictFn,char *hmmListFn);
+/*
+   Set key (MAXSTRLEN chars) to a string identifying the network
+   which ExpandWordNet builds from the lattice latFn, dictionary
+   dictFn and hmm list hmmListFn with the current HNet configuration.
+   The key is made from checksums of the contents of these files.
+*/
+
+ReturnStatus WriteNetwork(Network *net,HMMSet *hset,char *fn,char *key);
+/*
+   Save net, just as created by ExpandWordNet, in binary to the
+   network cache file fn tagged with key.
+*/
+
+Network *ReadNetwork(MemHeap *heap,char *fn,char *key,Vocab *voc,
+                     HMMSet *hset);
+/*
+   Read a network saved by WriteNetwork in fn into heap.  Returns NULL
+   if fn does not exist, was saved with a different key or refers to
+   models or pronunciations not in hset or voc.  The network should
+   then be rebuilt by ExpandWordNet.
+*/
+
 /* --- Context handling stuff useful for general network building --- */
 
 HMMSetCxtInfo *GetHMMSetCxtInfo(HMMSet *hset, Boolean frcCxtInd);
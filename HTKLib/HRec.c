@@ -46,6 +46,7 @@ char *hrec_vc_id = "$Id: HRec.c,v 1.1.1.1 2006/10/11 09:54:58 jal58 Exp $";
 
 static int trace=0;
 static Boolean forceOutput=FALSE;
+static Boolean exactLAdd=TRUE;   /* LADDKIND=EXACT, mixtures summed by LAdd */
 
 const Token null_token={LZERO,0.0,NULL,NULL};
 
@@ -145,7 +146,7 @@ struct _NetInst
 #endif
 };
 
-/* HMMSet information is some precomputed limits plus the precomps */
+/* Shared mixture output likelihood cached with its frame id */
 typedef struct precomp
 {
    int id;                  /* Unique identifier for current frame */
@@ -153,6 +154,15 @@ typedef struct precomp
 }
 PreComp;
 
+/* Block of state output likelihoods computed by POutPBlock */
+typedef struct blkcomp
+{
+   int id;                  /* Identifier of first frame in block */
+   int n;                   /* Number of valid frames in block */
+   LogFloat outp[OUTPBLOCK];/* State output likelihoods */
+}
+BlkComp;
+
 struct psetinfo
 {
    MemHeap heap;            /* Memory for this set of pre-comps */
@@ -160,19 +170,38 @@ struct psetinfo
 
    int max;                 /* Max states in HMM set */
    Boolean mixShared;
-   int nsp;
-   PreComp *sPre;           /* Array[1..nsp] State PreComps */
-   int nmp;
-   PreComp *mPre;           /* Array[1..nmp] Shared mixture PreComps */
+   int nsp;                 /* Number of states */
+   int nmp;                 /* Number of shared mixtures */
    int ntr;
    short ***seIndexes;      /* Array[1..ntr] of seIndexes */
-   Token *tBuf;             /* Buffer Array[2..N-1] of tok for StepHMM1 */
-   TokenSet *sBuf;          /* Buffer Array[2..N-1] of tokset for StepHMM1_N */
 
    short stHeapNum;         /* Number of separate state heaps */
    short *stHeapIdx;        /* Array[1..max] of state to heap index */
 };
 
+/* Linear alignment.  When the network is a simple chain each HMM in */
+/*  it is a LinModel and its states 1..N are held at consecutive     */
+/*  positions base..base+N-1 of a dense array for each frame.        */
+typedef struct linmodel
+{
+   NetNode *node;           /* HMM node in network */
+   int base;                /* Position of entry state */
+   int N;                   /* Number of states */
+   LogFloat lm;             /* LM likelihood of tokens in the model */
+   LogFloat wdlk;           /* Likelihood from exit to word end (as inst) */
+}
+LinModel;
+
+typedef struct linframe
+{
+   int lo,hi;               /* Range of models with live tokens */
+   int off,n;               /* Positions held are off..off+n-1 */
+   LogDouble *like;         /* Array[0..n-1] of token likelihoods */
+   LogFloat *outp;          /* Array[0..n-1] of outp in like */
+   int *bp;                 /* Array[0..n-1] of previous positions */
+}
+LinFrame;
+
 /* Private recognition information PRecInfo. (Not visible outside HRec) */
 /* Contains all status/network/allocation/pruning information for a     */
 /*  single network.                                                     */
@@ -180,9 +209,28 @@ struct precinfo {
    /* Input parameters - Set once and unseen */
 
    Observation *obs;         /* Current Observation */
+   Observation **obsBlk;     /* Current and following Observations */
+   int nBlk;                 /* Number of Observations in obsBlk */
+   ScoreView *sview;         /* View used to score states (or NULL) */
+   AdaptXForm *inXForm;      /* Input xform of current observation */
 
    PSetInfo *psi;           /* HMMSet information */
+   ScoreContext *sc;        /* Scratch space for scoring psi->hset */
+   LogFloat *sOutp;         /* Array[1..nsp] State outps of current frame */
+   int *sId;                /* Array[1..nsp] Frame id of each sOutp */
+   StateInfo **sAct;        /* Array[nsp] States to score this frame */
+   PreComp *mPre;           /* Array[1..nmp] Shared mixture PreComps */
+   BlkComp *sBlk;           /* Array[1..nsp] State block outps (or NULL) */
+   TokenSet *sBuf;          /* Buffer Array[1..N-1] of tokset for StepHMM1 */
    Network *net;            /* Recognition network */
+   Boolean linear;          /* Network is a chain aligned by StepLinear */
+   MemHeap linHeap;         /* Storage for linear alignment */
+   LinModel *lmod;          /* Array[0..nlmod-1] of models in chain */
+   int nlmod;               /* Number of models in chain */
+   LinFrame *lfr;           /* Array[0..frame] of frame records */
+   int nlfr;                /* Size of lfr */
+   int linMax;              /* Position of genMaxTok */
+   Boolean linFinal;        /* Token reached final node this frame */
    int nToks;               /* Maximum tokens to propagate (0==1) */
    Boolean models;          /* Keep track of model history */
    Boolean states;          /* Keep track of state history */
@@ -249,10 +297,6 @@ struct precinfo {
 
 };
 
-/* Global variable (so we want to get rid of them) */
-static PRecInfo *pri;
-static AdaptXForm *inXForm;
-
 /* Module Initialisation */
 static ConfParam *cParm[MAXGLOBS];      /* config parameters */
 static int nParm = 0;
@@ -270,13 +314,14 @@ void InitRec(void)
       if (GetConfInt(cParm,nParm,"TRACE",&i)) trace = i;
       if (GetConfBool(cParm,nParm,"FORCEOUT",&b)) forceOutput = b;
    }
+   exactLAdd = (GetLAddKind()==EXACTLA);
 }
 
 
 /* Basic token merging step used during propagation.      */ 
 /* Token in cmp plus extra info from src merged into res. */
 /*  tokens less likely that info.nThresh ignored.         */
-static void TokSetMerge(TokenSet *res,Token *cmp,TokenSet *src)
+static void TokSetMerge(PRecInfo *pri,TokenSet *res,Token *cmp,TokenSet *src)
 {
    Path *path;
    TokenSet tmp;
@@ -434,13 +479,61 @@ static void TokSetMerge(TokenSet *res,Token *cmp,TokenSet *src)
       nodes[i]->aux=0;
 }
 
+/* Caching mixture sum of cSOutP, restricted to the components set
+   in Gaussian selection cell if not NULL, nSel is set to the number
+   of components used */
+static LogFloat cMixOutP(PRecInfo *pri, HMMSet *hset, Vector v, StreamElem *se,
+                         unsigned char *cell, int id, int *nSel)
+{
+   PreComp *pre;
+   LogFloat sx,px,wt,det;
+   LogDouble bx,lx[LADDVECSIZE];
+   MixtureElem *me;
+   int m,n;
+
+   sx=bx=LZERO; *nSel=0; n=0;
+   me=se->spdf.cpdf+1;
+   for (m=1; m<=se->nMix; m++,me++) {
+      if (cell!=NULL && me->mpdf->mIdx>0 && !GSEL_ISSET(cell,me->mpdf->mIdx))
+         continue;
+      wt = MixLogWeight(hset, me->weight);
+      if (wt>LMINMIX) {   
+         if (me->mpdf->mIdx>0 && me->mpdf->mIdx<=pri->psi->nmp)
+            pre=pri->mPre+me->mpdf->mIdx;
+         else pre=NULL;
+         if (pre==NULL) {
+            px= CtxMOutP(pri->sc,ApplyCompFXForm(me->mpdf,v,pri->inXForm,&det,id),me->mpdf);
+            px += det;
+         } else if (pre->id!=id) {
+            px= CtxMOutP(pri->sc,ApplyCompFXForm(me->mpdf,v,pri->inXForm,&det,id),me->mpdf);
+            px += det;
+            pre->id=id;
+            pre->outp=px;
+         }
+         else
+            px=pre->outp;
+         ++(*nSel);
+         if (exactLAdd)
+            sx=LAdd(sx,wt+px);
+         else {
+            lx[n++]=wt+px;
+            if (n==LADDVECSIZE) {
+               bx=LAddVec(bx,lx,n); n=0;
+            }
+         }
+      }
+   }
+   return exactLAdd ? sx : LAddVec(bx,lx,n);
+}
+
 /* Caching version of SOutP used when mixPDFs shared */
-static LogFloat cSOutP(HMMSet *hset, int s, Observation *x, StreamElem *se,
+static LogFloat cSOutP(PRecInfo *pri, HMMSet *hset, int s, Observation *x, StreamElem *se,
                        int id)
 {
    PreComp *pre;
-   LogFloat bx,px,wt,det;
-   int m,vSize;
+   LogFloat bx,det;
+   unsigned char *cell;
+   int m,vSize,nSel;
    double sum;
    MixtureElem *me;
    TMixRec *tr;
@@ -454,41 +547,25 @@ static LogFloat cSOutP(HMMSet *hset, int s, Observation *x, StreamElem *se,
       me=se->spdf.cpdf+1;
       if (se->nMix==1){     /* Single Mixture Case */
          if (me->mpdf->mIdx>0 && me->mpdf->mIdx<=pri->psi->nmp)
-            pre=pri->psi->mPre+me->mpdf->mIdx;
+            pre=pri->mPre+me->mpdf->mIdx;
          else pre=NULL;
          if (pre==NULL) {
-            bx= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
+            bx= CtxMOutP(pri->sc,ApplyCompFXForm(me->mpdf,v,pri->inXForm,&det,id),me->mpdf);
             bx += det;
          } else if (pre->id!=id) {
-            bx= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
+            bx= CtxMOutP(pri->sc,ApplyCompFXForm(me->mpdf,v,pri->inXForm,&det,id),me->mpdf);
             bx += det;
             pre->id=id;
             pre->outp=bx;
          }
          else
             bx=pre->outp;
-      } else {
-         bx=LZERO;                   /* Multi Mixture Case */
-         for (m=1; m<=se->nMix; m++,me++) {
-            wt = MixLogWeight(hset, me->weight);
-            if (wt>LMINMIX) {   
-               if (me->mpdf->mIdx>0 && me->mpdf->mIdx<=pri->psi->nmp)
-                  pre=pri->psi->mPre+me->mpdf->mIdx;
-               else pre=NULL;
-               if (pre==NULL) {
-                  px= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
-                  px += det;
-               } else if (pre->id!=id) {
-                  px= MOutP(ApplyCompFXForm(me->mpdf,v,inXForm,&det,id),me->mpdf);
-                  px += det;
-                  pre->id=id;
-                  pre->outp=px;
-               }
-               else
-                  px=pre->outp;
-               bx=LAdd(bx,wt+px);
-            }
-         }
+      } else {                  /* Multi Mixture Case */
+         cell = GSelCell(hset,s,x);
+         bx = cMixOutP(pri,hset,v,se,cell,id,&nSel);
+         if (cell!=NULL && nSel==0)     /* empty shortlist */
+            bx = (hset->gsel->floor>LSMALL) ? hset->gsel->floor :
+               cMixOutP(pri,hset,v,se,NULL,id,&nSel);
       }
       return bx;
    case TIEDHS:
@@ -497,7 +574,7 @@ static LogFloat cSOutP(HMMSet *hset, int s, Observation *x, StreamElem *se,
       if (vSize != hset->swidth[s])
          HError(7071,"SOutP: incompatible stream widths %d vs %d",
                 vSize,hset->swidth[s]);
-      sum = 0.0; tr = hset->tmRecs+s;
+      sum = 0.0; tr = pri->sc->tmRecs+s;
       tm = tr->probs+1; tv = se->spdf.tpdf;
       for (m=1; m<=tr->topM; m++,tm++)
          sum += tm->prob * tv[tm->index];
@@ -508,50 +585,97 @@ static LogFloat cSOutP(HMMSet *hset, int s, Observation *x, StreamElem *se,
 }
 
 
-/* Version of POutP that caches outp values with frame id */
-static LogFloat cPOutP(PSetInfo *psi,Observation *obs,StateInfo *si,int id)
+/* Version of POutP for the frame with the given id, using the block
+   of outps already computed for it if there is one */
+static LogFloat StateOutP(PRecInfo *pri,Observation *obs,StateInfo *si,int id)
 {
-   PreComp *pre;
+   PSetInfo *psi;
+   BlkComp *blk;
    LogFloat outp;
    StreamElem *se;
    Vector w;
    int s,S;
 
-   if (si->sIdx>0 && si->sIdx<=pri->psi->nsp)
-      pre=pri->psi->sPre+si->sIdx;
-   else pre=NULL;
-
-#ifdef SANITY
-   if (pre==NULL)
-      HError(8520,"cPOutP: State has no PreComp attached");
-#endif
-   
-   if (pre->id!=id) { /* bodged at the moment - fix !! */
-      if ((FALSE && psi->mixShared==FALSE) || (psi->hset->hsKind == DISCRETEHS)) {
-         outp=POutP(psi->hset,obs,si);
+   psi=pri->psi;
+   if (pri->nBlk>1) {   /* score whole block of frames at once */
+      blk=pri->sBlk+si->sIdx;
+      if (id<blk->id || id>=blk->id+blk->n) {
+         if (pri->sview!=NULL)
+            ViewPOutPBlock(pri->sview,pri->obsBlk,pri->nBlk,si->sIdx,
+                           blk->outp);
+         else
+            CtxPOutPBlock(pri->sc,pri->obsBlk,pri->nBlk,si,blk->outp);
+         blk->id=id; blk->n=pri->nBlk;
+      }
+      outp=blk->outp[id-blk->id];
+   }
+   else if ((FALSE && psi->mixShared==FALSE) || (psi->hset->hsKind == DISCRETEHS)) {
+      outp=CtxPOutP(pri->sc,obs,si);
+   }
+   else if (pri->sview!=NULL) {
+      outp=ViewPOutP(pri->sview,obs,si->sIdx);
+   }
+   else {
+      S=obs->swidth[0];
+      if (S==1 && si->weights==NULL){
+         outp=cSOutP(pri,psi->hset,1,obs,si->pdf+1,id);
       }
       else {
-         S=obs->swidth[0];
-         if (S==1 && si->weights==NULL){
-            outp=cSOutP(psi->hset,1,obs,si->pdf+1,id);
+         outp=0.0;
+         se=si->pdf+1;
+         w=si->weights;
+         for (s=1;s<=S;s++,se++){
+            outp+=w[s]*cSOutP(pri,psi->hset,s,obs,se,id);
          }
-         else {
-            outp=0.0;
-            se=si->pdf+1;
-            w=si->weights;
-            for (s=1;s<=S;s++,se++){
-               outp+=w[s]*cSOutP(psi->hset,s,obs,se,id);
-            }
+      }
+   }
+   return(outp);
+}
+
+/* Fill pri->sOutp for every state which will survive state pruning
+   in StepHMM1 this frame, ie which has a predecessor token within
+   genThresh (still that of the previous frame).  Each shared state
+   is scored once in a single pass before any tokens move */
+static void ScoreActiveStates(PRecInfo *pri)
+{
+   NetInst *inst;
+   HMMDef *hmm;
+   TokenSet *cur;
+   StateInfo *si,**act;
+   Matrix trP;
+   short **seIndex;
+   int i,j,k,n,N,endi,id;
+
+   id=pri->id; act=pri->sAct; n=0;
+   for (inst=pri->head.link;inst!=NULL;inst=inst->link) {
+      if (inst->node==NULL || !node_hmm(inst->node)) continue;
+      hmm=inst->node->info.hmm;
+      N=hmm->numStates;
+      trP=hmm->transP;
+      seIndex=pri->psi->seIndexes[hmm->tIdx];
+      for (j=2;j<N;j++) {
+         si=hmm->svec[j].info;
+#ifdef SANITY
+         if (si->sIdx<1 || si->sIdx>pri->psi->nsp)
+            HError(8520,"ScoreActiveStates: State %d has bad sIdx",j);
+#endif
+         if (pri->sId[si->sIdx]==id) continue;
+         i=seIndex[j][0];
+         endi=seIndex[j][1];
+         for (cur=inst->state+i-1;i<=endi;i++,cur++)
+            if (cur->tok.like+trP[i][j]>pri->genThresh) break;
+         if (i<=endi) {
+            pri->sId[si->sIdx]=id;
+            act[n++]=si;
          }
       }
-      pre->outp=outp;
-      pre->id=id;
    }
-   return(pre->outp);
+   for (k=0;k<n;k++)
+      pri->sOutp[act[k]->sIdx]=StateOutP(pri,pri->obs,act[k],id);
 }
 
 /* Move align record to (head of) YES referenced list */
-static void MoveAlignYesRef(Align *align)
+static void MoveAlignYesRef(PRecInfo *pri,Align *align)
 {
    align->link->knil=align->knil;
    align->knil->link=align->link;
@@ -562,10 +686,10 @@ static void MoveAlignYesRef(Align *align)
 
 /* Add reference to align record.                     */
 /* Moves record to YES referenced list when necessary */
-static void RefAlign(Align *align)
+static void RefAlign(PRecInfo *pri,Align *align)
 {
    if (align->usage==0) {
-      MoveAlignYesRef(align);
+      MoveAlignYesRef(pri,align);
 #ifdef SANITY
       pri->anlen--;pri->aylen++;
 #endif
@@ -575,7 +699,7 @@ static void RefAlign(Align *align)
 
 /* Remove reference to align record, moving to  */ 
 /* (tail of) NO referenced list when necessary. */
-static void DeRefAlign(Align *align)
+static void DeRefAlign(PRecInfo *pri,Align *align)
 {
 #ifdef SANITY
    if (align->usage<0)
@@ -595,7 +719,7 @@ static void DeRefAlign(Align *align)
 }
 
 /* Allocate new align record and add to NOT referenced list */
-static Align *NewNRefAlign(NetNode *node,int state,double like,
+static Align *NewNRefAlign(PRecInfo *pri,NetNode *node,int state,double like,
                            int frame,Align *prev)
 {
    Align *align;
@@ -613,7 +737,7 @@ static Align *NewNRefAlign(NetNode *node,int state,double like,
    align->frame=frame;
    
    if ((align->prev=prev)!=NULL)
-      RefAlign(prev);
+      RefAlign(pri,prev);
 
    pri->nalign++;
 #ifdef SANITY
@@ -624,7 +748,7 @@ static Align *NewNRefAlign(NetNode *node,int state,double like,
 }
 
 /* Remove and free align record from NO referenced list */
-static void UnlinkAlign(Align *align)
+static void UnlinkAlign(PRecInfo *pri,Align *align)
 {
    align->link->knil=align->knil;
    align->knil->link=align->link;
@@ -639,7 +763,7 @@ static void UnlinkAlign(Align *align)
    pri->nalign--;
 }
 
-static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
+static void StepHMM1(PRecInfo *pri,NetNode *node) /* Model internal propagation NBEST */
 {
    NetInst *inst;
    HMMDef *hmm;
@@ -662,7 +786,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
    trP=hmm->transP;
    seIndex=pri->psi->seIndexes[hmm->tIdx];
    
-   for (j=2,res=pri->psi->sBuf+2;j<N;j++,res++) {  /* Emitting states first */
+   for (j=2,res=pri->sBuf+2;j<N;j++,res++) {  /* Emitting states first */
       i=seIndex[j][0]; 
       endi=seIndex[j][1];
       cur=inst->state+i-1;
@@ -680,10 +804,10 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
                res->tok=cmp.tok;
          }
          else
-            TokSetMerge(res,&cmp.tok,cur);
+            TokSetMerge(pri,res,&cmp.tok,cur);
       }
       if (res->tok.like>pri->genThresh) { /* State pruning */
-         outp=cPOutP(pri->psi,pri->obs,hmm->svec[j].info,pri->id);
+         outp=pri->sOutp[hmm->svec[j].info->sIdx];
          res->tok.like+=outp;
    
          if (res->tok.like>max.like)
@@ -691,7 +815,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
          if (pri->states) {
             if (res->tok.align==NULL?TRUE:
                 res->tok.align->state!=j || res->tok.align->node!=node) {
-               align=NewNRefAlign(node,j,
+               align=NewNRefAlign(pri,node,j,
                                   res->tok.like-outp-res->tok.lm*pri->scale,
                                   pri->frame-1,res->tok.align);
                res->tok.align=align;
@@ -705,7 +829,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
 	      if (res->set[n].align==NULL?TRUE:
 		  (res->set[n].align->state!=j||
 		   res->set[n].align->node!=node)) {
-		align=NewNRefAlign(node,j,
+		align=NewNRefAlign(pri,node,j,
 				   res->tok.like-outp-res->tok.lm*pri->scale,
 				   pri->frame-1,res->set[n].align);
 		res->set[n].align=align;
@@ -722,7 +846,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
    
    /* Null entry state ready for external propagation */
    /*  And copy tokens from buffer to instance */
-   for (i=1,res=pri->psi->sBuf+1,cur=inst->state;
+   for (i=1,res=pri->sBuf+1,cur=inst->state;
         i<N;i++,res++,cur++) {
       cur->n=res->n; cur->tok=res->tok; 
       for (k=0;k<res->n;k++) cur->set[k]=res->set[k];
@@ -756,7 +880,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
             res->tok=cmp.tok;
       }
       else 
-         TokSetMerge(res,&cmp.tok,cur);
+         TokSetMerge(pri,res,&cmp.tok,cur);
    }
    if (res->tok.like>LSMALL){
       tok.like=res->tok.like+inst->wdlk;
@@ -765,7 +889,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
          pri->wordMaxNode=node;
       }
       if (!node_tr0(node) && pri->models) {
-         align=NewNRefAlign(node,-1,
+         align=NewNRefAlign(pri,node,-1,
                             res->tok.like-res->tok.lm*pri->scale,
                             pri->frame,res->tok.align);
          res->tok.align=align;
@@ -773,7 +897,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
 	 if (pri->nToks>1)
            res->set[0].align=align;
          for (n=1;n<res->n;n++) {
-           align=NewNRefAlign(node,-1,
+           align=NewNRefAlign(pri,node,-1,
                               res->tok.like-res->tok.lm*pri->scale,
                               pri->frame,res->set[n].align);
            res->set[n].align=align;
@@ -787,7 +911,7 @@ static void StepHMM1(NetNode *node) /* Model internal propagation NBEST */
 }
 
 /* Tee transition propagation - may be repeated */
-static void StepHMM2(NetNode *node) 
+static void StepHMM2(PRecInfo *pri,NetNode *node) 
 {
    NetInst *inst;
    HMMDef *hmm;
@@ -814,10 +938,10 @@ static void StepHMM2(NetNode *node)
          res->tok=cmp.tok;
    }
    else 
-      TokSetMerge(res,&cmp.tok,cur);
+      TokSetMerge(pri,res,&cmp.tok,cur);
 
    if (pri->models) {
-      align=NewNRefAlign(node,-1,
+      align=NewNRefAlign(pri,node,-1,
                          res->tok.like-res->tok.lm*pri->scale,
                          pri->frame,res->tok.align);
       res->tok.align=align;
@@ -825,7 +949,7 @@ static void StepHMM2(NetNode *node)
       if (pri->nToks>1)
         res->set[0].align=align;
       for (n=1;n<res->n;n++) {
-        align=NewNRefAlign(node,-1,
+        align=NewNRefAlign(pri,node,-1,
                            res->tok.like-res->tok.lm*pri->scale,
                            pri->frame,res->set[n].align);
         res->set[n].align=align;
@@ -834,7 +958,7 @@ static void StepHMM2(NetNode *node)
    }
 }
 
-static Path *NewNRefPath(void)
+static Path *NewNRefPath(PRecInfo *pri)
 {
    Path *path;
 
@@ -851,7 +975,7 @@ static Path *NewNRefPath(void)
    return(path);
 }
 
-static void MovePathYesRef(Path *path)
+static void MovePathYesRef(PRecInfo *pri,Path *path)
 {
    path->link->knil=path->knil;
    path->knil->link=path->link;
@@ -860,10 +984,10 @@ static void MovePathYesRef(Path *path)
    path->link->knil=path->knil->link=path;
 }
 
-static void RefPath(Path *path)
+static void RefPath(PRecInfo *pri,Path *path)
 {
    if (path->usage==0) {
-      MovePathYesRef(path);
+      MovePathYesRef(pri,path);
 #ifdef SANITY
       pri->pnlen--;pri->pylen++;
 #endif
@@ -871,7 +995,7 @@ static void RefPath(Path *path)
    path->usage++;
 }
    
-static void DeRefPathPrev(Path *path)
+static void DeRefPathPrev(PRecInfo *pri,Path *path)
 {
    Path *pth;
    NxtPath tmp,*cur;
@@ -899,7 +1023,7 @@ static void DeRefPathPrev(Path *path)
    }
 }
    
-static void UnlinkPath(Path *path)
+static void UnlinkPath(PRecInfo *pri,Path *path)
 {
    NxtPath *pth,*nth;
 
@@ -921,7 +1045,7 @@ static void UnlinkPath(Path *path)
    pri->npth--;
 }
 
-static void CollectPaths(void)
+static void CollectPaths(PRecInfo *pri)
 {
    NetInst *inst;
    TokenSet *cur;
@@ -938,7 +1062,7 @@ static void CollectPaths(void)
          for (i=1,cur=inst->state;i<=n;i++,cur++) {
             path=cur->tok.path;
             if (path && !path->used) {
-               if (path->usage!=0) MovePathYesRef(path);
+               if (path->usage!=0) MovePathYesRef(pri,path);
                path->used=TRUE;
             }
 #ifdef SANITY
@@ -948,26 +1072,26 @@ static void CollectPaths(void)
             for (k=1;k<cur->n;k++) {
                path=cur->set[k].path;
                if (path && !path->used) {
-                  if (path->usage!=0) MovePathYesRef(path);
+                  if (path->usage!=0) MovePathYesRef(pri,path);
                   path->used=TRUE;
                }
 #ifdef PHNALG
 	       align=cur->set[k].align;
                if (align && !align->used) {
-                 if (align->usage!=0) MoveAlignYesRef(align);
+                 if (align->usage!=0) MoveAlignYesRef(pri,align);
 		 align->used=TRUE;
                }
 #endif
             }
             align=cur->tok.align;
             if (align && !align->used) {
-               if (align->usage!=0) MoveAlignYesRef(align);
+               if (align->usage!=0) MoveAlignYesRef(pri,align);
                align->used=TRUE;
             }
          }
          path=inst->exit->tok.path;
          if (path && !path->used) {
-            if (path->usage!=0) MovePathYesRef(path);
+            if (path->usage!=0) MovePathYesRef(pri,path);
             path->used=TRUE;
          }
 #ifdef SANITY
@@ -978,20 +1102,20 @@ static void CollectPaths(void)
          for (k=1;k<inst->exit->n;k++) {
             path=inst->exit->set[k].path;
             if (path && !path->used) {
-               if (path->usage!=0) MovePathYesRef(path);
+               if (path->usage!=0) MovePathYesRef(pri,path);
                path->used=TRUE;
             }
 #ifdef PHNALG
 	    align=inst->exit->set[k].align;
             if (align && !align->used) {
-	      if (align->usage!=0) MoveAlignYesRef(align);
+	      if (align->usage!=0) MoveAlignYesRef(pri,align);
 	      align->used=TRUE;
             }
 #endif
          }
          align=inst->exit->tok.align;
          if (align && !align->used) {
-            if (align->usage!=0) MoveAlignYesRef(align);
+            if (align->usage!=0) MoveAlignYesRef(pri,align);
             align->used=TRUE;
          }
       }
@@ -999,10 +1123,10 @@ static void CollectPaths(void)
    for (path=pri->pNoRef.link;path->link!=NULL;path=plink) {
       if (!path->used) {
          if (path->align!=NULL)
-            DeRefAlign(path->align);
-         DeRefPathPrev(path);
+            DeRefAlign(pri,path->align);
+         DeRefPathPrev(pri,path);
          plink=path->link;
-         UnlinkPath(path);
+         UnlinkPath(pri,path);
       }
       else {
          path->used=FALSE;
@@ -1018,9 +1142,9 @@ static void CollectPaths(void)
    for (align=pri->aNoRef.link;align->link!=NULL;align=alink) {
       if (!align->used) {
          if (align->prev!=NULL)
-            DeRefAlign(align->prev);
+            DeRefAlign(pri,align->prev);
          alink=align->link;
-         UnlinkAlign(align);
+         UnlinkAlign(pri,align);
       }
       else {
          align->used=FALSE;
@@ -1034,7 +1158,7 @@ static void CollectPaths(void)
    pri->calign=pri->nalign;
 }
 
-static void StepWord1(NetNode *node) /* Just invalidate the tokens */
+static void StepWord1(PRecInfo *pri,NetNode *node) /* Just invalidate the tokens */
 {
    node->inst->state->tok=null_token;
    node->inst->state->n=((pri->nToks>1)?1:0);
@@ -1043,7 +1167,7 @@ static void StepWord1(NetNode *node) /* Just invalidate the tokens */
    node->inst->max=LZERO;
 }
 
-static void StepWord2(NetNode *node) /* Update the path - may be repeated */
+static void StepWord2(PRecInfo *pri,NetNode *node) /* Update the path - may be repeated */
 {
    NetInst *inst;
    Path *newpth,*oldpth;
@@ -1065,21 +1189,21 @@ static void StepWord2(NetNode *node) /* Update the path - may be repeated */
          inst->exit->tok.like+=pri->wordpen;
          inst->exit->tok.like+=node->info.pron->prob*pri->pscale;
       }
-      newpth=NewNRefPath();
+      newpth=NewNRefPath(pri);
       newpth->node=node;
       newpth->usage=0;
       newpth->frame=pri->frame;
       newpth->like=inst->exit->tok.like;
       newpth->lm=inst->exit->tok.lm;
       if ((newpth->align=inst->exit->tok.align)!=NULL)
-         RefAlign(newpth->align);
+         RefAlign(pri,newpth->align);
       inst->exit->tok.path=newpth;
       inst->exit->tok.lm=0.0;
       inst->exit->tok.align=NULL;
       
       oldpth=inst->state->tok.path;
       if ((newpth->prev=oldpth)!=NULL)
-         RefPath(oldpth);
+         RefPath(pri,oldpth);
 
       if (pri->nToks>1) {
          inst->exit->n=1;
@@ -1093,10 +1217,10 @@ static void StepWord2(NetNode *node) /* Update the path - may be repeated */
             rth->like=newpth->like+cur->like;
             rth->lm=cur->lm;
             if ((rth->prev=cur->path)!=NULL)
-               RefPath(cur->path);
+               RefPath(pri,cur->path);
 #ifdef PHNALG
 	    if ((rth->align=cur->align)!=NULL)
-	      RefAlign(cur->align);
+	      RefAlign(pri,cur->align);
 #endif
             for (i=2,cur++;i<inst->state->n;i++,cur++) {
                rth->chain=(NxtPath*) New(&pri->rPthHeap,0);
@@ -1105,10 +1229,10 @@ static void StepWord2(NetNode *node) /* Update the path - may be repeated */
                rth->like=newpth->like+cur->like;
                rth->lm=cur->lm;
                if ((rth->prev=cur->path)!=NULL)
-                  RefPath(cur->path);
+                  RefPath(pri,cur->path);
 #ifdef PHNALG
 	       if ((rth->align=cur->align)!=NULL)
-		 RefAlign(cur->align);
+		 RefAlign(pri,cur->align);
 #endif
             }
          }
@@ -1120,7 +1244,7 @@ static void StepWord2(NetNode *node) /* Update the path - may be repeated */
    }
 }
 
-static void MoveToRecent(NetInst *inst)
+static void MoveToRecent(PRecInfo *pri,NetInst *inst)
 {
    if (inst->node==NULL) return;
 
@@ -1149,7 +1273,7 @@ static void MoveToRecent(NetInst *inst)
 #endif
 }
 
-static void ReOrderList(NetNode *node)
+static void ReOrderList(PRecInfo *pri,NetNode *node)
 {
    NetLink *dest;
    int i;
@@ -1159,16 +1283,16 @@ static void ReOrderList(NetNode *node)
    for (i=0,dest=node->links;i<node->nlinks;i++,dest++) {
       if (!node_tr0(dest->node)) break;
       if (dest->node->inst!=NULL) 
-         MoveToRecent(dest->node->inst);
+         MoveToRecent(pri,dest->node->inst);
    }
    for (i=0,dest=node->links;i<node->nlinks;i++,dest++) {
       if (!node_tr0(dest->node)) break;
       if (dest->node->inst!=NULL)
-         ReOrderList(dest->node);
+         ReOrderList(pri,dest->node);
    }
 }
 
-static LogFloat LikeToWord(NetNode *node)
+static LogFloat LikeToWord(PRecInfo *pri,NetNode *node)
 {
    NetLink *dest;
    HMMDef *hmm;
@@ -1190,14 +1314,14 @@ static LogFloat LikeToWord(NetNode *node)
          hmm=dest->node->info.hmm;
          N=hmm->numStates;
          like+=hmm->transP[1][N];
-         like+=LikeToWord(dest->node);
+         like+=LikeToWord(pri,dest->node);
          if (like>best) best=like;
       }
    }
    return(best);
 }   
 
-static void AttachInst(NetNode *node)
+static void AttachInst(PRecInfo *pri,NetNode *node)
 {
    TokenSet *cur;
    NetInst *inst;
@@ -1249,7 +1373,7 @@ static void AttachInst(NetNode *node)
    node->inst=inst;
 
    if (node_wd0(node))
-      inst->wdlk=LikeToWord(inst->node);
+      inst->wdlk=LikeToWord(pri,inst->node);
    else
       inst->wdlk=LZERO;
 
@@ -1262,10 +1386,10 @@ static void AttachInst(NetNode *node)
    inst->ipos=pri->ipos++;
    pri->start_inst=inst;
 #endif
-   ReOrderList(node);
+   ReOrderList(pri,node);
 }
 
-static void DetachInst(NetNode *node)
+static void DetachInst(PRecInfo *pri,NetNode *node)
 {
    TokenSet *cur;
    NetInst *inst;
@@ -1300,7 +1424,7 @@ static void DetachInst(NetNode *node)
    node->inst=0;
 }
 
-static void SetEntryState(NetNode *node,TokenSet *src)
+static void SetEntryState(PRecInfo *pri,NetNode *node,TokenSet *src)
 {
    NetInst *inst;
    TokenSet *res;
@@ -1311,7 +1435,7 @@ static void SetEntryState(NetNode *node,TokenSet *src)
 #endif
 
    if (node->inst==NULL)
-      AttachInst(node);
+      AttachInst(pri,node);
 
    inst=node->inst;
    res=inst->state;
@@ -1338,7 +1462,7 @@ static void SetEntryState(NetNode *node,TokenSet *src)
          res->tok=src->tok;
    }
    else
-      TokSetMerge(res,&src->tok,src);
+      TokSetMerge(pri,res,&src->tok,src);
    if (res->tok.like>inst->max)
       inst->max=res->tok.like;
    if (node->type==n_word && (pri->wordMaxNode==NULL || 
@@ -1347,17 +1471,17 @@ static void SetEntryState(NetNode *node,TokenSet *src)
       pri->wordMaxNode=node;
 }
 
-static void StepInst1(NetNode *node) /* First pass of token propagation (Internal) */
+static void StepInst1(PRecInfo *pri,NetNode *node) /* First pass of token propagation (Internal) */
 {
    if (node_hmm(node))
-      StepHMM1(node);   /* Advance tokens within HMM instance t => t-1 */
+      StepHMM1(pri,node);   /* Advance tokens within HMM instance t => t-1 */
                         /* Entry tokens valid for t-1, do states 2..N */
    else
-      StepWord1(node);
+      StepWord1(pri,node);
    node->inst->pxd=FALSE;
 }
 
-static void StepInst2(NetNode *node) /* Second pass of token propagation (External) */
+static void StepInst2(PRecInfo *pri,NetNode *node) /* Second pass of token propagation (External) */
      /* Must be able to survive doing this twice !! */
 {
    Token tok;
@@ -1368,9 +1492,9 @@ static void StepInst2(NetNode *node) /* Second pass of token propagation (Extern
    int i,k;
 
    if (node_word(node))
-      StepWord2(node);  /* Merge tokens and update traceback */
+      StepWord2(pri,node);  /* Merge tokens and update traceback */
    else if (node_tr0(node) /* && node_hmm(node) */)
-      StepHMM2(node);   /* Advance tokens within HMM instance t => t-1 */
+      StepHMM2(pri,node);   /* Advance tokens within HMM instance t => t-1 */
                         /* Entry token valid for t, only do state N */
    tok=node->inst->exit->tok;
    xtok.tok=tok;
@@ -1391,7 +1515,7 @@ static void StepInst2(NetNode *node) /* Second pass of token propagation (Extern
          for (k=0;k<xtok.n;k++)
             xtok.set[k].lm=node->inst->exit->set[k].lm+lm;
          if (xtok.tok.like>pri->genThresh) {
-            SetEntryState(dest->node,&xtok);
+            SetEntryState(pri,dest->node,&xtok);
             /* Transfer set of tokens to node, activating when necessary */
             /* choosing N most likely after adding transition likelihood */
          }
@@ -1431,16 +1555,14 @@ static void CreateSEIndex(PSetInfo *psi,HLink hmm)
    }
 }
 
-/* Prepare HMMSet for recognition.  Allocates seIndex and preComp from */
-/*  hmmset heap.*/
+/* Prepare HMMSet for recognition.  Allocates seIndex from psi heap, */
+/*  the preComps are private to each recogniser (see InitVRecInfo) */
 PSetInfo *InitPSetInfo(HMMSet *hset)
 {
    PSetInfo *psi;
-   RelToken *rtoks;
    int n,h,i;
    HLink hmm;
    MLink q;
-   PreComp *pre;
    char name[80];
    static int psid=0;
 
@@ -1451,19 +1573,6 @@ PSetInfo *InitPSetInfo(HMMSet *hset)
 
    psi->max=MaxStatesInSet(hset)-1;
 
-   psi->tBuf=(Token*) New(&psi->heap,(psi->max-1)*sizeof(Token));
-   psi->tBuf-=2;
-
-   psi->sBuf=(TokenSet*) New(&psi->heap,psi->max*sizeof(TokenSet));
-   rtoks=(RelToken*) New(&psi->heap,psi->max*sizeof(RelToken)*MAX_TOKS);
-   psi->sBuf-=1;
-   for (i=0; i<psi->max; i++) {
-      psi->sBuf[i+1].set=rtoks;rtoks+=MAX_TOKS;
-      psi->sBuf[i+1].tok=null_token;
-      psi->sBuf[i+1].n=0;
-      psi->sBuf[i+1].set[0]=rmax;
-   }
-
    psi->stHeapIdx=(short*) New(&psi->heap,(psi->max+1)*sizeof(short));
    for (i=0; i<=psi->max; i++) psi->stHeapIdx[i]=-1;
    psi->stHeapIdx[1]=0; /* For one state word end models */
@@ -1482,18 +1591,10 @@ PSetInfo *InitPSetInfo(HMMSet *hset)
          }
       }
    psi->nsp=hset->numStates;
-   psi->sPre=(PreComp*) New(&psi->heap, sizeof(PreComp)*psi->nsp);
-   psi->sPre--;
-   for(i=1,pre=psi->sPre+1;i<=psi->nsp;i++,pre++) pre->id=-1;
-   if (hset->numSharedMix>0) {
-      psi->mixShared=TRUE;
-      psi->nmp=hset->numSharedMix;
-      psi->mPre=(PreComp*) New(&psi->heap, sizeof(PreComp)*psi->nmp);
-      psi->mPre--;
-      for(i=1,pre=psi->mPre+1;i<=psi->nmp;i++,pre++) pre->id=-1;
-   }
+   if (hset->numSharedMix>0)
+      psi->mixShared=TRUE,psi->nmp=hset->numSharedMix;
    else
-      psi->mixShared=FALSE,psi->nmp=0,psi->mPre=NULL;
+      psi->mixShared=FALSE,psi->nmp=0;
 
    for (n=1,i=0;n<=psi->max;n++)
       if (psi->stHeapIdx[n]>=0)
@@ -1509,7 +1610,7 @@ void FreePSetInfo(PSetInfo *psi)
    Dispose(&gcheap,psi);
 }
 
-static void LatFromPaths(Path *path,int *ln,Lattice *lat)
+static void LatFromPaths(PRecInfo *pri,Path *path,int *ln,Lattice *lat)
 {
    LNode *ne,*ns;
    LArc *la;
@@ -1572,7 +1673,7 @@ static void LatFromPaths(Path *path,int *ln,Lattice *lat)
       ns->foll=ne->pred=la;
       
       if (pth->prev!=NULL && ns->word==NULL)
-         LatFromPaths(pth->prev,ln,lat);
+         LatFromPaths(pri,pth->prev,ln,lat);
 #ifdef PHNALG
       align=pth->align;
 #endif
@@ -1676,7 +1777,7 @@ static void MarkPaths(Path *path,int *nn,int *nl)
    }
 }
 
-static Lattice *CreateLattice(MemHeap *heap,TokenSet *res,HTime framedur)
+static Lattice *CreateLattice(PRecInfo *pri,MemHeap *heap,TokenSet *res,HTime framedur)
 {
    Lattice *lat;
    RelToken *cur;
@@ -1728,7 +1829,7 @@ static Lattice *CreateLattice(MemHeap *heap,TokenSet *res,HTime framedur)
    lat->lnodes[0].tag=NULL;
    lat->lnodes[0].score=0.0;
 
-   LatFromPaths(&path,&ln,lat);
+   LatFromPaths(pri,&path,&ln,lat);
 
 #ifdef SANITY
    if (ln!=nl)
@@ -1738,6 +1839,323 @@ static Lattice *CreateLattice(MemHeap *heap,TokenSet *res,HTime framedur)
    return(lat);
 }
 
+/* ---------------------- Linear Alignment ---------------------- */
+
+/* Carry tok, the exit token of node, along the links of a chain 
+   network to the entry state of the next HMM or to the final node,
+   as StepInst2 and StepWord2 would.  Returns FALSE if tok is pruned.
+   When mk is TRUE the path records of words passed are created and
+   no pruning is done (the token is known to have survived) */
+static Boolean LinCross(PRecInfo *pri,NetNode *node,Token *tok,Boolean mk)
+{
+   Path *newpth;
+   LogFloat lm;
+
+   for (;;) {
+      if (node_word(node)) {
+         if (node->info.pron!=NULL || node->tag!=NULL) {
+            if (node->info.pron!=NULL) {
+               tok->like+=pri->wordpen;
+               tok->like+=node->info.pron->prob*pri->pscale;
+            }
+            if (mk) {
+               newpth=NewNRefPath(pri);
+               newpth->node=node;
+               newpth->usage=0;
+               newpth->frame=pri->frame;
+               newpth->like=tok->like;
+               newpth->lm=tok->lm;
+               if ((newpth->align=tok->align)!=NULL)
+                  RefAlign(pri,newpth->align);
+               if ((newpth->prev=tok->path)!=NULL)
+                  RefPath(pri,tok->path);
+               newpth->chain=NULL;
+               tok->path=newpth;
+               tok->align=NULL;
+            }
+            tok->lm=0.0;
+         }
+         if (node==&pri->net->final) return(TRUE);
+         if (!mk && tok->like<pri->wordThresh) return(FALSE);
+      }
+      if (!mk && !(tok->like>pri->genThresh)) return(FALSE);
+      lm=node->links[0].like;
+      tok->like=tok->like+lm*pri->scale;
+      tok->lm=tok->lm+lm;
+      if (!mk && !(tok->like>pri->genThresh)) return(FALSE);
+      node=node->links[0].node;
+      if (node_hmm(node)) return(TRUE);
+   }
+}
+
+/* Allocate the record for frame t covering models lo..hi */
+static LinFrame *NewLinFrame(PRecInfo *pri,int t,int lo,int hi)
+{
+   LinFrame *fr,*lfr;
+   LinModel *m;
+   int i;
+
+   if (t>=pri->nlfr) {
+      lfr=(LinFrame*) New(&pri->linHeap,2*pri->nlfr*sizeof(LinFrame));
+      for (i=0;i<pri->nlfr;i++) lfr[i]=pri->lfr[i];
+      pri->lfr=lfr; pri->nlfr*=2;
+   }
+   fr=pri->lfr+t;
+   fr->lo=lo; fr->hi=hi;
+   if (hi<pri->nlmod-1) hi++;   /* Room for new entry token */
+   if (lo>hi) lo=hi;
+   m=pri->lmod+hi;
+   fr->off=pri->lmod[lo].base; fr->n=m->base+m->N-fr->off;
+   fr->like=(LogDouble*) New(&pri->linHeap,fr->n*sizeof(LogDouble));
+   fr->outp=(LogFloat*) New(&pri->linHeap,fr->n*sizeof(LogFloat));
+   fr->bp=(int*) New(&pri->linHeap,fr->n*sizeof(int));
+   for (i=0;i<fr->n;i++) {
+      fr->like[i]=LZERO; fr->outp[i]=0.0; fr->bp[i]=-1;
+   }
+   return(fr);
+}
+
+/* Set up linear alignment if pri->net is a chain of non-tee HMMs and
+   word nodes, returning FALSE if it is not */
+static Boolean StartLinear(PRecInfo *pri)
+{
+   NetNode *node;
+   LinModel *m;
+   LinFrame *fr;
+   Token tok;
+   LogFloat lm;
+   int n,steps;
+
+   n=steps=0;
+   for (node=&pri->net->initial;node!=&pri->net->final;
+        node=node->links[0].node) {
+      if (node->nlinks!=1 || ++steps>pri->net->numNode+2) return(FALSE);
+      if (node_hmm(node)) {
+         if (node_tr0(node)) return(FALSE);
+         n++;
+      }
+      else if (!node_word(node)) return(FALSE);
+   }
+   if (n==0) return(FALSE);
+
+   pri->nlmod=n;
+   pri->lmod=(LinModel*) New(&pri->linHeap,n*sizeof(LinModel));
+   lm=0.0; n=0;
+   for (node=&pri->net->initial,m=pri->lmod;node!=&pri->net->final;
+        node=node->links[0].node) {
+      if (node_hmm(node)) {
+         m->node=node;
+         m->N=node->info.hmm->numStates;
+         m->base=(n==0)?0:m[-1].base+m[-1].N;
+         m->lm=lm;
+         m->wdlk=node_wd0(node)?LikeToWord(pri,node):LZERO;
+         m++; n++;
+      }
+      else if (node->info.pron!=NULL || node->tag!=NULL)
+         lm=0.0;
+      lm=lm+node->links[0].like;
+   }
+   pri->nlfr=256;
+   pri->lfr=(LinFrame*) New(&pri->linHeap,pri->nlfr*sizeof(LinFrame));
+
+   /* Frame 0 just holds the initial token entering the first model */
+   tok=null_token; tok.like=0.0; tok.lm=0.0;
+   fr=NewLinFrame(pri,0,0,0);
+   if (LinCross(pri,&pri->net->initial,&tok,FALSE))
+      fr->like[0]=tok.like;
+   else
+      fr->hi=-1;
+   pri->nact=fr->hi-fr->lo+1;
+   pri->linFinal=FALSE; pri->linMax=-1;
+   return(TRUE);
+}
+
+/* Linear equivalent of passes 1 and 2 of ProcessObservation.  Each
+   state is scored when it survives state pruning, the exit of each
+   model is found and then passed on to the entry of the next.  The
+   arithmetic and pruning is identical to token passing so exactly the
+   same best path is found */
+static void StepLinear(PRecInfo *pri,VRecInfo *vri)
+{
+   LinFrame *pr,*fr;
+   LinModel *m;
+   HMMDef *hmm;
+   StateInfo *si;
+   Matrix trP;
+   short **seIndex;
+   Token tok;
+   LogDouble best,x,mmax,wmax;
+   LogFloat outp;
+   int i,j,k,b,bi,endi,N,lo,hi,nxt;
+   Boolean live;
+
+   pr=pri->lfr+pri->frame-1;
+   fr=NewLinFrame(pri,pri->frame,pr->lo,pr->hi);
+   pri->genMaxTok=pri->wordMaxTok=null_token;
+   pri->genMaxNode=pri->wordMaxNode=NULL;
+   pri->linMax=-1; pri->linFinal=FALSE;
+   wmax=LZERO;
+
+   /* Internal propagation and scoring as StepHMM1 */
+#define PL(p) (((p)>=pr->off && (p)<pr->off+pr->n)?pr->like[(p)-pr->off]:LZERO)
+   for (k=pr->lo,m=pri->lmod+k;k<=pr->hi;k++,m++) {
+      hmm=m->node->info.hmm; N=m->N; b=m->base-fr->off;
+      trP=hmm->transP;
+      seIndex=pri->psi->seIndexes[hmm->tIdx];
+      mmax=LZERO;
+      for (j=2;j<N;j++) {
+         i=seIndex[j][0]; endi=seIndex[j][1];
+         bi=m->base+i-1; best=PL(bi); best+=trP[i][j];
+         for (i++;i<=endi;i++) {
+            x=PL(m->base+i-1); x+=trP[i][j];
+            if (x>best) best=x,bi=m->base+i-1;
+         }
+         if (best>pri->genThresh) {
+            si=hmm->svec[j].info;
+            if (pri->sId[si->sIdx]!=pri->id) {
+               pri->sOutp[si->sIdx]=StateOutP(pri,pri->obs,si,pri->id);
+               pri->sId[si->sIdx]=pri->id;
+            }
+            outp=pri->sOutp[si->sIdx];
+            best+=outp;
+            fr->like[b+j-1]=best; fr->outp[b+j-1]=outp; fr->bp[b+j-1]=bi;
+            if (best>mmax) {
+               mmax=best;
+               if (best>pri->genMaxTok.like) 
+                  pri->linMax=fr->off+b+j-1;
+            }
+         }
+      }
+      if (mmax>pri->genMaxTok.like) {
+         pri->genMaxTok.like=mmax;
+         pri->genMaxNode=m->node;
+      }
+      i=seIndex[N][0]; endi=seIndex[N][1];
+      bi=b+i-1; best=fr->like[bi]; best+=trP[i][N];
+      for (i++;i<=endi;i++) {
+         x=fr->like[b+i-1]; x+=trP[i][N];
+         if (x>best) best=x,bi=b+i-1;
+      }
+      if (best>LSMALL) {
+         fr->like[b+N-1]=best; fr->bp[b+N-1]=fr->off+bi;
+         x=best+m->wdlk;
+         if (x>wmax) {
+            wmax=x;
+            pri->wordMaxNode=m->node;
+         }
+      }
+   }
+#undef PL
+   pri->wordMaxTok.like=wmax;
+
+   pri->wordThresh=pri->wordMaxTok.like-vri->wordBeam;
+   if (pri->wordThresh<LSMALL) pri->wordThresh=LSMALL;
+   pri->genThresh=pri->genMaxTok.like-vri->genBeam;
+   if (pri->genThresh<LSMALL) pri->genThresh=LSMALL;
+
+   /* External propagation as StepInst2 */
+   nxt=-1;
+   for (k=pr->lo,m=pri->lmod+k;k<=pr->hi;k++,m++) {
+      b=m->base+m->N-1-fr->off;
+      if (fr->like[b]<=pri->genThresh) continue;
+      tok=null_token; tok.like=fr->like[b]; tok.lm=m->lm;
+      if (!LinCross(pri,m->node,&tok,FALSE)) continue;
+      if (k==pri->nlmod-1)
+         pri->linFinal=TRUE;
+      else {
+         fr->like[b+1]=tok.like; fr->bp[b+1]=fr->off+b;
+         nxt=k+1;
+      }
+   }
+
+   /* Trim the range to models that can still be reached */
+   lo=pr->lo; hi=(nxt>pr->hi)?nxt:pr->hi;
+   for (;lo<=hi;lo++) {
+      m=pri->lmod+lo; b=m->base-fr->off;
+      for (j=0,live=FALSE;j<m->N-1 && !live;j++) 
+         live=(fr->like[b+j]>pri->genThresh);
+      if (live) break;
+   }
+   for (;hi>=lo;hi--) {
+      m=pri->lmod+hi; b=m->base-fr->off;
+      for (j=0,live=FALSE;j<m->N-1 && !live;j++) 
+         live=(fr->like[b+j]>pri->genThresh);
+      if (live) break;
+   }
+   fr->lo=lo; fr->hi=hi;
+   pri->nact=hi-lo+1;
+}
+
+/* Find the model holding position pos */
+static LinModel *LinModelAt(PRecInfo *pri,int pos)
+{
+   int lo,hi,k;
+
+   lo=0; hi=pri->nlmod-1;
+   while (lo<hi) {
+      k=(lo+hi+1)/2;
+      if (pri->lmod[k].base<=pos) lo=k;
+      else hi=k-1;
+   }
+   return(pri->lmod+lo);
+}
+
+/* Trace back from position pos at the last frame, recreating the path
+   and align records token passing would have left on the best path,
+   and return its token */
+static Token LinTraceBack(PRecInfo *pri,int pos)
+{
+   LinFrame *fr;
+   LinModel *m;
+   Token tok;
+   int *fp,*pp,t,n,i,j,T;
+
+   /* Collect frames and positions visited, entry and exit positions
+      are reached in the same frame as the position before them */
+   T=pri->frame;
+   for (n=0,t=T,j=pos;j>=0;n++) {
+      fr=pri->lfr+t; m=LinModelAt(pri,j);
+      i=fr->bp[j-fr->off];
+      if (j!=m->base && j!=m->base+m->N-1) t--;
+      j=i;
+   }
+   fp=(int*) New(&gstack,2*n*sizeof(int)); pp=fp+n;
+   for (i=n-1,t=T,j=pos;i>=0;i--) {
+      fp[i]=t; pp[i]=j;
+      fr=pri->lfr+t; m=LinModelAt(pri,j);
+      j=fr->bp[j-fr->off];
+      if (pp[i]!=m->base && pp[i]!=m->base+m->N-1) t--;
+   }
+
+   /* Replay forwards from the initial node */
+   pri->frame=0;
+   tok=null_token; tok.like=0.0; tok.lm=0.0;
+   LinCross(pri,&pri->net->initial,&tok,TRUE);
+   for (i=0;i<n;i++) {
+      t=fp[i]; j=pp[i];
+      fr=pri->lfr+t; m=LinModelAt(pri,j);
+      if (j==m->base) continue;             /* Entry, set by crossing */
+      tok.like=fr->like[j-fr->off];
+      if (j==m->base+m->N-1) {              /* Exit, as StepHMM1 */
+         if (pri->models)
+            tok.align=NewNRefAlign(pri,m->node,-1,
+                                   tok.like-tok.lm*pri->scale,
+                                   t,tok.align);
+         pri->frame=t;
+         LinCross(pri,m->node,&tok,TRUE);
+      }
+      else if (pri->states && 
+               (tok.align==NULL?TRUE:
+                tok.align->state!=j-m->base+1 || tok.align->node!=m->node))
+         tok.align=NewNRefAlign(pri,m->node,j-m->base+1,
+                                tok.like-fr->outp[j-fr->off]-tok.lm*pri->scale,
+                                t-1,tok.align);
+   }
+   pri->frame=T;
+   Dispose(&gstack,fp);
+   return(tok);
+}
+
 static void qcksrtM(float *array,int l,int r,int M)
 {
    int i,j;
@@ -1761,7 +2179,9 @@ static void qcksrtM(float *array,int l,int r,int M)
 VRecInfo *InitVRecInfo(PSetInfo *psi,int nToks,Boolean models,Boolean states)
 {
    VRecInfo *vri;
+   PRecInfo *pri;
    PreComp *pre;
+   RelToken *rtoks;
    int i,n;
    char name[80];
    static int prid=0;
@@ -1789,11 +2209,15 @@ VRecInfo *InitVRecInfo(PSetInfo *psi,int nToks,Boolean models,Boolean states)
    vri->tmBeam=LZERO;
    vri->pCollThresh=1024;
    vri->aCollThresh=1024;
+   vri->linear=FALSE;
 
    /* Set up private parameters */
    pri->qsn=0;pri->qsa=NULL;
    pri->psi=NULL;
    pri->net=NULL;
+   pri->obsBlk=NULL;pri->nBlk=0;
+   pri->sview=NULL;
+   pri->inXForm=NULL;
    pri->scale=1.0;
    pri->wordpen=0.0;
 
@@ -1805,11 +2229,38 @@ VRecInfo *InitVRecInfo(PSetInfo *psi,int nToks,Boolean models,Boolean states)
 
    /* SetUp heaps for recognition */
 
-   /* Model set dependent */
+   /* Model set dependent, private so that recognisers sharing psi */
+   /*  can run in different threads */
    pri->psi=psi;
-   /* pri->psi->sBuf[1].n=((pri->nToks>1)?1:0);  Needed every observation */
-   for(i=1,pre=psi->sPre+1;i<=psi->nsp;i++,pre++) pre->id=-1;
-   for(i=1,pre=psi->mPre+1;i<=psi->nmp;i++,pre++) pre->id=-1;
+   pri->sc=CreateScoreContext(&vri->heap,psi->hset);
+   if (!psi->mixShared)
+      GetScoreView(psi->hset); /* Build now rather than in a thread */
+
+   pri->sBuf=(TokenSet*) New(&vri->heap,psi->max*sizeof(TokenSet));
+   rtoks=(RelToken*) New(&vri->heap,psi->max*sizeof(RelToken)*MAX_TOKS);
+   pri->sBuf-=1;
+   for (i=0; i<psi->max; i++) {
+      pri->sBuf[i+1].set=rtoks;rtoks+=MAX_TOKS;
+      pri->sBuf[i+1].tok=null_token;
+      pri->sBuf[i+1].n=0;
+      pri->sBuf[i+1].set[0]=rmax;
+   }
+   /* pri->sBuf[1].n=((pri->nToks>1)?1:0);  Needed every observation */
+
+   pri->sOutp=(LogFloat*) New(&vri->heap, sizeof(LogFloat)*psi->nsp);
+   pri->sOutp--;
+   pri->sId=(int*) New(&vri->heap, sizeof(int)*psi->nsp);
+   pri->sId--;
+   for(i=1;i<=psi->nsp;i++) pri->sId[i]=-1;
+   pri->sAct=(StateInfo**) New(&vri->heap, sizeof(StateInfo*)*psi->nsp);
+   if (psi->nmp>0) {
+      pri->mPre=(PreComp*) New(&vri->heap, sizeof(PreComp)*psi->nmp);
+      pri->mPre--;
+      for(i=1,pre=pri->mPre+1;i<=psi->nmp;i++,pre++) pre->id=-1;
+   }
+   else
+      pri->mPre=NULL;
+   pri->sBlk=NULL;
 
    pri->stHeap=(MemHeap *) New(&vri->heap,pri->psi->stHeapNum*sizeof(MemHeap));
    for (n=1;n<=pri->psi->max;n++) {
@@ -1833,6 +2284,9 @@ VRecInfo *InitVRecInfo(PSetInfo *psi,int nToks,Boolean models,Boolean states)
               MHEAP,sizeof(Path),1.0,200,1600);
    CreateHeap(&pri->alignHeap,"Align Heap",
               MHEAP,sizeof(Align),1.0,200,3200);
+   CreateHeap(&pri->linHeap,"Linear Align Heap",
+              MSTAK,1,1.0,8000,80000);
+   pri->linear=FALSE;
 
 
    /* Now set up instances */
@@ -1876,6 +2330,7 @@ void DeleteVRecInfo(VRecInfo *vri)
    DeleteHeap(&pri->rPthHeap);
    DeleteHeap(&pri->pathHeap);
    DeleteHeap(&pri->alignHeap);
+   DeleteHeap(&pri->linHeap);
    DeleteHeap(&vri->heap);
    Dispose(&gcheap,vri);
 }
@@ -1884,15 +2339,17 @@ void DeleteVRecInfo(VRecInfo *vri)
 void StartRecognition(VRecInfo *vri,Network *net,
                       float scale,LogFloat wordpen,float pscale)
 {
+   PRecInfo *pri;
    NetNode *node;
    NetInst *inst,*next;
    PreComp *pre;
+   BlkComp *blk;
    int i;
 
    pri=vri->pri;
    if (pri==NULL)
       HError(8570,"StartRecognition: Visible recognition info not initialised");
-   /* pri->psi->sBuf[1].n=((pri->nToks>1)?1:0);  Only needed for Step1 */
+   /* pri->sBuf[1].n=((pri->nToks>1)?1:0);  Only needed for Step1 */
 
    vri->noTokenSurvived=TRUE;
    pri->net=net;
@@ -1903,49 +2360,59 @@ void StartRecognition(VRecInfo *vri,Network *net,
                        
    for (node=pri->net->chain;node!=NULL;node=node->chain) node->inst=NULL;
    pri->net->final.inst=pri->net->initial.inst=NULL;
-   for(i=1,pre=pri->psi->sPre+1;i<=pri->psi->nsp;i++,pre++) pre->id=-1;
-   for(i=1,pre=pri->psi->mPre+1;i<=pri->psi->nmp;i++,pre++) pre->id=-1;
+   for(i=1;i<=pri->psi->nsp;i++) pri->sId[i]=-1;
+   for(i=1,pre=pri->mPre+1;i<=pri->psi->nmp;i++,pre++) pre->id=-1;
+   if (pri->sBlk!=NULL)
+      for(i=1,blk=pri->sBlk+1;i<=pri->psi->nsp;i++,blk++) blk->n=0;
 
    pri->tact=pri->nact=pri->frame=0;
 
-   AttachInst(&pri->net->initial);
+   vri->genMaxNode=vri->wordMaxNode=NULL;
+   vri->genMaxTok=vri->wordMaxTok=null_token;
+   pri->wordThresh=pri->genThresh=pri->nThresh=LSMALL;
+   pri->genMaxNode=pri->wordMaxNode=NULL;
+   pri->genMaxTok=pri->wordMaxTok=null_token;
+
+   /* Chain networks can be aligned without token passing */
+   if (vri->linear && pri->nToks==0 && StartLinear(pri)) {
+      pri->linear=TRUE;
+      return;
+   }
+
+   AttachInst(pri,&pri->net->initial);
    inst=pri->net->initial.inst;
    inst->state->tok.like=inst->max=0.0;
    inst->state->tok.lm=0.0;
    inst->state->tok.path=NULL;
    inst->state->n=((pri->nToks>1)?1:0);
 
-   vri->genMaxNode=vri->wordMaxNode=NULL;
-   vri->genMaxTok=vri->wordMaxTok=null_token;
-   pri->wordThresh=pri->genThresh=pri->nThresh=LSMALL;
-   pri->genMaxNode=pri->wordMaxNode=NULL;
-   pri->genMaxTok=pri->wordMaxTok=null_token;
    for (inst=pri->head.link;inst!=NULL && inst->node!=NULL;inst=next)
       if (inst->max<pri->genThresh) {
          next=inst->link;
-         DetachInst(inst->node);
+         DetachInst(pri,inst->node);
       }
       else {
          pri->nxtInst=inst;
-         StepInst2(inst->node);
+         StepInst2(pri,inst->node);
          next=pri->nxtInst->link;
       }
 }
 
 void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform)
 {
+   PRecInfo *pri;
    NetInst *inst,*next;
    int j;
    float thresh;
 
    pri=vri->pri;
-   inXForm = xform; /* sepcifies the transform to use for this observation */
    if (pri==NULL)
       HError(8570,"ProcessObservation: Visible recognition info not initialised");
    if (pri->net==NULL)
       HError(8570,"ProcessObservation: Recognition not started");
+   pri->inXForm = xform; /* sepcifies the transform to use for this observation */
 
-   pri->psi->sBuf[1].n=((pri->nToks>1)?1:0); /* Needed every observation */
+   pri->sBuf[1].n=((pri->nToks>1)?1:0); /* Needed every observation */
    pri->frame++;
    pri->obs=obs;
    if (id<0) pri->id=(pri->prid<<20)+pri->frame;
@@ -1954,7 +2421,11 @@ void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform
    if (obs->swidth[0]!=pri->psi->hset->swidth[0])
       HError(8571,"ProcessObservation: incompatible number of streams (%d vs %d)",
              obs->swidth[0],pri->psi->hset->swidth[0]);
-   if (pri->psi->mixShared)
+   /* Score through the view of the set unless shared mixtures are 
+      cached or components need the input xform */
+   pri->sview=(xform==NULL && !pri->psi->mixShared) ? 
+      GetScoreView(pri->psi->hset) : NULL;
+   if (pri->psi->mixShared || pri->sview!=NULL)
       for (j=1;j<=obs->swidth[0];j++)
          if (VectorSize(obs->fv[j])!=pri->psi->hset->swidth[j])
             HError(8571,"ProcessObservatio: incompatible stream widths for %d (%d vs %d)",
@@ -1963,7 +2434,7 @@ void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform
 
    /* Max model pruning is done initially in a separate pass */
 
-   if (vri->maxBeam>0 && pri->nact>vri->maxBeam) {
+   if (vri->maxBeam>0 && pri->nact>vri->maxBeam && !pri->linear) {
       if (pri->nact>pri->qsn) {
          if (pri->qsn>0)
             Dispose(&vri->heap,pri->qsa);
@@ -1979,45 +2450,53 @@ void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform
             for (inst=pri->head.link;inst->link!=NULL;inst=next) {
                next=inst->link;
                if (inst->max<thresh) 
-                  DetachInst(inst->node);
+                  DetachInst(pri,inst->node);
             }
       }
    }   
    if (pri->psi->hset->hsKind==TIEDHS)
-      PrecomputeTMix(pri->psi->hset,obs,vri->tmBeam,0);
-   /* Pass 1 must calculate top of all beams - inc word end !! */
-   pri->genMaxTok=pri->wordMaxTok=null_token;
-   pri->genMaxNode=pri->wordMaxNode=NULL;
-   for (inst=pri->head.link,j=0;inst!=NULL;inst=inst->link,j++)
-      if (inst->node)
-         StepInst1(inst->node);
+      CtxPrecomputeTMix(pri->sc,obs,vri->tmBeam,0);
+   else if (pri->psi->hset->gsel!=NULL)
+      GSelObservation(pri->psi->hset,obs);
+   if (pri->linear)
+      StepLinear(pri,vri);
+   else {
+      /* Score states for pass 1 before any tokens are propagated */
+      ScoreActiveStates(pri);
+      /* Pass 1 must calculate top of all beams - inc word end !! */
+      pri->genMaxTok=pri->wordMaxTok=null_token;
+      pri->genMaxNode=pri->wordMaxNode=NULL;
+      for (inst=pri->head.link,j=0;inst!=NULL;inst=inst->link,j++)
+         if (inst->node)
+            StepInst1(pri,inst->node);
    
-   /* Not changing beam width for max model pruning */
+      /* Not changing beam width for max model pruning */
    
-   pri->wordThresh=pri->wordMaxTok.like-vri->wordBeam;
-   if (pri->wordThresh<LSMALL) pri->wordThresh=LSMALL;
-   pri->genThresh=pri->genMaxTok.like-vri->genBeam;
-   if (pri->genThresh<LSMALL) pri->genThresh=LSMALL;
-   if (pri->nToks>1) {
-      pri->nThresh=pri->genMaxTok.like-vri->nBeam;
-      if (pri->nThresh<LSMALL/2) pri->nThresh=LSMALL/2;
-   }
-   
-   /* Pass 2 Performs external token propagation and pruning */
-   for (inst=pri->head.link,j=0;inst!=NULL && inst->node!=NULL;inst=next,j++)
-      if (inst->max<pri->genThresh) {
-         next=inst->link;
-         DetachInst(inst->node);
-      }
-      else {
-         pri->nxtInst=inst;
-         StepInst2(inst->node);
-         next=pri->nxtInst->link;
+      pri->wordThresh=pri->wordMaxTok.like-vri->wordBeam;
+      if (pri->wordThresh<LSMALL) pri->wordThresh=LSMALL;
+      pri->genThresh=pri->genMaxTok.like-vri->genBeam;
+      if (pri->genThresh<LSMALL) pri->genThresh=LSMALL;
+      if (pri->nToks>1) {
+         pri->nThresh=pri->genMaxTok.like-vri->nBeam;
+         if (pri->nThresh<LSMALL/2) pri->nThresh=LSMALL/2;
       }
    
-   if ((pri->npth-pri->cpth) > vri->pCollThresh || 
-       (pri->nalign-pri->calign) > vri->aCollThresh)
-      CollectPaths();
+      /* Pass 2 Performs external token propagation and pruning */
+      for (inst=pri->head.link,j=0;inst!=NULL && inst->node!=NULL;inst=next,j++)
+         if (inst->max<pri->genThresh) {
+            next=inst->link;
+            DetachInst(pri,inst->node);
+         }
+         else {
+            pri->nxtInst=inst;
+            StepInst2(pri,inst->node);
+            next=pri->nxtInst->link;
+         }
+   
+      if ((pri->npth-pri->cpth) > vri->pCollThresh || 
+          (pri->nalign-pri->calign) > vri->aCollThresh)
+         CollectPaths(pri);
+   }
 
    pri->tact+=pri->nact;
 
@@ -2029,19 +2508,49 @@ void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform
    vri->wordMaxTok=pri->wordMaxTok;
 }
 
+/* EXPORT->ProcessObsBlock: process obs[0] scoring states over obs[0..n-1] */
+void ProcessObsBlock(VRecInfo *vri,Observation **obs,int n, AdaptXForm *xform)
+{
+   PRecInfo *pri;
+   PSetInfo *psi;
+   HSetKind kind;
+   int i;
+
+   pri=vri->pri;
+   if (pri==NULL)
+      HError(8570,"ProcessObsBlock: Visible recognition info not initialised");
+   if (n<1 || n>OUTPBLOCK)
+      HError(8570,"ProcessObsBlock: block size %d not in range 1..%d",
+             n,OUTPBLOCK);
+   psi=pri->psi; kind=psi->hset->hsKind;
+   /* Input xforms, tied mixtures and Gaussian selection need per 
+      frame set up */
+   if (n>1 && xform==NULL && psi->hset->gsel==NULL && 
+       (kind==PLAINHS || kind==SHAREDHS)) {
+      if (pri->sBlk==NULL) {
+         pri->sBlk=(BlkComp*) New(&vri->heap, sizeof(BlkComp)*psi->nsp);
+         pri->sBlk--;
+         for (i=1;i<=psi->nsp;i++) pri->sBlk[i].n=0;
+      }
+      pri->obsBlk=obs; pri->nBlk=n;
+   }
+   ProcessObservation(vri,obs[0],-1,xform);
+   pri->obsBlk=NULL; pri->nBlk=0;
+}
+
 /* EXPORT->TracePath: Summarise word history */
-void TracePath(FILE *file,Path *path)
+void TracePath(FILE *file,VRecInfo *vri,Path *path)
 {
    MLink ml;
    Align *align;
 
    if (path->prev!=NULL)
-      TracePath(file,path->prev);
+      TracePath(file,vri,path->prev);
    fprintf(file,"%s ",path->node->info.pron->word->wordName->name);
    if (path->align!=NULL) {
       fprintf(file,"{");
       for (align=path->align;align!=NULL;align=align->prev) {
-         ml=FindMacroStruct(pri->psi->hset,'h',align->node->info.hmm);
+         ml=FindMacroStruct(vri->pri->psi->hset,'h',align->node->info.hmm);
          if (ml==NULL) fprintf(file," !*!");
          else fprintf(file," %s",ml->id->name);
          if (align->state>0) fprintf(file,"[%d]",align->state);
@@ -2053,10 +2562,12 @@ void TracePath(FILE *file,Path *path)
 /* EXPORT->CompleteRecognition: Free unused data and return traceback */
 Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap)
 {
+   PRecInfo *pri;
    Lattice *lat = NULL;
    NetInst *inst;
    TokenSet dummy;
    RelToken rtok[1];
+   LinModel *m;
    int i;
 
    pri=vri->pri;
@@ -2070,11 +2581,31 @@ Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap)
    vri->frameDur=frameDur;
    
    /* Should delay this until we have freed everything that we can */
-   if (heap!=NULL) {
+   if (heap!=NULL && pri->linear) {
+      lat=NULL;vri->noTokenSurvived=TRUE;
+      if (pri->linFinal) {
+         m=pri->lmod+pri->nlmod-1;
+         dummy.n=0;
+         dummy.tok=LinTraceBack(pri,m->base+m->N-1);
+         if (dummy.tok.path!=NULL)
+            lat=CreateLattice(pri,heap,&dummy,vri->frameDur),
+               vri->noTokenSurvived=FALSE;
+      }
+      if (lat==NULL && forceOutput) {
+         dummy.n=0;
+         dummy.tok=(pri->linMax<0)?null_token:LinTraceBack(pri,pri->linMax);
+         dummy.set=rtok;
+         dummy.set[0].like=0.0;
+         dummy.set[0].path=dummy.tok.path;
+         dummy.set[0].lm=dummy.tok.lm;
+         lat=CreateLattice(pri,heap,&dummy,vri->frameDur);
+      }
+   }
+   else if (heap!=NULL) {
       lat=NULL;vri->noTokenSurvived=TRUE;
       if (pri->net->final.inst!=NULL)
          if (pri->net->final.inst->exit->tok.path!=NULL)
-            lat=CreateLattice(heap,pri->net->final.inst->exit,vri->frameDur),
+            lat=CreateLattice(pri,heap,pri->net->final.inst->exit,vri->frameDur),
                vri->noTokenSurvived=FALSE;
      
       if (lat==NULL && forceOutput) {
@@ -2084,7 +2615,7 @@ Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap)
          dummy.set[0].like=0.0;
          dummy.set[0].path=dummy.tok.path;
          dummy.set[0].lm=dummy.tok.lm;
-         lat=CreateLattice(heap,&dummy,vri->frameDur);
+         lat=CreateLattice(pri,heap,&dummy,vri->frameDur);
       }
    }
 
@@ -2124,6 +2655,8 @@ Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap)
    ResetHeap(&pri->alignHeap);
    ResetHeap(&pri->rPthHeap);
    ResetHeap(&pri->pathHeap);
+   ResetHeap(&pri->linHeap);
+   pri->linear=FALSE;
    
    return(lat);
 }
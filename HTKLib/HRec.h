@@ -104,6 +104,10 @@ struct vrecinfo
    int pCollThresh;         /* Max path records created before collection */
    int aCollThresh;         /* Max align records created before collection */
 
+   /* Options - setable before StartRecognition */
+
+   Boolean linear;          /* Align chain networks by linear Viterbi */
+
    /* Status information - readable every frame */
 
    int frame;               /* Current frame number */
@@ -127,10 +131,14 @@ void InitRec(void);
 /*
    Functions specific to HMMSet
 
-   Providing calls to ProcessObservation are not made simultaneously
-   and that each recogniser's VRecInfo is separately initialised
-   multiple recognisers can share HMMSets.  Use of unique observation 
-   ids allows correct caching of observation output probabilities.
+   Providing that each recogniser's VRecInfo is separately initialised
+   multiple recognisers can share a PSetInfo and its HMMSet.  Each
+   recogniser caches observation output probabilities privately, by
+   unique observation id, so recognisers may run concurrently in
+   different threads (see HThreads) as long as no input xform is in
+   use and the networks, observations and heaps passed to them are
+   distinct.  InitPSetInfo and InitVRecInfo must be called before the
+   threads are started.
 */
 
 PSetInfo *InitPSetInfo(HMMSet *hset);
@@ -175,7 +183,14 @@ void StartRecognition(VRecInfo *vri,Network *net,
                       float scale,LogFloat wordpen,float pscale);
 /*
    Commence recognition using previously initialised recogniser using
-   supplied network and language model scale and word insertion penalty
+   supplied network and language model scale and word insertion penalty.
+   If vri->linear is set, only one token is kept per state and the
+   network is a single chain of word nodes and HMMs without tee
+   transitions (as for forced alignment to a transcription with one
+   pronunciation per word), the utterance is aligned by a Viterbi
+   search over the states of the chain with one backpointer per active
+   state and frame instead of token passing.  The pruning and lattice
+   produced are the same but maxBeam is not applied.
 */
 
 void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform);
@@ -185,6 +200,18 @@ void ProcessObservation(VRecInfo *vri,Observation *obs,int id, AdaptXForm *xform
    provide an id value unique to a particular observation.
 */
 
+void ProcessObsBlock(VRecInfo *vri,Observation **obs,int n, AdaptXForm *xform);
+/*
+   As ProcessObservation for obs[0] with an automatically assigned id,
+   except that obs[1..n-1] must hold the observations of the following
+   frames.  When a state is first needed its output likelihoods for
+   all n frames are computed together with POutPBlock and cached for
+   the subsequent frames.  n must not exceed OUTPBLOCK.  Blocking is
+   only used for PLAINHS/SHAREDHS sets without an input xform or
+   Gaussian selection index, otherwise this is identical to 
+   ProcessObservation.
+*/
+
 Lattice *CompleteRecognition(VRecInfo *vri,HTime frameDur,MemHeap *heap);
 /*
    Create lattice with traceback and then free recognition data
@@ -211,9 +238,9 @@ void FormatTranscription(Transcription *trans,HTime frameDur,
    Format a label transcription prior to calling LSave
 */
 
-void TracePath(FILE *file,Path *path);
+void TracePath(FILE *file,VRecInfo *vri,Path *path);
 /*
-   Output to file the sequence of words in path
+   Output to file the sequence of words in path of recogniser vri
 */
 
 #ifdef __cplusplus
@@ -0,0 +1,241 @@
+/* ----------------------------------------------------------- */
+/*                                                             */
+/*                          ___                                */
+/*                       |_| | |_/   SPEECH                    */
+/*                       | | | | \   RECOGNITION               */
+/*                       =========   SOFTWARE                  */
+/*                                                             */
+/*                                                             */
+/* ----------------------------------------------------------- */
+/*         Copyright:                                          */
+/*                                                             */
+/*              2026  HTK contributors                         */
+/*                                                             */
+/*   Use of this software is governed by a License Agreement   */
+/*    ** See the file License for the Conditions of Use  **    */
+/*    **     This banner notice must not be removed      **    */
+/*                                                             */
+/* ----------------------------------------------------------- */
+/*         File: HThreads.c: Threads and Locks                 */
+/* ----------------------------------------------------------- */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L   /* for clock_gettime */
+#endif
+
+char *hthreads_version = "!HVER!HThreads:   3.4.1 [contrib 17/10/26]";
+char *hthreads_vc_id = "$Id$";
+
+#include "HShell.h"
+#include "HMem.h"
+#include "HThreads.h"
+
+#if defined(WIN32) && !defined(NO_THREADS)
+#define NO_THREADS
+#endif
+
+#include <time.h>
+#ifndef NO_THREADS
+#include <pthread.h>
+#endif
+
+/* ------------------------ Trace Flags ------------------------- */
+
+static int trace = 0;
+#define T_TOP  0001     /* report thread creation */
+
+/* -------------------------------------------------------------- */
+
+static ConfParam *cParm[MAXGLOBS];       /* config parameters */
+static int numParm = 0;
+static int nThreads = 0;                 /* number of threads created */
+
+struct _HThreadRec {
+   int id;                  /* creation number */
+   Ptr result;              /* value returned by fn */
+#ifndef NO_THREADS
+   pthread_t thread;
+#endif
+};
+
+struct _HLockRec {
+#ifndef NO_THREADS
+   pthread_mutex_t mutex;
+#else
+   int dummy;
+#endif
+};
+
+struct _HSignalRec {
+#ifndef NO_THREADS
+   pthread_cond_t cond;
+#else
+   int dummy;
+#endif
+};
+
+/* EXPORT->InitThreads: initialise the thread module */
+void InitThreads(void)
+{
+   int i;
+
+   Register(hthreads_version,hthreads_vc_id);
+   numParm = GetConfig("HTHREADS", TRUE, cParm, MAXGLOBS);
+   if (numParm>0){
+      if (GetConfInt(cParm,numParm,"TRACE",&i)) trace = i;
+   }
+}
+
+/* EXPORT->ThreadsAvailable: TRUE if threads run concurrently */
+Boolean ThreadsAvailable(void)
+{
+#ifndef NO_THREADS
+   return TRUE;
+#else
+   return FALSE;
+#endif
+}
+
+/* ------------------------- Threads ---------------------------- */
+
+/* EXPORT->CreateHThread: start a thread running fn(arg) */
+HThread CreateHThread(MemHeap *x, HThreadFn fn, Ptr arg)
+{
+   HThread t;
+
+   t = (HThread)New(x,sizeof(struct _HThreadRec));
+   t->id = ++nThreads; t->result = NULL;
+   if (trace&T_TOP) {
+      printf("HThreads: starting thread %d\n",t->id); fflush(stdout);
+   }
+#ifndef NO_THREADS
+   if (pthread_create(&t->thread,NULL,fn,arg) != 0)
+      HError(5470,"CreateHThread: cannot create thread %d",t->id);
+#else
+   t->result = fn(arg);
+#endif
+   return t;
+}
+
+/* EXPORT->JoinHThread: wait for t to finish */
+Ptr JoinHThread(HThread t)
+{
+#ifndef NO_THREADS
+   if (pthread_join(t->thread,&t->result) != 0)
+      HError(5471,"JoinHThread: cannot join thread %d",t->id);
+#endif
+   if (trace&T_TOP) {
+      printf("HThreads: thread %d finished\n",t->id); fflush(stdout);
+   }
+   return t->result;
+}
+
+/* EXPORT->ThreadCPUTime: CPU seconds used by the calling thread */
+double ThreadCPUTime(void)
+{
+#if !defined(NO_THREADS) && defined(CLOCK_THREAD_CPUTIME_ID)
+   struct timespec ts;
+
+   if (clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts) == 0)
+      return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+#endif
+   return clock() / (double) CLOCKS_PER_SEC;
+}
+
+/* EXPORT->WallClockTime: elapsed seconds since an arbitrary origin */
+double WallClockTime(void)
+{
+#if defined(CLOCK_MONOTONIC)
+   struct timespec ts;
+
+   if (clock_gettime(CLOCK_MONOTONIC,&ts) == 0)
+      return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+#endif
+   return (double) time(NULL);
+}
+
+/* -------------------------- Locks ----------------------------- */
+
+/* EXPORT->CreateHLock: create a lock in x */
+HLock CreateHLock(MemHeap *x)
+{
+   HLock l;
+
+   l = (HLock)New(x,sizeof(struct _HLockRec));
+#ifndef NO_THREADS
+   if (pthread_mutex_init(&l->mutex,NULL) != 0)
+      HError(5470,"CreateHLock: cannot create lock");
+#endif
+   return l;
+}
+
+/* EXPORT->AcquireHLock: wait for and take lock l */
+void AcquireHLock(HLock l)
+{
+#ifndef NO_THREADS
+   if (pthread_mutex_lock(&l->mutex) != 0)
+      HError(5471,"AcquireHLock: lock failed");
+#endif
+}
+
+/* EXPORT->ReleaseHLock: release lock l */
+void ReleaseHLock(HLock l)
+{
+#ifndef NO_THREADS
+   if (pthread_mutex_unlock(&l->mutex) != 0)
+      HError(5471,"ReleaseHLock: unlock failed");
+#endif
+}
+
+/* EXPORT->DeleteHLock: release system resources of l */
+void DeleteHLock(HLock l)
+{
+#ifndef NO_THREADS
+   pthread_mutex_destroy(&l->mutex);
+#endif
+}
+
+/* ------------------------- Signals ---------------------------- */
+
+/* EXPORT->CreateHSignal: create a signal in x */
+HSignal CreateHSignal(MemHeap *x)
+{
+   HSignal s;
+
+   s = (HSignal)New(x,sizeof(struct _HSignalRec));
+#ifndef NO_THREADS
+   if (pthread_cond_init(&s->cond,NULL) != 0)
+      HError(5470,"CreateHSignal: cannot create signal");
+#endif
+   return s;
+}
+
+/* EXPORT->WaitHSignal: wait with l held for s to be broadcast */
+void WaitHSignal(HSignal s, HLock l)
+{
+#ifndef NO_THREADS
+   if (pthread_cond_wait(&s->cond,&l->mutex) != 0)
+      HError(5471,"WaitHSignal: wait failed");
+#else
+   HError(5471,"WaitHSignal: would wait forever without threads");
+#endif
+}
+
+/* EXPORT->BroadcastHSignal: wake all threads waiting for s */
+void BroadcastHSignal(HSignal s)
+{
+#ifndef NO_THREADS
+   if (pthread_cond_broadcast(&s->cond) != 0)
+      HError(5471,"BroadcastHSignal: broadcast failed");
+#endif
+}
+
+/* EXPORT->DeleteHSignal: release system resources of s */
+void DeleteHSignal(HSignal s)
+{
+#ifndef NO_THREADS
+   pthread_cond_destroy(&s->cond);
+#endif
+}
+
+/* ---------------------------  HThreads.c ---------------------------- */
@@ -0,0 +1,115 @@
+/* ----------------------------------------------------------- */
+/*                                                             */
+/*                          ___                                */
+/*                       |_| | |_/   SPEECH                    */
+/*                       | | | | \   RECOGNITION               */
+/*                       =========   SOFTWARE                  */
+/*                                                             */
+/*                                                             */
+/* ----------------------------------------------------------- */
+/*         Copyright:                                          */
+/*                                                             */
+/*              2026  HTK contributors                         */
+/*                                                             */
+/*   Use of this software is governed by a License Agreement   */
+/*    ** See the file License for the Conditions of Use  **    */
+/*    **     This banner notice must not be removed      **    */
+/*                                                             */
+/* ----------------------------------------------------------- */
+/*         File: HThreads.h: Threads and Locks                 */
+/* ----------------------------------------------------------- */
+
+/* !HVER!HThreads:   3.4.1 [contrib 17/10/26] */
+
+/*
+   This module provides the small set of thread primitives needed by
+   tools which process several utterances at once: threads, locks and
+   signals (condition variables).  It uses POSIX threads.  If the
+   library is compiled with NO_THREADS (always so for WIN32) threads
+   run to completion inside CreateHThread, in creation order, locks do
+   nothing and waiting for a signal is an error, so a thread must
+   only wait for conditions that earlier threads have made true.
+
+   Most of the HTK library is not reentrant.  In particular heaps may
+   only be created or deleted, input opened or read via HParm and
+   labels or lattices written by one thread at a time, and any
+   concurrent use of a shared structure (e.g. an HMMSet) must be
+   read-only.  Tools must serialise everything else with a lock.
+*/
+
+#ifndef _HTHREADS_H_
+#define _HTHREADS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef Ptr (*HThreadFn)(Ptr arg);    /* body of a thread */
+
+typedef struct _HThreadRec *HThread;  /* a running thread */
+typedef struct _HLockRec *HLock;      /* mutual exclusion lock */
+typedef struct _HSignalRec *HSignal;  /* condition to wait for */
+
+void InitThreads(void);
+/*
+   Initialise the module
+*/
+
+Boolean ThreadsAvailable(void);
+/*
+   Return TRUE if threads really run concurrently
+*/
+
+HThread CreateHThread(MemHeap *x, HThreadFn fn, Ptr arg);
+Ptr JoinHThread(HThread t);
+/*
+   Start a thread running fn(arg), allocating its record in x.
+   JoinHThread waits for thread t to finish and returns the value
+   returned by fn.
+*/
+
+double ThreadCPUTime(void);
+/*
+   Return the CPU time in seconds used so far by the calling thread
+   (by the whole process without threads)
+*/
+
+double WallClockTime(void);
+/*
+   Return the elapsed (wall clock) time in seconds since some fixed
+   origin, suitable for timing intervals
+*/
+
+HLock CreateHLock(MemHeap *x);
+void AcquireHLock(HLock l);
+void ReleaseHLock(HLock l);
+/*
+   Create a lock in x, acquire it (waiting until no other thread
+   holds it) and release it
+*/
+
+HSignal CreateHSignal(MemHeap *x);
+void WaitHSignal(HSignal s, HLock l);
+void BroadcastHSignal(HSignal s);
+/*
+   Create a signal in x.  WaitHSignal must be called with l held, it
+   releases l while waiting for s to be broadcast and acquires it
+   again before returning.  Since wake-ups may be spurious it should
+   be called in a loop testing the awaited condition.
+   BroadcastHSignal wakes all threads waiting for s.
+*/
+
+void DeleteHLock(HLock l);
+void DeleteHSignal(HSignal s);
+/*
+   Release the system resources of l and s (the records themselves
+   remain in the heap they were created in)
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _HTHREADS_H_ */
+
+/* ---------------------- End of HThreads.h ---------------------- */
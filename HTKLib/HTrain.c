@@ -897,6 +897,7 @@ static VaAcc *CreateVaAcc(MemHeap *x, int vSize, CovKind ck, int nPara)
        ZeroVector(va[count].cov.var);
        break;
      case FULLC:
+     case LLTC:
        va[count].cov.inv = CreateTriMat(x,vSize);
        ZeroTriMat(va[count].cov.inv);
        break;
@@ -935,7 +936,7 @@ static WtAcc *CreateWtAcc(MemHeap *x, int nMix, int nPara)
      wa[count].c = CreateVector(x,nMix);
      ZeroVector(wa[count].c);
      wa[count].occ = 0.0;
-     wa[count].time = -1; wa[count].prob = NULL;
+     wa[count].time = -1; wa[count].prob = NULL; wa[count].blkLen = 0;
      ++wtC;
    }
    return wa;
@@ -1056,6 +1057,7 @@ void TMZeroAccs(HMMSet *hset, int start, int end)
 	     ZeroVector(va[i].cov.var);
 	     break;
 	   case FULLC:
+	   case LLTC:
 	     ZeroTriMat(va[i].cov.inv);
 	     break;
 	   default:
@@ -1092,7 +1094,7 @@ void ZeroAccsParallel(HMMSet *hset, UPDSet uFlags, int nPara)
             wa = (WtAcc *)ste->hook;
             for(i=start;i<=end;i++){
 	      ZeroVector(wa[i].c); wa[i].occ = 0.0;
-	      wa[i].time = -1; wa[i].prob = NULL;
+	      wa[i].time = -1; wa[i].prob = NULL; wa[i].blkLen = 0;
 	    }
             if (hss.isCont)
                while (GoNextMix(&hss,TRUE)) {
@@ -1123,6 +1125,7 @@ void ZeroAccsParallel(HMMSet *hset, UPDSet uFlags, int nPara)
                            ZeroVector(va[i].cov.var);
                            break;
                         case FULLC:
+                        case LLTC:
                            ZeroTriMat(va[i].cov.inv);
                            break;
                         default:
@@ -1150,6 +1153,103 @@ void ZeroAccsParallel(HMMSet *hset, UPDSet uFlags, int nPara)
       TMZeroAccs(hset,start,end);
 }
 
+/* SumMuVaAccs: add slots 1..nPara-1 of the accs of mp into slot 0 */
+static void SumMuVaAccs(MuAcc *ma, VaAcc *va, CovKind ck, int nPara)
+{
+   int i,j,k,n;
+
+   for (i=1; i<nPara; i++) {
+      if (ma != NULL) {
+         n = VectorSize(ma[0].mu);
+         for (k=1; k<=n; k++) ma[0].mu[k] += ma[i].mu[k];
+         ma[0].occ += ma[i].occ;
+      }
+      if (va != NULL) {
+         switch(ck){
+         case DIAGC:
+         case INVDIAGC:
+            n = VectorSize(va[0].cov.var);
+            for (k=1; k<=n; k++) va[0].cov.var[k] += va[i].cov.var[k];
+            break;
+         case FULLC:
+         case LLTC:
+            n = TriMatSize(va[0].cov.inv);
+            for (k=1; k<=n; k++)
+               for (j=1; j<=k; j++) 
+                  va[0].cov.inv[k][j] += va[i].cov.inv[k][j];
+            break;
+         default:
+            HError(7170,"SumAccs: bad cov kind %d",ck);
+         }
+         va[0].occ += va[i].occ;
+      }
+   }
+}
+
+/* EXPORT->SumAccsParallel: add accumulator slots 1..nPara-1 into slot 0 */
+void SumAccsParallel(HMMSet *hset, UPDSet uFlags, int nPara)
+{
+   HMMScanState hss;
+   TMixRec tmRec;
+   MixPDF *mp;
+   HLink hmm;
+   TrAcc *ta;
+   WtAcc *wa;
+   MuAcc *ma;
+   VaAcc *va;
+   int i,j,k,m,s,N;
+
+   if (nPara<2) return;
+   NewHMMScan(hset,&hss);
+   do {
+      hmm = hss.hmm;
+      while (GoNextState(&hss,TRUE)) {
+         while (GoNextStream(&hss,TRUE)) {
+            wa = (WtAcc *)hss.ste->hook;
+            for (i=1; i<nPara; i++) {
+               for (m=1; m<=VectorSize(wa[0].c); m++) 
+                  wa[0].c[m] += wa[i].c[m];
+               wa[0].occ += wa[i].occ;
+            }
+            if (hss.isCont)
+               while (GoNextMix(&hss,TRUE)) {
+                  ma = NULL; va = NULL;
+                  if ((uFlags&UPMEANS) && (!IsSeenV(hss.mp->mean))) {
+                     ma = (MuAcc *)GetHook(hss.mp->mean);
+                     TouchV(hss.mp->mean);
+                  }
+                  if ((uFlags&(UPVARS|UPSEMIT)) && (!IsSeenV(hss.mp->cov.var))) {
+                     va = (VaAcc *)GetHook(hss.mp->cov.var);
+                     TouchV(hss.mp->cov.var);
+                  }
+                  SumMuVaAccs(ma,va,(uFlags&UPSEMIT)?FULLC:hss.mp->ckind,nPara);
+               }
+         }
+      }
+      if (!IsSeenV(hmm->transP)) {
+         ta = (TrAcc *)GetHook(hmm->transP);
+         N = hmm->numStates;
+         for (i=1; i<nPara; i++)
+            for (j=1; j<=N; j++) {
+               ta[0].occ[j] += ta[i].occ[j];
+               for (k=1; k<=N; k++) 
+                  ta[0].tran[j][k] += ta[i].tran[j][k];
+            }
+         TouchV(hmm->transP);       
+      }
+   } while (GoNextHMM(&hss));
+   EndHMMScan(&hss);
+   if (hset->hsKind==TIEDHS)
+      for (s=1;s<=hset->swidth[0];s++){
+         tmRec = hset->tmRecs[s];
+         for (m=1;m<=tmRec.nMix;m++){
+            mp = tmRec.mixes[m];
+            SumMuVaAccs((MuAcc *)GetHook(mp->mean),
+                        (VaAcc *)GetHook(mp->cov.var),mp->ckind,nPara);
+         }
+      }
+}
+
 /* TMShowAccs: show accs attached to tied mixes in hset */
 void TMShowAccs(HMMSet *hset, int index)
 {
@@ -1179,6 +1279,7 @@ void TMShowAccs(HMMSet *hset, int index)
             ShowVector("    vars=",va[index].cov.var,mw);
             break;
          case FULLC:
+         case LLTC:
             ShowTriMat("    covs=",va[index].cov.inv,mw,mw);
             break;
          default:
@@ -1235,6 +1336,7 @@ void ShowAccsParallel(HMMSet *hset, UPDSet uFlags, int index)
                         ShowVector("    vars=",va[index].cov.var,mw);
                         break;
                      case FULLC:
+                     case LLTC:
                         ShowTriMat("    covs=",va[index].cov.inv,mw,mw);
                         break;
                      default:
@@ -1302,7 +1404,7 @@ void ResetPreComps(HMMSet *hset)
          while (GoNextStream(&hss,TRUE)) {
             ste = hss.ste;
             wa = (WtAcc *)ste->hook;
-            wa->time = -1; wa->prob = NULL;
+            wa->time = -1; wa->prob = NULL; wa->blkLen = 0;
             if (hss.isCont)
                while (GoNextMix(&hss,TRUE)) {
                   p = (PreComp *)hss.mp->hook;
@@ -1331,7 +1433,7 @@ void ResetHMMPreComps(HLink hmm, int nStreams)
       for (s=1;s<=nStreams; s++,ste++){
          wa = (WtAcc *)ste->hook; nMixes = ste->nMix;
          if (wa != NULL) {
-            wa->time = -1; wa->prob = NULL;
+            wa->time = -1; wa->prob = NULL; wa->blkLen = 0;
             me = ste->spdf.cpdf+1;
             for (m=1; m<=nMixes; m++,me++){
                p = (PreComp *)me->mpdf->hook;
@@ -1357,7 +1459,7 @@ void ResetHMMWtAccs(HLink hmm, int nStreams)
       for (s=1;s<=nStreams; s++,ste++){
          wa = (WtAcc *)ste->hook;
          if (wa != NULL) {
-            wa->time = -1; wa->prob = NULL;
+            wa->time = -1; wa->prob = NULL; wa->blkLen = 0;
          }
       }
    }
@@ -219,6 +219,9 @@ typedef struct {     /* attached to StreamElem */
    float occ;        /* occ for states sharing this pdf */
    float *prob;      /* PreComputed mixture Log Probs */
    int   time;       /* time for which prob is valid */
+   float **blkProb;  /* prob for frames blkTime..blkTime+blkLen-1 */
+   int   blkTime;    /* first frame of block scored by HFB/HFBLat */
+   int   blkLen;     /* number of frames in blkProb, 0 if none */
 } WtAcc;
 
 typedef struct {     /* attached to mean vector */
@@ -256,6 +259,12 @@ void ZeroAccs(HMMSet *hset, UPDSet uFlags);
    Zero all accumulators in given HMM set.
 */
 
+void SumAccsParallel(HMMSet *hset, UPDSet uFlags, int nPara);
+/*
+   Add the accumulators in slots 1..nPara-1 of the given HMM set
+   into slot 0, in slot order.  The numEg counters are not changed.
+*/
+
 void ShowAccsParallel(HMMSet *hset, UPDSet uFlags, int index);
 void ShowAccs(HMMSet *hset, UPDSet uFlags);
 /*
@@ -70,6 +70,7 @@ char *herest_vc_id = "$Id: HERest.c,v 1.2 2006/12/07 11:09:08 mjfg Exp $";
 #include "HAdapt.h"
 #include "HMap.h"
 #include "HFB.h"
+#include "HThreads.h"
 
 /* Trace Flags */
 #define T_TOP   0001    /* Top level tracing */
@@ -124,7 +125,6 @@ static LogDouble pruneLim = NOPRUNE;     /* pruning threshold limit */
 static float minFrwdP = NOPRUNE;         /* mix prune threshold */
 
 
-static Boolean firstTime = TRUE;    /* Flag used to enable creation of ot */
 static Boolean twoDataFiles = FALSE; /* Enables creation of ot2 for FB
                                         training using two data files */
 static int totalT=0;       /* total number of frames in training data */
@@ -143,6 +143,29 @@ static float varFloorPercent = 0;
 
 static char *labFileMask = NULL;
 
+/* Files are processed by numThreads threads, each with its own
+   forward-backward information and utterance storage, accumulating
+   into its own slot of the accumulators.  Thread t takes script
+   files t, t+numThreads, ... so every slot sums the same files in
+   the same order on each run.  The file names are read before the
+   threads start so that no thread waits for another to take its
+   turn */
+typedef struct {
+   int idx;                       /* thread number */
+   FBInfo *fbInfo;                /* F-B info, updating fbInfo->slot */
+   UttInfo *utt;                  /* utterance information storage */
+   Boolean firstTime;             /* Flag used to enable creation of ot */
+   int totalT;                    /* frames processed by this thread */
+   LogDouble totalPr;             /* total log prob of those frames */
+} FBThread;
+
+static int numThreads = 1;        /* number of forward-backward threads */
+static FBThread *fbThr;           /* [numThreads] per thread state */
+static HLock ioLock;              /* serialises label and data input */
+static int numData = 0;           /* number of script files for the threads */
+static char **dataFn;             /* [numData] data files */
+static char **dataFn2;            /* [numData] second data files (-r) */
+
 /* ------------------ Process Command Line -------------------------- */
    
 /* SetConfParms: set conf parms relevant to HCompV  */
@@ -157,6 +180,7 @@ void SetConfParms(void)
    if (nParm>0) {
       if (GetConfInt(cParm,nParm,"TRACE",&i)) trace = i;
       if (GetConfFlt(cParm,nParm,"VARFLOORPERCENTILE",&f)) varFloorPercent = f;
+      if (GetConfInt(cParm,nParm,"NUMTHREADS",&i)) numThreads = i;
       if (GetConfBool(cParm,nParm,"SAVEBINARY",&b)) saveBinary = b;
       if (GetConfBool(cParm,nParm,"BINARYACCFORMAT",&b)) ldBinary = b;
       /* 2-model reestimation alignment model set */
@@ -307,10 +331,13 @@ int main(int argc, char *argv[])
    Source src;
    float tmpFlt;
    int tmpInt;
-   int numUtt,spUtt=0;
+   int numUtt,spUtt=0,t;
 
    void Initialise(FBInfo *fbInfo, MemHeap *x, HMMSet *hset, char *hmmListFn);
-   void DoForwardBackward(FBInfo *fbInfo, UttInfo *utt, char *datafn, char *datafn2);
+   void DoForwardBackward(FBThread *ft, char *datafn, char *datafn2);
+   void LoadScriptFiles(void);
+   void RunThreads(HThreadFn fn);
+   Ptr FBFiles(Ptr arg);
    void UpdateModels(HMMSet *hset, ParmBuf pbuf2);
    void StatReport(HMMSet *hset);
    
@@ -325,6 +352,7 @@ int main(int argc, char *argv[])
    InitTrain();
    InitUtil();   InitFB();
    InitAdapt(&xfInfo); InitMap();
+   InitThreads();
 
    if (!InfoPrinted() && NumArgs() == 0)
       ReportUsage();
@@ -335,10 +363,12 @@ int main(int argc, char *argv[])
    CreateHeap(&hmmStack,"HmmStore", MSTAK, 1, 1.0, 50000, 500000);
    SetConfParms(); 
    CreateHMMSet(&hset,&hmmStack,TRUE);
+   if (numThreads<1)
+      HError(2322,"HERest: NUMTHREADS must be at least 1");
    CreateHeap(&uttStack,   "uttStore",    MSTAK, 1, 0.5, 100,   1000);
-   utt = (UttInfo *) New(&uttStack, sizeof(UttInfo));
+   utt = (UttInfo *) New(&uttStack, numThreads*sizeof(UttInfo));
    CreateHeap(&fbInfoStack,   "FBInfoStore",  MSTAK, 1, 0.5, 100 ,  1000 );
-   fbInfo = (FBInfo *) New(&fbInfoStack, sizeof(FBInfo));
+   fbInfo = (FBInfo *) New(&fbInfoStack, numThreads*sizeof(FBInfo));
    CreateHeap(&accStack,   "accStore",    MSTAK, 1, 1.0, 50000,   500000);
 
    while (NextArg() == SWITCHARG) {
@@ -491,15 +521,38 @@ int main(int argc, char *argv[])
    } 
    if (NextArg() != STRINGARG)
       HError(2319,"HERest: file name of vocabulary list expected");
+   if (numThreads>1) {
+      if (parMode==0 || maxSpUtt>0 || al_hmmUsed)
+         HError(2322,"HERest: -p 0, -l and 2-model re-estimation need NUMTHREADS=1");
+      if ((uFlags&(UPXFORM|UPSEMIT)) || xfInfo.useInXForm || xfInfo.usePaXForm)
+         HError(2322,"HERest: Transforms need NUMTHREADS=1");
+   }
 
    Initialise(fbInfo, &fbInfoStack, &hset, GetStrArg());
-   InitUttInfo(utt, twoDataFiles);
+   fbThr = (FBThread *) New(&fbInfoStack, numThreads*sizeof(FBThread));
+   for (t=0; t<numThreads; t++) {
+      InitUttInfo(utt+t, twoDataFiles);
+      fbThr[t].idx = t;
+      fbThr[t].fbInfo = fbInfo+t; fbThr[t].utt = utt+t;
+      fbInfo[t].inXForm = fbInfo[t].al_inXForm = fbInfo[t].paXForm = NULL;
+      fbThr[t].firstTime = TRUE;
+      fbThr[t].totalT = 0; fbThr[t].totalPr = 0.0;
+   }
+   ioLock = CreateHLock(&fbInfoStack);
    numUtt = 1;
 
-   if (trace&T_TOP) 
+   /* per file traces would not be in step if several files are in hand */
+   if ((trace&T_TOP) && numThreads==1) 
       SetTraceFB(); /* allows HFB to do top-level tracing */
 
-   do {
+   if (numThreads>1) {
+      if (NextArg()!=STRINGARG)
+         HError(2319,"HERest: data file name expected");
+      GetScoreView(&hset);  /* build the view before it is shared */
+      LoadScriptFiles();
+      RunThreads(FBFiles);
+   }
+   else do {
       if (NextArg()!=STRINGARG)
          HError(2319,"HERest: data file name expected");
       if (twoDataFiles && (parMode!=0)){
@@ -527,11 +580,19 @@ int main(int argc, char *argv[])
          fbInfo->inXForm = xfInfo.inXForm;
          fbInfo->al_inXForm = xfInfo.al_inXForm;
          fbInfo->paXForm = xfInfo.paXForm;
-         if ((maxSpUtt==0) || (spUtt<maxSpUtt))
-            DoForwardBackward(fbInfo, utt, datafn, datafn2) ;
+         if ((maxSpUtt==0) || (spUtt<maxSpUtt)) {
+            AcquireHLock(ioLock);
+            DoForwardBackward(fbThr, datafn, datafn2) ;
+         }
          numUtt += 1; spUtt++;
       }
    } while (NumArgs()>0);
+   /* combine the totals and accumulators of all threads */
+   for (t=0; t<numThreads; t++) {
+      totalT += fbThr[t].totalT;
+      totalPr += fbThr[t].totalPr;
+   }
+   SumAccsParallel(&hset, uFlags, numThreads);
 
    if (uFlags&UPXFORM) {/* ensure final speaker correctly handled */ 
       UpdateSpkrStats(&hset,&xfInfo, NULL); 
@@ -552,8 +613,10 @@ int main(int argc, char *argv[])
          if (stats) {
             StatReport(&hset);
          }
-         if (updateMode&UPMODE_UPDATE)
-            UpdateModels(&hset,utt->pbuf2);
+         if (updateMode&UPMODE_UPDATE) {
+            for (t=0; t<numThreads-1 && utt[t].pbuf2==NULL; t++);
+            UpdateModels(&hset,utt[t].pbuf2);
+         }
       }
    }
    ResetHeap(&uttStack);
@@ -577,8 +640,10 @@ void Initialise(FBInfo *fbInfo, MemHeap *x, HMMSet *hset, char *hmmListFn)
    if(LoadHMMSet( hset,hmmDir,hmmExt)<SUCCESS)
       HError(2321,"Initialise: LoadHMMSet failed");
    if (uFlags&UPSEMIT) uFlags = uFlags|UPMEANS|UPVARS;
-   AttachAccs(hset, &accStack, uFlags);
-   ZeroAccs(hset, uFlags);
+   if (numThreads>1 && (hset->xf!=NULL || hset->semiTied!=NULL))
+      HError(2322,"Initialise: Input and semi-tied transforms need NUMTHREADS=1");
+   AttachAccsParallel(hset, &accStack, uFlags, numThreads);
+   ZeroAccsParallel(hset, uFlags, numThreads);
    P = hset->numPhyHMM;
    L = hset->numLogHMM;
    vSize = hset->vecSize;
@@ -604,6 +669,7 @@ void Initialise(FBInfo *fbInfo, MemHeap *x, HMMSet *hset, char *hmmListFn)
       printf("\n\n ");
     
       if (parMode>=0) printf("Parallel-Mode[%d] ",parMode);
+      if (numThreads>1) printf("Threads[%d] ",numThreads);
 
       printf("System is ");
       switch (hsKind){
@@ -637,8 +703,8 @@ void Initialise(FBInfo *fbInfo, MemHeap *x, HMMSet *hset, char *hmmListFn)
 
    
    /* initialise and  pass information to the forward backward library */
-   InitialiseForBack(fbInfo, x, hset, uFlags, pruneInit, pruneInc,
-                     pruneLim, minFrwdP);
+   InitialiseForBackParallel(fbInfo, x, hset, uFlags, pruneInit, pruneInc,
+                             pruneLim, minFrwdP, numThreads);
 
    if (parMode != 0) {
       ConvLogWt(hset);
@@ -749,10 +815,14 @@ void StatReport(HMMSet *hset)
 /* -------------------- Top Level of F-B Updating ---------------- */
 
 
-/* Load data and call FBFile: apply forward-backward to given utterance */
-void DoForwardBackward(FBInfo *fbInfo, UttInfo *utt, char * datafn, char * datafn2)
+/* Load data and call FBFile: apply forward-backward to given utterance.
+   Must be called with ioLock held, which is released once the data
+   has been loaded */
+void DoForwardBackward(FBThread *ft, char * datafn, char * datafn2)
 {
    char datafn_lab[MAXFNAMELEN];
+   FBInfo *fbInfo = ft->fbInfo;
+   UttInfo *utt = ft->utt;
 
    utt->twoDataFiles = twoDataFiles ;
    utt->S = fbInfo->al_hset->swidth[0];
@@ -768,24 +838,77 @@ void DoForwardBackward(FBInfo *fbInfo, UttInfo *utt, char * datafn, char * dataf
    /* Load the data */
    LoadData(fbInfo->al_hset, utt, dff, datafn, datafn2);
 
-   if (firstTime) {
+   if (ft->firstTime) {
       InitUttObservations(utt, fbInfo->al_hset, datafn, fbInfo->maxMixInS);
-      firstTime = FALSE;
+      ft->firstTime = FALSE;
    }
+   ReleaseHLock(ioLock);
   
    /* fill the alpha beta and otprobs (held in fbInfo) */
    if (FBFile(fbInfo, utt, datafn)) {
       /* update totals */
-      totalT += utt->T ;
-      totalPr += utt->pr ;
+      ft->totalT += utt->T ;
+      ft->totalPr += utt->pr ;
       /* Handle the input xform Jacobian if necssary */
       if (fbInfo->al_hset->xf != NULL) {
-         totalPr += utt->T*0.5*fbInfo->al_hset->xf->xform->det;
+         ft->totalPr += utt->T*0.5*fbInfo->al_hset->xf->xform->det;
       }
 
    }
 }
 
+/* LoadScriptFiles: read the remaining data file names into dataFn
+   (and dataFn2 for -r) */
+void LoadScriptFiles(void)
+{
+   int n;
+
+   if (twoDataFiles && (NumArgs() % 2) != 0)
+      HError(2319,"HERest: Must be even num of training files for single pass training");
+   n = twoDataFiles ? NumArgs()/2 : NumArgs();
+   dataFn = (char **) New(&fbInfoStack, n*sizeof(char *));
+   dataFn2 = (char **) New(&fbInfoStack, n*sizeof(char *));
+   for (numData=0; numData<n; numData++) {
+      if (NextArg()!=STRINGARG)
+         HError(2319,"HERest: data file name expected");
+      dataFn[numData] = CopyString(&fbInfoStack, GetStrArg());
+      if (twoDataFiles) {
+         if (NextArg()!=STRINGARG)
+            HError(2319,"HERest: data file name expected");
+         dataFn2[numData] = CopyString(&fbInfoStack, GetStrArg());
+      } else
+         dataFn2[numData] = NULL;
+   }
+}
+
+/* FBFiles: body of a forward-backward thread, process script files
+   ft->idx, ft->idx+numThreads, ... in turn */
+Ptr FBFiles(Ptr arg)
+{
+   FBThread *ft = (FBThread *)arg;
+   int i;
+
+   for (i=ft->idx; i<numData; i+=numThreads) {
+      AcquireHLock(ioLock);
+      DoForwardBackward(ft, dataFn[i], dataFn2[i]);
+   }
+   return NULL;
+}
+
+/* RunThreads: run fn for each forward-backward thread and wait for 
+   them all */
+void RunThreads(HThreadFn fn)
+{
+   HThread *thr;
+   int t;
+
+   thr = (HThread *)New(&fbInfoStack,numThreads*sizeof(HThread));
+   for (t=0; t<numThreads; t++)
+      thr[t] = CreateHThread(&fbInfoStack,fn,(Ptr)(fbThr+t));
+   for (t=0; t<numThreads; t++)
+      JoinHThread(thr[t]);
+}
+
 /* --------------------------- Model Update --------------------- */
 
 static int nFloorVar = 0;     /* # of floored variance comps */
@@ -1105,6 +1228,8 @@ void UpdateVars(HMMSet *hset, int px, HLink hmm)
                            }
                         }
                         CovInvert(cov.inv,cov.inv);
+                        if (me->mpdf->ckind==LLTC)
+                           TriCholeski(cov.inv,cov.inv);
                      }
                   }
                   else{
@@ -1177,6 +1302,8 @@ void UpdateTMVars(HMMSet *hset)
                      }
                   }
                   CovInvert(cov.inv,cov.inv);
+                  if (mpdf->ckind==LLTC)
+                     TriCholeski(cov.inv,cov.inv);
                }
             }
             else
@@ -0,0 +1,317 @@
+/* ----------------------------------------------------------- */
+/*                                                             */
+/*                          ___                                */
+/*                       |_| | |_/   SPEECH                    */
+/*                       | | | | \   RECOGNITION               */
+/*                       =========   SOFTWARE                  */
+/*                                                             */
+/*                                                             */
+/* ----------------------------------------------------------- */
+/*         Copyright:                                          */
+/*                                                             */
+/*              2026  HTK contributors                         */
+/*                                                             */
+/*   Use of this software is governed by a License Agreement   */
+/*    ** See the file License for the Conditions of Use  **    */
+/*    **     This banner notice must not be removed      **    */
+/*                                                             */
+/* ----------------------------------------------------------- */
+/*     File: HGSel.c: Build a Gaussian selection index         */
+/* ----------------------------------------------------------- */
+
+char *hgsel_version = "!HVER!HGSel:   3.4.1 [contrib 16/10/26]";
+char *hgsel_vc_id = "$Id$";
+
+/*
+   This program builds a Gaussian selection index for a continuous
+   density HMM set from a VQ table produced by HQuant.  For each cell
+   of the VQ codebook of each stream it lists the mixture components
+   whose mean lies within a normalised distance of the cell centroid,
+   plus the nearest few components of every state so that no state is
+   left without a shortlist.  Recognisers load the index via the
+   HModel GSELINDEX configuration variable and then only evaluate
+   the listed components of each state.
+
+   Index file format (all ascii):
+      vqTabFN numMix numS
+   then for each stream s
+      s nCells nList
+   followed by nList entries of the form
+      vqidx n mIdx_1 ... mIdx_n
+   where mIdx are the HModel component indices.
+*/
+
+#include "HShell.h"     /* HMM ToolKit Modules */
+#include "HMem.h"
+#include "HMath.h"
+#include "HSigP.h"
+#include "HAudio.h"
+#include "HWave.h"
+#include "HVQ.h"
+#include "HParm.h"
+#include "HLabel.h"
+#include "HModel.h"
+#include "HUtil.h"
+
+/* Trace Flags */
+#define T_TOP   0001    /* Top level tracing */
+#define T_CEL   0002    /* Shortlist size of each cell */
+
+/* -------------- Global Settings ------------------ */
+
+static char * hmmDir = NULL;     /* directory to look for hmm def files */
+static char * hmmExt = NULL;     /* hmm def file extension */
+static float thresh  = 1.5;      /* max normalised distance to centroid */
+static int minState  = 1;        /* min listed components per state */
+
+static int trace = 0;            /* Trace level */
+static ConfParam *cParm[MAXGLOBS];   /* configuration parameters */
+static int nParm = 0;            /* total num params */
+
+static HMMSet hset;              /* the HMM set */
+static MemHeap hmmStack;         /* stores the HMM set */
+static VQTable vqTab;            /* the codebook */
+
+/* ------------------ Process Command Line ------------------------- */
+
+void SetConfParms(void)
+{
+   int i;
+
+   nParm = GetConfig("HGSEL", TRUE, cParm, MAXGLOBS);
+   if (nParm>0) {
+      if (GetConfInt(cParm,nParm,"TRACE",&i)) trace = i;
+   }
+}
+
+void ReportUsage(void)
+{
+   printf("\nUSAGE: HGSel [options] hmmList vqFile indexFile\n\n");
+   printf(" Option                                       Default\n\n");
+   printf(" -d s    dir to find hmm definitions          current\n");
+   printf(" -n N    min components listed per state      1\n");
+   printf(" -t f    max normalised centroid distance     1.5\n");
+   printf(" -x s    extension for hmm files              none\n");
+   PrintStdOpts("HT");
+   printf("\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+   char *s,*hmmListFn,*vqFn,*indexFn;
+   void Initialise(char *hmmListFn, char *vqFn);
+   void BuildIndex(char *vqFn, char *indexFn);
+
+   if(InitShell(argc,argv,hgsel_version,hgsel_vc_id)<SUCCESS)
+      HError(2700,"HGSel: InitShell failed");
+
+   InitMem();   InitLabel();
+   InitMath();  InitSigP();
+   InitWave();  InitAudio();
+   InitVQ();    InitModel();
+   if(InitParm()<SUCCESS)
+      HError(2700,"HGSel: InitParm failed");
+   InitUtil();
+
+   if (!InfoPrinted() && NumArgs() == 0)
+      ReportUsage();
+   if (NumArgs() == 0) Exit(0);
+
+   SetConfParms();
+   CreateHeap(&hmmStack,"HmmStore", MSTAK, 1, 1.0, 50000, 500000);
+   CreateHMMSet(&hset,&hmmStack,TRUE);
+   while (NextArg() == SWITCHARG) {
+      s = GetSwtArg();
+      if (strlen(s)!=1)
+         HError(2719,"HGSel: Bad switch %s; must be single letter",s);
+      switch(s[0]){
+      case 'd':
+         if (NextArg()!=STRINGARG)
+            HError(2719,"HGSel: HMM definition directory expected");
+         hmmDir = GetStrArg(); break;
+      case 'n':
+         minState = GetChkedInt(0,10000,s); break;
+      case 't':
+         thresh = GetChkedFlt(0.0,1.0E10,s); break;
+      case 'x':
+         if (NextArg()!=STRINGARG)
+            HError(2719,"HGSel: HMM file extension expected");
+         hmmExt = GetStrArg(); break;
+      case 'H':
+         if (NextArg() != STRINGARG)
+            HError(2719,"HGSel: HMM macro file name expected");
+         AddMMF(&hset,GetStrArg());
+         break;
+      case 'T':
+         trace = GetChkedInt(0,0100000,s);
+         break;
+      default:
+         HError(2719,"HGSel: Unknown switch %s",s);
+      }
+   }
+   if (NextArg()!=STRINGARG)
+      HError(2719,"HGSel: file name of HMM list expected");
+   hmmListFn = GetStrArg();
+   if (NextArg()!=STRINGARG)
+      HError(2719,"HGSel: file name of VQ table expected");
+   vqFn = GetStrArg();
+   if (NextArg()!=STRINGARG)
+      HError(2719,"HGSel: file name of output index expected");
+   indexFn = GetStrArg();
+   Initialise(hmmListFn,vqFn);
+   BuildIndex(vqFn,indexFn);
+   Exit(0);
+   return (0);          /* never reached -- make compiler happy */
+}
+
+/* ------------------------ Initialisation ----------------------- */
+
+/* Initialise: load HMMs and VQ table and check they match */
+void Initialise(char *hmmListFn, char *vqFn)
+{
+   int s;
+
+   if(MakeHMMSet(&hset,hmmListFn)<SUCCESS)
+      HError(2728,"Initialise: MakeHMMSet failed");
+   if(LoadHMMSet(&hset,hmmDir,hmmExt)<SUCCESS)
+      HError(2728,"Initialise: LoadHMMSet failed");
+   if (hset.hsKind != PLAINHS && hset.hsKind != SHAREDHS)
+      HError(2730,"Initialise: Gaussian selection needs PLAIN or SHARED HMMs");
+   vqTab = LoadVQTab(vqFn,0);
+   for (s=0; s<=hset.swidth[0]; s++)
+      if (vqTab->swidth[s] != hset.swidth[s])
+         HError(2730,"Initialise: VQ table %s does not match stream widths",
+                vqFn);
+   if (trace&T_TOP) {
+      printf("HGSel: %d states, %d mixture components, %d streams\n",
+             hset.numStates,hset.numMix,hset.swidth[0]);
+      fflush(stdout);
+   }
+}
+
+/* ------------------------ Index Building ----------------------- */
+
+/* CompDist: normalised distance from centroid c to component mp */
+static float CompDist(Vector c, MixPDF *mp)
+{
+   int i,vSize;
+   float x,sum;
+   Vector mean,var;
+
+   vSize = VectorSize(c);
+   mean = mp->mean; var = mp->cov.var;
+   sum = 0.0;
+   switch (mp->ckind) {
+   case DIAGC:
+      for (i=1; i<=vSize; i++) {
+         x = c[i]-mean[i]; sum += x*x/var[i];
+      }
+      break;
+   case INVDIAGC:
+      for (i=1; i<=vSize; i++) {
+         x = c[i]-mean[i]; sum += x*x*var[i];
+      }
+      break;
+   default:             /* always list components we cannot measure */
+      return 0.0;
+   }
+   return sum/vSize;
+}
+
+/* CollectCells: put codebook nodes which GetVQ can return in cell[] */
+static void CollectCells(VQNode n, TreeType type, VQNode *cell, int *nc)
+{
+   if (n == NULL) return;
+   if (type == linTree || (n->left == NULL && n->right == NULL))
+      cell[(*nc)++] = n;
+   if (type == binTree)
+      CollectCells(n->left,type,cell,nc);
+   CollectCells(n->right,type,cell,nc);
+}
+
+/* ListState: mark components of stream element ste that are close to
+   centroid c, always marking the minState nearest ones */
+static void ListState(StreamElem *ste, Vector c, char *listed,
+                      float *best, int *bestIdx)
+{
+   int m,i,j,nb;
+   float d;
+   MixPDF *mp;
+
+   nb = 0;
+   for (m=1; m<=ste->nMix; m++) {
+      mp = ste->spdf.cpdf[m].mpdf;
+      if (mp->mIdx <= 0) continue;      /* defunct component */
+      d = CompDist(c,mp);
+      if (d <= thresh) listed[mp->mIdx] = 1;
+      /* keep the minState best in ascending order */
+      for (i=nb; i>0 && best[i-1]>d; i--);
+      if (i < minState) {
+         if (nb < minState) nb++;
+         for (j=nb-1; j>i; j--) {
+            best[j] = best[j-1]; bestIdx[j] = bestIdx[j-1];
+         }
+         best[i] = d; bestIdx[i] = mp->mIdx;
+      }
+   }
+   for (i=0; i<nb; i++) listed[bestIdx[i]] = 1;
+}
+
+/* BuildIndex: build the shortlist of each cell and write to indexFn */
+void BuildIndex(char *vqFn, char *indexFn)
+{
+   FILE *f;
+   HMMScanState hss;
+   VQNode *cell;
+   char *listed;
+   float *best;
+   int *bestIdx;
+   int s,c,m,n,nc,nCells,nLine;
+   long total;
+
+   if ((f = fopen(indexFn,"w")) == NULL)
+      HError(2711,"BuildIndex: Cannot create index file %s",indexFn);
+   fprintf(f,"\"%s\" %d %d\n",vqFn,hset.numMix,hset.swidth[0]);
+   cell = (VQNode *)New(&gstack,vqTab->numNodes*sizeof(VQNode));
+   listed = (char *)New(&gstack,hset.numMix+1);
+   best = (float *)New(&gstack,(minState+1)*sizeof(float));
+   bestIdx = (int *)New(&gstack,(minState+1)*sizeof(int));
+   for (s=1; s<=hset.swidth[0]; s++) {
+      nc = 0;
+      CollectCells(vqTab->tree[s],vqTab->type,cell,&nc);
+      nCells = 0;
+      for (c=0; c<nc; c++)
+         if (cell[c]->vqidx >= nCells) nCells = cell[c]->vqidx+1;
+      fprintf(f,"%d %d %d\n",s,nCells,nc);
+      total = 0;
+      for (c=0; c<nc; c++) {
+         for (m=1; m<=hset.numMix; m++) listed[m] = 0;
+         NewHMMScan(&hset,&hss);
+         while (GoNextState(&hss,FALSE))
+            ListState(hss.si->pdf+s,cell[c]->mean,listed,best,bestIdx);
+         EndHMMScan(&hss);
+         for (m=1,n=0; m<=hset.numMix; m++)
+            if (listed[m]) n++;
+         total += n;
+         if (trace&T_CEL)
+            printf(" Stream %d cell %d: %d components listed\n",
+                   s,cell[c]->vqidx,n);
+         fprintf(f,"%d %d",cell[c]->vqidx,n);
+         for (m=1,nLine=0; m<=hset.numMix; m++)
+            if (listed[m]) {
+               fprintf(f,(++nLine%16==0)?"\n %d":" %d",m);
+            }
+         fprintf(f,"\n");
+      }
+      if (trace&T_TOP) {
+         printf("Stream %d: %d cells, on average %.1f of %d components (%.1f%%) listed\n",
+                s,nc,(float)total/nc,hset.numMix,100.0*total/nc/hset.numMix);
+         fflush(stdout);
+      }
+   }
+   fclose(f);
+}
+
+/* ----------------------------------------------------------- */
+/*                      END:  HGSel.c                          */
+/* ----------------------------------------------------------- */
@@ -5543,6 +5543,83 @@ void FullCovarCommand(void)
    hset->ckind = FULLC;
 }
 
+/* ------------- CK - CovKind Command ----------------- */
+
+/* ConvFullCov: convert inverse covariance inv in place to/from the
+   Choleski factor of the inverse covariance and rename its macro */
+static void ConvFullCov(STriMat inv, CovKind from, CovKind to)
+{
+   TriMat tm;
+   MLink ml;
+   int u;
+
+   if (to == LLTC)
+      TriCholeski(inv,inv);
+   else {
+      tm = CreateTriMat(&gstack,TriMatSize(inv));
+      TriCholeskiProd(inv,tm);
+      CopyTriMat(tm,inv);
+      FreeTriMat(&gstack,tm);
+   }
+   u = GetUse(inv);
+   if (u!=0) {
+      ml = FindMacroStruct(hset,(from==LLTC)?'c':'i',inv);
+      if (ml != NULL) {
+         DeleteMacro(hset,ml);
+         NewMacro(hset,fidx,(to==LLTC)?'c':'i',ml->id,inv);
+         SetUse(inv,u);
+      }
+   }
+}
+
+/* CovKindCommand: convert full covariances to the storage kind given */
+void CovKindCommand(void)
+{
+   HMMScanState hss;
+   char s[256];
+   CovKind ck;
+   MixPDF *mp;
+   int nConv = 0;
+
+   ChkedAlpha("CK covariance kind",s);
+   if (trace & T_BID) {
+      printf("\nCK %s\n Convert full covariances of currently loaded HMM set\n",s);
+      fflush(stdout);
+   }
+   if (strcmp(s,"FULLC")==0) ck = FULLC;
+   else if (strcmp(s,"LLTC")==0) ck = LLTC;
+   else {
+      ck = FULLC;
+      HError(2632,"CovKindCommand: covariance kind %s not FULLC or LLTC",s);
+   }
+   if (hset->hsKind==TIEDHS || hset->hsKind==DISCRETEHS)
+      HError(2640,"CovKindCommand: Only possible for continuous models");
+
+   NewHMMScan(hset,&hss);
+   while(GoNextMix(&hss,FALSE)) {
+      mp = hss.me->mpdf;
+      if (mp->ckind == ck) continue;
+      if (mp->ckind != FULLC && mp->ckind != LLTC)
+         HError(2640,"CovKindCommand: Only FULLC and LLTC covariances can be converted");
+      if (!IsSeenV(mp->cov.inv)) {
+         ConvFullCov(mp->cov.inv,mp->ckind,ck);
+         TouchV(mp->cov.inv);
+         ++nConv;
+      }
+      mp->ckind = ck;
+      if (ck == LLTC) FixLLTGConst(mp);
+      else FixFullGConst(mp,-CovDet(mp->cov.inv));
+   }
+   EndHMMScan(&hss);
+   ClearSeenFlags(hset,CLR_ALL);
+   if (hset->ckind == FULLC || hset->ckind == LLTC)
+      hset->ckind = ck;
+   if (trace & T_BID) {
+      printf(" CK: %d covariance matrices converted\n",nConv);
+      fflush(stdout);
+   }
+}
+
 /* ------------- PR - ProjectCommand   ----------------- */
 
 void ProjectCommand(void)
@@ -6362,21 +6439,21 @@ void Initialise(char *hmmListFn)
 /* -------------------- Top Level of Editing ---------------- */
 
 
-static int  nCmds = 40;
+static int  nCmds = 41;
 
 static char *cmdmap[] = {"AT","RT","SS","CL","CO","JO","MU","TI","UF","NC",
                          "TC","UT","MT","SH","SU","SW","SK",
                          "RC",
                          "RO","RM","RN","RP",
                          "LS","QS","TB","TR","AU","GQ","MD","ST","LT",
-                         "MM","DP","HK","FC","FA","FV","XF","PS","PR","" };
+                         "MM","DP","HK","FC","FA","FV","XF","PS","PR","CK","" };
 
 typedef enum           { AT=1, RT , SS , CL , CO , JO , MU , TI , UF , NC ,
                          TC , UT , MT , SH , SU , SW , SK ,
                          RC ,
                          RO , RM , RN , RP ,
                          LS , QS , TB , TR , AU , GQ , MD , ST , LT ,
-                         MM , DP , HK , FC , FA , FV, XF, PS, PR }
+                         MM , DP , HK , FC , FA , FV, XF, PS, PR, CK }
 cmdNum;
 
 /* CmdIndex: return index 1..N of given command */
@@ -6448,6 +6525,7 @@ void DoEdit(char * editFn)
       case UF: UseCommand(); break;
       case FA: FloorAverageCommand(); break;
       case FC: FullCovarCommand(); break;
+      case CK: CovKindCommand(); break;
       case FV: FloorVectorCommand(); break;
       case PS: PowerSizeCommand(); break;
       case PR: ProjectCommand(); break;
@@ -0,0 +1,151 @@
+/* ----------------------------------------------------------- */
+/*                                                             */
+/*                          ___                                */
+/*                       |_| | |_/   SPEECH                    */
+/*                       | | | | \   RECOGNITION               */
+/*                       =========   SOFTWARE                  */
+/*                                                             */
+/*                                                             */
+/* ----------------------------------------------------------- */
+/*         Copyright:                                          */
+/*                                                             */
+/*              2026  HTK contributors                         */
+/*                                                             */
+/*   Use of this software is governed by a License Agreement   */
+/*    ** See the file License for the Conditions of Use  **    */
+/*    **     This banner notice must not be removed      **    */
+/*                                                             */
+/* ----------------------------------------------------------- */
+/*     File: HImage.c: Compile an HMM set into an image        */
+/* ----------------------------------------------------------- */
+
+char *himage_version = "!HVER!HImage:   3.4.1 [contrib 17/10/26]";
+char *himage_vc_id = "$Id$";
+
+/*
+   This program loads an HMM set in the usual way and writes it as a
+   compiled image (see SaveHMMSetImage in HModel).  The image can then
+   be given to any tool in place of the MMFs via -H; it is memory
+   mapped rather than parsed so the set is available almost at once
+   and its pages are shared by all processes using it.
+*/
+
+#include "HShell.h"     /* HMM ToolKit Modules */
+#include "HMem.h"
+#include "HMath.h"
+#include "HSigP.h"
+#include "HAudio.h"
+#include "HWave.h"
+#include "HVQ.h"
+#include "HParm.h"
+#include "HLabel.h"
+#include "HModel.h"
+
+/* Trace Flags */
+#define T_TOP   0001    /* Top level tracing */
+
+/* -------------- Global Settings ------------------ */
+
+static char * hmmDir = NULL;     /* directory to look for hmm def files */
+static char * hmmExt = NULL;     /* hmm def file extension */
+
+static int trace = 0;            /* Trace level */
+static ConfParam *cParm[MAXGLOBS];   /* configuration parameters */
+static int nParm = 0;            /* total num params */
+
+static HMMSet hset;              /* the HMM set */
+static MemHeap hmmStack;         /* stores the HMM set */
+
+/* ------------------ Process Command Line ------------------------- */
+
+void SetConfParms(void)
+{
+   int i;
+
+   nParm = GetConfig("HIMAGE", TRUE, cParm, MAXGLOBS);
+   if (nParm>0) {
+      if (GetConfInt(cParm,nParm,"TRACE",&i)) trace = i;
+   }
+}
+
+void ReportUsage(void)
+{
+   printf("\nUSAGE: HImage [options] hmmList imageFile\n\n");
+   printf(" Option                                       Default\n\n");
+   printf(" -d s    dir to find hmm definitions          current\n");
+   printf(" -x s    extension for hmm files              none\n");
+   PrintStdOpts("HT");
+   printf("\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+   char *s,*hmmListFn,*imageFn;
+
+   if(InitShell(argc,argv,himage_version,himage_vc_id)<SUCCESS)
+      HError(2800,"HImage: InitShell failed");
+
+   InitMem();   InitLabel();
+   InitMath();  InitSigP();
+   InitWave();  InitAudio();
+   InitVQ();    InitModel();
+   if(InitParm()<SUCCESS)
+      HError(2800,"HImage: InitParm failed");
+
+   if (!InfoPrinted() && NumArgs() == 0)
+      ReportUsage();
+   if (NumArgs() == 0) Exit(0);
+
+   SetConfParms();
+   CreateHeap(&hmmStack,"HmmStore", MSTAK, 1, 1.0, 50000, 500000);
+   CreateHMMSet(&hset,&hmmStack,TRUE);
+   while (NextArg() == SWITCHARG) {
+      s = GetSwtArg();
+      if (strlen(s)!=1)
+         HError(2819,"HImage: Bad switch %s; must be single letter",s);
+      switch(s[0]){
+      case 'd':
+         if (NextArg()!=STRINGARG)
+            HError(2819,"HImage: HMM definition directory expected");
+         hmmDir = GetStrArg(); break;
+      case 'x':
+         if (NextArg()!=STRINGARG)
+            HError(2819,"HImage: HMM file extension expected");
+         hmmExt = GetStrArg(); break;
+      case 'H':
+         if (NextArg() != STRINGARG)
+            HError(2819,"HImage: HMM macro file name expected");
+         AddMMF(&hset,GetStrArg());
+         break;
+      case 'T':
+         trace = GetChkedInt(0,0100000,s);
+         break;
+      default:
+         HError(2819,"HImage: Unknown switch %s",s);
+      }
+   }
+   if (NextArg()!=STRINGARG)
+      HError(2819,"HImage: file name of HMM list expected");
+   hmmListFn = GetStrArg();
+   if (NextArg()!=STRINGARG)
+      HError(2819,"HImage: file name of output image expected");
+   imageFn = GetStrArg();
+
+   if(MakeHMMSet(&hset,hmmListFn)<SUCCESS)
+      HError(2828,"HImage: MakeHMMSet failed");
+   if(LoadHMMSet(&hset,hmmDir,hmmExt)<SUCCESS)
+      HError(2828,"HImage: LoadHMMSet failed");
+   if (trace&T_TOP) {
+      printf("HImage: %d logical/%d physical HMMs, %d states, %d mixture components\n",
+             hset.numLogHMM,hset.numPhyHMM,hset.numStates,hset.numMix);
+      fflush(stdout);
+   }
+   if(SaveHMMSetImage(&hset,imageFn)<SUCCESS)
+      HError(2811,"HImage: SaveHMMSetImage failed");
+   Exit(0);
+   return (0);          /* never reached -- make compiler happy */
+}
+
+/* ----------------------------------------------------------- */
+/*                      END:  HImage.c                         */
+/* ----------------------------------------------------------- */
@@ -53,6 +53,7 @@ char *hvite_vc_id = "$Id: HVite.c,v 1.1.1.1 2006/10/11 09:55:02 jal58 Exp $";
 #include "HDict.h"
 #include "HNet.h"
 #include "HRec.h"
+#include "HThreads.h"
 
 /* -------------------------- Trace Flags & Vars ------------------------ */
 
@@ -73,7 +74,6 @@ static Boolean states = FALSE;    /* Keep track of state alignment */
 static Boolean models = FALSE;    /* Keep track of model alignment */
 
 /* With what */
-static char *datFN;               /* Speech file */
 static char *dictFn;              /* Dictionary */
 static char *wdNetFn = NULL;      /* Word level lattice */
 static char *hmmListFn;           /* HMMs */
@@ -92,6 +92,7 @@ static char * labInDir = NULL;    /* input network/label file directory */
 static char * labInExt = "lab";   /* input network/label file extension */
 static char * latExt = NULL;      /* output lattice file extension */
 static char * labFileMask = NULL; /* mask for reading lablels (lattices) */
+static char * netCacheFn = NULL;  /* cache file for expanded network */
 static FileFormat dfmt=UNDEFF;    /* Data input file format */
 static FileFormat ifmt=UNDEFF;    /* Label input file format */
 static FileFormat ofmt=UNDEFF;    /* Label output file format */
@@ -117,14 +118,35 @@ static int maxActive = 0;         /* max active phone instances */
 
 /* Global variables */
 static Observation obs;           /* current observation */
+static int obsBlock = 1;          /* frames scored together by HRec */
+static Boolean linearAlign = TRUE;/* align chain networks by linear Viterbi */
 static HMMSet hset;               /* the HMM set */
 static Vocab vocab;               /* the dictionary */
-static Lattice *wdNet;            /* the word level recognition network */
 static PSetInfo *psi;             /* Private data used by HRec */
-static VRecInfo *vri;             /* Visible HRec Info */
 static int maxM = 0;              /* max mixtures in any model */
 static int maxMixInS[SMAX];       /* array[1..swidth[0]] of max mixes */
 
+/* Files are processed by numThreads threads, each with its own
+   recogniser and network over the shared psi and HMM set */
+typedef struct {
+   VRecInfo *vri;                 /* Visible HRec Info */
+   Observation obsBlk[OUTPBLOCK]; /* current and read ahead observations */
+   Network *net;                  /* recognition network */
+   MemHeap ansHeap;               /* lattices and transcriptions */
+   MemHeap netHeap;               /* networks */
+   MemHeap bufHeap;               /* input buffer */
+   char *datFN;                   /* current speech file */
+   int idx;                       /* position of datFN in script */
+   Boolean named;                 /* datFN has been traced */
+} RecThread;
+
+static int numThreads = 1;        /* number of recognition threads */
+static RecThread *rthr;           /* [numThreads] per thread state */
+static HLock ioLock;              /* serialises input, networks and output */
+static HSignal outSignal;         /* broadcast when nextOut is incremented */
+static int nextIn = 0;            /* script position of next file to read */
+static int nextOut = 0;           /* script position of next file to output */
+
 /* Global adaptation variables */
 static int update = 0;            /* Perfom MLLR & update every n utts */
 static UttInfo *utt;              /* utterance info for state/frame align */
@@ -134,10 +156,7 @@ static VRecInfo *alignvri;        /* Visible HRec Info */
 static Boolean saveBinary=FALSE;  /* Save tmf in binary format */
 
 /* Heaps */
-static MemHeap ansHeap;
 static MemHeap modelHeap;
-static MemHeap netHeap;
-static MemHeap bufHeap;
 static MemHeap repHeap;
 static MemHeap regHeap;
 
@@ -170,6 +189,15 @@ void SetConfParms(void)
       if (GetConfStr(cParm,nParm,"LABFILEMASK",buf)) {
          labFileMask = CopyString(&gstack, buf);
       }
+      if (GetConfInt(cParm,nParm,"OBSBLOCK",&i)) {
+         if (i<1 || i>OUTPBLOCK)
+            HError(3219,"SetConfParms: OBSBLOCK must be in range 1..%d",OUTPBLOCK);
+         obsBlock = i;
+      }
+      if (GetConfInt(cParm,nParm,"NUMTHREADS",&i)) numThreads = i;
+      if (GetConfBool(cParm,nParm,"LINEARALIGN",&b)) linearAlign = b;
+      if (GetConfStr(cParm,nParm,"NETCACHE",buf))
+         netCacheFn = CopyString(&gstack,buf);
    }
 }
 
@@ -211,6 +239,7 @@ void ReportUsage(void)
 int main(int argc, char *argv[])
 {
    char *s;
+   int t;
 
    void Initialise(void);
    void DoRecognition(void);
@@ -227,7 +256,7 @@ int main(int argc, char *argv[])
    if(InitParm()<SUCCESS)  
       HError(3200,"HVite: InitParm failed");
 
-   InitDict();
+   InitDict();  InitThreads();
    InitNet();   InitRec();
    InitUtil(); 
    InitAdapt(&xfInfo); InitMap();
@@ -458,6 +487,14 @@ int main(int argc, char *argv[])
       HError(-3230,"HVite: Performing nbest recognition with 1-best and latttices output");
    if ((update>0) && (!xfInfo.useOutXForm))
       HError(3230,"HVite: Must use -K option with incremental adaptation");
+   if (numThreads<1)
+      HError(3230,"HVite: NUMTHREADS must be at least 1");
+   if (numThreads>1) {
+      if (NumArgs()==0)
+         HError(3230,"HVite: Recognition from audio needs NUMTHREADS=1");
+      if (update>0 || xfInfo.useInXForm || xfInfo.usePaXForm || xfInfo.useOutXForm)
+         HError(3230,"HVite: Adaptation and transforms need NUMTHREADS=1");
+   }
 
 
    Initialise();
@@ -477,8 +514,10 @@ int main(int argc, char *argv[])
    }
 
 
-   DeleteVRecInfo(vri);
-   ResetHeap(&netHeap);
+   for (t=0; t<numThreads; t++) {
+      DeleteVRecInfo(rthr[t].vri);
+      ResetHeap(&rthr[t].netHeap);
+   }
    FreePSetInfo(psi);
    UpdateSpkrStats(&hset,&xfInfo, NULL); 
    ResetHeap(&regHeap);
@@ -493,7 +532,8 @@ int main(int argc, char *argv[])
 void Initialise(void)
 {
    Boolean eSep;
-   int s;
+   RecThread *rt;
+   int s,t;
 
    /* Load hmms, convert to inverse DiagC */
    if(MakeHMMSet(&hset,hmmListFn)<SUCCESS) 
@@ -501,8 +541,11 @@ void Initialise(void)
    if(LoadHMMSet(&hset,hmmDir,hmmExt)<SUCCESS) 
       HError(3228,"Initialise: LoadHMMSet failed");
    ConvDiagC(&hset,TRUE);
+   if (numThreads>1 && hset.semiTied!=NULL)
+      HError(3230,"Initialise: Semi-tied transforms need NUMTHREADS=1");
    
-   /* Create observation and storage for input buffer */
+   /* Create observation, the read ahead observations of each thread
+      follow it */
    SetStreamWidths(hset.pkind,hset.vecSize,hset.swidth,&eSep);
    obs=MakeObservation(&gstack,hset.swidth,hset.pkind,
                        hset.hsKind==DISCRETEHS,eSep);
@@ -531,7 +574,6 @@ void Initialise(void)
       AttachPreComps(&hset,hset.hmem);
    }
     
-   CreateHeap(&bufHeap,"Input Buffer heap",MSTAK,1,0.0,50000,50000);
    CreateHeap(&repHeap,"Replay Buffer heap",MSTAK,1,0.0,50000,50000);
    
    maxM = MaxMixInSet(&hset);
@@ -542,16 +584,34 @@ void Initialise(void)
              hset.numPhyHMM,hset.numLogHMM);  fflush(stdout);
    }
    
-   /* Initialise recogniser */
+   /* Initialise recognisers and their storage for input and lattices */
    if (nToks>1) nBeam=genBeam;
    psi=InitPSetInfo(&hset);
-   vri=InitVRecInfo(psi,nToks,models,states);
+   rthr=(RecThread*) New(&gcheap,numThreads*sizeof(RecThread));
+   for (t=0; t<numThreads; t++) {
+      rt=rthr+t;
+      rt->vri=InitVRecInfo(psi,nToks,models,states);
+      /* max model pruning is not available in linear alignment */
+      rt->vri->linear=(linearAlign && wdNetFn==NULL && maxActive==0);
+      rt->obsBlk[0]=(t==0)?obs:MakeObservation(&gstack,hset.swidth,hset.pkind,
+                                               hset.hsKind==DISCRETEHS,eSep);
+      for (s=1; s<obsBlock; s++)
+         rt->obsBlk[s]=MakeObservation(&gstack,hset.swidth,hset.pkind,
+                                       hset.hsKind==DISCRETEHS,eSep);
+      CreateHeap(&rt->bufHeap,"Input Buffer heap",MSTAK,1,0.0,50000,50000);
+      CreateHeap(&rt->ansHeap,"Lattice heap",MSTAK,1,0.0,4000,4000);
+      rt->net=NULL;
+      rt->datFN=NULL;
+      rt->idx=0;
+      rt->named=FALSE;
+   }
+   ioLock=CreateHLock(&gcheap);
+   outSignal=CreateHSignal(&gcheap);
 
-   /* Read dictionary and create storage for lattice */
+   /* Read dictionary */
    InitVocab(&vocab);   
    if(ReadDict(dictFn,&vocab)<SUCCESS) 
       HError(3213, "Main: ReadDict failed");
-   CreateHeap(&ansHeap,"Lattice heap",MSTAK,1,0.0,4000,4000);
    if (trace & T_MEM){
       printf("Memory State After Initialisation\n");
       PrintAllHeapStats();
@@ -575,7 +635,7 @@ void ReplayAudio(BufferInfo info)
 
 /* DoOnlineAdaptation: Perform unsupervised online adaptation
    using the recognition hypothesis as the transcription */
-int DoOnlineAdaptation(Lattice *lat, ParmBuf pbuf, int nFrames)
+int DoOnlineAdaptation(RecThread *rt, Lattice *lat, ParmBuf pbuf, int nFrames)
 {
    Transcription *modelTrans, *trans;
    BufferInfo pbinfo;
@@ -584,10 +644,10 @@ int DoOnlineAdaptation(Lattice *lat, ParmBuf pbuf, int nFrames)
    int i;
 
    GetBufferInfo(pbuf,&pbinfo);
-   trans=TranscriptionFromLattice(&netHeap,lat,1);
+   trans=TranscriptionFromLattice(&rt->netHeap,lat,1);
    wordNet=LatticeFromLabels(GetLabelList(trans,1),bndId,
-                             &vocab,&netHeap);
-   alignNet=ExpandWordNet(&netHeap,wordNet,&vocab,&hset);
+                             &vocab,&rt->netHeap);
+   alignNet=ExpandWordNet(&rt->netHeap,wordNet,&vocab,&hset);
 
    StartRecognition(alignvri,alignNet,0.0,0.0,0.0);     
 
@@ -599,14 +659,14 @@ int DoOnlineAdaptation(Lattice *lat, ParmBuf pbuf, int nFrames)
     
    alignLat=CompleteRecognition(alignvri,
                                 pbinfo.tgtSampRate/10000000.0,
-                                &netHeap);
+                                &rt->netHeap);
         
    if (alignvri->noTokenSurvived) {
-      Dispose(&netHeap, trans);
+      Dispose(&rt->netHeap, trans);
       /* Return value 0 to indicate zero frames process failed */
       return 0;
    }
-   modelTrans=TranscriptionFromLattice(&netHeap,alignLat,1);
+   modelTrans=TranscriptionFromLattice(&rt->netHeap,alignLat,1);
       
    /* format the transcription so that it contains just the models */
    FormatTranscription(modelTrans,pbinfo.tgtSampRate,FALSE,TRUE,
@@ -627,7 +687,7 @@ int DoOnlineAdaptation(Lattice *lat, ParmBuf pbuf, int nFrames)
    if (!FBFile(fbInfo, utt, NULL))
      nFrames = 0;
 
-   Dispose(&netHeap, trans);
+   Dispose(&rt->netHeap, trans);
 
    if (trace&T_TOP) {
       printf("Accumulated statistics...\n"); 
@@ -636,9 +696,36 @@ int DoOnlineAdaptation(Lattice *lat, ParmBuf pbuf, int nFrames)
    return nFrames;
 } 
 
-/* ProcessFile: process given file. If fn=NULL then direct audio */
-Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam, Boolean restartable)
+/* WaitForOutput: wait, with ioLock held, until all files before the
+   current file of rt have been output */
+void WaitForOutput(RecThread *rt)
+{
+   while (nextOut!=rt->idx)
+      WaitHSignal(outSignal,ioLock);
+   if ((trace&T_TOP) && numThreads>1 && !rt->named) {
+      printf("%s: %s\n",(wdNetFn==NULL)?"Aligning File":"File",rt->datFN);
+      fflush(stdout);
+      rt->named=TRUE;
+   }
+}
+
+/* FileDone: the current file of rt has been output, let the next
+   one go and release ioLock */
+void FileDone(RecThread *rt)
+{
+   ++nextOut;
+   BroadcastHSignal(outSignal);
+   ReleaseHLock(ioLock);
+}
+
+/* ProcessFile: process given file with the recogniser of rt. If fn=NULL
+   then direct audio.  Must be called with ioLock held, which is released
+   while decoding, and returns with it held once all earlier files in
+   the script have been output */
+Boolean ProcessFile(RecThread *rt, char *fn, Network *net, int utterNum, LogDouble currGenBeam, Boolean restartable)
 {
+   VRecInfo *vri = rt->vri;
+   Observation *obsBlk = rt->obsBlk;
    FILE *file;
    ParmBuf pbuf;
    BufferInfo pbinfo;
@@ -649,7 +736,8 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
    Transcription *trans;
    MLink m;
    LogFloat lmlk,aclk;
-   int s,j,tact,nFrames;
+   int s,j,tact,nFrames,nBlk;
+   Observation *ob,*blk[OUTPBLOCK];
    LatFormat form;
    char *p,lfn[255],buf1[80],buf2[80],thisFN[MAXSTRLEN];
    Boolean enableOutput = TRUE, isPipe;
@@ -661,7 +749,7 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
    else 
       enableOutput = FALSE;
       
-   if((pbuf = OpenBuffer(&bufHeap,fn,50,dfmt,TRI_UNDEF,TRI_UNDEF))==NULL)
+   if((pbuf = OpenBuffer(&rt->bufHeap,fn,50,dfmt,TRI_UNDEF,TRI_UNDEF))==NULL)
       HError(3250,"ProcessFile: Config parameters invalid");   
 
    /* Check pbuf same as hset */
@@ -675,20 +763,32 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
    StartRecognition(vri,net,lmScale,wordPen,prScale);
    SetPruningLevels(vri,maxActive,currGenBeam,wordBeam,nBeam,tmBeam);
  
-   tact=0;nFrames=0;
+   tact=0;nFrames=0;nBlk=0;
    StartBuffer(pbuf);
-   while(BufferStatus(pbuf)!=PB_CLEARED) {
-      ReadAsBuffer(pbuf,&obs);
-      if (trace&T_OBS) PrintObservation(nFrames,&obs,13);      
-
-      if (hset.hsKind==DISCRETEHS){
-         for (s=1; s<=hset.swidth[0]; s++){
-            if( (obs.vq[s] < 1) || (obs.vq[s] > maxMixInS[s]))
-               HError(3250,"ProcessFile: Discrete data value [ %d ] out of range in stream [ %d ] in file %s",obs.vq[s],s,fn);
+   ReleaseHLock(ioLock);
+   for (;;) {
+      /* keep up to obsBlock frames read ahead for HRec, HParm is
+         not reentrant */
+      AcquireHLock(ioLock);
+      while (nBlk<obsBlock && BufferStatus(pbuf)!=PB_CLEARED) {
+         ob=obsBlk+(nFrames+nBlk)%obsBlock;
+         ReadAsBuffer(pbuf,ob);
+         if (hset.hsKind==DISCRETEHS){
+            for (s=1; s<=hset.swidth[0]; s++){
+               if( (ob->vq[s] < 1) || (ob->vq[s] > maxMixInS[s]))
+                  HError(3250,"ProcessFile: Discrete data value [ %d ] out of range in stream [ %d ] in file %s",ob->vq[s],s,fn);
+            }
          }
+         nBlk++;
       }
-
-      ProcessObservation(vri,&obs,-1,xfInfo.inXForm);
+      ReleaseHLock(ioLock);
+      if (nBlk==0) break;
+      for (j=0; j<nBlk; j++)
+         blk[j]=obsBlk+(nFrames+j)%obsBlock;
+      if (trace&T_OBS) PrintObservation(nFrames,blk[0],13);      
+
+      ProcessObsBlock(vri,blk,nBlk,xfInfo.inXForm);
+      nBlk--;
       
       if (trace & T_FRS) {
          for (d=vri->genMaxNode,j=0;j<30;d=d->links[0].node,j++)
@@ -707,7 +807,9 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
       nFrames++;
       tact+=vri->nact;
    }
-   lat=CompleteRecognition(vri,pbinfo.tgtSampRate/10000000.0,&ansHeap);
+   AcquireHLock(ioLock);
+   lat=CompleteRecognition(vri,pbinfo.tgtSampRate/10000000.0,&rt->ansHeap);
+   WaitForOutput(rt);
    
    if (lat==NULL) {
       if ((trace & T_TOP) && fn != NULL){
@@ -724,8 +826,11 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
       return FALSE;
    }
    
-   if (vri->noTokenSurvived && restartable)
+   if (vri->noTokenSurvived && restartable) {
+      Dispose(&rt->ansHeap,lat);
+      CloseBuffer(pbuf);
       return FALSE;
+   }
 
    if (vri->noTokenSurvived && trace & T_TOP) {
       printf("No tokens survived to final node of network\n");
@@ -763,7 +868,7 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
    /* accumulate stats for online unsupervised adaptation 
       only if a token survived */
    if ((lat != NULL) &&  (!vri->noTokenSurvived) && ((update > 0) || (xfInfo.useOutXForm)))
-      DoOnlineAdaptation(lat, pbuf, nFrames);
+      DoOnlineAdaptation(rt, lat, pbuf, nFrames);
 
    if (enableOutput){
       if (nToks>1 && latExt!=NULL) {
@@ -796,10 +901,10 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
 
       /* only output 1-best transcription if generating lattices */
       if (nTrans > 1 && latExt != NULL) 
-         trans=TranscriptionFromLattice(&ansHeap,lat,1);
+         trans=TranscriptionFromLattice(&rt->ansHeap,lat,1);
       /* output N-best transcriptions as usual */
       else
-      trans=TranscriptionFromLattice(&ansHeap,lat,nTrans);
+      trans=TranscriptionFromLattice(&rt->ansHeap,lat,nTrans);
       
       if (labForm!=NULL)
          FormatTranscription(trans,pbinfo.tgtSampRate,states,models,
@@ -812,9 +917,9 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
       /* if(LSave(lfn,trans,ofmt)<SUCCESS)
          HError(3214,"ProcessFile: Cannot save file %s", lfn); */
       LSave(lfn,trans,ofmt);
-      Dispose(&ansHeap,trans);
+      Dispose(&rt->ansHeap,trans);
    }
-   Dispose(&ansHeap,lat);
+   Dispose(&rt->ansHeap,lat);
    CloseBuffer(pbuf);
    if (trace & T_MMU){
       printf("Memory State after utter %d\n",utterNum);
@@ -826,47 +931,94 @@ Boolean ProcessFile(char *fn, Network *net, int utterNum, LogDouble currGenBeam,
 
 /* --------------------- Top Level Processing --------------------- */
 
-/* DoAlignment: by creating network from transcriptions or lattices */
-void DoAlignment(void)
+/* UpdateModelSet: estimate an incremental transform and apply it */
+void UpdateModelSet(void)
+{
+   AdaptXForm *incXForm;
+
+   if (trace&T_TOP) {
+      printf("Transforming model set\n");
+      fflush(stdout);
+   }
+   /* 
+      at every stage a new transform is created - fix?? 
+      Estimate transform and then set it up as the 
+      input XForm
+   */
+   incXForm = CreateAdaptXForm(&hset,"inc");
+   TidyBaseAccs();
+   GenAdaptXForm(&hset,incXForm);
+   xfInfo.inXForm = GetMLLRDiagCov(incXForm);;
+   SetXForm(&hset,xfInfo.inXForm);
+   ApplyHMMSetXForm(&hset,xfInfo.inXForm);
+}
+
+/* NextFile: with ioLock held, take the next file of the script for rt,
+   return FALSE when there are none left */
+Boolean NextFile(RecThread *rt, char *caller)
+{
+   if (NumArgs()==0) return FALSE;
+   if (NextArg() != STRINGARG)
+      HError(3219,"%s: Data file name expected",caller);
+   rt->datFN = GetStrArg();
+   rt->idx = nextIn++; rt->named = FALSE;
+   return TRUE;
+}
+
+/* RunThreads: run fn for each recogniser and wait for them all */
+void RunThreads(HThreadFn fn)
+{
+   HThread *thr;
+   int t;
+
+   if (numThreads==1) {
+      fn((Ptr)rthr);
+      return;
+   }
+   thr = (HThread *)New(&gstack,numThreads*sizeof(HThread));
+   for (t=0; t<numThreads; t++)
+      thr[t] = CreateHThread(&gstack,fn,(Ptr)(rthr+t));
+   for (t=0; t<numThreads; t++)
+      JoinHThread(thr[t]);
+   Dispose(&gstack,thr);
+}
+
+/* AlignFiles: body of an alignment thread, align files from the
+   script until there are none left */
+Ptr AlignFiles(Ptr arg)
 {
+   RecThread *rt = (RecThread *)arg;
    FILE *nf;
    char lfn[MAXSTRLEN], buf[MAXSTRLEN];
    Transcription *trans;
+   Lattice *wdNet;
    Network *net;
-   Boolean isPipe;
-   int n=0;
+   Boolean isPipe, ttop;
+   int n;
    LogDouble currGenBeam;
-   AdaptXForm *incXForm;
 
-   if (trace&T_TOP) {
-      if (loadNetworks) 
-         printf("New network will be used for each file\n");
-      else
-         printf("Label file will be used to align each file\n");
-      fflush(stdout);
-   }
-   CreateHeap(&netHeap,"Net heap",MSTAK,1,0,8000,80000);
-   while (NumArgs()>0) {
-      if (NextArg() != STRINGARG)
-         HError(3219,"DoAlignment: Data file name expected");
-      datFN = GetStrArg();
-      if (trace&T_TOP) {
-         printf("Aligning File: %s\n",datFN);  fflush(stdout);
+   /* per file traces would interleave if several files are in hand */
+   ttop = (trace&T_TOP) && numThreads==1;
+   AcquireHLock(ioLock);
+   while (NextFile(rt,"DoAlignment")) {
+      n = rt->idx+1;
+      if (ttop) {
+         printf("Aligning File: %s\n",rt->datFN);  fflush(stdout);
       }
       if (labFileMask != NULL ) { /* support for rescoring lattice masks */
-         if (!MaskMatch(labFileMask,buf,datFN))
-            HError(2319,"DoAlignment: mask %s has no match with segemnt %s",labFileMask,datFN);
+         if (!MaskMatch(labFileMask,buf,rt->datFN))
+            HError(2319,"DoAlignment: mask %s has no match with segemnt %s",labFileMask,rt->datFN);
          MakeFN(buf,labInDir,labInExt,lfn);
       } else {
-         MakeFN(datFN,labInDir,labInExt,lfn);
+         MakeFN(rt->datFN,labInDir,labInExt,lfn);
       }
       if (loadNetworks) {
          if ( (nf = FOpen(lfn,NetFilter,&isPipe)) == NULL)
             HError(3210,"DoAlignment: Cannot open Word Net file %s",lfn);
-         if((wdNet = ReadLattice(nf,&netHeap,&vocab,TRUE,FALSE))==NULL)
+         if((wdNet = ReadLattice(nf,&rt->netHeap,&vocab,TRUE,FALSE))==NULL)
             HError(3210,"DoAlignment: ReadLattice failed");
          FClose(nf,isPipe);
-         if (trace&T_TOP) {
+         if (ttop) {
             printf("Read lattice with %d nodes / %d arcs\n",
                    wdNet->nn,wdNet->na);
             fflush(stdout);
@@ -875,91 +1027,146 @@ void DoAlignment(void)
       else {
          LabList *ll = NULL;
 
-         trans=LOpen(&netHeap,lfn,ifmt);
+         trans=LOpen(&rt->netHeap,lfn,ifmt);
          if (trans->numLists >= 1)
             ll = GetLabelList(trans,1);
          if (!ll && !bndId)
             HError(3233, "DoAlignment: cannot align empty transcription");
 
-         wdNet=LatticeFromLabels(ll, bndId, &vocab,&netHeap);
-         if (trace&T_TOP) {
+         wdNet=LatticeFromLabels(ll, bndId, &vocab,&rt->netHeap);
+         if (ttop) {
             printf("Created lattice with %d nodes / %d arcs from label file\n",
                    wdNet->nn,wdNet->na);
             fflush(stdout);
          }
       }
-      net=ExpandWordNet(&netHeap,wdNet,&vocab,&hset);
+      net=ExpandWordNet(&rt->netHeap,wdNet,&vocab,&hset);
 
-      ++n;
       currGenBeam = genBeam;
       /* This handles the initial input transform, parent transform setting
 	 and output transform creation */
-      if (UpdateSpkrStats(&hset, &xfInfo, datFN) && (!(xfInfo.useInXForm)) && (hset.semiTied == NULL)) {
+      if (UpdateSpkrStats(&hset, &xfInfo, rt->datFN) && (!(xfInfo.useInXForm)) && (hset.semiTied == NULL)) {
          xfInfo.inXForm = NULL;
       }
       if (genBeamInc == 0.0)
-         ProcessFile (datFN, net, n, currGenBeam, FALSE);
+         ProcessFile (rt, rt->datFN, net, n, currGenBeam, FALSE);
       else {
          Boolean completed;
 
-         completed = ProcessFile (datFN, net, n, currGenBeam, TRUE);
+         completed = ProcessFile (rt, rt->datFN, net, n, currGenBeam, TRUE);
          currGenBeam += genBeamInc;
          while (!completed && (currGenBeam <= genBeamLim - genBeamInc)) {
-            completed = ProcessFile (datFN, net, n, currGenBeam, TRUE);
+            completed = ProcessFile (rt, rt->datFN, net, n, currGenBeam, TRUE);
             currGenBeam += genBeamInc;
          }
          if (!completed)
-            ProcessFile (datFN, net, n, currGenBeam, FALSE);
+            ProcessFile (rt, rt->datFN, net, n, currGenBeam, FALSE);
       }
 
-      if (update > 0 && n%update == 0) {
-         if (trace&T_TOP) {
-            printf("Transforming model set\n");
-            fflush(stdout);
-         }
-	 /* 
-	    at every stage a new transform is created - fix?? 
-	    Estimate transform and then set it up as the 
-	    input XForm
-	 */
-	 incXForm = CreateAdaptXForm(&hset,"inc");
-         TidyBaseAccs();
-	 GenAdaptXForm(&hset,incXForm);
-         xfInfo.inXForm = GetMLLRDiagCov(incXForm);;
-	 SetXForm(&hset,xfInfo.inXForm);
-	 ApplyHMMSetXForm(&hset,xfInfo.inXForm);
+      if (update > 0 && n%update == 0)
+         UpdateModelSet();
+      ResetHeap(&rt->netHeap);
+      FileDone(rt);
+      AcquireHLock(ioLock);
+   }
+   ReleaseHLock(ioLock);
+   return NULL;
+}
+
+/* DoAlignment: by creating network from transcriptions or lattices */
+void DoAlignment(void)
+{
+   int t;
+
+   if (trace&T_TOP) {
+      if (loadNetworks) 
+         printf("New network will be used for each file\n");
+      else
+         printf("Label file will be used to align each file\n");
+      fflush(stdout);
+   }
+   for (t=0; t<numThreads; t++)
+      CreateHeap(&rthr[t].netHeap,"Net heap",MSTAK,1,0,8000,80000);
+   RunThreads(AlignFiles);
+}
+
+/* RecogniseFiles: body of a recognition thread, recognise files from
+   the script until there are none left */
+Ptr RecogniseFiles(Ptr arg)
+{
+   RecThread *rt = (RecThread *)arg;
+   int n;
+
+   AcquireHLock(ioLock);
+   while (NextFile(rt,"DoRecognition")) {
+      n = rt->idx;
+      if ((trace&T_TOP) && numThreads==1) {
+         printf("File: %s\n",rt->datFN); fflush(stdout);
+      }
+      /* This handles the initial input transform, parent transform setting
+         and output transform creation */
+      if (UpdateSpkrStats(&hset, &xfInfo, rt->datFN) && (!(xfInfo.useInXForm)) && (hset.semiTied == NULL)) {
+         xfInfo.inXForm = NULL;
       }
-      ResetHeap(&netHeap);
+      ProcessFile(rt,rt->datFN,rt->net,n++,genBeam,FALSE);
+      if (update > 0 && n%update == 0)
+         UpdateModelSet();
+      FileDone(rt);
+      AcquireHLock(ioLock);
    }
+   ReleaseHLock(ioLock);
+   return NULL;
 }
 
 /* DoRecognition:  use single network to recognise each input utterance */
 void DoRecognition(void)
 {
    FILE *nf;
-   Network *net;
+   Lattice *wdNet;
+   RecThread *rt;
    Boolean isPipe;
-   int n=0;
-   AdaptXForm *incXForm;
-
-   if ( (nf = FOpen(wdNetFn,NetFilter,&isPipe)) == NULL)
-      HError(3210,"DoRecognition: Cannot open Word Net file %s",wdNetFn);
-   if((wdNet = ReadLattice(nf,&ansHeap,&vocab,TRUE,FALSE))==NULL)
-      HError(3210,"DoAlignment: ReadLattice failed");
-   FClose(nf,isPipe);
-
-   if (trace&T_TOP) {
-      printf("Read lattice with %d nodes / %d arcs\n",wdNet->nn,wdNet->na);
-      fflush(stdout);
+   char key[MAXSTRLEN];
+   int n=0,t;
+
+   if (netCacheFn!=NULL)
+      NetCacheKey(key,wdNetFn,dictFn,hmmListFn);
+   /* ExpandWordNet alters the lattice so each recogniser reads its own */
+   for (t=0,rt=rthr; t<numThreads; t++,rt++) {
+      if (netCacheFn!=NULL) {
+         CreateHeap(&rt->netHeap,"Net heap",MSTAK,1,0,80000,80000);
+         rt->net = ReadNetwork(&rt->netHeap,netCacheFn,key,&vocab,&hset);
+         if (rt->net!=NULL) {
+            if ((trace&T_TOP) && t==0) {
+               printf("Read network from %s\n",netCacheFn); fflush(stdout);
+            }
+            continue;
+         }
+         DeleteHeap(&rt->netHeap);
+      }
+      if ( (nf = FOpen(wdNetFn,NetFilter,&isPipe)) == NULL)
+         HError(3210,"DoRecognition: Cannot open Word Net file %s",wdNetFn);
+      if((wdNet = ReadLattice(nf,&rt->ansHeap,&vocab,TRUE,FALSE))==NULL)
+         HError(3210,"DoAlignment: ReadLattice failed");
+      FClose(nf,isPipe);
+
+      if ((trace&T_TOP) && t==0) {
+         printf("Read lattice with %d nodes / %d arcs\n",wdNet->nn,wdNet->na);
+         fflush(stdout);
+      }
+      CreateHeap(&rt->netHeap,"Net heap",MSTAK,1,0,
+                 wdNet->na*sizeof(NetLink),wdNet->na*sizeof(NetLink));
+
+      rt->net = ExpandWordNet(&rt->netHeap,wdNet,&vocab,&hset);
+      ResetHeap(&rt->ansHeap);
+      if (netCacheFn!=NULL && t==0 &&
+          WriteNetwork(rt->net,&hset,netCacheFn,key)==SUCCESS &&
+          (trace&T_TOP)) {
+         printf("Saved network to %s\n",netCacheFn); fflush(stdout);
+      }
    }
-   CreateHeap(&netHeap,"Net heap",MSTAK,1,0,
-              wdNet->na*sizeof(NetLink),wdNet->na*sizeof(NetLink));
-
-   net = ExpandWordNet(&netHeap,wdNet,&vocab,&hset);
-   ResetHeap(&ansHeap);
    if (trace&T_TOP) {
       printf("Created network with %d nodes / %d links\n",
-             net->numNode,net->numLink);  fflush(stdout);
+             rthr->net->numNode,rthr->net->numLink);  fflush(stdout);
    }
    if (trace & T_MEM){
       printf("Memory State Before Recognition\n");
@@ -967,62 +1174,20 @@ void DoRecognition(void)
    }
 
    if (NumArgs()==0) {      /* Process audio */
+      rt = rthr;
       while(TRUE){
          printf("\nREADY[%d]>\n",++n); fflush(stdout);
+         AcquireHLock(ioLock);
+         rt->idx = nextIn++; rt->datFN = NULL;
 	 /* no input transform possible for audio input .... */
-         ProcessFile(NULL,net,n,genBeam, FALSE);
-         if (update > 0 && n%update == 0) {
-            if (trace&T_TOP) {
-               printf("Transforming model set\n");
-               fflush(stdout);
-            }
-	    /* 
-	       at every stage a new transform is created - fix?? 
-	       Estimate transform and then set it up as the 
-	       input XForm
-	    */
-	    incXForm = CreateAdaptXForm(&hset,"inc");
-            TidyBaseAccs();
-	    GenAdaptXForm(&hset,incXForm);
-            xfInfo.inXForm = GetMLLRDiagCov(incXForm);;
-            SetXForm(&hset,xfInfo.inXForm);
-	    ApplyHMMSetXForm(&hset,xfInfo.inXForm);
-         }
-      }
-   }
-   else {                   /* Process files */
-      while (NumArgs()>0) {
-         if (NextArg()!=STRINGARG)
-            HError(3219,"DoRecognition: Data file name expected");
-         datFN = GetStrArg();
-         if (trace&T_TOP) {
-            printf("File: %s\n",datFN); fflush(stdout);
-         }
-	 /* This handles the initial input transform, parent transform setting
-	    and output transform creation */
-         if (UpdateSpkrStats(&hset, &xfInfo, datFN) && (!(xfInfo.useInXForm)) && (hset.semiTied == NULL)) {
-            xfInfo.inXForm = NULL;
-         }
-         ProcessFile(datFN,net,n++,genBeam,FALSE);
-         if (update > 0 && n%update == 0) {
-            if (trace&T_TOP) {
-               printf("Transforming model set\n");
-               fflush(stdout);
-            }
-	    /* 
-	       at every stage a new transform is created - fix?? 
-	       Estimate transform and then set it up as the 
-	       input XForm
-	    */
-	    incXForm = CreateAdaptXForm(&hset,"inc");
-            TidyBaseAccs();
-	    GenAdaptXForm(&hset,incXForm);
-            xfInfo.inXForm = GetMLLRDiagCov(incXForm);;
-            SetXForm(&hset,xfInfo.inXForm);
-	    ApplyHMMSetXForm(&hset,xfInfo.inXForm);
-         }
+         ProcessFile(rt,NULL,rt->net,n,genBeam, FALSE);
+         if (update > 0 && n%update == 0)
+            UpdateModelSet();
+         FileDone(rt);
       }
    }
+   else                     /* Process files */
+      RunThreads(RecogniseFiles);
 }
 
 /* ----------------------------------------------------------- */